@@ -12,12 +12,59 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <sys/file.h>
+#include <signal.h>
+#include <inttypes.h>
 
 #include "utility.h"
+#include "tokenizer.h"
+#include "header_parser.h"
+#include "dedup.h"
+#include "intermediates.h"
+#include "arena.h"
+#include "combiner.h"
+#include "locality.h"
+#include "progress.h"
+#include "trace.h"
+
+// Addresses of a header line tokenized without allocation
+#define MAX_ADDRESSES_PER_LINE 64
+// Size of the reads fed to the header parser
+#define MAIL_CHUNK_SIZE 4096
+
+static analysis_options_t analysis_options = {.temporary_directory = "", .dedup_message_ids = false, .filter = NULL,
+                                              .time_buckets = TIME_BUCKETS_NONE, .locality_keys = false};
+// Arena of the recipients lists of the files analysis, kept by the worker process across batches
+static arena_t mapper_arena;
+// Arena the recipients lists are allocated from, NULL when they are malloc'ed
+static arena_t *recipients_arena = NULL;
+
+// Batches analyzed by a pool worker whose combined records are not committed yet (@see hold_file_batches)
+typedef struct {
+    bool enabled;
+    char temporary_directory[STR_MAX_LEN];
+    file_batch_t batches[MAX_HELD_BATCHES];
+    uint32_t count;
+    combiner_t combiner;
+    bool combined; // false once the combiner is unusable: records are then written one by one
+    FILE *records_file;
+    char *records;
+    size_t records_size;
+} held_batches_t;
+
+static held_batches_t held_batches = {.enabled = false, .count = 0};
+
+/*!
+ * @brief set_analysis_options sets the analysis settings for the current process and the workers it forks later
+ * @param options the settings to copy
+ */
+void set_analysis_options(analysis_options_t *options) {
+    if (options != NULL) analysis_options = *options;
+}
 
 /*!
  * @brief parse_dir parses a directory to find all files in it and its subdirs (recursive analysis of root directory)
- * All files must be output with their full path into the output file.
+ * All files must be output with their full path into the output file, after their locality keys if the run orders
+ * step1_output by physical locality (@see write_located_file).
  * @param path the path to the object directory
  * @param output_file a pointer to an already opened file
  */
@@ -33,8 +80,13 @@ void parse_dir(char *path, FILE *output_file) {
     struct dirent * dir; // for the directory entries
     while ((dir = readdir(d)) != NULL) // if we were able to read somehting from the directory
     {
-        if(dir-> d_type != DT_DIR)
-            fprintf(output_file,"%s/%s\n",path ,dir->d_name);
+        if(dir-> d_type != DT_DIR) {
+            if (analysis_options.locality_keys)
+                write_located_file(output_file, path, dir->d_name, dir->d_ino);
+            else
+                fprintf(output_file,"%s/%s\n",path ,dir->d_name);
+            count_progress(0, 1, 0, 0);
+        }
         else
         if(dir -> d_type == DT_DIR && strcmp(dir->d_name,".")!=0 && strcmp(dir->d_name,"..")!=0 ) // if it is a directory
         {
@@ -47,10 +99,12 @@ void parse_dir(char *path, FILE *output_file) {
 }
 
 /*!
- * @brief clear_recipient_list clears all recipients in a recipients list
+ * @brief clear_recipient_list clears all recipients in a recipients list (nothing to do when the list was allocated
+ * from an arena, which is rewound by its owner)
  * @param list the list to be cleared
  */
 void clear_recipient_list(simple_recipient_t *list) {
+    if (recipients_arena != NULL) return;
     simple_recipient_t *cur = list;
     while (cur != NULL) {
         simple_recipient_t *next = cur->next;
@@ -67,8 +121,10 @@ void clear_recipient_list(simple_recipient_t *list) {
  * @return a pointer to the new recipient (to update the list with)
  */
 simple_recipient_t *add_recipient_to_list(char *recipient_email, simple_recipient_t *list) {
-    simple_recipient_t *new_recipient = (simple_recipient_t *) malloc(sizeof(simple_recipient_t));
-    strcpy(new_recipient->email, recipient_email);
+    simple_recipient_t *new_recipient = (simple_recipient_t *) arena_alloc(recipients_arena,
+                                                                           sizeof(simple_recipient_t));
+    strncpy(new_recipient->email, recipient_email, STR_MAX_LEN - 1);
+    new_recipient->email[STR_MAX_LEN - 1] = '\0';
     new_recipient->next = NULL;
 
     if (list == NULL) {
@@ -87,128 +143,262 @@ simple_recipient_t *add_recipient_to_list(char *recipient_email, simple_recipien
 
 /*!
  * @brief extract_emails extracts all the e-mails from a buffer and put the e-mails into a recipients list
- * @param buffer the buffer containing one or more e-mails
+ * @param buffer the buffer containing one or more e-mails (canonicalized in place)
  * @param list the resulting list
  * @return the updated list
+ * Uses tokenize_addresses, so that display names, quotes and angle brackets are stripped and case is folded. The
+ * e-mails rejected by the recipient filter of the analysis, or too long for a recipient, are not added.
  */
 simple_recipient_t *extract_emails(char *buffer, simple_recipient_t *list) {
     if (buffer == NULL) return list; // Check parameters
-    char *email = strtok(buffer, " ");
-    while (email != NULL) {
-        // Trim leading/trailing spaces and newlines
-        email = str_trim(email);
-        str_remove_char(email,',');
-        // Add email to list
-        list = add_recipient_to_list(email, list);
-        email = strtok(NULL, " ");
+    address_span_t local_spans[MAX_ADDRESSES_PER_LINE];
+    address_span_t *spans = local_spans;
+    size_t length = strlen(buffer);
+    size_t count = tokenize_addresses(buffer, length, spans, MAX_ADDRESSES_PER_LINE);
+    if (count > MAX_ADDRESSES_PER_LINE) {
+        // Long distribution list: tokenize again into a large enough array (case folding is idempotent)
+        spans = malloc(sizeof(address_span_t) * count);
+        if (spans == NULL) return list;
+        tokenize_addresses(buffer, length, spans, count);
     }
-
+    // Spans are followed by a delimiter that is no longer needed: terminate them in place
+    for (size_t i = 0; i < count; i++) {
+        if (spans[i].length >= STR_MAX_LEN) continue; // Not an e-mail, as in extract_e_mail
+        ((char *) spans[i].start)[spans[i].length] = '\0';
+        if (!recipient_matches(analysis_options.filter, spans[i].start)) continue;
+        list = add_recipient_to_list((char *) spans[i].start, list);
+    }
+    if (spans != local_spans) free(spans);
     return list;
 }
 
 /*!
  * @brief extract_e_mail extracts an e-mail from a buffer
  * @param buffer the buffer containing the e-mail
- * @param destination the buffer into which the e-mail is copied
+ * @param destination the buffer into which the e-mail is copied (empty string if buffer holds no e-mail)
  */
 void extract_e_mail(char *buffer, char *destination) {
     if (buffer == NULL || destination == NULL) return; // Check parameters
-    // Extract email address from buffer
-    char *email = strtok(buffer, " ");
-    // Trim leading and trailing whitespace from email
-    email = str_trim(email);
-    // Remove newline character if it is present at the end of the email address
-    size_t email_len = strlen(email);
-    if (email[email_len - 1] == '\n') email[email_len - 1] = '\0';
-    // Copy email address to destination
-    strcpy(destination, email);
+    address_span_t span;
+    if (tokenize_addresses(buffer, strlen(buffer), &span, 1) == 0 || span.length >= STR_MAX_LEN) {
+        destination[0] = '\0';
+        return;
+    }
+    memcpy(destination, span.start, span.length);
+    destination[span.length] = '\0';
 }
 
-
-// Used to track status in e-mail (for multi lines To, Cc, and Bcc fields)
-typedef enum {IN_DEST_FIELD, OUT_OF_DEST_FIELD} read_status_t;
+typedef struct {
+    char from_email[STR_MAX_LEN];
+    simple_recipient_t *recipients;
+    bool duplicate; // Another copy of the e-mail (same Message-ID) was already analyzed
+    bool rejected; // A header failed the filter of the analysis
+    bool has_date; // The first Date header was read (only with a date filter or time buckets)
+    uint16_t bucket; // Time bucket of the first Date header, NO_BUCKET if there is none
+} mail_record_t;
 
 /*!
- * @brief parse_file parses mail file at filepath location and writes the result to
- * file whose location is on path output
- * @param filepath name of the e-mail file to analyze
- * @param output path to output file
- * Uses previous utility functions: extract_email, extract_emails, add_recipient_to_list,
- * and clear_recipient_list
+ * @brief collect_record_fields is the header parser callback of parse_file: it extracts the sender from the first
+ * From: field and the recipients from all To:, Cc: and Bcc: fields (already unfolded by the parser). In dedup mode,
+ * the Message-ID is checked against the shared set of already analyzed e-mails. The sender and the date are checked
+ * against the filter of the analysis as soon as they are read. The first Date field is parsed once, for both the
+ * filter and the time bucket of the e-mail.
+ * @param field the field
+ * @param value the unfolded field value
+ * @param length the value length
+ * @param context the mail_record_t being built
+ * @return false to stop parsing a duplicate or rejected e-mail, true else
  */
-void parse_file(char *filepath, char *output) {
-    // 1. Check parameters
-    if (filepath == NULL || output == NULL) return;
-    // 2. Go through e-mail and extract From: address into a buffer
-    char from_email[STR_MAX_LEN];
-    simple_recipient_t *recipients = NULL;
-    // Open email file
-    FILE *email_file = fopen(filepath, "r");
-    if (email_file == NULL) return;
-    // Open output file
-    FILE *output_file = fopen(output, "a");
-    if (output_file == NULL) return;
-    char buffer[STR_MAX_LEN];
-
-    bool from_extracted = false;
-    bool to_extracted = false;
-    bool cc_extracted = false;
-    bool bcc_extracted = false;
-    while (fgets(buffer, STR_MAX_LEN, email_file) != NULL) {
-        if (strncmp(buffer, "From:", 5) == 0) {
-            if (!from_extracted) {
-                // Extract sender's email address
-                extract_e_mail(buffer + 6, from_email);
-                from_extracted = true;
-            }
-        }else if (strncmp(buffer, "To:", 3) == 0) {
-            if (!to_extracted){
-                // Extract recipients' email addresses from the "To:" field
-                recipients = extract_emails(buffer + 4, recipients);
-                to_extracted = true;
+static bool collect_record_fields(header_field_t field, char *value, size_t length, void *context) {
+    (void) length; // The value is also '\0' terminated
+    mail_record_t *record = (mail_record_t *) context;
+    switch (field) {
+        case HEADER_FROM:
+            if (record->from_email[0] == '\0') {
+                extract_e_mail(value, record->from_email);
+                if (record->from_email[0] != '\0' && !sender_matches(analysis_options.filter, record->from_email)) {
+                    record->rejected = true;
+                    return false;
+                }
             }
-        }else if (strncmp(buffer, "Cc:", 3) == 0) {
-            if (!cc_extracted){
-                // Extract recipients' email addresses from the "Cc:" field
-                recipients = extract_emails(buffer + 4, recipients);
-                cc_extracted = true;
+            break;
+        case HEADER_DATE:
+            if (!record->has_date &&
+                (has_date_filter(analysis_options.filter) || analysis_options.time_buckets != TIME_BUCKETS_NONE)) {
+                int64_t timestamp;
+                bool valid = parse_mail_date(value, &timestamp);
+                bool in_range = valid && date_matches(analysis_options.filter, timestamp);
+                if (has_date_filter(analysis_options.filter) && !in_range) {
+                    record->rejected = true;
+                    return false;
+                }
+                if (valid && analysis_options.time_buckets != TIME_BUCKETS_NONE) {
+                    record->bucket = time_bucket(timestamp, analysis_options.time_buckets);
+                }
+                record->has_date = true;
             }
-        }else if (strncmp(buffer, "Bcc:", 4) == 0) {
-            if (!bcc_extracted){
-                // Extract recipients' email addresses from the "Bcc:" field
-                recipients = extract_emails(buffer + 5, recipients);
-                bcc_extracted = true;
+            break;
+        case HEADER_TO:
+        case HEADER_CC:
+        case HEADER_BCC:
+            record->recipients = extract_emails(value, record->recipients);
+            break;
+        case HEADER_MESSAGE_ID:
+            if (analysis_options.dedup_message_ids) {
+                char *message_id = str_trim(value);
+                if (message_id_seen(analysis_options.temporary_directory, message_id, strlen(message_id))) {
+                    record->duplicate = true;
+                    return false; // No need to parse a copy any further
+                }
             }
-        }else if (strncmp(buffer, "X-From:", 7) == 0){
             break;
+        default:
+            break;
+    }
+    return true;
+}
+
+/*!
+ * @brief read_mail_record reads the header section of an e-mail into a record. The file is read by chunks fed to the
+ * streaming header parser, which handles folded To/Cc/Bcc lines and stops at the end of the header section.
+ * @param filepath name of the e-mail file to analyze
+ * @param record the record to fill (its recipients must be released with clear_recipient_list)
+ * @return true if the e-mail has a sender and recipients, is not a duplicate (dedup mode) and matches the filter,
+ * false else
+ */
+static bool read_mail_record(char *filepath, mail_record_t *record) {
+    *record = (mail_record_t) {.from_email = "", .recipients = NULL, .duplicate = false, .rejected = false,
+                               .has_date = false, .bucket = NO_BUCKET};
+    uint64_t open_start = trace_clock();
+    // Without blocking: a FIFO in the data source has no writer (it reads as an empty file)
+    int email_fd = open(filepath, O_RDONLY | O_NONBLOCK);
+    trace_span(TRACE_OPEN, open_start);
+    if (email_fd == -1) {
+        count_progress(0, 1, 0, 1);
+        return false;
+    }
+    header_parser_t parser;
+    init_header_parser(&parser, collect_record_fields, record);
+    char buffer[MAIL_CHUNK_SIZE];
+    ssize_t bytes_read;
+    uint64_t total_read = 0;
+    uint64_t parse_start = trace_clock();
+    bool headers_done = false;
+    while (!headers_done && (bytes_read = read(email_fd, buffer, MAIL_CHUNK_SIZE)) > 0) {
+        headers_done = header_parser_feed(&parser, buffer, bytes_read);
+        total_read += bytes_read;
+    }
+    count_progress(0, 1, total_read, 0);
+    header_parser_finish(&parser);
+    clear_header_parser(&parser);
+    trace_span(TRACE_PARSE, parse_start);
+    close(email_fd);
+    if (has_date_filter(analysis_options.filter) && !record->has_date) record->rejected = true;
+    return !record->duplicate && !record->rejected && record->from_email[0] != '\0' && record->recipients != NULL;
+}
+
+/*!
+ * @brief write_mail_record writes a record as a line of step2_output, according to project instructions. With time
+ * buckets, the line starts with the bucket of the e-mail ("-" if it has none).
+ * @param output_file the file to write to
+ * @param record the record to write
+ */
+static void write_mail_record(FILE *output_file, mail_record_t *record) {
+    if (analysis_options.time_buckets != TIME_BUCKETS_NONE) {
+        if (record->bucket == NO_BUCKET) {
+            fputs("- ", output_file);
+        } else {
+            fprintf(output_file, "%u ", record->bucket);
         }
     }
-    // 4. Lock output file
-    flock(fileno(output_file), LOCK_EX);
-    // 5. Write to output file according to project instructions
-    fprintf(output_file, "%s", from_email);
-    simple_recipient_t *current = recipients;
+    fprintf(output_file, "%s", record->from_email);
+    simple_recipient_t *current = record->recipients;
     while (current != NULL) {
         fprintf(output_file, " %s", current->email);
         current = current->next;
     }
     fprintf(output_file, "\n");
+}
 
-    // 6. Unlock file
-    flock(fileno(output_file), LOCK_UN);
-    // 7. Close file
-    fclose(email_file);
-    fclose(output_file);
-    // 8. Clear all allocated resources
-    clear_recipient_list(recipients);
+/*!
+ * @brief combine_mail_record adds a record to the combiner of a list of files (@see combiner.h)
+ * @param combiner the combiner
+ * @param record the record to add
+ * @return true on success, false on error
+ */
+static bool combine_mail_record(combiner_t *combiner, mail_record_t *record) {
+    char key[STR_MAX_LEN + 8];
+    if (analysis_options.time_buckets == TIME_BUCKETS_NONE) {
+        strcpy(key, record->from_email);
+    } else if (record->bucket == NO_BUCKET) {
+        snprintf(key, sizeof(key), "- %s", record->from_email);
+    } else {
+        snprintf(key, sizeof(key), "%u %s", record->bucket, record->from_email);
+    }
+    combined_sender_t *sender = combine_sender(combiner, key);
+    if (sender == NULL) return false;
+    for (simple_recipient_t *current = record->recipients; current != NULL; current = current->next) {
+        if (!combine_recipient(combiner, sender, current->email)) return false;
+    }
+    return true;
 }
 
+/*!
+ * @brief parse_file parses mail file at filepath location and writes the result to
+ * file whose location is on path output
+ * @param filepath name of the e-mail file to analyze
+ * @param output path to output file
+ * Nothing is written if the e-mail has no sender or no recipient, if it is a duplicate (dedup mode) or if it does not
+ * match the filter.
+ */
+void parse_file(char *filepath, char *output) {
+    // 1. Check parameters
+    if (filepath == NULL || output == NULL) return;
 
+    // 2. Parse the header section
+    mail_record_t record;
+    bool has_record = read_mail_record(filepath, &record);
+
+    // 3. Write the record to the locked output file
+    if (has_record) {
+        FILE *output_file = fopen(output, "a");
+        if (output_file != NULL) {
+            flock(fileno(output_file), LOCK_EX);
+            write_mail_record(output_file, &record);
+            fflush(output_file);
+            if (durability_at_least(DURABILITY_FULL) && !intermediates_in_memory()) fdatasync(fileno(output_file));
+            flock(fileno(output_file), LOCK_UN);
+            fclose(output_file);
+        }
+    }
+
+    // 4. Clear all allocated resources
+    clear_recipient_list(record.recipients);
+}
+
+/*!
+ * @brief append_locked appends a block of data to a file shared by all workers, under an exclusive lock so that
+ * blocks of different workers are never interleaved
+ * @param path the path to the file
+ * @param data the data to append
+ * @param length the length of data
+ * @return true if the whole block was appended, false else
+ */
+static bool append_locked(char *path, char *data, size_t length) {
+    int fd = open(path, O_WRONLY | O_APPEND);
+    if (fd == -1) return false;
+    flock(fd, LOCK_EX);
+    bool written = write_all(fd, data, length);
+    flock(fd, LOCK_UN);
+    close(fd);
+    return written;
+}
 
 /*!
  * @brief process_directory goes recursively into directory pointed by its task parameter object_directory
  * and lists all of its files (with complete path) into the file defined by task parameter temporary_directory/name of
- * object directory
+ * object directory. With in memory intermediates, the listing is built in memory and appended at once to
+ * step1_output instead.
  * @param task the task to execute: it is a directory_task_t that shall be cast from task pointer
  * Use parse_dir.
  */
@@ -221,11 +411,27 @@ void process_directory(task_t *task) {
         if (dir_task->object_directory == NULL || dir_task->temporary_directory == NULL) {
             return;
         }
+        if (intermediates_in_memory()) {
+            char *listing = NULL;
+            size_t listing_size = 0;
+            FILE *output_file = open_memstream(&listing, &listing_size);
+            if (output_file == NULL) return;
+            parse_dir(dir_task->object_directory, output_file);
+            fclose(output_file);
+            char step1_path[STR_MAX_LEN];
+            intermediate_path(dir_task->temporary_directory, STEP1_OUTPUT, step1_path);
+            bool appended = append_locked(step1_path, listing, listing_size);
+            if (!appended) perror("Error appending to step1_output");
+            free(listing);
+            count_progress(1, 0, 0, appended ? 0 : 1);
+            return;
+        }
         // 2. Go through dir tree and find all regular files
         char output_path[255];
         snprintf(output_path, 255, "%s/%s", dir_task->temporary_directory, basename(dir_task->object_directory));
         FILE *output_file = fopen(output_path, "w");
         if (output_file == NULL) {
+            count_progress(1, 0, 0, 1);
             return;
         }
 
@@ -234,6 +440,7 @@ void process_directory(task_t *task) {
 
         // 4. Clear all allocated resources
         fclose(output_file);
+        count_progress(1, 0, 0, 0);
 }
 
 
@@ -251,13 +458,176 @@ void process_file(task_t *task) {
     char filepath[STR_MAX_LEN];
     strncpy(filepath, file_task->object_file, STR_MAX_LEN);
     char output[STR_MAX_LEN];
-    if (concat_path(file_task->temporary_directory, "step2_output", output) == NULL) return;
+    if (intermediate_path(file_task->temporary_directory, STEP2_OUTPUT, output) == NULL) return;
 
     // 3. Call parse_file
     parse_file(filepath, output);
 }
 
+/*!
+ * @brief analyze_listed_files analyzes the files of a list and adds their records to a combiner. If memory is
+ * exhausted, the combiner is flushed and released, and the records are written one by one from there.
+ * @param files_list the list, read from its current position
+ * @param end the position in files_list where the analysis stops (the end of the last line to analyze)
+ * @param combiner the combiner, writing to records_file
+ * @param combined true if the combiner is usable, set to false when it is released
+ * @param records_file the file receiving the records
+ */
+static void analyze_listed_files(FILE *files_list, off_t end, combiner_t *combiner, bool *combined,
+                                 FILE *records_file) {
+    char *filepath = NULL;
+    size_t filepath_size = 0;
+    ssize_t length;
+    recipients_arena = &mapper_arena;
+    while (ftello(files_list) < end && (length = getline(&filepath, &filepath_size, files_list)) > 0) {
+        if (filepath[length - 1] == '\n') filepath[length - 1] = '\0';
+        mail_record_t record;
+        if (read_mail_record(filepath, &record)) {
+            if (*combined && !combine_mail_record(combiner, &record)) {
+                // Memory is exhausted: write what was combined and go on without the combiner
+                flush_combiner(combiner);
+                clear_combiner(combiner);
+                *combined = false;
+            } else if (!*combined) {
+                write_mail_record(records_file, &record);
+            }
+        }
+        // Release the recipients of the record at once
+        rewind_arena(&mapper_arena);
+    }
+    recipients_arena = NULL;
+    free(filepath);
+    set_progress_arena(mapper_arena.peak_bytes, mapper_arena.block_count);
+}
+
+/*!
+ * @brief analyze_files_list analyzes the files of a list (one path per line, as in step1_output) and writes their
+ * records to another file. The records are combined (@see combiner.h): a sender/recipient pair found in several
+ * e-mails of the list is written once with its count. Recipients lists are allocated from the arena of the process.
+ * If memory is exhausted, the records are written one by one from there.
+ * @param files_list the list, read from its current position
+ * @param end the position in files_list where the analysis stops (the end of the last line to analyze)
+ * @param records_file the file receiving the records
+ */
+void analyze_files_list(FILE *files_list, off_t end, FILE *records_file) {
+    combiner_t combiner;
+    bool combined = init_combiner(&combiner, records_file);
+    analyze_listed_files(files_list, end, &combiner, &combined, records_file);
+    if (combined) {
+        flush_combiner(&combiner);
+        clear_combiner(&combiner);
+    }
+}
+
+/*!
+ * @brief commit_held_batches writes the combined records of the held batches, then commits them at once to
+ * step2_output and to the progress journal (@see commit_batches)
+ * @return true if the batches were committed (or none was held), false else
+ */
+static bool commit_held_batches(void) {
+    if (held_batches.count == 0) return true;
+    if (held_batches.combined) {
+        flush_combiner(&held_batches.combiner);
+        clear_combiner(&held_batches.combiner);
+    }
+    fclose(held_batches.records_file);
+
+    uint64_t emit_start = trace_clock();
+    bool committed = commit_batches(held_batches.temporary_directory, held_batches.batches, held_batches.count,
+                                    held_batches.records, held_batches.records_size);
+    trace_span(TRACE_EMIT, emit_start);
+    if (analysis_options.dedup_message_ids) publish_message_id_counts(held_batches.temporary_directory);
+    if (!committed) {
+        fprintf(stderr, "Could not commit %u batches of files from file %" PRIu64 "\n", held_batches.count,
+                held_batches.batches[0].first_file);
+        count_progress(0, 0, 0, 1);
+    }
+    free(held_batches.records);
+    held_batches.records = NULL;
+    held_batches.count = 0;
+    return committed;
+}
+
+/*!
+ * @brief hold_file_batches makes the process keep the records of its batches in a single combiner until it holds
+ * MAX_HELD_BATCHES of them or is told to commit them (@see commit_file_batches). Pool workers hold their batches so
+ * that a sender/recipient pair is written once for all of them, the other processes commit each batch.
+ * @param hold true to hold the batches, false to commit each batch (the held batches are committed first)
+ */
+void hold_file_batches(bool hold) {
+    if (!hold) commit_held_batches();
+    held_batches.enabled = hold;
+}
+
+/*!
+ * @brief held_file_batches counts the batches analyzed by the process but not committed yet
+ * @return the number of held batches
+ */
+uint32_t held_file_batches(void) {
+    return held_batches.count;
+}
 
+/*!
+ * @brief commit_file_batches is the callback of the task committing the batches held by a worker
+ * @param task the task (unused)
+ */
+void commit_file_batches(task_t *task) {
+    (void) task;
+    commit_held_batches();
+}
 
+#ifdef A22_TEST_HOOKS
+/*!
+ * @brief crash_if_requested is a test hook, only compiled in the test build (A22_TEST_HOOKS): the worker analyzing
+ * the batch starting at file A22_CRASH_AT_FILE of step1_output is killed, once per temporary directory, after the
+ * analysis of the batch and before its commit
+ * @param batch_task the analyzed batch
+ */
+static void crash_if_requested(batch_task_t *batch_task) {
+    char *crash_file = getenv("A22_CRASH_AT_FILE");
+    if (crash_file == NULL || strtoull(crash_file, NULL, 10) != batch_task->batch.first_file) return;
+    char marker[STR_MAX_LEN];
+    if (concat_path(batch_task->temporary_directory, "crash_injected", marker) == NULL) return;
+    int marker_fd = open(marker, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (marker_fd == -1) return; // The batch already crashed a worker
+    close(marker_fd);
+    raise(SIGKILL);
+}
+#endif
 
+/*!
+ * @brief process_file_batch processes a batch of consecutive files of step1_output: their records are added to the
+ * combiner of the held batches, which are committed at once to step2_output and to the progress journal when the
+ * process does not hold batches or holds MAX_HELD_BATCHES of them (@see commit_batches)
+ * @param task a batch_task_t as a pointer to a task
+ */
+void process_file_batch(task_t *task) {
+    if (task == NULL) return;
+    batch_task_t *batch_task = (batch_task_t *) task;
+    char step1_path[STR_MAX_LEN];
+    intermediate_path(batch_task->temporary_directory, STEP1_OUTPUT, step1_path);
+    FILE *files_list = fopen(step1_path, "r");
+    if (files_list == NULL) return;
+    if (held_batches.count == 0) {
+        held_batches.records_file = open_memstream(&held_batches.records, &held_batches.records_size);
+        if (held_batches.records_file == NULL) {
+            fclose(files_list);
+            return;
+        }
+        held_batches.combined = init_combiner(&held_batches.combiner, held_batches.records_file);
+        strcpy(held_batches.temporary_directory, batch_task->temporary_directory);
+    }
 
+    fseeko(files_list, batch_task->batch.start, SEEK_SET);
+    set_message_id_batch(batch_task->batch.first_file);
+    analyze_listed_files(files_list, batch_task->batch.end, &held_batches.combiner, &held_batches.combined,
+                         held_batches.records_file);
+    set_message_id_batch(UINT64_MAX);
+    fclose(files_list);
+#ifdef A22_TEST_HOOKS
+    crash_if_requested(batch_task);
+#endif
+    held_batches.batches[held_batches.count++] = batch_task->batch;
+    count_progress(1, 0, 0, 0);
+    if (!held_batches.enabled || held_batches.count == MAX_HELD_BATCHES) commit_held_batches();
+}
@@ -6,7 +6,11 @@
 #define A2022_ANALYSIS_H
 
 #include "global_defs.h"
+#include "checkpoint.h"
+#include "filter.h"
+#include "mail_date.h"
 #include <stdio.h>
+#include <stdbool.h>
 
 typedef struct _simple_recipient {
     char email[STR_MAX_LEN];
@@ -25,10 +29,36 @@ typedef struct {
     char temporary_directory[STR_MAX_LEN];
 } file_task_t;
 
+typedef struct {
+    void (* task_callback)(task_t *);
+    file_batch_t batch;
+    char temporary_directory[STR_MAX_LEN];
+} batch_task_t;
+
+// Run wide analysis settings, set by the parent before workers are forked
+typedef struct {
+    char temporary_directory[STR_MAX_LEN];
+    bool dedup_message_ids; // Skip e-mails whose Message-ID was already analyzed (see dedup.h)
+    mail_filter_t *filter; // Only the e-mails matching this filter are analyzed (see filter.h), NULL for all
+    time_buckets_t time_buckets; // Records start with the time bucket of the e-mail (see mail_date.h)
+    bool locality_keys; // Listings of the first step give the locality keys of each file (see locality.h)
+} analysis_options_t;
+
+void set_analysis_options(analysis_options_t *options);
+
+simple_recipient_t *extract_emails(char *buffer, simple_recipient_t *list);
+void extract_e_mail(char *buffer, char *destination);
+void clear_recipient_list(simple_recipient_t *list);
+
 void parse_dir(char *path, FILE *output_file);
 void parse_file(char *filepath, char *output);
+void analyze_files_list(FILE *files_list, off_t end, FILE *records_file);
 
 void process_directory(task_t *task);
 void process_file(task_t *task);
+void process_file_batch(task_t *task);
+void hold_file_batches(bool hold);
+uint32_t held_file_batches(void);
+void commit_file_batches(task_t *task);
 
 #endif //A2022_ANALYSIS_H
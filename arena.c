@@ -0,0 +1,145 @@
+#include "arena.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+// Size of a block header, rounded so that the first allocation of a block is aligned
+#define BLOCK_HEADER_SIZE ((sizeof(arena_block_t) + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1))
+
+static arena_pages_t arena_pages = ARENA_PAGES_DEFAULT;
+static char *arena_pages_names[] = {[ARENA_PAGES_DEFAULT] = "regular", [ARENA_PAGES_THP] = "transparent huge",
+                                    [ARENA_PAGES_HUGETLB] = "huge"};
+
+/*!
+ * @brief set_arena_pages sets the pages backing the blocks of the arenas of the current process and of the workers
+ * it forks later
+ * @param pages the kind of pages
+ */
+void set_arena_pages(arena_pages_t pages) {
+    arena_pages = pages;
+}
+
+/*!
+ * @brief map_block maps a new block, with the pages selected by set_arena_pages
+ * @param arena the arena the block is for (its statistics are updated)
+ * @param size the size of the block, a multiple of ARENA_BLOCK_SIZE
+ * @return the block, NULL if it could not be mapped
+ */
+static arena_block_t *map_block(arena_t *arena, size_t size) {
+    void *memory = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (arena_pages == ARENA_PAGES_HUGETLB) {
+        memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory == MAP_FAILED) arena->hugetlb_fallbacks++;
+    }
+#endif
+    if (memory == MAP_FAILED) {
+        memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+        if (arena_pages != ARENA_PAGES_DEFAULT) madvise(memory, size, MADV_HUGEPAGE);
+#endif
+    }
+    arena_block_t *block = memory;
+    block->next = NULL;
+    block->size = size;
+    block->used = BLOCK_HEADER_SIZE;
+    arena->mapped_bytes += size;
+    arena->block_count++;
+    return block;
+}
+
+/*!
+ * @brief init_arena prepares an empty arena (blocks are mapped on first use)
+ * @param arena the arena to initialize
+ */
+void init_arena(arena_t *arena) {
+    *arena = (arena_t) {.blocks = NULL};
+}
+
+/*!
+ * @brief arena_alloc allocates memory from an arena. The memory is released by rewind_arena or clear_arena, never by
+ * free.
+ * @param arena the arena, NULL to allocate with malloc instead (the memory must then be released with free)
+ * @param size the size to allocate
+ * @return a pointer to the allocated memory (aligned on ARENA_ALIGNMENT), NULL if allocation failed
+ */
+void *arena_alloc(arena_t *arena, size_t size) {
+    if (arena == NULL) return malloc(size);
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+    arena_block_t *block = arena->blocks;
+    if (block == NULL || block->used + size > block->size) {
+        if (size > ARENA_BLOCK_SIZE - BLOCK_HEADER_SIZE) {
+            // Oversized allocation: a dedicated block, inserted after the current one which may still have room
+            size_t block_size = (size + BLOCK_HEADER_SIZE + ARENA_BLOCK_SIZE - 1) & ~(size_t) (ARENA_BLOCK_SIZE - 1);
+            block = map_block(arena, block_size);
+            if (block == NULL) return NULL;
+            if (arena->blocks != NULL) {
+                block->next = arena->blocks->next;
+                arena->blocks->next = block;
+            } else {
+                arena->blocks = block;
+            }
+        } else {
+            block = map_block(arena, ARENA_BLOCK_SIZE);
+            if (block == NULL) return NULL;
+            block->next = arena->blocks;
+            arena->blocks = block;
+        }
+    }
+    void *memory = (char *) block + block->used;
+    block->used += size;
+    arena->allocations++;
+    arena->allocated_bytes += size;
+    arena->live_bytes += size;
+    if (arena->live_bytes > arena->peak_bytes) arena->peak_bytes = arena->live_bytes;
+    return memory;
+}
+
+/*!
+ * @brief rewind_arena releases all allocations of an arena at once, but keeps one block mapped for the next ones
+ * @param arena the arena to rewind
+ */
+void rewind_arena(arena_t *arena) {
+    arena_block_t *kept = NULL;
+    arena_block_t *block = arena->blocks;
+    while (block != NULL) {
+        arena_block_t *next = block->next;
+        if (kept == NULL && block->size == ARENA_BLOCK_SIZE) {
+            kept = block;
+            kept->next = NULL;
+            kept->used = BLOCK_HEADER_SIZE;
+        } else {
+            munmap(block, block->size);
+        }
+        block = next;
+    }
+    arena->blocks = kept;
+    arena->live_bytes = 0;
+}
+
+/*!
+ * @brief clear_arena releases all allocations and blocks of an arena at once (its statistics are kept)
+ * @param arena the arena to clear
+ */
+void clear_arena(arena_t *arena) {
+    rewind_arena(arena);
+    if (arena->blocks != NULL) munmap(arena->blocks, arena->blocks->size);
+    arena->blocks = NULL;
+}
+
+/*!
+ * @brief report_arena prints the statistics of an arena: each allocation is a malloc and a free saved, and its
+ * high-water mark is the memory it needed at most between two rewinds
+ * @param arena the arena
+ * @param name the name of the arena in the report
+ */
+void report_arena(arena_t *arena, char *name) {
+    printf("%s arena: %" PRIu64 " allocations (%" PRIu64 " bytes, at most %" PRIu64 " at once) from %u blocks (%" PRIu64
+           " bytes) of %s pages", name, arena->allocations, arena->allocated_bytes, arena->peak_bytes,
+           arena->block_count, arena->mapped_bytes, arena_pages_names[arena_pages]);
+    if (arena->hugetlb_fallbacks > 0) printf(", %u blocks without reserved huge pages", arena->hugetlb_fallbacks);
+    printf("\n");
+}
@@ -0,0 +1,46 @@
+#ifndef A2022_ARENA_H
+#define A2022_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Size of the blocks of an arena (also the size of a huge page on x86-64)
+#define ARENA_BLOCK_SIZE (2 * 1024 * 1024)
+// Alignment of the allocations
+#define ARENA_ALIGNMENT 16
+
+// Pages backing the blocks of arenas
+typedef enum {
+    ARENA_PAGES_DEFAULT, // Regular pages
+    ARENA_PAGES_THP, // Regular mapping, advised for transparent huge pages
+    ARENA_PAGES_HUGETLB, // Huge pages from the reserved pool (falls back to THP when the pool is empty)
+} arena_pages_t;
+
+typedef struct _arena_block {
+    struct _arena_block *next;
+    size_t size;
+    size_t used;
+} arena_block_t;
+
+// A bump allocator: allocations are carved from large blocks and are never freed one by one, the whole arena is
+// released (or rewound) at once
+typedef struct {
+    arena_block_t *blocks; // Current block first
+    uint64_t allocations;
+    uint64_t allocated_bytes;
+    uint64_t live_bytes; // Bytes allocated since the last rewind
+    uint64_t peak_bytes; // High-water mark of live_bytes
+    uint64_t mapped_bytes;
+    uint32_t block_count;
+    uint32_t hugetlb_fallbacks;
+} arena_t;
+
+void set_arena_pages(arena_pages_t pages);
+void init_arena(arena_t *arena);
+void *arena_alloc(arena_t *arena, size_t size);
+void rewind_arena(arena_t *arena);
+void clear_arena(arena_t *arena);
+void report_arena(arena_t *arena, char *name);
+
+#endif //A2022_ARENA_H
@@ -0,0 +1,577 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include "global_defs.h"
+#include "analysis.h"
+#include "intermediates.h"
+#include "reducers.h"
+#include "tokenizer.h"
+#include "utility.h"
+
+#define GENERATED_LINES 100000
+#define DEFAULT_WARMUP 1
+#define DEFAULT_REPETITIONS 5
+#define MAX_REPETITIONS 1000
+// E-mails written for the parse_file kernel (one per corpus line, at most)
+#define MAIL_FILES 2000
+#define MAX_SPANS 64
+
+typedef struct {
+    char **lines;
+    size_t count;
+    size_t bytes;
+} corpus_t;
+
+// Inputs of the kernels, built once from the corpus before the measures
+typedef struct {
+    corpus_t *corpus;
+    // Fresh copy of the corpus lines, for the kernels which modify their input
+    char *scratch;
+    char **lines;
+    // Canonical addresses of each line (as extracted by the tokenizer), the first one is the sender
+    char ***addresses;
+    size_t *address_counts;
+    size_t address_total;
+    // Sources of the add_recipient_to_source kernel: the sender of each line in sources
+    sender_t *sources;
+    sender_t **line_sources;
+    // Generated e-mails, step2_output and reducer output in a temporary directory
+    char directory[STR_MAX_LEN];
+    char **mail_paths;
+    size_t mail_count;
+    size_t mail_bytes;
+    char step2_path[STR_MAX_LEN];
+    size_t step2_lines;
+    size_t step2_bytes;
+    char output_path[STR_MAX_LEN];
+} inputs_t;
+
+// Work done by a timed run of a kernel
+typedef struct {
+    size_t ops;
+    size_t bytes;
+} work_t;
+
+typedef struct {
+    char *name;
+    char *unit; // What an op is
+    void (*prepare)(inputs_t *inputs); // Before each run, not timed (NULL if none)
+    work_t (*run)(inputs_t *inputs);
+} kernel_t;
+
+// A measured run
+typedef struct {
+    double ns;
+    uint64_t cycles;
+} sample_t;
+
+typedef enum {
+    FORMAT_TEXT,
+    FORMAT_JSON, // One JSON object per kernel and line (JSON Lines)
+} format_t;
+
+typedef struct {
+    format_t format;
+    int warmup;
+    int repetitions;
+    char *kernels; // Comma separated names, NULL for all
+    char *headers; // Recorded headers, NULL to generate the corpus
+} benchmark_options_t;
+
+/*!
+ * @brief generate_corpus builds address list lines mixing the formats found in mail headers (plain lists, display
+ * names with angle brackets, quoted names, mixed case)
+ * @param corpus the corpus to fill
+ * @param count the number of lines to generate
+ */
+static void generate_corpus(corpus_t *corpus, size_t count) {
+    static char *formats[] = {"%s.%s@enron.com", "\"%s, %s\" <%s.%s@ENRON.com>", "%s %s <%s.%s@enron.com>",
+                              "'%s.%s@Enron.com'"};
+    static char *names[] = {"john", "Jane", "mark", "Sally", "jeff", "Kenneth", "vince", "Louise"};
+    corpus->lines = malloc(sizeof(char *) * count);
+    corpus->count = count;
+    corpus->bytes = 0;
+    srand(42);
+    for (size_t i = 0; i < count; i++) {
+        char line[4 * STR_MAX_LEN] = "";
+        int addresses = 1 + rand() % 12;
+        for (int a = 0; a < addresses; a++) {
+            char address[STR_MAX_LEN];
+            char *first = names[rand() % 8], *last = names[rand() % 8];
+            char *format = formats[rand() % 4];
+            snprintf(address, STR_MAX_LEN, format, first, last, first, last);
+            if (a > 0) strcat(line, ", ");
+            strcat(line, address);
+        }
+        strcat(line, "\n");
+        corpus->lines[i] = strdup(line);
+        corpus->bytes += strlen(line);
+    }
+}
+
+/*!
+ * @brief load_corpus reads header values from a file (e.g. extracted with grep -h '^To:' from the maildir), the
+ * field name before the first ':' is removed
+ * @param corpus the corpus to fill
+ * @param path the path to the recorded headers
+ * @return 0 on success, -1 else
+ */
+static int load_corpus(corpus_t *corpus, char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return -1;
+    size_t capacity = 1024;
+    corpus->lines = malloc(sizeof(char *) * capacity);
+    corpus->count = 0;
+    corpus->bytes = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    while (getline(&line, &line_size, file) != -1) {
+        char *value = strchr(line, ':');
+        value = value == NULL ? line : value + 1;
+        if (corpus->count == capacity) {
+            capacity *= 2;
+            corpus->lines = realloc(corpus->lines, sizeof(char *) * capacity);
+        }
+        corpus->lines[corpus->count++] = strdup(value);
+        corpus->bytes += strlen(value);
+    }
+    free(line);
+    fclose(file);
+    return 0;
+}
+
+/*!
+ * @brief copy_lines refreshes the scratch copy of the corpus (prepare callback of the kernels modifying their input)
+ * @param inputs the inputs
+ */
+static void copy_lines(inputs_t *inputs) {
+    char *cursor = inputs->scratch;
+    for (size_t i = 0; i < inputs->corpus->count; i++) {
+        size_t length = strlen(inputs->corpus->lines[i]) + 1;
+        memcpy(cursor, inputs->corpus->lines[i], length);
+        inputs->lines[i] = cursor;
+        cursor += length;
+    }
+}
+
+static work_t run_extract_emails(inputs_t *inputs) {
+    work_t work = {.ops = 0, .bytes = inputs->corpus->bytes};
+    for (size_t i = 0; i < inputs->corpus->count; i++) {
+        simple_recipient_t *list = extract_emails(inputs->lines[i], NULL);
+        for (simple_recipient_t *recipient = list; recipient != NULL; recipient = recipient->next) work.ops++;
+        clear_recipient_list(list);
+    }
+    return work;
+}
+
+static work_t run_extract_e_mail(inputs_t *inputs) {
+    work_t work = {.ops = inputs->corpus->count, .bytes = inputs->corpus->bytes};
+    char email[STR_MAX_LEN];
+    for (size_t i = 0; i < inputs->corpus->count; i++) extract_e_mail(inputs->lines[i], email);
+    return work;
+}
+
+static work_t run_tokenize_addresses(inputs_t *inputs) {
+    work_t work = {.ops = 0, .bytes = inputs->corpus->bytes};
+    address_span_t spans[MAX_SPANS];
+    for (size_t i = 0; i < inputs->corpus->count; i++) {
+        work.ops += tokenize_addresses(inputs->lines[i], strlen(inputs->lines[i]), spans, MAX_SPANS);
+    }
+    return work;
+}
+
+static work_t run_str_trim(inputs_t *inputs) {
+    work_t work = {.ops = inputs->corpus->count, .bytes = inputs->corpus->bytes};
+    for (size_t i = 0; i < inputs->corpus->count; i++) str_trim(inputs->lines[i]);
+    return work;
+}
+
+static work_t run_str_remove_char(inputs_t *inputs) {
+    work_t work = {.ops = inputs->corpus->count, .bytes = inputs->corpus->bytes};
+    for (size_t i = 0; i < inputs->corpus->count; i++) str_remove_char(inputs->lines[i], ',');
+    return work;
+}
+
+/*!
+ * @brief reset_sources rebuilds the sources of add_recipient_to_source, without recipients
+ * @param inputs the inputs
+ */
+static void reset_sources(inputs_t *inputs) {
+    clear_sources_list(inputs->sources);
+    inputs->sources = NULL;
+    for (size_t i = 0; i < inputs->corpus->count; i++) {
+        inputs->line_sources[i] = NULL;
+        if (inputs->address_counts[i] == 0) continue;
+        sender_t *source = find_source_in_list(inputs->sources, inputs->addresses[i][0]);
+        if (source == NULL) {
+            inputs->sources = add_source_to_list(inputs->sources, inputs->addresses[i][0]);
+            source = find_source_in_list(inputs->sources, inputs->addresses[i][0]);
+        }
+        inputs->line_sources[i] = source;
+    }
+}
+
+static work_t run_add_recipient_to_source(inputs_t *inputs) {
+    work_t work = {.ops = 0, .bytes = 0};
+    for (size_t i = 0; i < inputs->corpus->count; i++) {
+        for (size_t a = 1; a < inputs->address_counts[i]; a++) {
+            add_recipient_to_source(inputs->line_sources[i], inputs->addresses[i][a]);
+            work.bytes += strlen(inputs->addresses[i][a]);
+            work.ops++;
+        }
+    }
+    return work;
+}
+
+/*!
+ * @brief truncate_output empties the output of parse_file and files_reducer
+ * @param inputs the inputs
+ */
+static void truncate_output(inputs_t *inputs) {
+    fclose(fopen(inputs->output_path, "w"));
+}
+
+static work_t run_parse_file(inputs_t *inputs) {
+    for (size_t i = 0; i < inputs->mail_count; i++) parse_file(inputs->mail_paths[i], inputs->output_path);
+    return (work_t) {.ops = inputs->mail_count, .bytes = inputs->mail_bytes};
+}
+
+static work_t run_files_reducer(inputs_t *inputs) {
+    if (!files_reducer(inputs->step2_path, inputs->directory, inputs->output_path, 0, TIME_BUCKETS_NONE, 1)) {
+        return (work_t) {.ops = 0, .bytes = 0};
+    }
+    return (work_t) {.ops = inputs->step2_lines, .bytes = inputs->step2_bytes};
+}
+
+static kernel_t kernels[] = {
+        {"extract_emails", "address", copy_lines, run_extract_emails},
+        {"extract_e_mail", "line", copy_lines, run_extract_e_mail},
+        {"tokenize_addresses", "address", copy_lines, run_tokenize_addresses},
+        {"str_trim", "line", copy_lines, run_str_trim},
+        {"str_remove_char", "line", copy_lines, run_str_remove_char},
+        {"add_recipient_to_source", "recipient", reset_sources, run_add_recipient_to_source},
+        {"parse_file", "e-mail", truncate_output, run_parse_file},
+        {"files_reducer", "record", NULL, run_files_reducer},
+};
+
+/*!
+ * @brief make_inputs extracts the addresses of the corpus and writes the e-mails and the step2_output of the file
+ * kernels to a temporary directory
+ * @param inputs the inputs to fill
+ * @param corpus the corpus
+ * @return true on success, false else
+ */
+static bool make_inputs(inputs_t *inputs, corpus_t *corpus) {
+    memset(inputs, 0, sizeof(inputs_t));
+    inputs->corpus = corpus;
+    inputs->scratch = malloc(corpus->bytes + corpus->count);
+    inputs->lines = malloc(sizeof(char *) * corpus->count);
+    inputs->addresses = malloc(sizeof(char **) * corpus->count);
+    inputs->address_counts = malloc(sizeof(size_t) * corpus->count);
+    inputs->line_sources = malloc(sizeof(sender_t *) * corpus->count);
+    inputs->mail_paths = malloc(sizeof(char *) * MAIL_FILES);
+    strcpy(inputs->directory, "/tmp/a22-benchmark-XXXXXX");
+    if (inputs->scratch == NULL || inputs->lines == NULL || inputs->addresses == NULL ||
+        inputs->address_counts == NULL || inputs->line_sources == NULL || inputs->mail_paths == NULL ||
+        mkdtemp(inputs->directory) == NULL) {
+        perror("Could not prepare the benchmark inputs");
+        inputs->directory[0] = '\0';
+        return false;
+    }
+
+    // 1. Canonical addresses of each line
+    copy_lines(inputs);
+    address_span_t spans[MAX_SPANS];
+    for (size_t i = 0; i < corpus->count; i++) {
+        size_t count = tokenize_addresses(inputs->lines[i], strlen(inputs->lines[i]), spans, MAX_SPANS);
+        inputs->addresses[i] = malloc(sizeof(char *) * (count + 1));
+        inputs->address_counts[i] = count;
+        for (size_t a = 0; a < count; a++) {
+            inputs->addresses[i][a] = strndup(spans[a].start, spans[a].length);
+        }
+        inputs->address_total += count;
+    }
+
+    // 2. E-mails (the first address sends to the others) and step2_output (a record per line)
+    concat_path(inputs->directory, STEP2_OUTPUT, inputs->step2_path);
+    concat_path(inputs->directory, "output", inputs->output_path);
+    FILE *step2 = fopen(inputs->step2_path, "w");
+    if (step2 == NULL) {
+        perror("Could not write the benchmark step2_output");
+        return false;
+    }
+    for (size_t i = 0; i < corpus->count; i++) {
+        if (inputs->address_counts[i] < 2) continue;
+        char **addresses = inputs->addresses[i];
+        int length = fprintf(step2, "%s", addresses[0]);
+        for (size_t a = 1; a < inputs->address_counts[i]; a++) length += fprintf(step2, " %s", addresses[a]);
+        length += fprintf(step2, "\n");
+        inputs->step2_bytes += length;
+        inputs->step2_lines++;
+        if (inputs->mail_count == MAIL_FILES) continue;
+        char name[STR_MAX_LEN], path[STR_MAX_LEN];
+        snprintf(name, STR_MAX_LEN, "%zu.", inputs->mail_count + 1);
+        FILE *mail = fopen(concat_path(inputs->directory, name, path), "w");
+        if (mail == NULL) continue;
+        length = fprintf(mail, "Message-ID: <%zu.benchmark@a22>\nDate: Mon, 14 May 2001 16:39:00 -0700 (PDT)\n"
+                               "From: %s\nTo: %s", inputs->mail_count, addresses[0], corpus->lines[i]);
+        length += fprintf(mail, "Subject: benchmark\nMime-Version: 1.0\n\nBody of the e-mail.\n");
+        fclose(mail);
+        inputs->mail_bytes += length;
+        inputs->mail_paths[inputs->mail_count++] = strdup(path);
+    }
+    if (fclose(step2) != 0) return false;
+    return true;
+}
+
+/*!
+ * @brief clear_inputs frees the inputs and removes their temporary directory
+ * @param inputs the inputs
+ */
+static void clear_inputs(inputs_t *inputs) {
+    if (inputs->directory[0] != '\0') {
+        DIR *directory = opendir(inputs->directory);
+        struct dirent *entry;
+        while (directory != NULL && (entry = readdir(directory)) != NULL) {
+            char path[STR_MAX_LEN];
+            if (entry->d_name[0] != '.') remove(concat_path(inputs->directory, entry->d_name, path));
+        }
+        if (directory != NULL) closedir(directory);
+        rmdir(inputs->directory);
+    }
+    for (size_t i = 0; inputs->addresses != NULL && i < inputs->corpus->count; i++) {
+        for (size_t a = 0; a < inputs->address_counts[i]; a++) free(inputs->addresses[i][a]);
+        free(inputs->addresses[i]);
+    }
+    for (size_t i = 0; i < inputs->mail_count; i++) free(inputs->mail_paths[i]);
+    clear_sources_list(inputs->sources);
+    free(inputs->mail_paths);
+    free(inputs->line_sources);
+    free(inputs->address_counts);
+    free(inputs->addresses);
+    free(inputs->lines);
+    free(inputs->scratch);
+}
+
+/*!
+ * @brief open_cycles_counter opens a CPU cycles counter on the process and its children (files_reducer forks)
+ * @return the counter file descriptor, -1 if the counter is not available (no PMU, perf_event_paranoid)
+ */
+static int open_cycles_counter() {
+    struct perf_event_attr attributes;
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.type = PERF_TYPE_HARDWARE;
+    attributes.size = sizeof(attributes);
+    attributes.config = PERF_COUNT_HW_CPU_CYCLES;
+    attributes.disabled = 1;
+    attributes.inherit = 1;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+}
+
+/*!
+ * @brief now_ns reads the monotonic clock
+ * @return the current time in nanoseconds
+ */
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*!
+ * @brief compare_samples orders samples by duration (qsort callback)
+ * @param a a sample_t pointer
+ * @param b a sample_t pointer
+ * @return a negative value if a is faster, positive if b is faster, 0 if equal
+ */
+static int compare_samples(const void *a, const void *b) {
+    const sample_t *sample_a = a, *sample_b = b;
+    if (sample_a->ns != sample_b->ns) return sample_a->ns < sample_b->ns ? -1 : 1;
+    return 0;
+}
+
+/*!
+ * @brief run_kernel measures a kernel (warmup runs, then measured runs) and prints its best and median runs. The
+ * standard output is redirected to /dev/null during the runs, as some kernels print their statistics.
+ * @param kernel the kernel
+ * @param inputs the inputs
+ * @param options the benchmark options
+ * @param cycles_fd the cycles counter, -1 if none
+ * @param results the stream where results are printed
+ */
+static void run_kernel(kernel_t *kernel, inputs_t *inputs, benchmark_options_t *options, int cycles_fd,
+                       FILE *results) {
+    sample_t samples[MAX_REPETITIONS];
+    work_t work = {0, 0};
+    int null_fd = open("/dev/null", O_WRONLY);
+    int stdout_fd = dup(STDOUT_FILENO);
+    for (int run = 0; run < options->warmup + options->repetitions; run++) {
+        if (kernel->prepare != NULL) kernel->prepare(inputs);
+        fflush(stdout);
+        dup2(null_fd, STDOUT_FILENO);
+        if (cycles_fd != -1) {
+            ioctl(cycles_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(cycles_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+        double start = now_ns();
+        work = kernel->run(inputs);
+        double elapsed = now_ns() - start;
+        uint64_t cycles = 0;
+        if (cycles_fd != -1) {
+            ioctl(cycles_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(cycles_fd, &cycles, sizeof(cycles)) != sizeof(cycles)) cycles = 0;
+        }
+        fflush(stdout);
+        dup2(stdout_fd, STDOUT_FILENO);
+        if (run >= options->warmup) samples[run - options->warmup] = (sample_t) {.ns = elapsed, .cycles = cycles};
+    }
+    close(stdout_fd);
+    close(null_fd);
+
+    qsort(samples, options->repetitions, sizeof(sample_t), compare_samples);
+    sample_t best = samples[0], median = samples[options->repetitions / 2];
+    double ops = work.ops > 0 ? (double) work.ops : 1;
+    if (options->format == FORMAT_JSON) {
+        fprintf(results, "{\"kernel\":\"%s\",\"unit\":\"%s\",\"input\":\"%s\",\"warmup\":%d,\"repetitions\":%d,"
+                         "\"ops\":%zu,\"bytes\":%zu,\"best_ns\":%.0f,\"median_ns\":%.0f,\"ns_per_op\":%.3f,"
+                         "\"median_ns_per_op\":%.3f,\"bytes_per_op\":%.3f,\"mb_per_s\":%.3f,\"cycles_per_op\":",
+                kernel->name, kernel->unit, options->headers == NULL ? "generated" : options->headers,
+                options->warmup, options->repetitions, work.ops, work.bytes, best.ns, median.ns, best.ns / ops,
+                median.ns / ops, work.bytes / ops, work.bytes / (best.ns / 1e3));
+        if (cycles_fd != -1) {
+            fprintf(results, "%.3f}\n", best.cycles / ops);
+        } else {
+            fprintf(results, "null}\n");
+        }
+    } else {
+        fprintf(results, "%-24s %-9s %10zu %12zu %10.3f %10.3f %10.1f %10.1f %9.1f ", kernel->name, kernel->unit,
+                work.ops, work.bytes, best.ns / 1e6, median.ns / 1e6, best.ns / ops, work.bytes / ops,
+                work.bytes / (best.ns / 1e3));
+        if (cycles_fd != -1) {
+            fprintf(results, "%10.1f\n", best.cycles / ops);
+        } else {
+            fprintf(results, "%10s\n", "-");
+        }
+    }
+    fflush(results);
+}
+
+/*!
+ * @brief kernel_selected tells if a kernel is in the comma separated list of the --kernels option
+ * @param options the benchmark options
+ * @param name the name of the kernel
+ * @return true if the kernel must be run
+ */
+static bool kernel_selected(benchmark_options_t *options, char *name) {
+    if (options->kernels == NULL) return true;
+    size_t length = strlen(name);
+    for (char *cursor = options->kernels; cursor != NULL; cursor = strchr(cursor, ',')) {
+        if (*cursor == ',') cursor++;
+        if (strncmp(cursor, name, length) == 0 && (cursor[length] == ',' || cursor[length] == '\0')) return true;
+    }
+    return false;
+}
+
+/*!
+ * @brief parse_benchmark_options reads the command line of the benchmark
+ * @param options the options to fill
+ * @param argc the number of arguments
+ * @param argv the arguments
+ * @return true if the command line is valid, false else
+ */
+static bool parse_benchmark_options(benchmark_options_t *options, int argc, char *argv[]) {
+    static struct option long_options[] = {
+            {"format", required_argument, NULL, 'f'},
+            {"warmup", required_argument, NULL, 'w'},
+            {"repetitions", required_argument, NULL, 'r'},
+            {"kernels", required_argument, NULL, 'k'},
+            {NULL, 0, NULL, 0}
+    };
+    *options = (benchmark_options_t) {.format = FORMAT_TEXT, .warmup = DEFAULT_WARMUP,
+                                      .repetitions = DEFAULT_REPETITIONS, .kernels = NULL, .headers = NULL};
+    int opt;
+    while ((opt = getopt_long(argc, argv, "f:w:r:k:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'f':
+                if (strcmp(optarg, "text") == 0) {
+                    options->format = FORMAT_TEXT;
+                } else if (strcmp(optarg, "json") == 0) {
+                    options->format = FORMAT_JSON;
+                } else {
+                    return false;
+                }
+                break;
+            case 'w':
+                options->warmup = atoi(optarg);
+                if (options->warmup < 0) return false;
+                break;
+            case 'r':
+                options->repetitions = atoi(optarg);
+                if (options->repetitions < 1 || options->repetitions > MAX_REPETITIONS) return false;
+                break;
+            case 'k':
+                options->kernels = optarg;
+                break;
+            default:
+                return false;
+        }
+    }
+    if (optind < argc) options->headers = argv[optind];
+    return optind + 1 >= argc;
+}
+
+int main(int argc, char *argv[]) {
+    benchmark_options_t options;
+    if (!parse_benchmark_options(&options, argc, argv)) {
+        fprintf(stderr, "Usage: %s [-f|--format text|json] [-w|--warmup N] [-r|--repetitions N] "
+                        "[-k|--kernels NAME,...] [HEADERS_FILE]\nKernels:", argv[0]);
+        for (size_t i = 0; i < sizeof(kernels) / sizeof(kernel_t); i++) fprintf(stderr, " %s", kernels[i].name);
+        fprintf(stderr, "\n");
+        return 1;
+    }
+    corpus_t corpus;
+    if (options.headers != NULL) {
+        if (load_corpus(&corpus, options.headers) != 0) {
+            fprintf(stderr, "Could not read headers corpus %s\n", options.headers);
+            return 1;
+        }
+    } else {
+        generate_corpus(&corpus, GENERATED_LINES);
+    }
+
+    inputs_t inputs;
+    bool ready = make_inputs(&inputs, &corpus);
+    FILE *results = fdopen(dup(STDOUT_FILENO), "w");
+    int cycles_fd = open_cycles_counter();
+    if (ready && results != NULL) {
+        if (options.format == FORMAT_TEXT) {
+            fprintf(results, "Corpus: %s, %zu lines, %zu bytes, %zu addresses, %zu e-mails, %zu records, "
+                             "%d warmup and %d measured runs\n",
+                    options.headers == NULL ? "generated" : options.headers, corpus.count, corpus.bytes, inputs.address_total, inputs.mail_count, inputs.step2_lines,
+                    options.warmup, options.repetitions);
+            fprintf(results, "%-24s %-9s %10s %12s %10s %10s %10s %10s %9s %10s\n", "kernel", "unit", "ops", "bytes",
+                    "best_ms", "median_ms", "ns/op", "bytes/op", "MB/s", "cycles/op");
+        }
+        for (size_t i = 0; i < sizeof(kernels) / sizeof(kernel_t); i++) {
+            if (kernel_selected(&options, kernels[i].name)) run_kernel(&kernels[i], &inputs, &options, cycles_fd,
+                                                                       results);
+        }
+    }
+    if (cycles_fd != -1) close(cycles_fd);
+    if (results != NULL) fclose(results);
+    clear_inputs(&inputs);
+    for (size_t i = 0; i < corpus.count; i++) free(corpus.lines[i]);
+    free(corpus.lines);
+    return ready ? 0 : 1;
+}
@@ -0,0 +1,476 @@
+#include "checkpoint.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "global_defs.h"
+#include "utility.h"
+#include "intermediates.h"
+#include "prefetch.h"
+
+/*
+ * The journal is a text file: a header line "step2_journal <size of step1_output> <FILES_PER_BATCH>", written when
+ * the files analysis starts, then one "<first file> <file count> <end offset>" line per committed batch. The records
+ * of a group of batches committed together are appended to step2_output and their journal lines are written under
+ * the lock of step2_output, so journal lines are in the order of the records. All lines of a group but the last one
+ * end with "+" instead of an offset: a group only counts once its last line is complete, and the end offset of the
+ * last complete group is the size of the committed part of step2_output (anything after belongs to an interrupted
+ * commit).
+ */
+
+/*!
+ * @brief read_journal_header reads the header of the journal and checks it matches the current step1_output
+ * @param journal the journal
+ * @param temp_dir the temporary directory
+ * @return true if the journal can be used to resume, false else
+ */
+static bool read_journal_header(FILE *journal, char *temp_dir) {
+    char step1_path[STR_MAX_LEN];
+    struct stat sb;
+    long long step1_size;
+    unsigned batch_size;
+    if (intermediate_path(temp_dir, STEP1_OUTPUT, step1_path) == NULL || stat(step1_path, &sb) == -1) return false;
+    if (fscanf(journal, "step2_journal %lld %u\n", &step1_size, &batch_size) != 2) return false;
+    return step1_size == sb.st_size && batch_size == FILES_PER_BATCH;
+}
+
+/*!
+ * @brief can_resume tells if a previous run left a journal matching the current step1_output (resume is only
+ * possible when intermediate results are kept in files)
+ * @param temp_dir the temporary directory
+ * @return true if the files analysis can be resumed, false else
+ */
+bool can_resume(char *temp_dir) {
+    if (intermediates_in_memory()) return false;
+    char journal_path[STR_MAX_LEN];
+    concat_path(temp_dir, STEP2_JOURNAL, journal_path);
+    FILE *journal = fopen(journal_path, "r");
+    if (journal == NULL) return false;
+    bool valid = read_journal_header(journal, temp_dir);
+    fclose(journal);
+    return valid;
+}
+
+/*!
+ * @brief split_batches splits step1_output, from a given line, into batches of FILES_PER_BATCH lines
+ * @param temp_dir the temporary directory
+ * @param list the work list receiving the batches
+ * @param start the offset of the first line to split
+ * @param first_file the index of the first line to split
+ * @return true on success, false else
+ */
+static bool split_batches(char *temp_dir, work_list_t *list, off_t start, uint64_t first_file) {
+    char step1_path[STR_MAX_LEN];
+    intermediate_path(temp_dir, STEP1_OUTPUT, step1_path);
+    FILE *files_list = fopen(step1_path, "r");
+    if (files_list == NULL) return false;
+    fseeko(files_list, start, SEEK_SET);
+    uint64_t capacity = 64;
+    list->batches = malloc(sizeof(file_batch_t) * capacity);
+    char *line = NULL;
+    size_t line_size = 0;
+    uint64_t files = first_file;
+    off_t offset = start;
+    ssize_t length;
+    while (list->batches != NULL && (length = getline(&line, &line_size, files_list)) != -1) {
+        if ((files - first_file) % FILES_PER_BATCH == 0) {
+            if (list->batch_count == capacity) {
+                capacity *= 2;
+                file_batch_t *grown = realloc(list->batches, sizeof(file_batch_t) * capacity);
+                if (grown == NULL) {
+                    free(list->batches);
+                    list->batches = NULL;
+                    break;
+                }
+                list->batches = grown;
+            }
+            list->batches[list->batch_count++] = (file_batch_t) {files, 0, offset, offset};
+        }
+        file_batch_t *batch = &list->batches[list->batch_count - 1];
+        offset += length;
+        batch->file_count++;
+        batch->end = offset;
+        files++;
+    }
+    free(line);
+    fclose(files_list);
+    return list->batches != NULL;
+}
+
+/*!
+ * @brief scan_journal reads the groups of batches of the journal, from the line following its header, until the first
+ * incomplete or invalid line, and gives each complete group to a visitor
+ * @param journal the journal, positioned after its header
+ * @param visit the visitor of the complete groups (indexes of their first files, false to stop at the group), NULL for
+ * none
+ * @param context the context of the visitor
+ * @param journal_end the resulting size of the complete groups of the journal (header included)
+ * @param step2_end the resulting size of the committed part of step2_output
+ * @return true on success, false on memory error
+ */
+static bool scan_journal(FILE *journal, bool (*visit)(uint64_t *, uint32_t, void *), void *context,
+                         off_t *journal_end, off_t *step2_end) {
+    *journal_end = ftello(journal);
+    *step2_end = 0;
+    uint64_t *group = malloc(sizeof(uint64_t) * MAX_HELD_BATCHES);
+    if (group == NULL) return false;
+    uint32_t group_size = 0;
+    off_t group_length = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_size, journal)) != -1 && line[length - 1] == '\n') {
+        unsigned long long first_file;
+        unsigned file_count;
+        char end[32];
+        if (sscanf(line, "%llu %u %31s", &first_file, &file_count, end) != 3) break;
+        if (group_size == MAX_HELD_BATCHES) break;
+        group[group_size++] = first_file;
+        group_length += length;
+        if (strcmp(end, "+") == 0) continue;
+        if (visit != NULL && !visit(group, group_size, context)) break;
+        *step2_end = strtoll(end, NULL, 10);
+        *journal_end += group_length;
+        group_size = 0;
+        group_length = 0;
+    }
+    free(line);
+    free(group);
+    return true;
+}
+
+/*!
+ * @brief mark_done_group is the journal visitor of load_journal: it marks the batches of a group as done
+ * @param group the first files of the batches of the group
+ * @param size the number of batches of the group
+ * @param context the work list
+ * @return false if a batch of the group is not a batch of the work list (the journal is not used past it), true else
+ */
+static bool mark_done_group(uint64_t *group, uint32_t size, void *context) {
+    work_list_t *list = (work_list_t *) context;
+    for (uint32_t i = 0; i < size; i++) {
+        uint64_t index = group[i] / FILES_PER_BATCH;
+        if (index >= list->batch_count || list->batches[index].first_file != group[i]) return false;
+    }
+    for (uint32_t i = 0; i < size; i++) {
+        uint64_t index = group[i] / FILES_PER_BATCH;
+        if (!list->done[index]) list->done_count++;
+        list->done[index] = true;
+    }
+    return true;
+}
+
+/*!
+ * @brief load_journal marks the batches committed by a previous run, and removes what was written after the last
+ * committed batch (partial records in step2_output, partial line in the journal)
+ * @param temp_dir the temporary directory
+ * @param list the work list to update
+ * @return true on success, false else
+ */
+static bool load_journal(char *temp_dir, work_list_t *list) {
+    char journal_path[STR_MAX_LEN], step2_path[STR_MAX_LEN];
+    concat_path(temp_dir, STEP2_JOURNAL, journal_path);
+    intermediate_path(temp_dir, STEP2_OUTPUT, step2_path);
+    FILE *journal = fopen(journal_path, "r");
+    if (journal == NULL) return false;
+    if (!read_journal_header(journal, temp_dir)) {
+        fclose(journal);
+        return false;
+    }
+    off_t journal_end, step2_end;
+    bool scanned = scan_journal(journal, mark_done_group, list, &journal_end, &step2_end);
+    fclose(journal);
+    if (!scanned) return false;
+    if (truncate(journal_path, journal_end) == -1 || truncate(step2_path, step2_end) == -1) {
+        perror("Could not trim the interrupted batches");
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief make_work_list splits step1_output into batches for the files analysis. For a new run, step2_output is
+ * emptied and a new journal is started; when resuming, batches committed by the previous run are skipped and partial
+ * records are trimmed.
+ * @param temp_dir the temporary directory
+ * @param resume true to resume from the journal (@see can_resume), false for a new run
+ * @return a malloc'ed work list, NULL on error
+ */
+work_list_t *make_work_list(char *temp_dir, bool resume) {
+    work_list_t *list = calloc(1, sizeof(work_list_t));
+    if (list == NULL) return NULL;
+    if (!split_batches(temp_dir, list, 0, 0) || (list->done = calloc(list->batch_count + 1, sizeof(bool))) == NULL) {
+        clear_work_list(list);
+        return NULL;
+    }
+    if (resume) {
+        if (load_journal(temp_dir, list)) return list;
+        clear_work_list(list);
+        return NULL;
+    }
+
+    char step2_path[STR_MAX_LEN], step1_path[STR_MAX_LEN];
+    intermediate_path(temp_dir, STEP2_OUTPUT, step2_path);
+    int step2_fd = open(step2_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (step2_fd != -1) close(step2_fd);
+    // Start a new journal (also in memory mode, to trim the records of a worker dying during a commit)
+    struct stat sb;
+    char journal_path[STR_MAX_LEN];
+    concat_path(temp_dir, STEP2_JOURNAL, journal_path);
+    intermediate_path(temp_dir, STEP1_OUTPUT, step1_path);
+    FILE *journal = fopen(journal_path, "w");
+    if (journal == NULL || stat(step1_path, &sb) == -1) {
+        perror("Could not create the progress journal");
+        if (journal != NULL) fclose(journal);
+        clear_work_list(list);
+        return NULL;
+    }
+    fprintf(journal, "step2_journal %lld %u\n", (long long) sb.st_size, FILES_PER_BATCH);
+    fclose(journal);
+    return list;
+}
+
+/*!
+ * @brief make_appended_work_list splits the lines appended to step1_output after a completed files analysis into
+ * batches (watch mode). Their records are appended to step2_output by commit_batch as usual.
+ * @param temp_dir the temporary directory
+ * @param start the size of step1_output before the lines were appended
+ * @param first_file the number of lines of step1_output before the lines were appended
+ * @return a malloc'ed work list, NULL on error
+ */
+work_list_t *make_appended_work_list(char *temp_dir, off_t start, uint64_t first_file) {
+    work_list_t *list = calloc(1, sizeof(work_list_t));
+    if (list == NULL) return NULL;
+    if (!split_batches(temp_dir, list, start, first_file) ||
+        (list->done = calloc(list->batch_count + 1, sizeof(bool))) == NULL) {
+        clear_work_list(list);
+        return NULL;
+    }
+    return list;
+}
+
+/*!
+ * @brief next_pending_batch hands out the next batch that was not committed by a previous run, and reads ahead the
+ * following ones if the list has a prefetcher
+ * @param list the work list
+ * @param batch the batch to fill
+ * @return true if a batch was found, false when all batches were handed out
+ */
+bool next_pending_batch(work_list_t *list, file_batch_t *batch) {
+    while (list->next < list->batch_count && list->done[list->next]) list->next++;
+    if (list->next == list->batch_count) return false;
+    *batch = list->batches[list->next++];
+    if (list->prefetcher != NULL) prefetch_batches(list->prefetcher);
+    return true;
+}
+
+/*!
+ * @brief clear_work_list releases a work list
+ * @param list the list to release
+ */
+void clear_work_list(work_list_t *list) {
+    if (list == NULL) return;
+    clear_prefetcher(list->prefetcher);
+    free(list->batches);
+    free(list->done);
+    free(list);
+}
+
+/*!
+ * @brief trim_journal_tail removes what was written after the last complete group of the journal (a partial group
+ * in the journal and the records of an interrupted commit in step2_output), as load_journal does, and gives each
+ * complete group to a visitor. The header is not checked: in watch mode, step1_output grew since it was written.
+ * @param journal_path the path to the journal
+ * @param step2_fd step2_output, locked by the caller
+ * @param visit the visitor of the complete groups (@see scan_journal), NULL for none
+ * @param context the context of the visitor
+ * @return true on success, false else
+ */
+static bool trim_journal_tail(char *journal_path, int step2_fd, bool (*visit)(uint64_t *, uint32_t, void *),
+                              void *context) {
+    off_t journal_end, step2_end;
+    FILE *journal = fopen(journal_path, "r");
+    bool success = journal != NULL && fscanf(journal, "%*[^\n]\n") == 0 &&
+                   scan_journal(journal, visit, context, &journal_end, &step2_end);
+    if (journal != NULL) fclose(journal);
+    if (success && (truncate(journal_path, journal_end) == -1 || ftruncate(step2_fd, step2_end) == -1)) {
+        perror("Could not trim the interrupted commit");
+        success = false;
+    }
+    return success;
+}
+
+/*!
+ * @brief last_group_end reads the last line of the journal, to tell cheaply if the journal ends with a complete group
+ * @param journal_path the path to the journal
+ * @param step2_end the resulting size of the committed part of step2_output
+ * @return true if the journal ends with a complete group or with its header, false if it must be trimmed (or could
+ * not be read)
+ */
+static bool last_group_end(char *journal_path, off_t *step2_end) {
+    int journal_fd = open(journal_path, O_RDONLY);
+    if (journal_fd == -1) return false;
+    // Journal lines (header included) are shorter than 64 bytes
+    char tail[64];
+    off_t size = lseek(journal_fd, 0, SEEK_END);
+    off_t start = size > (off_t) sizeof(tail) ? size - (off_t) sizeof(tail) : 0;
+    ssize_t length = pread(journal_fd, tail, size - start, start);
+    close(journal_fd);
+    if (length <= 0 || length != size - start || tail[length - 1] != '\n') return false;
+    tail[length - 1] = '\0';
+    char *line = strrchr(tail, '\n');
+    if (line == NULL) {
+        if (start > 0) return false;
+        *step2_end = 0; // The header alone
+        return strncmp(tail, "step2_journal ", 14) == 0;
+    }
+    unsigned long long first_file;
+    unsigned file_count;
+    long long end;
+    char extra;
+    if (sscanf(line + 1, "%llu %u %lld%c", &first_file, &file_count, &end, &extra) != 3) return false;
+    *step2_end = end;
+    return true;
+}
+
+#ifdef A22_TEST_HOOKS
+/*!
+ * @brief crash_in_commit_if_requested is a test hook, only compiled in the test build (A22_TEST_HOOKS): when
+ * A22_CRASH_IN_COMMIT is set, the first worker committing batches is killed, once per temporary directory, after
+ * writing its records to step2_output and before journaling them
+ * @param temp_dir the temporary directory
+ */
+static void crash_in_commit_if_requested(char *temp_dir) {
+    if (getenv("A22_CRASH_IN_COMMIT") == NULL) return;
+    char marker[STR_MAX_LEN];
+    if (concat_path(temp_dir, "commit_crash_injected", marker) == NULL) return;
+    int marker_fd = open(marker, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (marker_fd == -1) return; // A worker already crashed
+    close(marker_fd);
+    raise(SIGKILL);
+}
+#endif
+
+/*!
+ * @brief commit_batches appends the records of a group of batches to step2_output, then records the batches in the
+ * journal, both under the lock of step2_output (called by workers). The journal lines of the group are written at
+ * once, and only its last line gives the end offset of the records: a partially written group is not resumed. What
+ * a worker that died during its commit wrote after the last complete group is removed first.
+ * @param temp_dir the temporary directory
+ * @param batches the analyzed batches
+ * @param count the number of batches (at most MAX_HELD_BATCHES)
+ * @param records the records of the batches (lines of step2_output)
+ * @param length the length of records
+ * @return true if the batches were committed, false else
+ */
+bool commit_batches(char *temp_dir, file_batch_t *batches, uint32_t count, char *records, size_t length) {
+    char step2_path[STR_MAX_LEN], journal_path[STR_MAX_LEN];
+    intermediate_path(temp_dir, STEP2_OUTPUT, step2_path);
+    concat_path(temp_dir, STEP2_JOURNAL, journal_path);
+    int step2_fd = open(step2_path, O_WRONLY | O_APPEND);
+    if (step2_fd == -1) return false;
+    flock(step2_fd, LOCK_EX);
+    off_t step2_end;
+    bool success;
+    if (last_group_end(journal_path, &step2_end)) {
+        success = lseek(step2_fd, 0, SEEK_END) == step2_end || ftruncate(step2_fd, step2_end) == 0;
+    } else {
+        success = trim_journal_tail(journal_path, step2_fd, NULL, NULL);
+    }
+    success = success && write_all(step2_fd, records, length);
+#ifdef A22_TEST_HOOKS
+    crash_in_commit_if_requested(temp_dir);
+#endif
+    if (success && durability_at_least(DURABILITY_FULL)) success = fdatasync(step2_fd) == 0;
+    if (success) {
+        int journal_fd = open(journal_path, O_WRONLY | O_APPEND);
+        // At most 3 numbers of 20 digits and 3 separators per line
+        char *entries = malloc((size_t) count * 64);
+        size_t entries_length = 0;
+        for (uint32_t i = 0; entries != NULL && i < count; i++) {
+            entries_length += sprintf(entries + entries_length, "%llu %u ",
+                                      (unsigned long long) batches[i].first_file, batches[i].file_count);
+            if (i + 1 < count) {
+                entries_length += sprintf(entries + entries_length, "+\n");
+            } else {
+                entries_length += sprintf(entries + entries_length, "%lld\n",
+                                          (long long) lseek(step2_fd, 0, SEEK_END));
+            }
+        }
+        success = journal_fd != -1 && entries != NULL && write_all(journal_fd, entries, entries_length);
+        if (success && durability_at_least(DURABILITY_FULL)) success = fdatasync(journal_fd) == 0;
+        if (journal_fd != -1) close(journal_fd);
+        free(entries);
+    }
+    flock(step2_fd, LOCK_UN);
+    close(step2_fd);
+    return success;
+}
+
+/*!
+ * @brief commit_batch appends the records of a batch to step2_output, then records the batch in the journal
+ * (@see commit_batches)
+ * @param temp_dir the temporary directory
+ * @param batch the analyzed batch
+ * @param records the records of the batch (lines of step2_output)
+ * @param length the length of records
+ * @return true if the batch was committed, false else
+ */
+bool commit_batch(char *temp_dir, file_batch_t *batch, char *records, size_t length) {
+    return commit_batches(temp_dir, batch, 1, records, length);
+}
+
+// Batches of a dead worker, looked for in the journal by trim_interrupted_commit
+typedef struct {
+    file_batch_t *batches;
+    uint32_t count;
+    bool *committed;
+} worker_batches_t;
+
+/*!
+ * @brief flag_committed_group is the journal visitor of trim_interrupted_commit: it flags the batches of the dead
+ * worker found in a group
+ * @param group the first files of the batches of the group
+ * @param size the number of batches of the group
+ * @param context the worker_batches_t of the dead worker
+ * @return true (the whole journal is read)
+ */
+static bool flag_committed_group(uint64_t *group, uint32_t size, void *context) {
+    worker_batches_t *worker = (worker_batches_t *) context;
+    for (uint32_t i = 0; i < size; i++) {
+        for (uint32_t j = 0; j < worker->count; j++) {
+            if (worker->batches[j].first_file == group[i]) worker->committed[j] = true;
+        }
+    }
+    return true;
+}
+
+/*!
+ * @brief trim_interrupted_commit is called by the orchestrator when a worker holding batches dies, before its batches
+ * are dispatched again: under the lock of step2_output, it removes what the worker wrote after the last complete
+ * group of the journal (it died during commit_batches), and tells which of its batches it committed before dying
+ * @param temp_dir the temporary directory
+ * @param batches the batches of the dead worker
+ * @param count the number of batches
+ * @param committed set to true for each batch found in the journal (count long)
+ * @return true on success, false else
+ */
+bool trim_interrupted_commit(char *temp_dir, file_batch_t *batches, uint32_t count, bool *committed) {
+    char journal_path[STR_MAX_LEN], step2_path[STR_MAX_LEN];
+    concat_path(temp_dir, STEP2_JOURNAL, journal_path);
+    intermediate_path(temp_dir, STEP2_OUTPUT, step2_path);
+    int step2_fd = open(step2_path, O_WRONLY);
+    if (step2_fd == -1) return false;
+    flock(step2_fd, LOCK_EX);
+    worker_batches_t worker = {batches, count, committed};
+    bool success = trim_journal_tail(journal_path, step2_fd, flag_committed_group, &worker);
+    flock(step2_fd, LOCK_UN);
+    close(step2_fd);
+    return success;
+}
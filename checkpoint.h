@@ -0,0 +1,43 @@
+#ifndef A2022_CHECKPOINT_H
+#define A2022_CHECKPOINT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Name of the progress journal of the files analysis, next to step2_output in the temporary directory
+#define STEP2_JOURNAL "step2_journal"
+// Number of files of step1_output handed out at once to a worker
+#define FILES_PER_BATCH 32
+// A pool worker combines the records of its batches until it holds this many of them, then commits them at once
+#define MAX_HELD_BATCHES 256
+
+// A batch of consecutive files of step1_output
+typedef struct {
+    uint64_t first_file; // Index of the first file in step1_output
+    uint32_t file_count;
+    off_t start; // Byte range of the batch in step1_output
+    off_t end;
+} file_batch_t;
+
+// The batches of the files analysis, and those already committed by a previous run
+typedef struct {
+    file_batch_t *batches;
+    uint64_t batch_count;
+    uint64_t next; // Next batch to hand out
+    bool *done;
+    uint64_t done_count;
+    struct _prefetcher *prefetcher; // Reads ahead the e-mails of the next batches, NULL for none (see prefetch.h)
+} work_list_t;
+
+bool can_resume(char *temp_dir);
+work_list_t *make_work_list(char *temp_dir, bool resume);
+work_list_t *make_appended_work_list(char *temp_dir, off_t start, uint64_t first_file);
+bool next_pending_batch(work_list_t *list, file_batch_t *batch);
+void clear_work_list(work_list_t *list);
+bool commit_batch(char *temp_dir, file_batch_t *batch, char *records, size_t length);
+bool commit_batches(char *temp_dir, file_batch_t *batches, uint32_t count, char *records, size_t length);
+bool trim_interrupted_commit(char *temp_dir, file_batch_t *batches, uint32_t count, bool *committed);
+
+#endif //A2022_CHECKPOINT_H
@@ -0,0 +1,171 @@
+#include "combiner.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global_defs.h"
+
+/*!
+ * @brief make_combiner_tables allocates the empty indexes of a combiner, in its arena
+ * @param combiner the combiner
+ * @return true on success, false if memory is exhausted
+ */
+static bool make_combiner_tables(combiner_t *combiner) {
+    combiner->senders = make_hash_table(256);
+    combiner->pairs = make_hash_table(1024);
+    combiner->head = NULL;
+    combiner->tail = NULL;
+    if (combiner->senders == NULL || combiner->pairs == NULL) return false;
+    combiner->senders->arena = &combiner->arena;
+    combiner->pairs->arena = &combiner->arena;
+    return true;
+}
+
+/*!
+ * @brief release_combiner_tables releases the indexes and records of a combiner (the arena keeps a block)
+ * @param combiner the combiner
+ */
+static void release_combiner_tables(combiner_t *combiner) {
+    if (combiner->senders != NULL) clear_hash_table(combiner->senders, NULL);
+    if (combiner->pairs != NULL) clear_hash_table(combiner->pairs, NULL);
+    combiner->senders = NULL;
+    combiner->pairs = NULL;
+    rewind_arena(&combiner->arena);
+}
+
+/*!
+ * @brief init_combiner prepares an empty combiner
+ * @param combiner the combiner to initialize
+ * @param output the file receiving the combined records
+ * @return true on success, false if memory is exhausted
+ */
+bool init_combiner(combiner_t *combiner, FILE *output) {
+    init_arena(&combiner->arena);
+    combiner->output = output;
+    combiner->records = 0;
+    combiner->lines = 0;
+    if (!make_combiner_tables(combiner)) {
+        clear_combiner(combiner);
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief combine_sender counts a record of a sender. The combiner is flushed first if it holds COMBINER_MAX_PAIRS
+ * pairs, so that a record is never split over two flushes.
+ * @param combiner the combiner
+ * @param key the sender, after the time bucket of the record if any
+ * @return the combined sender to add the recipients of the record to, NULL on error
+ */
+combined_sender_t *combine_sender(combiner_t *combiner, const char *key) {
+    if (combiner->pairs->size >= COMBINER_MAX_PAIRS && !flush_combiner(combiner)) return NULL;
+    hash_entry_t *entry = hash_table_find(combiner->senders, key, true);
+    if (entry == NULL) return NULL;
+    if (entry->value == NULL) {
+        combined_sender_t *sender = arena_alloc(&combiner->arena, sizeof(combined_sender_t));
+        if (sender == NULL) return NULL;
+        *sender = (combined_sender_t) {.key = entry->key, .mails = 0, .head = NULL, .tail = NULL, .next = NULL};
+        if (combiner->tail == NULL) {
+            combiner->head = sender;
+        } else {
+            combiner->tail->next = sender;
+        }
+        combiner->tail = sender;
+        entry->value = sender;
+    }
+    combiner->records++;
+    combined_sender_t *sender = entry->value;
+    sender->mails++;
+    return sender;
+}
+
+/*!
+ * @brief combine_recipient counts an occurrence of a recipient of a sender
+ * @param combiner the combiner
+ * @param sender the combined sender, as returned by combine_sender for the current record
+ * @param address the recipient
+ * @return true on success, false if memory is exhausted
+ */
+bool combine_recipient(combiner_t *combiner, combined_sender_t *sender, const char *address) {
+    char pair[2 * STR_MAX_LEN + 16];
+    snprintf(pair, sizeof(pair), "%s %s", sender->key, address);
+    hash_entry_t *entry = hash_table_find(combiner->pairs, pair, true);
+    if (entry == NULL) return false;
+    if (entry->value == NULL) {
+        combined_recipient_t *recipient = arena_alloc(&combiner->arena, sizeof(combined_recipient_t));
+        if (recipient == NULL) return false;
+        *recipient = (combined_recipient_t) {.address = entry->key + strlen(sender->key) + 1, .count = 0,
+                                             .next = NULL};
+        if (sender->tail == NULL) {
+            sender->head = recipient;
+        } else {
+            sender->tail->next = recipient;
+        }
+        sender->tail = recipient;
+        entry->value = recipient;
+    }
+    ((combined_recipient_t *) entry->value)->count++;
+    return true;
+}
+
+/*!
+ * @brief write_weighted writes a token of a combined line, with its count if it is not 1
+ * @param output the file to write to
+ * @param count the count
+ * @param token the token
+ */
+static void write_weighted(FILE *output, uint32_t count, const char *token) {
+    if (count != 1) fprintf(output, "%u%c", count, WEIGHT_SEPARATOR);
+    fputs(token, output);
+}
+
+/*!
+ * @brief flush_combiner writes the combined records, one line per sender in order of first record, then empties the
+ * combiner
+ * @param combiner the combiner
+ * @return true if the lines were written, false else
+ */
+bool flush_combiner(combiner_t *combiner) {
+    for (combined_sender_t *sender = combiner->head; sender != NULL; sender = sender->next) {
+        // The time bucket, if any, stays in front of the weighted sender
+        const char *address = strchr(sender->key, ' ');
+        address = address != NULL ? address + 1 : sender->key;
+        fwrite(sender->key, 1, address - sender->key, combiner->output);
+        write_weighted(combiner->output, sender->mails, address);
+        for (combined_recipient_t *recipient = sender->head; recipient != NULL; recipient = recipient->next) {
+            fputc(' ', combiner->output);
+            write_weighted(combiner->output, recipient->count, recipient->address);
+        }
+        fputc('\n', combiner->output);
+        combiner->lines++;
+    }
+    release_combiner_tables(combiner);
+    return make_combiner_tables(combiner) && !ferror(combiner->output);
+}
+
+/*!
+ * @brief clear_combiner releases a combiner, without flushing it
+ * @param combiner the combiner
+ */
+void clear_combiner(combiner_t *combiner) {
+    release_combiner_tables(combiner);
+    clear_arena(&combiner->arena);
+}
+
+/*!
+ * @brief split_weight reads a token of step2_output: "address", or "count,address" for a combined token
+ * @param token the token
+ * @param weight set to the count, 1 for a token without count
+ * @return the address in token
+ */
+char *split_weight(char *token, uint32_t *weight) {
+    *weight = 1;
+    if (!isdigit((unsigned char) *token)) return token;
+    char *end;
+    unsigned long count = strtoul(token, &end, 10);
+    if (*end != WEIGHT_SEPARATOR || count == 0 || count > UINT32_MAX) return token;
+    *weight = (uint32_t) count;
+    return end + 1;
+}
@@ -0,0 +1,56 @@
+#ifndef A2022_COMBINER_H
+#define A2022_COMBINER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "arena.h"
+#include "hash_table.h"
+
+// A combiner is flushed once it holds this many distinct sender/recipient pairs
+#define COMBINER_MAX_PAIRS 65536
+// Separates a count from an address in a combined token: it is never part of an extracted address (see tokenizer.c)
+#define WEIGHT_SEPARATOR ','
+
+typedef struct _combined_recipient {
+    char *address;
+    uint32_t count;
+    struct _combined_recipient *next;
+} combined_recipient_t;
+
+typedef struct _combined_sender {
+    char *key; // The sender, after the time bucket of its records if any
+    uint32_t mails;
+    combined_recipient_t *head;
+    combined_recipient_t *tail;
+    struct _combined_sender *next;
+} combined_sender_t;
+
+/*
+ * Map side combiner of the records of step2_output: the records of a worker task are added up by sender and by
+ * sender/recipient pair before they are written, so that a pair seen in several e-mails is written once with its
+ * count. A combined line is "[bucket ]sender r1 r2 ..." where the sender and each recipient may be prefixed by a count
+ * and WEIGHT_SEPARATOR ("3,alice@enron.com"): the number of e-mails of the line for the sender, the occurrences of the
+ * pair for a recipient. Tokens without a count weigh 1, so a single record is written as before.
+ */
+typedef struct {
+    arena_t arena;
+    hash_table_t *senders; // key -> combined_sender_t
+    hash_table_t *pairs; // "key recipient" -> combined_recipient_t
+    combined_sender_t *head; // Senders in order of first record
+    combined_sender_t *tail;
+    FILE *output;
+    uint64_t records; // Records combined since the combiner was initialized
+    uint64_t lines; // Lines written since the combiner was initialized
+} combiner_t;
+
+bool init_combiner(combiner_t *combiner, FILE *output);
+combined_sender_t *combine_sender(combiner_t *combiner, const char *key);
+bool combine_recipient(combiner_t *combiner, combined_sender_t *sender, const char *address);
+bool flush_combiner(combiner_t *combiner);
+void clear_combiner(combiner_t *combiner);
+
+char *split_weight(char *token, uint32_t *weight);
+
+#endif //A2022_COMBINER_H
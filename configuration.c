@@ -9,9 +9,112 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <inttypes.h>
 
 #include "utility.h"
 
+// Long only options (values out of the char range to avoid clashing with short options)
+enum {
+    OPT_TOP_K = 256,
+    OPT_APPROX_STATS,
+    OPT_DEDUP,
+    OPT_REDUCE_MEMORY_LIMIT,
+    OPT_INTERMEDIATES,
+    OPT_DURABILITY,
+    OPT_RESUME,
+    OPT_COORDINATOR,
+    OPT_WORKER,
+    OPT_HUGE_PAGES,
+    OPT_SERVE,
+    OPT_WATCH,
+    OPT_GRAPH_METRICS,
+    OPT_FILTER,
+    OPT_TIME_BUCKETS,
+    OPT_PREFETCH_BUDGET,
+    OPT_LOCALITY_ORDER,
+    OPT_TRACE,
+};
+
+static struct option long_options[] = {
+        {"top-k", required_argument, NULL, OPT_TOP_K},
+        {"approx-stats", no_argument, NULL, OPT_APPROX_STATS},
+        {"dedup", no_argument, NULL, OPT_DEDUP},
+        {"reduce-memory-limit", required_argument, NULL, OPT_REDUCE_MEMORY_LIMIT},
+        {"intermediates", required_argument, NULL, OPT_INTERMEDIATES},
+        {"durability", required_argument, NULL, OPT_DURABILITY},
+        {"resume", no_argument, NULL, OPT_RESUME},
+        {"coordinator", required_argument, NULL, OPT_COORDINATOR},
+        {"worker", required_argument, NULL, OPT_WORKER},
+        {"huge-pages", required_argument, NULL, OPT_HUGE_PAGES},
+        {"serve", required_argument, NULL, OPT_SERVE},
+        {"watch", required_argument, NULL, OPT_WATCH},
+        {"graph-metrics", required_argument, NULL, OPT_GRAPH_METRICS},
+        {"filter", required_argument, NULL, OPT_FILTER},
+        {"time-buckets", required_argument, NULL, OPT_TIME_BUCKETS},
+        {"prefetch-budget", required_argument, NULL, OPT_PREFETCH_BUDGET},
+        {"locality-order", no_argument, NULL, OPT_LOCALITY_ORDER},
+        {"trace", required_argument, NULL, OPT_TRACE},
+        {NULL, 0, NULL, 0}
+};
+
+/*!
+ * @brief parse_memory_size reads a size in bytes, optionally followed by a K, M or G (binary) unit
+ * @param value the size as a string, e.g. 512M
+ * @return the size in bytes, 0 if value is not a size
+ */
+static uint64_t parse_memory_size(char *value) {
+    char *unit;
+    uint64_t size = strtoull(value, &unit, 10);
+    switch (toupper(*unit)) {
+        case 'G':
+            size <<= 10; // fall through
+        case 'M':
+            size <<= 10; // fall through
+        case 'K':
+            size <<= 10; // fall through
+        case '\0':
+            return size;
+        default:
+            return 0;
+    }
+}
+
+/*!
+ * @brief append_filter adds a filter term to the filters of a configuration (terms of the configuration file and of the
+ * command line all apply, @see filter.h)
+ * @param configuration the configuration
+ * @param term the "kind:value" term
+ */
+static void append_filter(configuration_t *configuration, char *term) {
+    size_t length = strlen(configuration->filters);
+    if (length + strlen(term) + 2 > STR_MAX_LEN) {
+        fprintf(stderr, "Too many filters, %s is ignored\n", term);
+        return;
+    }
+    snprintf(configuration->filters + length, STR_MAX_LEN - length, "%s%s", length > 0 ? " " : "", term);
+}
+
+static char *intermediates_names[] = {[INTERMEDIATES_FILES] = "files", [INTERMEDIATES_MEMORY] = "memory"};
+static char *durability_names[] = {[DURABILITY_NONE] = "none", [DURABILITY_PHASE] = "phase", [DURABILITY_FULL] = "full"};
+static char *huge_pages_names[] = {[ARENA_PAGES_DEFAULT] = "none", [ARENA_PAGES_THP] = "thp",
+                                   [ARENA_PAGES_HUGETLB] = "hugetlb"};
+static char *time_buckets_names[] = {[TIME_BUCKETS_NONE] = "none", [TIME_BUCKETS_WEEK] = "week",
+                                     [TIME_BUCKETS_MONTH] = "month"};
+
+/*!
+ * @brief parse_name finds a value in a list of names (the index of a name is the matching enum value)
+ * @param value the value to look for
+ * @param names the names of the enum values
+ * @param count the number of names
+ * @return the index of value in names, -1 if not found
+ */
+static int parse_name(char *value, char *names[], int count) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(value, names[i]) == 0) return i;
+    }
+    return -1;
+}
+
 /*!
  * @brief make_configuration makes the configuration from the program parameters. CLI parameters are applied after
  * file parameters. You shall keep two configuration sets: one with the default values updated by file reading (if
@@ -23,8 +126,8 @@
  */
 configuration_t *make_configuration(configuration_t *base_configuration, char *argv[], int argc) {
     // 1. Read CLI parameters
-    int opt;
-    while ((opt = getopt(argc, argv, "d:o:t:vn")) != -1) {
+    int opt, value;
+    while ((opt = getopt_long(argc, argv, "d:o:t:vn", long_options, NULL)) != -1) {
         switch (opt) {
             case 'd':
 		strcpy(base_configuration->data_path,optarg);
@@ -41,8 +144,89 @@ configuration_t *make_configuration(configuration_t *base_configuration, char *a
 	    case 'n':
                 base_configuration->process_count = atoi(optarg);
                 break;
+            case OPT_TOP_K:
+                base_configuration->top_k = strtoul(optarg, NULL, 10);
+                break;
+            case OPT_APPROX_STATS:
+                base_configuration->approx_stats = true;
+                break;
+            case OPT_DEDUP:
+                base_configuration->dedup = true;
+                break;
+            case OPT_REDUCE_MEMORY_LIMIT:
+                base_configuration->reduce_memory_limit = parse_memory_size(optarg);
+                break;
+            case OPT_INTERMEDIATES:
+                value = parse_name(optarg, intermediates_names, 2);
+                if (value == -1) {
+                    fprintf(stderr, "Unknown intermediates mode %s (files or memory)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                base_configuration->intermediates = value;
+                break;
+            case OPT_DURABILITY:
+                value = parse_name(optarg, durability_names, 3);
+                if (value == -1) {
+                    fprintf(stderr, "Unknown durability level %s (none, phase or full)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                base_configuration->durability = value;
+                break;
+            case OPT_RESUME:
+                base_configuration->resume = true;
+                break;
+            case OPT_COORDINATOR:
+                base_configuration->coordinator_port = strtoul(optarg, NULL, 10);
+                break;
+            case OPT_WORKER:
+                strncpy(base_configuration->coordinator_address, optarg, STR_MAX_LEN - 1);
+                break;
+            case OPT_HUGE_PAGES:
+                value = parse_name(optarg, huge_pages_names, 3);
+                if (value == -1) {
+                    fprintf(stderr, "Unknown huge pages mode %s (none, thp or hugetlb)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                base_configuration->huge_pages = value;
+                break;
+            case OPT_SERVE:
+                strncpy(base_configuration->query_socket, optarg, STR_MAX_LEN - 1);
+                break;
+            case OPT_WATCH:
+                base_configuration->watch_interval = strtoul(optarg, NULL, 10);
+                break;
+            case OPT_GRAPH_METRICS:
+                strncpy(base_configuration->metrics_file, optarg, STR_MAX_LEN - 1);
+                break;
+            case OPT_FILTER:
+                append_filter(base_configuration, optarg);
+                break;
+            case OPT_TIME_BUCKETS:
+                value = parse_name(optarg, time_buckets_names, 3);
+                if (value == -1) {
+                    fprintf(stderr, "Unknown time buckets %s (none, week or month)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                base_configuration->time_buckets = value;
+                break;
+            case OPT_PREFETCH_BUDGET:
+                base_configuration->prefetch_budget = parse_memory_size(optarg);
+                break;
+            case OPT_LOCALITY_ORDER:
+                base_configuration->locality_order = true;
+                break;
+            case OPT_TRACE:
+                strncpy(base_configuration->trace_file, optarg, STR_MAX_LEN - 1);
+                break;
             default:
-                fprintf(stderr, "Usage: %s [-c config_file] [-v]\n", argv[0]);
+                fprintf(stderr, "Usage: %s [-c config_file] [-v] [--top-k N] [--approx-stats] [--dedup]"
+                                " [--reduce-memory-limit SIZE] [--intermediates files|memory]"
+                                " [--durability none|phase|full] [--resume] [--coordinator PORT]"
+                                " [--worker HOST:PORT] [--huge-pages none|thp|hugetlb] [--serve SOCKET]"
+                                " [--watch SECONDS] [--graph-metrics FILE]"
+                                " [--filter KIND:VALUE]... [--time-buckets none|week|month]"
+                                " [--prefetch-budget SIZE] [--locality-order] [--trace FILE]\n",
+                        argv[0]);
                 exit(EXIT_FAILURE);
         }
     }
@@ -144,6 +328,42 @@ configuration_t *read_cfg_file(configuration_t *base_configuration, char *path_t
                 base_configuration->cpu_core_multiplier = atoi(value);
             } else if (strcmp(key, "process_count") == 0) {
                 base_configuration->process_count = atoi(value);
+            } else if (strcmp(key, "top_k") == 0) {
+                base_configuration->top_k = strtoul(value, NULL, 10);
+            } else if (strcmp(key, "approx_stats") == 0) {
+                base_configuration->approx_stats = (strcmp(value, "true") == 0);
+            } else if (strcmp(key, "dedup") == 0) {
+                base_configuration->dedup = (strcmp(value, "true") == 0);
+            } else if (strcmp(key, "reduce_memory_limit") == 0) {
+                base_configuration->reduce_memory_limit = parse_memory_size(value);
+            } else if (strcmp(key, "intermediates") == 0 && parse_name(value, intermediates_names, 2) != -1) {
+                base_configuration->intermediates = parse_name(value, intermediates_names, 2);
+            } else if (strcmp(key, "durability") == 0 && parse_name(value, durability_names, 3) != -1) {
+                base_configuration->durability = parse_name(value, durability_names, 3);
+            } else if (strcmp(key, "resume") == 0) {
+                base_configuration->resume = (strcmp(value, "true") == 0);
+            } else if (strcmp(key, "coordinator_port") == 0) {
+                base_configuration->coordinator_port = strtoul(value, NULL, 10);
+            } else if (strcmp(key, "coordinator_address") == 0) {
+                strncpy(base_configuration->coordinator_address, value, STR_MAX_LEN - 1);
+            } else if (strcmp(key, "huge_pages") == 0 && parse_name(value, huge_pages_names, 3) != -1) {
+                base_configuration->huge_pages = parse_name(value, huge_pages_names, 3);
+            } else if (strcmp(key, "query_socket") == 0) {
+                strncpy(base_configuration->query_socket, value, STR_MAX_LEN - 1);
+            } else if (strcmp(key, "watch_interval") == 0) {
+                base_configuration->watch_interval = strtoul(value, NULL, 10);
+            } else if (strcmp(key, "metrics_file") == 0) {
+                strncpy(base_configuration->metrics_file, value, STR_MAX_LEN - 1);
+            } else if (strcmp(key, "filter") == 0) {
+                append_filter(base_configuration, value);
+            } else if (strcmp(key, "time_buckets") == 0 && parse_name(value, time_buckets_names, 3) != -1) {
+                base_configuration->time_buckets = parse_name(value, time_buckets_names, 3);
+            } else if (strcmp(key, "prefetch_budget") == 0) {
+                base_configuration->prefetch_budget = parse_memory_size(value);
+            } else if (strcmp(key, "locality_order") == 0) {
+                base_configuration->locality_order = (strcmp(value, "true") == 0);
+            } else if (strcmp(key, "trace_file") == 0) {
+                strncpy(base_configuration->trace_file, value, STR_MAX_LEN - 1);
             }
         }
     }
@@ -163,6 +383,59 @@ void display_configuration(configuration_t *configuration) {
     printf("\tVerbose mode is %s\n", configuration->is_verbose?"on":"off");
     printf("\tCPU multiplier is %d\n", configuration->cpu_core_multiplier);
     printf("\tProcess count is %d\n", configuration->process_count);
+    if (configuration->top_k > 0) {
+        printf("\tTop-k mode: %u heavy hitters\n", configuration->top_k);
+    } else {
+        printf("\tTop-k mode is off\n");
+    }
+    printf("\tApproximate statistics mode is %s\n", configuration->approx_stats?"on":"off");
+    printf("\tMessage-ID dedup is %s\n", configuration->dedup?"on":"off");
+    if (configuration->reduce_memory_limit > 0) {
+        printf("\tReducer memory limit: %" PRIu64 " bytes\n", configuration->reduce_memory_limit);
+    } else {
+        printf("\tReducer memory limit is off\n");
+    }
+    printf("\tIntermediate results are kept in %s\n", intermediates_names[configuration->intermediates]);
+    printf("\tDurability level is %s\n", durability_names[configuration->durability]);
+    printf("\tResume mode is %s\n", configuration->resume?"on":"off");
+    if (configuration->coordinator_port > 0) {
+        printf("\tFiles analysis served to remote workers on port %u\n", configuration->coordinator_port);
+    } else {
+        printf("\tCoordinator mode is off\n");
+    }
+    printf("\tHuge pages for arenas: %s\n", huge_pages_names[configuration->huge_pages]);
+    if (configuration->watch_interval > 0) {
+        printf("\tWatch mode: output rewritten every %u s\n", configuration->watch_interval);
+    } else {
+        printf("\tWatch mode is off\n");
+    }
+    if (configuration->filters[0] != '\0') {
+        printf("\tFilters: %s\n", configuration->filters);
+    } else {
+        printf("\tFilters are off\n");
+    }
+    if (configuration->metrics_file[0] != '\0') {
+        printf("\tGraph metrics written to %s\n", configuration->metrics_file);
+    } else {
+        printf("\tGraph metrics are off\n");
+    }
+    if (configuration->time_buckets != TIME_BUCKETS_NONE) {
+        printf("\tCounts per %s written to %s.buckets\n", time_buckets_names[configuration->time_buckets],
+               configuration->output_file);
+    } else {
+        printf("\tTime buckets are off\n");
+    }
+    if (configuration->prefetch_budget > 0) {
+        printf("\tRead-ahead budget: %" PRIu64 " bytes\n", configuration->prefetch_budget);
+    } else {
+        printf("\tRead-ahead is off\n");
+    }
+    printf("\tPhysical locality order of the files is %s\n", configuration->locality_order?"on":"off");
+    if (configuration->trace_file[0] != '\0') {
+        printf("\tTimeline of the tasks written to %s\n", configuration->trace_file);
+    } else {
+        printf("\tTrace is off\n");
+    }
     printf("End configuration\n");
 }
 
@@ -9,6 +9,9 @@
 #include <stdint.h>
 
 #include "global_defs.h"
+#include "intermediates.h"
+#include "arena.h"
+#include "mail_date.h"
 
 typedef struct {
     char data_path[STR_MAX_LEN];
@@ -17,6 +20,24 @@ typedef struct {
     bool is_verbose;
     uint8_t cpu_core_multiplier;
     uint16_t process_count;
+    uint32_t top_k; // 0 for the exact reducer, else number of heavy hitters to report
+    bool approx_stats; // Distinct counts estimations instead of the exact reducer
+    bool dedup; // Skip copies of the same e-mail (same Message-ID) in several folders
+    uint64_t reduce_memory_limit; // Memory budget of the exact reducer in bytes before spilling to disk, 0 for none
+    intermediates_mode_t intermediates; // Intermediate results in the temporary directory or in memory files
+    durability_t durability; // When files are forced to disk
+    bool resume; // Skip the work committed by a previous run (see checkpoint.h)
+    uint16_t coordinator_port; // Serve the files analysis to remote workers on this TCP port, 0 to analyze locally
+    char coordinator_address[STR_MAX_LEN]; // host:port of a coordinator to run as its remote worker, empty else
+    arena_pages_t huge_pages; // Pages backing the arenas of the mapper and of the exact reducer
+    char query_socket[STR_MAX_LEN]; // Unix socket of the query daemon on the output file, empty to run the analysis
+    uint32_t watch_interval; // After the analysis, watch the data source and rewrite the output every N s (0: off)
+    char filters[STR_MAX_LEN]; // Filters of the e-mails, evaluated by the mappers (see filter.h), empty for none
+    char metrics_file[STR_MAX_LEN]; // Phase 3: metrics of the communication graph written to this file, empty for none
+    time_buckets_t time_buckets; // Counts per sender, recipient and week or month written to <output_file>.buckets
+    uint64_t prefetch_budget; // Bytes of e-mails read ahead of the files analysis (see prefetch.h), 0 for none
+    bool locality_order; // Sort step1_output by physical location of the files on disk (see locality.h)
+    char trace_file[STR_MAX_LEN]; // Chrome trace-event timeline of the tasks written to this file, empty for none
 } configuration_t;
 
 configuration_t *make_configuration(configuration_t *base_configuration, char *argv[], int argc);
@@ -0,0 +1,164 @@
+#include "dedup.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "global_defs.h"
+#include "utility.h"
+
+// Set attached by the current process (workers attach it on their first lookup)
+static message_id_set_t *attached_set = NULL;
+static size_t attached_size = 0;
+// Owner of the Message-IDs inserted by the current process: batch number + 1 (0 out of a batch) in the high half
+static uint64_t current_batch = 0;
+// Counts of the current process not added to the set yet (@see publish_message_id_counts)
+static uint64_t pending_unique = 0;
+static uint64_t pending_duplicates = 0;
+
+/*!
+ * @brief attach_message_id_set maps the shared Message-ID set of a temporary directory into the current process
+ * @param temp_dir the temporary directory holding the set
+ * @return a pointer to the shared set, NULL if it does not exist
+ */
+static message_id_set_t *attach_message_id_set(char *temp_dir) {
+    if (attached_set != NULL) return attached_set;
+    char path[STR_MAX_LEN];
+    if (concat_path(temp_dir, MESSAGE_ID_SET_NAME, path) == NULL) return NULL;
+    int fd = open(path, O_RDWR);
+    if (fd == -1) return NULL;
+    struct stat sb;
+    if (fstat(fd, &sb) == 0 && sb.st_size > (off_t) sizeof(message_id_set_t)) {
+        void *map = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            attached_set = map;
+            attached_size = sb.st_size;
+        }
+    }
+    close(fd);
+    return attached_set;
+}
+
+/*!
+ * @brief make_message_id_set creates the shared Message-ID set used by the workers to detect copies of the same
+ * e-mail in several folders. It is an open addressing table of 64 bits hashes in a file mapped by all processes,
+ * filled with atomic compare-and-swap so that no lock is needed. Each hash is stored with its owner, so that a batch
+ * run again after its worker crashed does not take the Message-IDs of its previous run for duplicates.
+ * @param temp_dir the temporary directory where to create the set
+ * @param expected_ids the number of e-mails to analyze (the set has at least twice as many slots)
+ * @return true if the set was created, false else
+ */
+bool make_message_id_set(char *temp_dir, uint64_t expected_ids) {
+    char path[STR_MAX_LEN];
+    if (temp_dir == NULL || concat_path(temp_dir, MESSAGE_ID_SET_NAME, path) == NULL) return false;
+    uint64_t slots = 1024;
+    while (slots < 2 * expected_ids) slots <<= 1;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1) return false;
+    message_id_set_t header = {.slots_mask = slots - 1, .unique = 0, .duplicates = 0, .overflows = 0};
+    bool success = ftruncate(fd, sizeof(message_id_set_t) + slots * sizeof(message_id_slot_t)) == 0 &&
+                   write(fd, &header, sizeof(header)) == sizeof(header);
+    close(fd);
+    return success;
+}
+
+/*!
+ * @brief set_message_id_batch sets the batch of step1_output the current process analyzes. The Message-IDs of a batch
+ * are owned by the batch and the process: if the batch is run again by another process (its worker crashed before
+ * committing it), they are not counted as duplicates. The counts of a batch are kept until it is committed.
+ * @param first_file the first file of the batch, UINT64_MAX out of a batch (counts are then added at once)
+ */
+void set_message_id_batch(uint64_t first_file) {
+    current_batch = first_file == UINT64_MAX ? 0 : first_file + 1;
+}
+
+/*!
+ * @brief publish_message_id_counts adds the counts of the committed batches of the current process to the set
+ * @param temp_dir the temporary directory holding the set
+ */
+void publish_message_id_counts(char *temp_dir) {
+    message_id_set_t *set = attach_message_id_set(temp_dir);
+    if (set != NULL) {
+        __atomic_fetch_add(&set->unique, pending_unique, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&set->duplicates, pending_duplicates, __ATOMIC_RELAXED);
+    }
+    pending_unique = 0;
+    pending_duplicates = 0;
+}
+
+/*!
+ * @brief message_id_seen records a Message-ID in the shared set. A Message-ID inserted by the same batch in another
+ * process is taken over: that process crashed and the batch is run again. A Message-ID whose owner is not written yet
+ * (its insertion is in progress) is a duplicate.
+ * @param temp_dir the temporary directory holding the set
+ * @param message_id the Message-ID value
+ * @param length the length of message_id
+ * @return true if the Message-ID was already in the set (the e-mail is a duplicate), false else
+ */
+bool message_id_seen(char *temp_dir, const char *message_id, size_t length) {
+    message_id_set_t *set = attach_message_id_set(temp_dir);
+    if (set == NULL || length == 0) return false;
+    uint64_t hash = hash_bytes(message_id, length);
+    if (hash == 0) hash = 1; // 0 marks empty slots
+    uint64_t owner = (current_batch << 32) | (uint32_t) getpid();
+    bool seen = false;
+    uint64_t slot = hash & set->slots_mask;
+    uint64_t probes;
+    for (probes = 0; probes <= set->slots_mask; probes++) {
+        message_id_slot_t *entry = &set->slots[slot];
+        uint64_t expected = 0;
+        if (__atomic_compare_exchange_n(&entry->hash, &expected, hash, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&entry->owner, owner, __ATOMIC_RELEASE);
+            break;
+        }
+        if (expected == hash) {
+            uint64_t previous = __atomic_load_n(&entry->owner, __ATOMIC_ACQUIRE);
+            seen = current_batch == 0 || previous >> 32 != current_batch || previous == owner ||
+                   !__atomic_compare_exchange_n(&entry->owner, &previous, owner, false, __ATOMIC_ACQ_REL,
+                                                __ATOMIC_ACQUIRE);
+            break;
+        }
+        slot = (slot + 1) & set->slots_mask;
+    }
+    if (probes > set->slots_mask) {
+        __atomic_fetch_add(&set->overflows, 1, __ATOMIC_RELAXED);
+    } else if (seen) {
+        pending_duplicates++;
+    } else {
+        pending_unique++;
+    }
+    if (current_batch == 0) publish_message_id_counts(temp_dir);
+    return seen;
+}
+
+/*!
+ * @brief read_message_id_set_stats reads the counters of the shared Message-ID set
+ * @param temp_dir the temporary directory holding the set
+ * @param stats where to copy the set counters (its slots are not copied)
+ * @return true if the set could be read, false else
+ */
+bool read_message_id_set_stats(char *temp_dir, message_id_set_t *stats) {
+    message_id_set_t *set = attach_message_id_set(temp_dir);
+    if (set == NULL || stats == NULL) return false;
+    stats->slots_mask = set->slots_mask;
+    stats->unique = __atomic_load_n(&set->unique, __ATOMIC_RELAXED);
+    stats->duplicates = __atomic_load_n(&set->duplicates, __ATOMIC_RELAXED);
+    stats->overflows = __atomic_load_n(&set->overflows, __ATOMIC_RELAXED);
+    return true;
+}
+
+/*!
+ * @brief remove_message_id_set detaches and deletes the shared Message-ID set
+ * @param temp_dir the temporary directory holding the set
+ */
+void remove_message_id_set(char *temp_dir) {
+    if (attached_set != NULL) {
+        munmap(attached_set, attached_size);
+        attached_set = NULL;
+    }
+    char path[STR_MAX_LEN];
+    if (concat_path(temp_dir, MESSAGE_ID_SET_NAME, path) != NULL) remove(path);
+}
@@ -0,0 +1,31 @@
+#ifndef A2022_DEDUP_H
+#define A2022_DEDUP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Name of the shared Message-ID set in the temporary directory
+#define MESSAGE_ID_SET_NAME "message_ids"
+
+typedef struct {
+    uint64_t hash;  // 0 when empty, else the (non zero) hash of a Message-ID
+    uint64_t owner; // The batch and the process that inserted the Message-ID (@see set_message_id_batch)
+} message_id_slot_t;
+
+typedef struct {
+    uint64_t slots_mask;
+    uint64_t unique;     // Message-IDs inserted by committed work
+    uint64_t duplicates; // Message-IDs found already present by committed work
+    uint64_t overflows;  // Message-IDs not recorded because the set was full
+    message_id_slot_t slots[];
+} message_id_set_t;
+
+bool make_message_id_set(char *temp_dir, uint64_t expected_ids);
+void set_message_id_batch(uint64_t first_file);
+void publish_message_id_counts(char *temp_dir);
+bool message_id_seen(char *temp_dir, const char *message_id, size_t length);
+bool read_message_id_set_stats(char *temp_dir, message_id_set_t *stats);
+void remove_message_id_set(char *temp_dir);
+
+#endif //A2022_DEDUP_H
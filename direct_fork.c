@@ -14,10 +14,69 @@
 #include <string.h>
 #include "analysis.h"
 #include "utility.h"
+#include "scheduler.h"
+#include "progress.h"
+#include "trace.h"
 
 
 /*!
- * @brief direct_fork_directories runs the directory analysis with direct calls to fork
+ * @brief wait_for_child waits for the end of one of the running processes and records the duration of its task
+ * @param running the pids of the running processes (0 for a free slot)
+ * @param dispatched the dispatch times of the tasks of the running processes
+ * @param nb_proc the number of slots
+ * @param timing the timings of the phase
+ * @return true if a process ended, false if there was no process to wait for
+ */
+static bool wait_for_child(pid_t running[], struct timespec dispatched[], uint16_t nb_proc, phase_timing_t *timing) {
+    uint64_t wait_start = trace_clock();
+    pid_t pid = wait(NULL);
+    trace_span(TRACE_WAIT, wait_start);
+    if (pid == -1) return false;
+    for (uint16_t slot = 0; slot < nb_proc; slot++) {
+        if (running[slot] == pid) {
+            task_finished(timing, &dispatched[slot]);
+            running[slot] = 0;
+        }
+    }
+    return true;
+}
+
+/*!
+ * @brief fork_task runs a task in a new process, after waiting for a free slot
+ * @param task the task, run by the child
+ * @param running the pids of the running processes (0 for a free slot)
+ * @param dispatched the dispatch times of the tasks of the running processes
+ * @param nb_proc the maximum number of simultaneous processes
+ * @param timing the timings of the phase
+ */
+static void fork_task(task_t *task, pid_t running[], struct timespec dispatched[], uint16_t nb_proc,
+                      phase_timing_t *timing) {
+    // if max processes count already run, wait for one to end before starting a task.
+    uint16_t slot;
+    for (slot = 0; slot < nb_proc && running[slot] != 0; slot++);
+    while (slot == nb_proc) {
+        if (!wait_for_child(running, dispatched, nb_proc, timing)) return;
+        for (slot = 0; slot < nb_proc && running[slot] != 0; slot++);
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        set_progress_worker(slot);
+        set_trace_worker(slot);
+        run_traced_task(task);
+        exit(0);
+    } else if (pid > 0) {
+        running[slot] = pid;
+        task_dispatched(timing, &dispatched[slot]);
+        trace_dispatch(task);
+    } else {
+        perror("Error calling fork");
+    }
+}
+
+/*!
+ * @brief direct_fork_directories runs the directory analysis with direct calls to fork, largest directories first
+ * (@see make_directory_list)
  * @param data_source the data source directory with 150 directories to analyze (parallelize with fork)
  * @param temp_files the path to the temporary files directory
  * @param nb_proc the maximum number of simultaneous processes
@@ -28,110 +87,61 @@ void direct_fork_directories(char *data_source, char *temp_files, uint16_t nb_pr
         return;
     }
 
-    // 2. Iterate over directories (ignore . and ..)
-    DIR *dir = opendir(data_source);
-    if (dir == NULL) {
+    // 2. List the directories, by decreasing estimated cost
+    directory_list_t *directories = make_directory_list(data_source);
+    if (directories == NULL) {
         return;
     }
 
-    int running_processes = 0;
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
-        }
-
-        // if max processes count already run, wait for one to end before starting a task.
-        while (running_processes >= nb_proc) {
-            wait(NULL);
-            running_processes--;
-        }
-
+    pid_t running[nb_proc];
+    struct timespec dispatched[nb_proc];
+    memset(running, 0, sizeof(running));
+    phase_timing_t timing;
+    start_phase_timing(&timing);
+    task_t task;
+    task.task_callback = process_directory;
+    directory_task_t *dir_task = (directory_task_t *) &task;
+    strncpy(dir_task->temporary_directory, temp_files, STR_MAX_LEN - 1);
+    dir_task->temporary_directory[STR_MAX_LEN - 1] = '\0';
+    while (next_directory(directories, data_source, dir_task->object_directory)) {
         // 3. fork and start a task on current directory.
-        pid_t pid = fork();
-        if (pid == 0) {
-            // Create task
-            task_t task;
-            task.task_callback = process_directory;
-            directory_task_t *dir_task = (directory_task_t *) &task;
-            snprintf(dir_task->object_directory, 255, "%s/%s", data_source, entry->d_name);
-            strncpy(dir_task->temporary_directory, temp_files, STR_MAX_LEN);
-            dir_task->task_callback(&task);
-
-
-            exit(0);
-        } else if (pid > 0) {
-            running_processes++;
-        }
-
+        fork_task(&task, running, dispatched, nb_proc, &timing);
     }
     // 4. Cleanup
-    closedir(dir);
+    clear_directory_list(directories);
 
     // Wait for remaining processes to finish
-    while (running_processes > 0) {
-        wait(NULL);
-        running_processes--;
-    }
+    while (wait_for_child(running, dispatched, nb_proc, &timing));
+    report_phase_timing(&timing, "Direct fork, directories");
 }
 
 /*!
- * @brief direct_fork_files runs the files analysis with direct calls to fork
+ * @brief direct_fork_files runs the files analysis with direct calls to fork, one process per batch of files
  * @param data_source the data source containing the files
  * @param temp_files the temporary files to write the output (step2_output)
  * @param nb_proc the maximum number of simultaneous processes
+ * @param work the batches of step1_output to analyze
  */
-void direct_fork_files(char *data_source, char *temp_files, uint16_t nb_proc) {
+void direct_fork_files(char *data_source, char *temp_files, uint16_t nb_proc, work_list_t *work) {
     // 1. Check parameters
-    if (data_source == NULL || temp_files == NULL || nb_proc == 0) return;
-
-    // 2. Iterate over files in files list (step1_output)
-    char step1_output[255];
-    snprintf(step1_output, 255, "%s/%s", temp_files, "step1_output");
-    FILE *input_file = fopen(step1_output, "r");
-    if (input_file == NULL) return;
-
-    char file[STR_MAX_LEN];
-    int running_processes = 0;
-
+    if (data_source == NULL || temp_files == NULL || nb_proc == 0 || work == NULL) return;
+
+    // 2. Iterate over the pending batches of files of step1_output
+    pid_t running[nb_proc];
+    struct timespec dispatched[nb_proc];
+    memset(running, 0, sizeof(running));
+    phase_timing_t timing;
+    start_phase_timing(&timing);
     task_t task;
-    task.task_callback = process_file;
-    file_task_t *file_task = (file_task_t *) &task;
-    strcpy(file_task->temporary_directory, temp_files);
-    while (fgets(file, STR_MAX_LEN, input_file) != NULL) {
-
-        file[strlen(file) - 1] = '\0'; // Remove new line character
-
-        strcpy(file_task->object_file, file);
-
-        file_task->task_callback(&task);
-
-
-/*
-        while (running_processes >= nb_proc) {
-            wait(NULL);
-            running_processes--;
-        }
-
-        int pid = fork();
-        if (pid == 0) {
-            file_task->task_callback(&task);
-            exit(0);
-        } else if (pid > 0) {
-            running_processes++;
-        }else{
-            perror("Error calling fork");
-        }
-*/
+    task.task_callback = process_file_batch;
+    batch_task_t *batch_task = (batch_task_t *) &task;
+    strcpy(batch_task->temporary_directory, temp_files);
+    while (next_pending_batch(work, &batch_task->batch)) {
+        // 3. fork and start a task on current batch.
+        fork_task(&task, running, dispatched, nb_proc, &timing);
     }
-    // 4. Cleanup
-    fclose(input_file);
 
-    // Wait for remaining processes to finish
-    while (running_processes > 0) {
-        wait(NULL);
-        running_processes--;
-    }
+    // 4. Wait for remaining processes to finish
+    while (wait_for_child(running, dispatched, nb_proc, &timing));
+    report_phase_timing(&timing, "Direct fork, files");
 }
-
-
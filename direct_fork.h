@@ -6,8 +6,9 @@
 #define A2022_DIRECT_FORK_H
 
 #include "global_defs.h"
+#include "checkpoint.h"
 
 void direct_fork_directories(char *data_source, char *temp_files, uint16_t nb_proc);
-void direct_fork_files(char *data_source, char *temp_files, uint16_t nb_proc);
+void direct_fork_files(char *data_source, char *temp_files, uint16_t nb_proc, work_list_t *work);
 
 #endif //A2022_DIRECT_FORK_H
@@ -0,0 +1,462 @@
+#include "distributed.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+#include "global_defs.h"
+#include "analysis.h"
+#include "intermediates.h"
+
+// Remote workers may be started before the coordinator listens (it lists the files first): they retry connecting
+#define CONNECT_RETRY_DELAY_S 1
+#define CONNECT_TIMEOUT_S 600
+
+typedef enum {REMOTE_CONNECTED, REMOTE_IDLE, REMOTE_BUSY} remote_state_t;
+
+// A remote worker connection, as seen by the coordinator
+typedef struct {
+    int socket;
+    remote_state_t state;
+    file_batch_t batch; // The batch in flight when busy
+    char peer[INET6_ADDRSTRLEN + 8];
+} remote_worker_t;
+
+typedef struct {
+    char *temp_dir;
+    int step1_fd;
+    work_list_t *work;
+    bool work_exhausted; // All batches of the work list were handed out at least once
+    file_batch_t requeued[MAX_REMOTE_WORKERS]; // Batches of disconnected workers, handed out first
+    uint16_t requeued_count;
+    remote_worker_t workers[MAX_REMOTE_WORKERS];
+    uint16_t worker_count;
+    uint32_t connections;
+    uint64_t committed;
+    uint64_t redispatched;
+} coordinator_t;
+
+/*!
+ * @brief send_all sends a whole buffer on a socket (without SIGPIPE if the peer is gone)
+ * @param socket the socket
+ * @param data the data to send
+ * @param length the length of data
+ * @return true if all data was sent, false else
+ */
+static bool send_all(int socket, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(socket, data, length, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+/*!
+ * @brief receive_all receives exactly length bytes from a socket
+ * @param socket the socket
+ * @param data the buffer receiving the data
+ * @param length the number of bytes to receive
+ * @return true if all bytes were received, false on error or if the peer closed the connection
+ */
+static bool receive_all(int socket, char *data, size_t length) {
+    while (length > 0) {
+        ssize_t received = recv(socket, data, length, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return false;
+        data += received;
+        length -= received;
+    }
+    return true;
+}
+
+/*!
+ * @brief send_message sends a message of the protocol
+ * @param socket the socket
+ * @param opcode the operation
+ * @param payload the payload (may be NULL if length is 0)
+ * @param length the length of the payload
+ * @return true if the message was sent, false else
+ */
+static bool send_message(int socket, opcode_t opcode, const char *payload, uint32_t length) {
+    message_header_t header = {htonl(opcode), htonl(length)};
+    return send_all(socket, (char *) &header, sizeof(header)) && send_all(socket, payload, length);
+}
+
+/*!
+ * @brief receive_message receives a message of the protocol
+ * @param socket the socket
+ * @param opcode set to the operation
+ * @param length set to the length of the payload
+ * @return the malloc'ed payload ('\0' terminated), NULL on error or if the peer closed the connection
+ */
+static char *receive_message(int socket, opcode_t *opcode, uint32_t *length) {
+    message_header_t header;
+    if (!receive_all(socket, (char *) &header, sizeof(header))) return NULL;
+    *opcode = ntohl(header.opcode);
+    *length = ntohl(header.length);
+    if (*opcode == 0 || *opcode >= OP_COUNT || *length > MAX_MESSAGE_LENGTH) {
+        fprintf(stderr, "Invalid message (opcode %u, %u bytes)\n", *opcode, *length);
+        return NULL;
+    }
+    char *payload = malloc(*length + 1);
+    if (payload == NULL) return NULL;
+    if (!receive_all(socket, payload, *length)) {
+        free(payload);
+        return NULL;
+    }
+    payload[*length] = '\0';
+    return payload;
+}
+
+/*!
+ * @brief listen_on_port opens a TCP socket listening on all addresses
+ * @param port the port
+ * @return the listening socket, -1 on error
+ */
+static int listen_on_port(uint16_t port) {
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE};
+    struct addrinfo *addresses;
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    if (getaddrinfo(NULL, service, &hints, &addresses) != 0) return -1;
+    int listener = -1;
+    for (struct addrinfo *address = addresses; address != NULL && listener == -1; address = address->ai_next) {
+        listener = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (listener == -1) continue;
+        int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(listener, address->ai_addr, address->ai_addrlen) != 0 || listen(listener, SOMAXCONN) != 0) {
+            close(listener);
+            listener = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    return listener;
+}
+
+/*!
+ * @brief connect_to connects to a coordinator
+ * @param coordinator_address the address of the coordinator, as host:port
+ * @return the connected socket, -1 on error
+ */
+static int connect_to(char *coordinator_address) {
+    char host[STR_MAX_LEN];
+    strncpy(host, coordinator_address, STR_MAX_LEN - 1);
+    host[STR_MAX_LEN - 1] = '\0';
+    char *port = strrchr(host, ':');
+    if (port == NULL) {
+        fprintf(stderr, "Invalid coordinator address %s (expected host:port)\n", coordinator_address);
+        return -1;
+    }
+    *port++ = '\0';
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *addresses;
+    if (getaddrinfo(host, port, &hints, &addresses) != 0) return -1;
+    int connection = -1;
+    for (struct addrinfo *address = addresses; address != NULL && connection == -1; address = address->ai_next) {
+        connection = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (connection != -1 && connect(connection, address->ai_addr, address->ai_addrlen) != 0) {
+            close(connection);
+            connection = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    return connection;
+}
+
+/*!
+ * @brief next_remote_batch gets the next batch to hand out: batches of disconnected workers first, then the pending
+ * batches of the work list
+ * @param coordinator the coordinator
+ * @param batch the batch to fill
+ * @return true if a batch was found, false if there is nothing left to hand out
+ */
+static bool next_remote_batch(coordinator_t *coordinator, file_batch_t *batch) {
+    if (coordinator->requeued_count > 0) {
+        *batch = coordinator->requeued[--coordinator->requeued_count];
+        return true;
+    }
+    if (!coordinator->work_exhausted && next_pending_batch(coordinator->work, batch)) return true;
+    coordinator->work_exhausted = true;
+    return false;
+}
+
+/*!
+ * @brief drop_worker closes the connection of a worker and re-queues its batch in flight, if any. The last worker is
+ * moved to its place.
+ * @param coordinator the coordinator
+ * @param index the index of the worker
+ */
+static void drop_worker(coordinator_t *coordinator, uint16_t index) {
+    remote_worker_t *worker = &coordinator->workers[index];
+    if (worker->state == REMOTE_BUSY) {
+        coordinator->requeued[coordinator->requeued_count++] = worker->batch;
+        coordinator->redispatched++;
+        printf("Remote worker %s lost, files %" PRIu64 " to %" PRIu64 " will be analyzed again\n", worker->peer,
+               worker->batch.first_file, worker->batch.first_file + worker->batch.file_count - 1);
+    }
+    close(worker->socket);
+    *worker = coordinator->workers[--coordinator->worker_count];
+}
+
+/*!
+ * @brief dispatch_batch sends the next batch to an idle worker: the payload is the part of step1_output holding the
+ * paths of the batch
+ * @param coordinator the coordinator
+ * @param worker the idle worker
+ * @return true if the worker is busy with a batch, false if there was nothing left to hand out or on error
+ */
+static bool dispatch_batch(coordinator_t *coordinator, remote_worker_t *worker) {
+    file_batch_t batch;
+    if (!next_remote_batch(coordinator, &batch)) return false;
+    size_t length = batch.end - batch.start;
+    char *paths = malloc(length);
+    bool sent = paths != NULL && pread(coordinator->step1_fd, paths, length, batch.start) == (ssize_t) length &&
+                send_message(worker->socket, OP_ANALYZE_FILES, paths, length);
+    free(paths);
+    // On error, the batch is in flight until the worker is dropped, which re-queues it
+    worker->batch = batch;
+    worker->state = REMOTE_BUSY;
+    return sent;
+}
+
+/*!
+ * @brief accept_worker accepts a new remote worker connection, which becomes idle once it said hello
+ * @param coordinator the coordinator
+ * @param listener the listening socket
+ */
+static void accept_worker(coordinator_t *coordinator, int listener) {
+    struct sockaddr_storage address;
+    socklen_t address_length = sizeof(address);
+    int connection = accept(listener, (struct sockaddr *) &address, &address_length);
+    if (connection == -1) return;
+    if (coordinator->worker_count == MAX_REMOTE_WORKERS) {
+        send_message(connection, OP_SHUTDOWN, NULL, 0);
+        close(connection);
+        return;
+    }
+    remote_worker_t *worker = &coordinator->workers[coordinator->worker_count++];
+    *worker = (remote_worker_t) {.socket = connection, .state = REMOTE_CONNECTED, .peer = ""};
+    char service[8] = "";
+    getnameinfo((struct sockaddr *) &address, address_length, worker->peer, INET6_ADDRSTRLEN, service,
+                sizeof(service), NI_NUMERICHOST | NI_NUMERICSERV);
+    strcat(worker->peer, ":");
+    strcat(worker->peer, service);
+    coordinator->connections++;
+}
+
+/*!
+ * @brief handle_message reads and applies a message of a worker: a hello makes it idle, records are committed to
+ * step2_output (@see commit_batch) and make it idle again
+ * @param coordinator the coordinator
+ * @param index the index of the worker
+ * @return false if the worker must be dropped, true else
+ */
+static bool handle_message(coordinator_t *coordinator, uint16_t index) {
+    remote_worker_t *worker = &coordinator->workers[index];
+    opcode_t opcode;
+    uint32_t length;
+    char *payload = receive_message(worker->socket, &opcode, &length);
+    if (payload == NULL) return false;
+    bool valid = true;
+    if (opcode == OP_HELLO && worker->state == REMOTE_CONNECTED && length == sizeof(uint32_t)) {
+        uint32_t version;
+        memcpy(&version, payload, sizeof(version));
+        valid = ntohl(version) == PROTOCOL_VERSION;
+        if (!valid) fprintf(stderr, "Remote worker %s speaks protocol %u\n", worker->peer, ntohl(version));
+        worker->state = REMOTE_IDLE;
+    } else if (opcode == OP_RECORDS && worker->state == REMOTE_BUSY) {
+        if (commit_batch(coordinator->temp_dir, &worker->batch, payload, length)) {
+            coordinator->committed++;
+        } else {
+            fprintf(stderr, "Could not commit the batch of files %" PRIu64 " to %" PRIu64 "\n",
+                    worker->batch.first_file, worker->batch.first_file + worker->batch.file_count - 1);
+        }
+        worker->state = REMOTE_IDLE;
+    } else {
+        fprintf(stderr, "Unexpected message %u from remote worker %s\n", opcode, worker->peer);
+        valid = false;
+    }
+    free(payload);
+    return valid;
+}
+
+/*!
+ * @brief coordinate_files_analysis serves the pending batches of the files analysis to remote workers (started with
+ * run_remote_worker) over TCP, and commits the records they send back to step2_output. Workers must see the data
+ * source at the same path as the coordinator (e.g. on an NFS mount). The batch of a worker that disconnects is
+ * handed out again. Returns once all batches are committed.
+ * @param temp_dir the temporary directory (step1_output and step2_output are here)
+ * @param port the TCP port to listen on
+ * @param work the batches of step1_output to analyze
+ * @return true if all batches were analyzed, false on error
+ */
+bool coordinate_files_analysis(char *temp_dir, uint16_t port, work_list_t *work) {
+    if (temp_dir == NULL || work == NULL) return false;
+    coordinator_t *coordinator = calloc(1, sizeof(coordinator_t));
+    if (coordinator == NULL) return false;
+    char step1_path[STR_MAX_LEN];
+    intermediate_path(temp_dir, STEP1_OUTPUT, step1_path);
+    coordinator->temp_dir = temp_dir;
+    coordinator->work = work;
+    coordinator->step1_fd = open(step1_path, O_RDONLY);
+    int listener = listen_on_port(port);
+    if (coordinator->step1_fd == -1 || listener == -1) {
+        perror("Could not start the coordinator");
+        if (coordinator->step1_fd != -1) close(coordinator->step1_fd);
+        free(coordinator);
+        return false;
+    }
+    printf("Coordinator listening on port %u, %" PRIu64 " batches to analyze\n", port,
+           work->batch_count - work->done_count);
+    fflush(stdout);
+
+    struct pollfd fds[MAX_REMOTE_WORKERS + 1];
+    while (true) {
+        // Give a batch to every idle worker
+        uint16_t busy = 0;
+        for (uint16_t i = 0; i < coordinator->worker_count; i++) {
+            remote_worker_t *worker = &coordinator->workers[i];
+            if (worker->state == REMOTE_IDLE) dispatch_batch(coordinator, worker);
+            if (worker->state == REMOTE_BUSY) busy++;
+        }
+        if (busy == 0 && coordinator->work_exhausted && coordinator->requeued_count == 0) break;
+
+        // Wait for new workers and for results
+        fds[0] = (struct pollfd) {.fd = listener, .events = POLLIN};
+        for (uint16_t i = 0; i < coordinator->worker_count; i++) {
+            fds[i + 1] = (struct pollfd) {.fd = coordinator->workers[i].socket, .events = POLLIN};
+        }
+        if (poll(fds, coordinator->worker_count + 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+        // Backwards, so that dropping a worker (which moves the last one to its place) keeps the indexes valid
+        for (int i = coordinator->worker_count - 1; i >= 0; i--) {
+            if (fds[i + 1].revents != 0 && !handle_message(coordinator, i)) drop_worker(coordinator, i);
+        }
+        if (fds[0].revents & POLLIN) accept_worker(coordinator, listener);
+    }
+
+    for (uint16_t i = 0; i < coordinator->worker_count; i++) {
+        send_message(coordinator->workers[i].socket, OP_SHUTDOWN, NULL, 0);
+        close(coordinator->workers[i].socket);
+    }
+    close(listener);
+    close(coordinator->step1_fd);
+    printf("Coordinator: %" PRIu64 " batches analyzed by %u remote workers, %" PRIu64 " batches analyzed again\n",
+           coordinator->committed, coordinator->connections, coordinator->redispatched);
+    bool complete = coordinator->work_exhausted && coordinator->requeued_count == 0;
+    free(coordinator);
+    return complete;
+}
+
+/*!
+ * @brief analyze_files_handler analyzes a batch of files and sends their records to the coordinator
+ * @param socket the connection to the coordinator
+ * @param payload the paths of the files, one per line
+ * @param length the length of payload
+ * @return true if the records were sent, false else
+ */
+static bool analyze_files_handler(int socket, char *payload, uint32_t length) {
+    char *records = NULL;
+    size_t records_size = 0;
+    FILE *records_file = open_memstream(&records, &records_size);
+    if (records_file == NULL) return false;
+    FILE *files_list = length > 0 ? fmemopen(payload, length, "r") : NULL;
+    if (files_list != NULL) {
+        analyze_files_list(files_list, length, records_file);
+        fclose(files_list);
+    }
+    fclose(records_file);
+    bool sent = send_message(socket, OP_RECORDS, records, records_size);
+    free(records);
+    return sent;
+}
+
+// Handlers of the operations a worker receives, by opcode (OP_SHUTDOWN ends the connection)
+static bool (*const worker_handlers[OP_COUNT])(int socket, char *payload, uint32_t length) = {
+        [OP_ANALYZE_FILES] = analyze_files_handler,
+};
+
+/*!
+ * @brief serve_coordinator connects to a coordinator and runs the operations it sends until it shuts the worker down
+ * @param coordinator_address the address of the coordinator, as host:port
+ * @return true if the coordinator shut the worker down, false on error
+ */
+static bool serve_coordinator(char *coordinator_address) {
+    int connection = -1;
+    for (int waited = 0; connection == -1 && waited < CONNECT_TIMEOUT_S; waited += CONNECT_RETRY_DELAY_S) {
+        connection = connect_to(coordinator_address);
+        if (connection == -1) sleep(CONNECT_RETRY_DELAY_S);
+    }
+    if (connection == -1) {
+        fprintf(stderr, "Could not connect to coordinator %s\n", coordinator_address);
+        return false;
+    }
+    uint32_t version = htonl(PROTOCOL_VERSION);
+    bool running = send_message(connection, OP_HELLO, (char *) &version, sizeof(version));
+    bool shutdown = false;
+    while (running) {
+        opcode_t opcode;
+        uint32_t length;
+        char *payload = receive_message(connection, &opcode, &length);
+        if (payload == NULL) break;
+        if (opcode == OP_SHUTDOWN) {
+            shutdown = true;
+            running = false;
+        } else if (worker_handlers[opcode] != NULL) {
+            running = worker_handlers[opcode](connection, payload, length);
+        } else {
+            fprintf(stderr, "Unexpected message %u from coordinator\n", opcode);
+            running = false;
+        }
+        free(payload);
+    }
+    close(connection);
+    return shutdown;
+}
+
+/*!
+ * @brief run_remote_worker runs the files analysis for a coordinator (@see coordinate_files_analysis): each of the
+ * worker processes opens its own connection and analyzes one batch at a time
+ * @param coordinator_address the address of the coordinator, as host:port
+ * @param connections the number of worker processes
+ * @return true if all worker processes ran until the coordinator shut them down, false else
+ */
+bool run_remote_worker(char *coordinator_address, uint16_t connections) {
+    if (coordinator_address == NULL || connections == 0) return false;
+    printf("Remote worker: %u connections to coordinator %s\n", connections, coordinator_address);
+    fflush(stdout);
+    for (uint16_t i = 0; i < connections; i++) {
+        pid_t child = fork();
+        if (child == 0) {
+            exit(serve_coordinator(coordinator_address) ? 0 : 1);
+        } else if (child < 0) {
+            perror("fork");
+            connections = i;
+            break;
+        }
+    }
+    bool success = connections > 0;
+    int status;
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) success = false;
+    }
+    return success;
+}
@@ -0,0 +1,35 @@
+#ifndef A2022_DISTRIBUTED_H
+#define A2022_DISTRIBUTED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "checkpoint.h"
+
+// Version of the coordinator/worker protocol, checked when a worker connects
+#define PROTOCOL_VERSION 1
+// Maximum number of remote workers connected at once to a coordinator
+#define MAX_REMOTE_WORKERS 256
+// Largest message payload accepted (a batch of paths, or the records of a batch)
+#define MAX_MESSAGE_LENGTH (64 * 1024 * 1024)
+
+// Operations of the coordinator/worker protocol. Remote workers do not share the address space of the coordinator,
+// so tasks carry an opcode instead of a task_callback.
+typedef enum {
+    OP_HELLO = 1, // worker -> coordinator, payload: the protocol version (uint32_t, network order)
+    OP_ANALYZE_FILES, // coordinator -> worker, payload: the paths of a batch of step1_output, one per line
+    OP_RECORDS, // worker -> coordinator, payload: the step2_output records of the batch
+    OP_SHUTDOWN, // coordinator -> worker, no payload
+    OP_COUNT,
+} opcode_t;
+
+// Header of every message, in network byte order, followed by length bytes of payload
+typedef struct {
+    uint32_t opcode;
+    uint32_t length;
+} message_header_t;
+
+bool coordinate_files_analysis(char *temp_dir, uint16_t port, work_list_t *work);
+bool run_remote_worker(char *coordinator_address, uint16_t connections);
+
+#endif //A2022_DISTRIBUTED_H
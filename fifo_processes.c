@@ -13,6 +13,8 @@
 #include <sys/wait.h>
 #include <string.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <sys/syscall.h>
 
 #include <stdio.h>
 #include <stdint.h>
@@ -21,6 +23,10 @@
 
 #include "analysis.h"
 #include "utility.h"
+#include "supervisor.h"
+#include "scheduler.h"
+#include "progress.h"
+#include "trace.h"
 
 /*!
  * @brief make_fifos creates FIFOs for processes to communicate with their parent
@@ -70,6 +76,57 @@ void erase_fifos(uint16_t processes_count, char *file_format) {
     }
 }
 
+/*!
+ * @brief fifo_worker is the code of a worker process: it runs the tasks read on its command FIFO and notifies their
+ * completion on its notification FIFO, until it receives a task with a NULL callback
+ * @param index the index of the worker (and of its FIFOs)
+ */
+static void fifo_worker(int index) {
+    set_progress_worker(index);
+    set_trace_worker(index);
+    hold_file_batches(true);
+    // Open the FIFOs
+    char in_fifo_name[1024];
+    char out_fifo_name[1024];
+    sprintf(in_fifo_name, "fifo-in-%d", index);
+    sprintf(out_fifo_name, "fifo-out-%d", index);
+    int in_fifo = open(in_fifo_name, O_RDONLY);
+    int out_fifo = open(out_fifo_name, O_WRONLY);
+    if (in_fifo < 0 || out_fifo < 0) {
+        perror("open");
+        exit(1);
+    }
+
+    // Listen for tasks on the input FIFO
+    task_t task;
+    while (1) {
+        if (read(in_fifo, &task, sizeof(task_t)) < 0) {
+            perror("read");
+            exit(1);
+        }
+
+        if (task.task_callback == NULL) {
+            // Shutdown task received, exit the loop
+            break;
+        }
+
+        // Apply the task
+        run_traced_task(&task);
+
+        // Write a notification to the output FIFO to signal that the task has been completed
+        task_notification_t notification = {.pid = getpid(), .held = held_file_batches()};
+        if (write(out_fifo, &notification, sizeof(notification)) < 0) {
+            perror("write");
+            exit(1);
+        }
+    }
+
+    // Cleanup and exit
+    close(in_fifo);
+    close(out_fifo);
+    exit(0);
+}
+
 /*!
  * @brief make_processes creates processes and starts their code (waiting for commands)
  * @param processes_count the number of processes to create
@@ -86,52 +143,12 @@ pid_t *make_processes(uint16_t processes_count) {
         exit(1);
     }
 
+    fflush(stdout);
     for (i = 0; i < processes_count; i++) {
         pids[i] = fork();
         if (pids[i] == 0) {
             // This is the child process
-
-            // Open the FIFOs
-            char in_fifo_name[1024];
-            char out_fifo_name[1024];
-            sprintf(in_fifo_name, "fifo-in-%d", i);
-            sprintf(out_fifo_name, "fifo-out-%d", i);
-            int in_fifo = open(in_fifo_name, O_RDONLY);
-            int out_fifo = open(out_fifo_name, O_WRONLY);
-            if (in_fifo < 0 || out_fifo < 0) {
-                perror("open");
-                exit(1);
-            }
-
-            // Listen for tasks on the input FIFO
-            task_t task;
-            while (1) {
-                if (read(in_fifo, &task, sizeof(task_t)) < 0) {
-                    perror("read");
-                    exit(1);
-                }
-
-                if (task.task_callback == NULL) {
-                    // Shutdown task received, exit the loop
-                    break;
-                }
-
-                // Apply the task
-                task.task_callback(&task);
-
-                // Write a notification to the output FIFO to signal that the task has been completed
-                char notification[1024] = "Task completed";
-                if (write(out_fifo, &notification, sizeof(notification)) < 0) {
-                    perror("write");
-                    exit(1);
-                }
-            }
-
-
-            // Cleanup and exit
-            close(in_fifo);
-            close(out_fifo);
-            exit(0);
+            fifo_worker(i);
         } else if (pids[i] < 0) {
             // fork failed
             perror("fork");
@@ -242,185 +259,291 @@ int prepare_select(fd_set *fds, const int *filesdes, uint16_t nb_proc) {
     return maxfd;
 }
 
+// Context of next_directory_task
+typedef struct {
+    char *data_source;
+    char *temp_files;
+    directory_list_t *directories;
+} directory_tasks_t;
+
 /*!
- * @brief send_task sends a directory task to a child process. Must send a directory command on object directory
- * data_source/dir_name, to write the result in temp_files/dir_name. Sends on FIFO with FD command_fd
- * @param data_source the data source with directories to analyze
- * @param temp_files the temporary output files directory
- * @param dir_name the current dir name to analyze
- * @param command_fd the child process command FIFO file descriptor
+ * @brief next_directory_task builds a directory task on the next directory of the data source, largest first: the
+ * object directory is data_source/dir_name, the result is written in temp_files/dir_name
+ * @param task the task to fill
+ * @param context a directory_tasks_t pointer
+ * @return true if a task was built, false when all directories were listed
  */
-void send_task(char *data_source, char *temp_files, char *dir_name, int command_fd) {
-    directory_task_t task;
+static bool next_directory_task(task_t *task, void *context) {
+    directory_tasks_t *directories = (directory_tasks_t *) context;
+    directory_task_t *dir_task = (directory_task_t *) task;
+    if (!next_directory(directories->directories, directories->data_source, dir_task->object_directory)) {
+        return false;
+    }
+    dir_task->task_callback = &process_directory;
+    strcpy(dir_task->temporary_directory, directories->temp_files);
+    return true;
+}
 
-    // Set the callback function and the task arguments
-    task.task_callback = &process_directory;
-    snprintf(task.object_directory, STR_MAX_LEN, "%s/%s", data_source, dir_name);
-    strcpy(task.temporary_directory,temp_files);
+// Context of next_batch_task
+typedef struct {
+    char *temp_files;
+    work_list_t *work;
+} batch_tasks_t;
 
-    // Send the task to the child process
-    if (write(command_fd, &task, sizeof(directory_task_t)) < 0) {
-        perror("write");
-        exit(1);
+/*!
+ * @brief next_batch_task builds the task of the next pending batch of files of step1_output
+ * @param task the task to fill
+ * @param context a batch_tasks_t pointer
+ * @return true if a task was built, false when all batches were handed out
+ */
+static bool next_batch_task(task_t *task, void *context) {
+    batch_tasks_t *batches = (batch_tasks_t *) context;
+    batch_task_t *batch_task = (batch_task_t *) task;
+    if (!next_pending_batch(batches->work, &batch_task->batch)) return false;
+    batch_task->task_callback = &process_file_batch;
+    strcpy(batch_task->temporary_directory, batches->temp_files);
+    return true;
+}
+
+/*!
+ * @brief open_pidfd gets a file descriptor that becomes readable when a process terminates
+ * @param pid the PID of the process
+ * @return the pidfd, -1 if the kernel does not support them (worker deaths are then detected by the end of file of
+ * their notification FIFO)
+ */
+static int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int) syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void) pid;
+    return -1;
+#endif
+}
+
+typedef enum {TASK_DONE, WORKER_DIED} worker_event_t;
+
+/*!
+ * @brief wait_worker_event waits for a worker process to notify the end of its task, or to die
+ * @param notify_fifos the FIFOs on which to read for workers to notify end of tasks
+ * @param pidfds the pidfds of the workers (-1 if not available)
+ * @param nb_proc the number of workers
+ * @param worker set to the index of the worker
+ * @param held set to the number of batches the worker holds after its task (@see held_file_batches)
+ * @return the event
+ */
+static worker_event_t wait_worker_event(int *notify_fifos, int *pidfds, uint16_t nb_proc, int *worker,
+                                        uint32_t *held) {
+    while (1) {
+        fd_set read_fds;
+        // Initialize the fd_set and get the maximum file descriptor value
+        int maxfd = prepare_select(&read_fds, notify_fifos, nb_proc);
+        for (int i = 0; i < nb_proc; i++) {
+            if (pidfds[i] == -1) continue;
+            FD_SET(pidfds[i], &read_fds);
+            if (pidfds[i] > maxfd) maxfd = pidfds[i];
+        }
+        // Wait for a notification FIFO or a pidfd to become readable
+        uint64_t wait_start = trace_clock();
+        int ready = select(maxfd + 1, &read_fds, NULL, NULL, NULL);
+        trace_span(TRACE_WAIT, wait_start);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            perror("select");
+            exit(1);
+        }
+        // Notifications first: a worker may notify then terminate
+        for (int i = 0; i < nb_proc; i++) {
+            if (FD_ISSET(notify_fifos[i], &read_fds)) {
+                task_notification_t notification;
+                ssize_t bytes_read = read(notify_fifos[i], &notification, sizeof(notification));
+                if (bytes_read < 0) {
+                    perror("read");
+                    exit(1);
+                }
+                *worker = i;
+                *held = bytes_read == sizeof(notification) ? notification.held : 0;
+                // End of file: the worker closed its FIFO, its pidfd (if any) tells when it is gone
+                if (bytes_read > 0) return TASK_DONE;
+                if (pidfds[i] == -1) return WORKER_DIED;
+            }
+        }
+        for (int i = 0; i < nb_proc; i++) {
+            if (pidfds[i] != -1 && FD_ISSET(pidfds[i], &read_fds)) {
+                *worker = i;
+                return WORKER_DIED;
+            }
+        }
     }
 }
 
-void send_task_file(char *data_source, char *temp_files, char *file_name, int command_fd) {
-    file_task_t task;
+/*!
+ * @brief replace_worker reaps a dead worker and forks its replacement, after dropping the task left unread in its
+ * command FIFO, if any. The parent reopens the notification FIFO of the worker, which waits for the replacement to
+ * open its end (so the end of file of the dead worker is not seen again).
+ * @param supervisor the supervisor of the pool
+ * @param worker the index of the dead worker
+ * @param notify_fifos the FIFOs on which to read for workers to notify end of tasks
+ * @param pidfds the pidfds of the workers
+ */
+static void replace_worker(supervisor_t *supervisor, int worker, int *notify_fifos, int *pidfds) {
+    int status = 0;
+    waitpid(supervisor->children[worker], &status, 0);
+    worker_crashed(supervisor, worker, status);
+    if (pidfds[worker] != -1) close(pidfds[worker]);
+    close(notify_fifos[worker]);
+
+    // Drop a task the dead worker did not read: it is dispatched again, the replacement must not run it too
+    char filename[1024];
+    sprintf(filename, "fifo-in-%d", worker);
+    int unread_tasks = open(filename, O_RDONLY | O_NONBLOCK);
+    if (unread_tasks >= 0) {
+        task_t unread;
+        while (read(unread_tasks, &unread, sizeof(task_t)) > 0) continue;
+        close(unread_tasks);
+    }
 
-    // Set the callback function and the task arguments
-    task.task_callback = &process_file;
-    strcpy(task.object_file,file_name);
-    strcpy(task.temporary_directory,temp_files);
+    fflush(stdout);
+    pid_t replacement = fork();
+    if (replacement == 0) {
+        fifo_worker(worker);
+    } else if (replacement < 0) {
+        perror("fork");
+        exit(1);
+    }
+    supervisor->children[worker] = replacement;
+    pidfds[worker] = open_pidfd(replacement);
+    sprintf(filename, "fifo-out-%d", worker);
+    notify_fifos[worker] = open(filename, O_RDONLY);
+    if (notify_fifos[worker] < 0) {
+        perror("open");
+        exit(1);
+    }
+}
 
-    // Send the task to the child process
-    if (write(command_fd, &task, sizeof(file_task_t)) < 0) {
+/*!
+ * @brief send_fifo_task writes a task to the command FIFO of a worker. A worker that died without being replaced yet
+ * has no reader on its FIFO: the write fails with EPIPE and the task is dispatched again when the death is detected.
+ * @param command_fifo the command FIFO of the worker
+ * @param task the task
+ */
+static void send_fifo_task(int command_fifo, task_t *task) {
+    // Send the whole task_t: workers always read sizeof(task_t) bytes
+    if (write(command_fifo, task, sizeof(task_t)) < 0 && errno != EPIPE) {
         perror("write");
         exit(1);
     }
 }
 
+/*!
+ * @brief fifo_dispatch distributes tasks over the workers, one task at a time for each worker. Dead workers are
+ * replaced and their tasks dispatched again (@see supervisor.h). Returns once all tasks are complete.
+ * @param notify_fifos the FIFOs on which to read for workers to notify end of tasks
+ * @param command_fifos the FIFOs on which to send tasks to workers
+ * @param children the workers PIDs
+ * @param nb_proc the number of workers
+ * @param next_task the function building the next task, returning false when no task remains
+ * @param context an opaque pointer passed to next_task
+ * @param pool_name the name of the pool in the report of the dispatch
+ */
+static void fifo_dispatch(int *notify_fifos, int *command_fifos, pid_t *children, uint16_t nb_proc,
+                          bool (*next_task)(task_t *, void *), void *context, char *pool_name) {
+    supervisor_t supervisor;
+    int *pidfds = malloc(sizeof(int) * nb_proc);
+    if (pidfds == NULL || !init_supervisor(&supervisor, children, nb_proc)) {
+        perror("malloc");
+        exit(1);
+    }
+    for (int i = 0; i < nb_proc; i++) {
+        pidfds[i] = open_pidfd(children[i]);
+    }
+    // A task sent to a dead worker must not kill the parent (@see send_fifo_task)
+    void (*previous_handler)(int) = signal(SIGPIPE, SIG_IGN);
+
+    supervised_task_t task;
+    while (1) {
+        // Give a task to every idle worker
+        int worker;
+        while ((worker = idle_worker(&supervisor)) != -1 &&
+               next_supervised_task(&supervisor, next_task, context, &task)) {
+            send_fifo_task(command_fifos[worker], &task.task);
+            task_started(&supervisor, worker, &task);
+        }
+        // Once all tasks are dispatched, make the workers commit the batches they hold
+        while ((worker = next_commit_task(&supervisor, &task)) != -1) {
+            send_fifo_task(command_fifos[worker], &task.task);
+            task_started(&supervisor, worker, &task);
+        }
+        if (busy_workers(&supervisor) == 0) break;
+
+        // Wait for a worker process to finish its task, or to die
+        uint32_t held;
+        if (wait_worker_event(notify_fifos, pidfds, nb_proc, &worker, &held) == TASK_DONE) {
+            task_completed(&supervisor, worker, held);
+        } else {
+            replace_worker(&supervisor, worker, notify_fifos, pidfds);
+        }
+    }
+
+    signal(SIGPIPE, previous_handler);
+    report_supervisor(&supervisor, pool_name);
+    clear_supervisor(&supervisor);
+    for (int i = 0; i < nb_proc; i++) {
+        if (pidfds[i] != -1) close(pidfds[i]);
+    }
+    free(pidfds);
+}
+
 /*!
  * @brief fifo_process_directory is the main function to distribute directory analysis to worker processes.
  * @param data_source the data source with the directories to analyze
  * @param temp_files the temporary files directory
  * @param notify_fifos the FIFOs on which to read for workers to notify end of tasks
  * @param command_fifos the FIFOs on which to send tasks to workers
+ * @param children the workers PIDs (updated when a worker is replaced)
  * @param nb_proc the maximum number of simultaneous tasks, = to number of workers
- * Uses @see send_task
  */
-void fifo_process_directory(char *data_source, char *temp_files, int *notify_fifos, int *command_fifos, uint16_t nb_proc) {
-    DIR *dir;
-    struct dirent *entry;
-    fd_set read_fds;
-    int maxfd;
-    int i;
-    int completed_tasks = 0;
+void fifo_process_directory(char *data_source, char *temp_files, int *notify_fifos, int *command_fifos,
+                            pid_t *children, uint16_t nb_proc) {
     // Check the parameters
-    if (data_source == NULL || temp_files == NULL || notify_fifos == NULL || command_fifos == NULL || nb_proc == 0) {
+    if (data_source == NULL || temp_files == NULL || notify_fifos == NULL || command_fifos == NULL ||
+        children == NULL || nb_proc == 0) {
         fprintf(stderr, "Invalid parameters\n");
         exit(1);
     }
-    // Open the data source directory
-    dir = opendir(data_source);
-    if (dir == NULL) {
+    // List the directories of the data source, largest first (@see make_directory_list)
+    directory_tasks_t directories = {data_source, temp_files, make_directory_list(data_source)};
+    if (directories.directories == NULL) {
         perror("opendir");
         exit(1);
     }
     // Iterate over the directories in the data source
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            // Skip . and ..
-            continue;
-        }
-
-        if (completed_tasks < nb_proc) {
-            // There are available worker processes, send a task
-            send_task(data_source, temp_files, entry->d_name, command_fifos[completed_tasks]);
-            completed_tasks++;
-        } else {
-            // Wait for a worker process to finish its task
-
-            // Initialize the fd_set and get the maximum file descriptor value
-            maxfd = prepare_select(&read_fds, notify_fifos, nb_proc);
-            // Wait for a notification FIFO to become readable
-            if (select(maxfd + 1, &read_fds, NULL, NULL, NULL) < 0) {
-                perror("select");
-                exit(1);
-            }
-
-            // Find the readable FIFO
-            for (i = 0; i < nb_proc; i++) {
-                if (FD_ISSET(notify_fifos[i], &read_fds)) {
-                    // Read the notification from the worker process that just finished its task
-                    char notification[1024];
-                    if (read(notify_fifos[i], &notification, sizeof(notification)) < 0) {
-                        perror("read");
-                        exit(1);
-                    }
-
-                    // Check the notification message
-                    if (strcmp(notification, "Task completed") == 0) {
-                        // Send a new task to the worker process that just finished its task
-                        send_task(data_source, temp_files, entry->d_name, command_fifos[i]);
-                    }
-                    break;
-                }
-            }
-        }
-    }
+    fifo_dispatch(notify_fifos, command_fifos, children, nb_proc, next_directory_task, &directories,
+                  "FIFO pool, directories");
     // Cleanup
-    closedir(dir);
+    clear_directory_list(directories.directories);
 }
 
 /*!
- * @brief fifo_process_files is the main function to distribute files analysis to worker processes.
+ * @brief fifo_process_files is the main function to distribute files analysis to worker processes, by batches of
+ * files of step1_output.
  * @param data_source the data source with the files to analyze
  * @param temp_files the temporary files directory (step1_output is here)
  * @param notify_fifos the FIFOs on which to read for workers to notify end of tasks
  * @param command_fifos the FIFOs on which to send tasks to workers
+ * @param children the workers PIDs (updated when a worker is replaced)
  * @param nb_proc  the maximum number of simultaneous tasks, = to number of workers
+ * @param work the batches of step1_output to analyze
  */
-void fifo_process_files(char *data_source, char *temp_files, int *notify_fifos, int *command_fifos, uint16_t nb_proc) {
-    fd_set read_fds;
-    int maxfd;
-    int i;
-    int completed_tasks = 0;
-
+void fifo_process_files(char *data_source, char *temp_files, int *notify_fifos, int *command_fifos, pid_t *children,
+                        uint16_t nb_proc, work_list_t *work) {
     // Check the parameters
-    if (data_source == NULL || temp_files == NULL || notify_fifos == NULL || command_fifos == NULL || nb_proc == 0) {
+    if (data_source == NULL || temp_files == NULL || notify_fifos == NULL || command_fifos == NULL ||
+        children == NULL || nb_proc == 0 || work == NULL) {
         fprintf(stderr, "Invalid parameters\n");
         exit(1);
     }
 
-    char step1_output[255];
-    snprintf(step1_output, 255, "%s/%s", temp_files, "step1_output");
-    FILE *input_file = fopen(step1_output, "r");
-    if (input_file == NULL) return;
-
-    char file[STR_MAX_LEN];
-
-
-    // Iterate over the files in the step1_output directory
-    while (fgets(file, STR_MAX_LEN, input_file) != NULL) {
-
-        file[strlen(file) - 1] = '\0'; // Remove new line character
-
-        if (completed_tasks < nb_proc) {
-            // There are available worker processes, send a task
-            send_task_file(data_source, temp_files, file, command_fifos[completed_tasks]);
-            completed_tasks++;
-        } else {
-            // Wait for a worker process to finish its task
-
-            // Initialize the fd_set and get the maximum file descriptor value
-            maxfd = prepare_select(&read_fds, notify_fifos, nb_proc);
-            // Wait for a notification FIFO to become readable
-            if (select(maxfd + 1, &read_fds, NULL, NULL, NULL) < 0) {
-                perror("select");
-                exit(1);
-            }
-
-            // Find the readable FIFO
-            for (i = 0; i < nb_proc; i++) {
-                if (FD_ISSET(notify_fifos[i], &read_fds)) {
-                    // Read the notification from the worker process that just finished its task
-                    char notification[1024];
-                    if (read(notify_fifos[i], &notification, sizeof(notification)) < 0) {
-                        perror("read");
-                        exit(1);
-                    }
-
-                    // Check the notification message
-                    if (strcmp(notification, "Task completed") == 0) {
-                        // Send a new task to the worker process that just finished its task
-                        send_task_file(data_source, temp_files, file, command_fifos[i]);
-                    }
-                    break;
-                }
-            }
-        }
-    }
-    // Cleanup
-    fclose(input_file);
-}
\ No newline at end of file
+    // Iterate over the pending batches
+    batch_tasks_t batches = {temp_files, work};
+    fifo_dispatch(notify_fifos, command_fifos, children, nb_proc, next_batch_task, &batches, "FIFO pool, files");
+}
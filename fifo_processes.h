@@ -6,6 +6,7 @@
 #define A2022_FIFO_PROCESSES_H
 
 #include "global_defs.h"
+#include "checkpoint.h"
 #include <unistd.h>
 #include <stdio.h>
 
@@ -16,7 +17,9 @@ int *open_fifos(uint16_t processes_count, char *file_format, int flags);
 void close_fifos(uint16_t processes_count, int*files);
 void shutdown_processes(uint16_t processes_count, int *fifos);
 
-void fifo_process_directory(char *data_source, char *temp_files, int *notify_fifos, int *command_fifos, uint16_t nb_proc);
-void fifo_process_files(char *data_source, char *temp_files, int *notify_fifos, int *command_fifos, uint16_t nb_proc);
+void fifo_process_directory(char *data_source, char *temp_files, int *notify_fifos, int *command_fifos,
+                            pid_t *children, uint16_t nb_proc);
+void fifo_process_files(char *data_source, char *temp_files, int *notify_fifos, int *command_fifos, pid_t *children,
+                        uint16_t nb_proc, work_list_t *work);
 
 #endif //A2022_FIFO_PROCESSES_H
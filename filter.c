@@ -0,0 +1,179 @@
+#include "filter.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global_defs.h"
+#include "utility.h"
+#include "mail_date.h"
+
+/*!
+ * @brief parse_domains adds a comma separated list of domains to a list of domains, in lower case
+ * @param value the list ("@" before a domain is ignored)
+ * @param domains the list of domains
+ * @param count the number of domains in the list, updated
+ * @return true on success, false if the list is full or memory is exhausted
+ */
+static bool parse_domains(char *value, char **domains, uint8_t *count) {
+    char *saveptr;
+    for (char *domain = strtok_r(value, ",", &saveptr); domain != NULL; domain = strtok_r(NULL, ",", &saveptr)) {
+        if (*domain == '@') domain++;
+        if (*domain == '\0') continue;
+        if (*count == MAX_FILTER_DOMAINS) {
+            fprintf(stderr, "Too many domains in a filter (at most %d)\n", MAX_FILTER_DOMAINS);
+            return false;
+        }
+        domains[*count] = strdup(domain);
+        if (domains[*count] == NULL) return false;
+        for (char *c = domains[*count]; *c != '\0'; c++) *c = (char) tolower((unsigned char) *c);
+        (*count)++;
+    }
+    return true;
+}
+
+/*!
+ * @brief load_senders reads a list of sender addresses, one per line, into a set
+ * @param path the path to the list
+ * @return the set (addresses in lower case), NULL on error
+ */
+static hash_table_t *load_senders(char *path) {
+    FILE *list = fopen(path, "r");
+    if (list == NULL) {
+        perror("Could not open the list of senders");
+        return NULL;
+    }
+    hash_table_t *senders = make_hash_table(1024);
+    char *line = NULL;
+    size_t line_size = 0;
+    while (senders != NULL && getline(&line, &line_size, list) != -1) {
+        char *address = str_trim(line);
+        if (*address == '\0' || *address == '#') continue;
+        for (char *c = address; *c != '\0'; c++) *c = (char) tolower((unsigned char) *c);
+        if (hash_table_find(senders, address, true) == NULL) {
+            clear_hash_table(senders, NULL);
+            senders = NULL;
+        }
+    }
+    free(line);
+    fclose(list);
+    return senders;
+}
+
+/*!
+ * @brief make_mail_filter builds a filter from its specification (@see filter.h)
+ * @param specification the specification, modified by the parsing
+ * @return the malloc'ed filter, NULL if the specification is invalid
+ */
+mail_filter_t *make_mail_filter(char *specification) {
+    mail_filter_t *filter = calloc(1, sizeof(mail_filter_t));
+    if (filter == NULL) return NULL;
+    filter->since = NO_TIMESTAMP;
+    filter->until = NO_TIMESTAMP;
+    bool valid = true;
+    char *saveptr;
+    for (char *term = strtok_r(specification, " ", &saveptr); valid && term != NULL;
+         term = strtok_r(NULL, " ", &saveptr)) {
+        char *value = strchr(term, ':');
+        if (value == NULL) {
+            fprintf(stderr, "Filter %s is not kind:value\n", term);
+            valid = false;
+            break;
+        }
+        *value++ = '\0';
+        if (strcmp(term, "sender-domain") == 0) {
+            valid = parse_domains(value, filter->sender_domains, &filter->sender_domain_count);
+        } else if (strcmp(term, "recipient-domain") == 0) {
+            valid = parse_domains(value, filter->recipient_domains, &filter->recipient_domain_count);
+        } else if (strcmp(term, "since") == 0 || strcmp(term, "until") == 0) {
+            valid = parse_iso_date(value, term[0] == 's' ? &filter->since : &filter->until);
+            if (!valid) fprintf(stderr, "Filter date %s is not YYYY-MM-DD[THH:MM[:SS]]\n", value);
+        } else if (strcmp(term, "senders") == 0 && filter->senders == NULL) {
+            filter->senders = load_senders(value);
+            valid = filter->senders != NULL;
+        } else {
+            fprintf(stderr, "Unknown filter %s (sender-domain, recipient-domain, since, until or senders)\n", term);
+            valid = false;
+        }
+    }
+    if (!valid) {
+        clear_mail_filter(filter);
+        return NULL;
+    }
+    return filter;
+}
+
+/*!
+ * @brief clear_mail_filter releases a filter
+ * @param filter the filter, may be NULL
+ */
+void clear_mail_filter(mail_filter_t *filter) {
+    if (filter == NULL) return;
+    for (uint8_t i = 0; i < filter->sender_domain_count; i++) free(filter->sender_domains[i]);
+    for (uint8_t i = 0; i < filter->recipient_domain_count; i++) free(filter->recipient_domains[i]);
+    if (filter->senders != NULL) clear_hash_table(filter->senders, NULL);
+    free(filter);
+}
+
+/*!
+ * @brief in_domains tells if an address belongs to one of a list of domains
+ * @param address the address, in lower case
+ * @param domains the domains, in lower case
+ * @param count the number of domains
+ * @return true if the domain of the address is in the list, false else
+ */
+static bool in_domains(const char *address, char **domains, uint8_t count) {
+    const char *domain = strrchr(address, '@');
+    if (domain == NULL) return false;
+    for (uint8_t i = 0; i < count; i++) {
+        if (strcmp(domain + 1, domains[i]) == 0) return true;
+    }
+    return false;
+}
+
+/*!
+ * @brief has_date_filter tells if a filter restricts the Date header
+ * @param filter the filter, may be NULL
+ * @return true if e-mails must have a Date within a range, false else
+ */
+bool has_date_filter(mail_filter_t *filter) {
+    return filter != NULL && (filter->since != NO_TIMESTAMP || filter->until != NO_TIMESTAMP);
+}
+
+/*!
+ * @brief sender_matches tells if the sender of an e-mail passes a filter (sender domains and list of senders)
+ * @param filter the filter, NULL for none
+ * @param address the address of the sender, in lower case (as extracted by the tokenizer)
+ * @return true if the sender passes the filter, false else
+ */
+bool sender_matches(mail_filter_t *filter, const char *address) {
+    if (filter == NULL) return true;
+    if (filter->sender_domain_count > 0 && !in_domains(address, filter->sender_domains, filter->sender_domain_count)) {
+        return false;
+    }
+    return filter->senders == NULL || hash_table_find(filter->senders, address, false) != NULL;
+}
+
+/*!
+ * @brief recipient_matches tells if a recipient of an e-mail is kept by a filter (recipient domains)
+ * @param filter the filter, NULL for none
+ * @param address the address of the recipient, in lower case (as extracted by the tokenizer)
+ * @return true if the recipient is kept, false else
+ */
+bool recipient_matches(mail_filter_t *filter, const char *address) {
+    return filter == NULL || filter->recipient_domain_count == 0 ||
+           in_domains(address, filter->recipient_domains, filter->recipient_domain_count);
+}
+
+/*!
+ * @brief date_matches tells if the date of an e-mail is within the date range of a filter
+ * @param filter the filter, NULL for none
+ * @param timestamp the date of the e-mail (@see parse_mail_date)
+ * @return true if the date is within the range (or there is no range), false else
+ */
+bool date_matches(mail_filter_t *filter, int64_t timestamp) {
+    if (!has_date_filter(filter)) return true;
+    return (filter->since == NO_TIMESTAMP || timestamp >= filter->since) &&
+           (filter->until == NO_TIMESTAMP || timestamp < filter->until);
+}
@@ -0,0 +1,43 @@
+#ifndef A2022_FILTER_H
+#define A2022_FILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hash_table.h"
+
+#define MAX_FILTER_DOMAINS 32
+#define NO_TIMESTAMP INT64_MIN
+
+/*
+ * Filters of the e-mails, evaluated by the mappers while the headers are parsed: an e-mail is rejected as soon as a
+ * header fails a filter, and only the matching records reach step2_output. The specification is a list of
+ * "kind:value" terms separated by spaces, all of which must match:
+ *   sender-domain:D1[,D2...]      the sender is in one of the domains
+ *   recipient-domain:D1[,D2...]   only the recipients in one of the domains are kept (e-mails left without recipient
+ *                                 are rejected)
+ *   since:YYYY-MM-DD[THH:MM[:SS]] the Date header is at or after this UTC time
+ *   until:YYYY-MM-DD[THH:MM[:SS]] the Date header is before this UTC time
+ *   senders:FILE                  the sender is one of the addresses of FILE (one per line)
+ * With a date range, e-mails without a valid Date header are rejected. Addresses and domains are compared in lower
+ * case.
+ */
+typedef struct {
+    char *sender_domains[MAX_FILTER_DOMAINS];
+    uint8_t sender_domain_count;
+    char *recipient_domains[MAX_FILTER_DOMAINS];
+    uint8_t recipient_domain_count;
+    int64_t since; // NO_TIMESTAMP if there is no lower bound
+    int64_t until; // NO_TIMESTAMP if there is no upper bound
+    hash_table_t *senders; // NULL if there is no list of senders
+} mail_filter_t;
+
+mail_filter_t *make_mail_filter(char *specification);
+void clear_mail_filter(mail_filter_t *filter);
+
+bool has_date_filter(mail_filter_t *filter);
+bool sender_matches(mail_filter_t *filter, const char *address);
+bool recipient_matches(mail_filter_t *filter, const char *address);
+bool date_matches(mail_filter_t *filter, int64_t timestamp);
+
+#endif //A2022_FILTER_H
@@ -0,0 +1,495 @@
+#include "graph.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "global_defs.h"
+#include "hash_table.h"
+#include "arena.h"
+
+// An edge of the graph while it is built
+typedef struct {
+    uint32_t source;
+    uint32_t target;
+    uint32_t weight;
+} edge_t;
+
+// Header of a snapshot, followed by name_offsets, out_offsets, in_offsets, out_targets, out_weights, in_sources,
+// in_weights and names. The snapshot is only valid for the output file it was built from (same size and mtime).
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_count;
+    uint64_t edge_count;
+    uint64_t names_size;
+    int64_t source_mtime;
+    uint64_t source_size;
+} snapshot_header_t;
+
+/*!
+ * @brief intern_address gets the provisional id of an address, in order of first appearance
+ * @param index the index of addresses (address -> provisional id + 1)
+ * @param address the address
+ * @return the provisional id, NO_NODE if memory is exhausted
+ */
+static uint32_t intern_address(hash_table_t *index, const char *address) {
+    hash_entry_t *entry = hash_table_find(index, address, true);
+    if (entry == NULL) return NO_NODE;
+    if (entry->value == NULL) entry->value = (void *) (uintptr_t) index->size;
+    return (uint32_t) ((uintptr_t) entry->value - 1);
+}
+
+/*!
+ * @brief compare_by_source orders edges by source, then by target (qsort callback)
+ */
+static int compare_by_source(const void *a, const void *b) {
+    const edge_t *first = a, *second = b;
+    if (first->source != second->source) return first->source < second->source ? -1 : 1;
+    return first->target < second->target ? -1 : (first->target > second->target);
+}
+
+/*!
+ * @brief compare_by_target orders edges by target, then by source (qsort callback)
+ */
+static int compare_by_target(const void *a, const void *b) {
+    const edge_t *first = a, *second = b;
+    if (first->target != second->target) return first->target < second->target ? -1 : 1;
+    return first->source < second->source ? -1 : (first->source > second->source);
+}
+
+/*!
+ * @brief read_edges reads the output file of the reducer (lines of "sender count:recipient ...") as edges between
+ * provisional ids
+ * @param output_file the output file
+ * @param index the index of addresses, filled with all addresses
+ * @param edge_count set to the number of edges
+ * @return the malloc'ed edges, NULL on error
+ */
+static edge_t *read_edges(char *output_file, hash_table_t *index, uint64_t *edge_count) {
+    FILE *output_fp = fopen(output_file, "r");
+    if (output_fp == NULL) return NULL;
+    size_t capacity = 1024;
+    edge_t *edges = malloc(sizeof(edge_t) * capacity);
+    *edge_count = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    while (edges != NULL && getline(&line, &line_size, output_fp) != -1) {
+        char *saveptr;
+        char *sender = strtok_r(line, " \n", &saveptr);
+        if (sender == NULL) continue;
+        uint32_t source = intern_address(index, sender);
+        char *item;
+        while (source != NO_NODE && (item = strtok_r(NULL, " \n", &saveptr)) != NULL) {
+            char *recipient;
+            uint32_t weight = strtoul(item, &recipient, 10);
+            if (*recipient != ':') continue;
+            if (*edge_count == capacity) {
+                capacity *= 2;
+                edge_t *grown = realloc(edges, sizeof(edge_t) * capacity);
+                if (grown == NULL) {
+                    free(edges);
+                    edges = NULL;
+                    break;
+                }
+                edges = grown;
+            }
+            edges[(*edge_count)++] = (edge_t) {source, intern_address(index, recipient + 1), weight};
+            if (edges[*edge_count - 1].target == NO_NODE) source = NO_NODE;
+        }
+        if (source == NO_NODE) {
+            free(edges);
+            edges = NULL;
+        }
+    }
+    free(line);
+    fclose(output_fp);
+    return edges;
+}
+
+/*!
+ * @brief fill_rows builds the offsets of compressed sparse rows from edges sorted by row
+ * @param edges the sorted edges
+ * @param edge_count the number of edges
+ * @param by_source true if rows are the sources of edges, false if they are their targets
+ * @param node_count the number of nodes
+ * @param offsets the node_count + 1 offsets to fill
+ */
+static void fill_rows(edge_t *edges, uint64_t edge_count, bool by_source, uint32_t node_count, uint64_t *offsets) {
+    memset(offsets, 0, sizeof(uint64_t) * (node_count + 1));
+    for (uint64_t i = 0; i < edge_count; i++) {
+        offsets[(by_source ? edges[i].source : edges[i].target) + 1]++;
+    }
+    for (uint32_t node = 0; node < node_count; node++) {
+        offsets[node + 1] += offsets[node];
+    }
+}
+
+/*!
+ * @brief build_graph loads the output file of the reducer into a graph
+ * @param graph the graph to build
+ * @param output_file the output file
+ * @return true on success, false else
+ */
+bool build_graph(graph_t *graph, char *output_file) {
+    memset(graph, 0, sizeof(graph_t));
+    arena_t arena;
+    init_arena(&arena);
+    hash_table_t *index = make_hash_table(1024);
+    if (index == NULL) return false;
+    index->arena = &arena;
+    uint64_t edge_count = 0;
+    edge_t *edges = read_edges(output_file, index, &edge_count);
+    hash_entry_t **entries = edges != NULL ? hash_table_sorted_entries(index) : NULL;
+    uint32_t node_count = index->size;
+    uint32_t *node_ids = malloc(sizeof(uint32_t) * (node_count + 1));
+    bool success = entries != NULL && node_ids != NULL;
+
+    // Final ids follow the alphabetical order of addresses
+    graph->node_count = node_count;
+    graph->edge_count = edge_count;
+    for (uint32_t node = 0; success && node < node_count; node++) {
+        node_ids[(uintptr_t) entries[node]->value - 1] = node;
+        graph->names_size += strlen(entries[node]->key) + 1;
+    }
+    if (success) {
+        graph->names = malloc(graph->names_size + 1);
+        graph->name_offsets = malloc(sizeof(uint64_t) * (node_count + 1));
+        graph->out_offsets = malloc(sizeof(uint64_t) * (node_count + 1));
+        graph->in_offsets = malloc(sizeof(uint64_t) * (node_count + 1));
+        graph->out_targets = malloc(sizeof(uint32_t) * (edge_count + 1));
+        graph->out_weights = malloc(sizeof(uint32_t) * (edge_count + 1));
+        graph->in_sources = malloc(sizeof(uint32_t) * (edge_count + 1));
+        graph->in_weights = malloc(sizeof(uint32_t) * (edge_count + 1));
+        success = graph->names != NULL && graph->name_offsets != NULL && graph->out_offsets != NULL &&
+                  graph->in_offsets != NULL && graph->out_targets != NULL && graph->out_weights != NULL &&
+                  graph->in_sources != NULL && graph->in_weights != NULL;
+    }
+    if (success) {
+        uint64_t offset = 0;
+        for (uint32_t node = 0; node < node_count; node++) {
+            graph->name_offsets[node] = offset;
+            size_t length = strlen(entries[node]->key) + 1;
+            memcpy(graph->names + offset, entries[node]->key, length);
+            offset += length;
+        }
+        for (uint64_t i = 0; i < edge_count; i++) {
+            edges[i].source = node_ids[edges[i].source];
+            edges[i].target = node_ids[edges[i].target];
+        }
+        qsort(edges, edge_count, sizeof(edge_t), compare_by_source);
+        fill_rows(edges, edge_count, true, node_count, graph->out_offsets);
+        for (uint64_t i = 0; i < edge_count; i++) {
+            graph->out_targets[i] = edges[i].target;
+            graph->out_weights[i] = edges[i].weight;
+        }
+        qsort(edges, edge_count, sizeof(edge_t), compare_by_target);
+        fill_rows(edges, edge_count, false, node_count, graph->in_offsets);
+        for (uint64_t i = 0; i < edge_count; i++) {
+            graph->in_sources[i] = edges[i].source;
+            graph->in_weights[i] = edges[i].weight;
+        }
+    }
+    free(node_ids);
+    free(entries);
+    free(edges);
+    clear_hash_table(index, NULL);
+    clear_arena(&arena);
+    if (!success) clear_graph(graph);
+    return success;
+}
+
+/*!
+ * @brief write_array writes an array to a snapshot
+ * @return true if the whole array was written, false else
+ */
+static bool write_array(FILE *snapshot, const void *array, size_t size) {
+    return size == 0 || fwrite(array, size, 1, snapshot) == 1;
+}
+
+/*!
+ * @brief save_graph_snapshot writes a graph to a snapshot file, that load_graph_snapshot maps back
+ * @param graph the graph
+ * @param snapshot_path the path of the snapshot
+ * @param output_file the output file the graph was built from
+ * @return true if the snapshot was written, false else
+ */
+bool save_graph_snapshot(graph_t *graph, char *snapshot_path, char *output_file) {
+    struct stat source;
+    if (stat(output_file, &source) == -1) return false;
+    snapshot_header_t header = {.version = GRAPH_SNAPSHOT_VERSION, .node_count = graph->node_count,
+                                .edge_count = graph->edge_count, .names_size = graph->names_size,
+                                .source_mtime = source.st_mtime, .source_size = source.st_size};
+    memcpy(header.magic, GRAPH_SNAPSHOT_MAGIC, sizeof(header.magic));
+    char temporary_path[STR_MAX_LEN];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", snapshot_path);
+    FILE *snapshot = fopen(temporary_path, "w");
+    if (snapshot == NULL) return false;
+    size_t rows_size = sizeof(uint64_t) * (graph->node_count + 1);
+    size_t edges_size = sizeof(uint32_t) * graph->edge_count;
+    bool success = write_array(snapshot, &header, sizeof(header)) &&
+                   write_array(snapshot, graph->name_offsets, sizeof(uint64_t) * graph->node_count) &&
+                   write_array(snapshot, graph->out_offsets, rows_size) &&
+                   write_array(snapshot, graph->in_offsets, rows_size) &&
+                   write_array(snapshot, graph->out_targets, edges_size) &&
+                   write_array(snapshot, graph->out_weights, edges_size) &&
+                   write_array(snapshot, graph->in_sources, edges_size) &&
+                   write_array(snapshot, graph->in_weights, edges_size) &&
+                   write_array(snapshot, graph->names, graph->names_size);
+    if (fclose(snapshot) != 0) success = false;
+    // Replace a previous snapshot atomically
+    if (success) success = rename(temporary_path, snapshot_path) == 0;
+    if (!success) remove(temporary_path);
+    return success;
+}
+
+/*!
+ * @brief load_graph_snapshot maps a snapshot written by save_graph_snapshot: the arrays of the graph point into the
+ * (read only) mapping, so loading costs no parsing
+ * @param graph the graph to load
+ * @param snapshot_path the path of the snapshot
+ * @param output_file the output file the graph must have been built from
+ * @return true if the snapshot was loaded, false if it does not exist, is invalid or is older than output_file
+ */
+bool load_graph_snapshot(graph_t *graph, char *snapshot_path, char *output_file) {
+    memset(graph, 0, sizeof(graph_t));
+    struct stat source, snapshot;
+    int fd = open(snapshot_path, O_RDONLY);
+    if (fd == -1) return false;
+    if (stat(output_file, &source) == -1 || fstat(fd, &snapshot) == -1 ||
+        (size_t) snapshot.st_size < sizeof(snapshot_header_t)) {
+        close(fd);
+        return false;
+    }
+    void *mapping = mmap(NULL, snapshot.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return false;
+    snapshot_header_t *header = mapping;
+    uint64_t rows_size = sizeof(uint64_t) * (header->node_count + 1);
+    uint64_t edges_size = sizeof(uint32_t) * header->edge_count;
+    uint64_t expected_size = sizeof(snapshot_header_t) + sizeof(uint64_t) * header->node_count + 2 * rows_size +
+                             4 * edges_size + header->names_size;
+    if (memcmp(header->magic, GRAPH_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != GRAPH_SNAPSHOT_VERSION || header->source_mtime != source.st_mtime ||
+        header->source_size != (uint64_t) source.st_size || expected_size != (uint64_t) snapshot.st_size) {
+        munmap(mapping, snapshot.st_size);
+        return false;
+    }
+    char *cursor = (char *) mapping + sizeof(snapshot_header_t);
+    graph->node_count = header->node_count;
+    graph->edge_count = header->edge_count;
+    graph->names_size = header->names_size;
+    graph->name_offsets = (uint64_t *) cursor;
+    cursor += sizeof(uint64_t) * header->node_count;
+    graph->out_offsets = (uint64_t *) cursor;
+    cursor += rows_size;
+    graph->in_offsets = (uint64_t *) cursor;
+    cursor += rows_size;
+    graph->out_targets = (uint32_t *) cursor;
+    cursor += edges_size;
+    graph->out_weights = (uint32_t *) cursor;
+    cursor += edges_size;
+    graph->in_sources = (uint32_t *) cursor;
+    cursor += edges_size;
+    graph->in_weights = (uint32_t *) cursor;
+    cursor += edges_size;
+    graph->names = cursor;
+    graph->mapping = mapping;
+    graph->mapping_size = snapshot.st_size;
+    return true;
+}
+
+/*!
+ * @brief clear_graph releases a graph (its arrays, or the snapshot they point into)
+ * @param graph the graph to release
+ */
+void clear_graph(graph_t *graph) {
+    if (graph->mapping != NULL) {
+        munmap(graph->mapping, graph->mapping_size);
+    } else {
+        free(graph->names);
+        free(graph->name_offsets);
+        free(graph->out_offsets);
+        free(graph->out_targets);
+        free(graph->out_weights);
+        free(graph->in_offsets);
+        free(graph->in_sources);
+        free(graph->in_weights);
+    }
+    free(graph->parents);
+    free(graph->queue);
+    memset(graph, 0, sizeof(graph_t));
+}
+
+/*!
+ * @brief node_name gets the address of a node
+ * @param graph the graph
+ * @param node the node id
+ * @return the address
+ */
+const char *node_name(graph_t *graph, uint32_t node) {
+    return graph->names + graph->name_offsets[node];
+}
+
+/*!
+ * @brief find_node looks for an address in the graph (binary search, as ids follow the alphabetical order)
+ * @param graph the graph
+ * @param address the address
+ * @return the node id, NO_NODE if the address is not in the graph
+ */
+uint32_t find_node(graph_t *graph, const char *address) {
+    uint32_t low = 0, high = graph->node_count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        int order = strcmp(node_name(graph, middle), address);
+        if (order == 0) return middle;
+        if (order < 0) low = middle + 1;
+        else high = middle;
+    }
+    return NO_NODE;
+}
+
+/*!
+ * @brief find_in_row looks for a node in a row of the graph (binary search, as rows are sorted by node id)
+ * @param nodes the node ids of the rows
+ * @param start the offset of the first edge of the row
+ * @param end the offset after the last edge of the row
+ * @param node the node to look for
+ * @return the offset of the edge to node, end if there is none
+ */
+static uint64_t find_in_row(uint32_t *nodes, uint64_t start, uint64_t end, uint32_t node) {
+    uint64_t low = start, high = end;
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (nodes[middle] == node) return middle;
+        if (nodes[middle] < node) low = middle + 1;
+        else high = middle;
+    }
+    return end;
+}
+
+/*!
+ * @brief edge_weight gets the number of messages from a sender to a recipient
+ * @param graph the graph
+ * @param sender the sender node
+ * @param recipient the recipient node
+ * @return the number of messages, 0 if there is none
+ */
+uint32_t edge_weight(graph_t *graph, uint32_t sender, uint32_t recipient) {
+    uint64_t end = graph->out_offsets[sender + 1];
+    uint64_t edge = find_in_row(graph->out_targets, graph->out_offsets[sender], end, recipient);
+    return edge == end ? 0 : graph->out_weights[edge];
+}
+
+/*!
+ * @brief compare_correspondents orders correspondents by decreasing messages exchanged, then by node id
+ */
+static int compare_correspondents(const void *a, const void *b) {
+    const correspondent_t *first = a, *second = b;
+    uint64_t first_total = (uint64_t) first->sent + first->received;
+    uint64_t second_total = (uint64_t) second->sent + second->received;
+    if (first_total != second_total) return first_total > second_total ? -1 : 1;
+    return first->node < second->node ? -1 : (first->node > second->node);
+}
+
+/*!
+ * @brief top_correspondents finds the correspondents a node exchanged the most messages with (sent and received),
+ * by merging its out and in rows (both sorted by node id)
+ * @param graph the graph
+ * @param node the node
+ * @param top the array receiving the correspondents
+ * @param k the size of top
+ * @return the number of correspondents in top
+ */
+size_t top_correspondents(graph_t *graph, uint32_t node, correspondent_t *top, size_t k) {
+    uint64_t out = graph->out_offsets[node], out_end = graph->out_offsets[node + 1];
+    uint64_t in = graph->in_offsets[node], in_end = graph->in_offsets[node + 1];
+    correspondent_t *all = malloc(sizeof(correspondent_t) * (out_end - out + in_end - in + 1));
+    if (all == NULL) return 0;
+    size_t count = 0;
+    while (out < out_end || in < in_end) {
+        if (in == in_end || (out < out_end && graph->out_targets[out] < graph->in_sources[in])) {
+            all[count++] = (correspondent_t) {graph->out_targets[out], graph->out_weights[out], 0};
+            out++;
+        } else if (out == out_end || graph->in_sources[in] < graph->out_targets[out]) {
+            all[count++] = (correspondent_t) {graph->in_sources[in], 0, graph->in_weights[in]};
+            in++;
+        } else {
+            all[count++] = (correspondent_t) {graph->out_targets[out], graph->out_weights[out], graph->in_weights[in]};
+            out++;
+            in++;
+        }
+    }
+    qsort(all, count, sizeof(correspondent_t), compare_correspondents);
+    if (count > k) count = k;
+    memcpy(top, all, sizeof(correspondent_t) * count);
+    free(all);
+    return count;
+}
+
+/*!
+ * @brief visit marks a node as reached from parent during the breadth first search of shortest_path
+ * @return true if the node was not reached before
+ */
+static bool visit(graph_t *graph, uint32_t node, uint32_t parent, uint32_t *queue_end) {
+    if (graph->parents[node] != NO_NODE) return false;
+    graph->parents[node] = parent;
+    graph->queue[(*queue_end)++] = node;
+    return true;
+}
+
+/*!
+ * @brief shortest_path finds a shortest chain of correspondents between two nodes (breadth first search, messages
+ * in both directions count as a link)
+ * @param graph the graph
+ * @param from the first node
+ * @param to the last node
+ * @param path the array receiving the nodes of the path, from first to last
+ * @param max_length the size of path
+ * @return the number of nodes of the path, 0 if there is no path (or it is longer than max_length)
+ */
+size_t shortest_path(graph_t *graph, uint32_t from, uint32_t to, uint32_t *path, size_t max_length) {
+    if (graph->parents == NULL) {
+        graph->parents = malloc(sizeof(uint32_t) * graph->node_count);
+        graph->queue = malloc(sizeof(uint32_t) * graph->node_count);
+        if (graph->parents == NULL || graph->queue == NULL) return 0;
+        memset(graph->parents, 0xff, sizeof(uint32_t) * graph->node_count);
+    }
+    uint32_t queue_start = 0, queue_end = 0;
+    visit(graph, from, from, &queue_end);
+    bool found = from == to;
+    while (!found && queue_start < queue_end) {
+        uint32_t node = graph->queue[queue_start++];
+        for (uint64_t i = graph->out_offsets[node]; !found && i < graph->out_offsets[node + 1]; i++) {
+            found = visit(graph, graph->out_targets[i], node, &queue_end) && graph->out_targets[i] == to;
+        }
+        for (uint64_t i = graph->in_offsets[node]; !found && i < graph->in_offsets[node + 1]; i++) {
+            found = visit(graph, graph->in_sources[i], node, &queue_end) && graph->in_sources[i] == to;
+        }
+    }
+    size_t length = 0;
+    if (found) {
+        for (uint32_t node = to; length <= max_length; node = graph->parents[node]) {
+            length++;
+            if (node == from) break;
+        }
+        if (length <= max_length) {
+            uint32_t node = to;
+            for (size_t i = length; i > 0; i--) {
+                path[i - 1] = node;
+                node = graph->parents[node];
+            }
+        } else {
+            length = 0;
+        }
+    }
+    // Only reset the reached nodes, so that a search costs the size of the explored part of the graph
+    for (uint32_t i = 0; i < queue_end; i++) {
+        graph->parents[graph->queue[i]] = NO_NODE;
+    }
+    return length;
+}
@@ -0,0 +1,51 @@
+#ifndef A2022_GRAPH_H
+#define A2022_GRAPH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define GRAPH_SNAPSHOT_MAGIC "A22GRAPH"
+#define GRAPH_SNAPSHOT_VERSION 1
+#define NO_NODE UINT32_MAX
+
+// The communication graph of the output file in compressed sparse rows: node ids follow the alphabetical order of
+// addresses, the edges of a node are contiguous and sorted by the id of the other node. Edges are stored twice,
+// by sender (out) and by recipient (in).
+typedef struct {
+    uint32_t node_count;
+    uint64_t edge_count;
+    char *names; // '\0' terminated addresses, by node id
+    uint64_t names_size;
+    uint64_t *name_offsets; // Offset of the address of each node in names
+    uint64_t *out_offsets; // node_count + 1 offsets in out_targets/out_weights
+    uint32_t *out_targets;
+    uint32_t *out_weights;
+    uint64_t *in_offsets; // node_count + 1 offsets in in_sources/in_weights
+    uint32_t *in_sources;
+    uint32_t *in_weights;
+    void *mapping; // The snapshot the arrays point into, NULL if they are malloc'ed
+    size_t mapping_size;
+    uint32_t *parents; // Scratch arrays of shortest_path (node_count entries, allocated on first use)
+    uint32_t *queue;
+} graph_t;
+
+// A correspondent of a node: messages sent to it and received from it
+typedef struct {
+    uint32_t node;
+    uint32_t sent;
+    uint32_t received;
+} correspondent_t;
+
+bool build_graph(graph_t *graph, char *output_file);
+bool save_graph_snapshot(graph_t *graph, char *snapshot_path, char *output_file);
+bool load_graph_snapshot(graph_t *graph, char *snapshot_path, char *output_file);
+void clear_graph(graph_t *graph);
+
+const char *node_name(graph_t *graph, uint32_t node);
+uint32_t find_node(graph_t *graph, const char *address);
+uint32_t edge_weight(graph_t *graph, uint32_t sender, uint32_t recipient);
+size_t top_correspondents(graph_t *graph, uint32_t node, correspondent_t *top, size_t k);
+size_t shortest_path(graph_t *graph, uint32_t from, uint32_t to, uint32_t *path, size_t max_length);
+
+#endif //A2022_GRAPH_H
@@ -0,0 +1,134 @@
+#include "hash_table.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utility.h"
+
+/*!
+ * @brief make_hash_table allocates an empty string keyed hash table (separate chaining)
+ * @param initial_buckets the expected number of keys (rounded up to a power of 2)
+ * @return a pointer to the malloc'ed table, NULL if allocation failed
+ */
+hash_table_t *make_hash_table(size_t initial_buckets) {
+    hash_table_t *table = malloc(sizeof(hash_table_t));
+    if (table == NULL) return NULL;
+    table->bucket_count = 16;
+    while (table->bucket_count < initial_buckets) table->bucket_count <<= 1;
+    table->size = 0;
+    table->arena = NULL;
+    table->buckets = calloc(table->bucket_count, sizeof(hash_entry_t *));
+    if (table->buckets == NULL) {
+        free(table);
+        return NULL;
+    }
+    return table;
+}
+
+/*!
+ * @brief clear_hash_table releases a table, its entries and keys (unless they belong to the arena of the table)
+ * @param table the table to release
+ * @param free_value the function used to release each value, NULL if values must not be released
+ */
+void clear_hash_table(hash_table_t *table, void (*free_value)(void *)) {
+    if (table == NULL) return;
+    for (size_t i = 0; i < table->bucket_count; i++) {
+        hash_entry_t *entry = table->buckets[i];
+        while (entry != NULL) {
+            hash_entry_t *next = entry->next;
+            if (free_value != NULL) free_value(entry->value);
+            if (table->arena == NULL) {
+                free(entry->key);
+                free(entry);
+            }
+            entry = next;
+        }
+    }
+    free(table->buckets);
+    free(table);
+}
+
+/*!
+ * @brief grow_hash_table doubles the number of buckets of a table and redistributes its entries
+ * @param table the table to grow
+ */
+static void grow_hash_table(hash_table_t *table) {
+    size_t new_count = table->bucket_count * 2;
+    hash_entry_t **new_buckets = calloc(new_count, sizeof(hash_entry_t *));
+    if (new_buckets == NULL) return; // Keep working with longer chains
+    for (size_t i = 0; i < table->bucket_count; i++) {
+        hash_entry_t *entry = table->buckets[i];
+        while (entry != NULL) {
+            hash_entry_t *next = entry->next;
+            size_t bucket = entry->hash & (new_count - 1);
+            entry->next = new_buckets[bucket];
+            new_buckets[bucket] = entry;
+            entry = next;
+        }
+    }
+    free(table->buckets);
+    table->buckets = new_buckets;
+    table->bucket_count = new_count;
+}
+
+/*!
+ * @brief hash_table_find looks for a key in a table, and optionally adds it
+ * @param table the table to look into
+ * @param key the key to look for (copied into the table when added)
+ * @param create if true, the key is added with a NULL value when it is not found
+ * @return a pointer to the entry of the key, NULL if not found (and not created)
+ */
+hash_entry_t *hash_table_find(hash_table_t *table, const char *key, bool create) {
+    if (table == NULL || key == NULL) return NULL;
+    size_t length = strlen(key);
+    uint64_t hash = hash_bytes(key, length);
+    hash_entry_t *entry = table->buckets[hash & (table->bucket_count - 1)];
+    while (entry != NULL) {
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) return entry;
+        entry = entry->next;
+    }
+    if (!create) return NULL;
+
+    if (table->size >= table->bucket_count) grow_hash_table(table);
+    entry = arena_alloc(table->arena, sizeof(hash_entry_t));
+    if (entry == NULL) return NULL;
+    entry->key = arena_alloc(table->arena, length + 1);
+    if (entry->key == NULL) {
+        if (table->arena == NULL) free(entry);
+        return NULL;
+    }
+    memcpy(entry->key, key, length + 1);
+    entry->hash = hash;
+    entry->value = NULL;
+    size_t bucket = hash & (table->bucket_count - 1);
+    entry->next = table->buckets[bucket];
+    table->buckets[bucket] = entry;
+    table->size++;
+    return entry;
+}
+
+/*!
+ * @brief compare_entries orders hash entries by key
+ */
+static int compare_entries(const void *a, const void *b) {
+    return strcmp((*(hash_entry_t **) a)->key, (*(hash_entry_t **) b)->key);
+}
+
+/*!
+ * @brief hash_table_sorted_entries lists all entries of a table in alphabetical order of their keys
+ * @param table the table to list
+ * @return a malloc'ed array of table->size entries pointers, NULL if allocation failed
+ */
+hash_entry_t **hash_table_sorted_entries(hash_table_t *table) {
+    if (table == NULL) return NULL;
+    hash_entry_t **entries = malloc(sizeof(hash_entry_t *) * (table->size + 1));
+    if (entries == NULL) return NULL;
+    size_t count = 0;
+    for (size_t i = 0; i < table->bucket_count; i++) {
+        for (hash_entry_t *entry = table->buckets[i]; entry != NULL; entry = entry->next) {
+            entries[count++] = entry;
+        }
+    }
+    qsort(entries, count, sizeof(hash_entry_t *), compare_entries);
+    return entries;
+}
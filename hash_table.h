@@ -0,0 +1,29 @@
+#ifndef A2022_HASH_TABLE_H
+#define A2022_HASH_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+typedef struct _hash_entry {
+    char *key;
+    uint64_t hash;
+    void *value;
+    struct _hash_entry *next;
+} hash_entry_t;
+
+typedef struct {
+    hash_entry_t **buckets;
+    size_t bucket_count; // Always a power of 2
+    size_t size;
+    arena_t *arena; // Entries and keys are allocated from this arena when not NULL (and released with it)
+} hash_table_t;
+
+hash_table_t *make_hash_table(size_t initial_buckets);
+void clear_hash_table(hash_table_t *table, void (*free_value)(void *));
+hash_entry_t *hash_table_find(hash_table_t *table, const char *key, bool create);
+hash_entry_t **hash_table_sorted_entries(hash_table_t *table);
+
+#endif //A2022_HASH_TABLE_H
@@ -0,0 +1,167 @@
+#include "header_parser.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static const struct {
+    char *name;
+    header_field_t field;
+} known_fields[] = {
+        {"from", HEADER_FROM},
+        {"to", HEADER_TO},
+        {"cc", HEADER_CC},
+        {"bcc", HEADER_BCC},
+        {"message-id", HEADER_MESSAGE_ID},
+        {"date", HEADER_DATE},
+};
+
+/*!
+ * @brief identify_field finds which field of interest a header field name is (case insensitive)
+ * @param name the field name, '\0' terminated
+ * @return the field, HEADER_OTHER if it is not a field of interest
+ */
+static header_field_t identify_field(char *name) {
+    for (size_t i = 0; i < sizeof(known_fields) / sizeof(known_fields[0]); i++) {
+        if (strcasecmp(name, known_fields[i].name) == 0) return known_fields[i].field;
+    }
+    return HEADER_OTHER;
+}
+
+/*!
+ * @brief append_value appends characters to the value of the current field
+ * @param parser the parser
+ * @param data the characters to append
+ * @param length the number of characters to append
+ */
+static void append_value(header_parser_t *parser, const char *data, size_t length) {
+    if (parser->value_length + length > HEADER_VALUE_MAX_LEN) {
+        length = HEADER_VALUE_MAX_LEN - parser->value_length;
+    }
+    if (parser->value_length + length + 1 > parser->value_capacity) {
+        size_t capacity = parser->value_capacity * 2;
+        while (capacity < parser->value_length + length + 1) capacity *= 2;
+        char *value = realloc(parser->value, capacity);
+        if (value == NULL) return;
+        parser->value = value;
+        parser->value_capacity = capacity;
+    }
+    memcpy(parser->value + parser->value_length, data, length);
+    parser->value_length += length;
+}
+
+/*!
+ * @brief flush_field hands the completed field of interest (if any) to the parser callback
+ * @param parser the parser
+ * @return false if the callback requested to stop parsing, true else
+ */
+static bool flush_field(header_parser_t *parser) {
+    if (parser->status != IN_DEST_FIELD) return true;
+    parser->status = OUT_OF_DEST_FIELD;
+    parser->value[parser->value_length] = '\0';
+    return parser->callback(parser->field, parser->value, parser->value_length, parser->context);
+}
+
+/*!
+ * @brief init_header_parser prepares a parser for the header section of a new e-mail
+ * @param parser the parser to initialize
+ * @param callback the function called with each field of interest (From, To, Cc, Bcc, Message-ID, Date)
+ * @param context an opaque pointer passed to callback
+ */
+void init_header_parser(header_parser_t *parser, header_callback_t callback, void *context) {
+    parser->state = AT_LINE_START;
+    parser->status = OUT_OF_DEST_FIELD;
+    parser->field = HEADER_OTHER;
+    parser->name_length = 0;
+    parser->value_capacity = 1024;
+    parser->value = malloc(parser->value_capacity);
+    parser->value_length = 0;
+    parser->callback = callback;
+    parser->context = context;
+    if (parser->value == NULL) parser->state = END_OF_HEADERS;
+}
+
+/*!
+ * @brief clear_header_parser releases the resources of a parser
+ * @param parser the parser
+ */
+void clear_header_parser(header_parser_t *parser) {
+    free(parser->value);
+    parser->value = NULL;
+}
+
+/*!
+ * @brief header_parser_feed runs the header state machine on the next chunk of an e-mail. Chunks may be cut
+ * anywhere (even inside a field name or a CRLF). Folded lines (starting with a space or a tab, RFC 5322 2.2.3) are
+ * appended to the current field, and each field of interest is handed to the callback once its last line has been
+ * read. Parsing ends at the empty line separating the header section from the body.
+ * @param parser the parser
+ * @param chunk the next bytes of the e-mail
+ * @param length the number of bytes in chunk
+ * @return true once the header section is over (or the callback stopped the parsing): next chunks are not needed
+ */
+bool header_parser_feed(header_parser_t *parser, const char *chunk, size_t length) {
+    size_t i = 0;
+    while (i < length && parser->state != END_OF_HEADERS) {
+        char c = chunk[i];
+        switch (parser->state) {
+            case AT_LINE_START:
+                if (c == ' ' || c == '\t') {
+                    // Folded line: continuation of the current field
+                    parser->state = IN_FIELD_VALUE;
+                    continue;
+                }
+                if (c == '\r') break;
+                if (!flush_field(parser) || c == '\n') {
+                    parser->state = END_OF_HEADERS;
+                    break;
+                }
+                parser->name_length = 0;
+                parser->state = IN_FIELD_NAME;
+                continue;
+            case IN_FIELD_NAME:
+                if (c == ':') {
+                    while (parser->name_length > 0 &&
+                           (parser->name[parser->name_length - 1] == ' ' || parser->name[parser->name_length - 1] == '\t')) {
+                        parser->name_length--;
+                    }
+                    parser->name[parser->name_length] = '\0';
+                    parser->field = identify_field(parser->name);
+                    parser->status = parser->field == HEADER_OTHER ? OUT_OF_DEST_FIELD : IN_DEST_FIELD;
+                    parser->value_length = 0;
+                    parser->state = IN_FIELD_VALUE;
+                } else if (c == '\n') {
+                    // Not a field (e.g. mbox "From " separator): ignore the line
+                    parser->state = AT_LINE_START;
+                } else if (c != '\r' && parser->name_length < HEADER_NAME_LEN - 1) {
+                    parser->name[parser->name_length++] = c;
+                }
+                break;
+            case IN_FIELD_VALUE: {
+                // Copy up to the end of the line (or of the chunk) at once
+                const char *end_of_line = memchr(chunk + i, '\n', length - i);
+                size_t segment = end_of_line == NULL ? length - i : (size_t) (end_of_line - (chunk + i));
+                if (parser->status == IN_DEST_FIELD) append_value(parser, chunk + i, segment);
+                i += segment;
+                if (end_of_line != NULL) parser->state = AT_LINE_START;
+                break;
+            }
+            case END_OF_HEADERS:
+                break;
+        }
+        i++;
+    }
+    return parser->state == END_OF_HEADERS;
+}
+
+/*!
+ * @brief header_parser_finish ends the parsing at the end of the e-mail (needed when it has no body, to hand the last
+ * field to the callback)
+ * @param parser the parser
+ */
+void header_parser_finish(header_parser_t *parser) {
+    if (parser->state != END_OF_HEADERS) {
+        flush_field(parser);
+        parser->state = END_OF_HEADERS;
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef A2022_HEADER_PARSER_H
+#define A2022_HEADER_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Longest header field name kept by the parser (longer names are truncated, hence never match a known field)
+#define HEADER_NAME_LEN 32
+// Longest unfolded field value kept by the parser (longer values are truncated)
+#define HEADER_VALUE_MAX_LEN (1024 * 1024)
+
+typedef enum {
+    HEADER_FROM,
+    HEADER_TO,
+    HEADER_CC,
+    HEADER_BCC,
+    HEADER_MESSAGE_ID,
+    HEADER_DATE,
+    HEADER_OTHER,
+} header_field_t;
+
+// Used to track status in e-mail (for multi lines To, Cc, and Bcc fields)
+typedef enum {IN_DEST_FIELD, OUT_OF_DEST_FIELD} read_status_t;
+
+typedef enum {AT_LINE_START, IN_FIELD_NAME, IN_FIELD_VALUE, END_OF_HEADERS} header_state_t;
+
+// Called for each complete (unfolded) field of interest, value is '\0' terminated and may be modified.
+// Returning false stops the parsing.
+typedef bool (*header_callback_t)(header_field_t field, char *value, size_t length, void *context);
+
+typedef struct {
+    header_state_t state;
+    read_status_t status;
+    header_field_t field;
+    char name[HEADER_NAME_LEN];
+    size_t name_length;
+    char *value;
+    size_t value_length;
+    size_t value_capacity;
+    header_callback_t callback;
+    void *context;
+} header_parser_t;
+
+void init_header_parser(header_parser_t *parser, header_callback_t callback, void *context);
+void clear_header_parser(header_parser_t *parser);
+bool header_parser_feed(header_parser_t *parser, const char *chunk, size_t length);
+void header_parser_finish(header_parser_t *parser);
+
+#endif //A2022_HEADER_PARSER_H
@@ -0,0 +1,117 @@
+#define _GNU_SOURCE // memfd_create
+
+#include "intermediates.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "global_defs.h"
+#include "utility.h"
+
+#define MEMORY_INTERMEDIATES_COUNT 2
+
+static intermediates_mode_t intermediates_mode = INTERMEDIATES_FILES;
+static durability_t durability_level = DURABILITY_PHASE;
+static char *memory_names[MEMORY_INTERMEDIATES_COUNT] = {STEP1_OUTPUT, STEP2_OUTPUT};
+static int memory_fds[MEMORY_INTERMEDIATES_COUNT] = {-1, -1};
+
+/*!
+ * @brief init_intermediates sets where intermediate results are kept and how durable they are, for the current process
+ * and the workers it forks later. In memory mode, step1_output and step2_output are anonymous memory files (memfd)
+ * inherited by the workers, so this must be called before any worker is forked.
+ * @param mode files in the temporary directory, or memory files
+ * @param durability the durability level of the run
+ * @return true on success, false if memory files could not be created (files mode is then used)
+ */
+bool init_intermediates(intermediates_mode_t mode, durability_t durability) {
+    durability_level = durability;
+    intermediates_mode = mode;
+    if (mode != INTERMEDIATES_MEMORY) return true;
+    for (int i = 0; i < MEMORY_INTERMEDIATES_COUNT; i++) {
+        memory_fds[i] = memfd_create(memory_names[i], 0);
+        if (memory_fds[i] == -1) {
+            perror("Could not create in memory intermediates");
+            close_intermediates();
+            intermediates_mode = INTERMEDIATES_FILES;
+            return false;
+        }
+    }
+    return true;
+}
+
+/*!
+ * @brief close_intermediates releases the memory files of the intermediate results, if any
+ */
+void close_intermediates() {
+    for (int i = 0; i < MEMORY_INTERMEDIATES_COUNT; i++) {
+        if (memory_fds[i] != -1) close(memory_fds[i]);
+        memory_fds[i] = -1;
+    }
+}
+
+/*!
+ * @brief intermediates_in_memory tells if intermediate results are kept in memory files
+ * @return true in memory mode, false in files mode
+ */
+bool intermediates_in_memory() {
+    return intermediates_mode == INTERMEDIATES_MEMORY;
+}
+
+/*!
+ * @brief durability_at_least tells if the durability level of the run includes a level
+ * @param level the level to test
+ * @return true if files must be synced at this level, false else
+ */
+bool durability_at_least(durability_t level) {
+    return durability_level >= level;
+}
+
+/*!
+ * @brief intermediate_path builds the path where an intermediate result can be opened (with open or fopen, by any
+ * process of the run). In memory mode, it is the /proc/self/fd link of the inherited memory file.
+ * @param temp_dir the temporary directory
+ * @param name the name of the intermediate result (STEP1_OUTPUT or STEP2_OUTPUT)
+ * @param path the resulting path (STR_MAX_LEN long)
+ * @return a pointer to path, NULL on error
+ */
+char *intermediate_path(char *temp_dir, char *name, char *path) {
+    if (name == NULL || path == NULL) return NULL;
+    for (int i = 0; intermediates_mode == INTERMEDIATES_MEMORY && i < MEMORY_INTERMEDIATES_COUNT; i++) {
+        if (memory_fds[i] != -1 && strcmp(memory_names[i], name) == 0) {
+            snprintf(path, STR_MAX_LEN, "/proc/self/fd/%d", memory_fds[i]);
+            return path;
+        }
+    }
+    return concat_path(temp_dir, name, path);
+}
+
+/*!
+ * @brief sync_file forces the data of a file to disk (fdatasync) if the durability level of the run requires it
+ * @param path the path to the file
+ * @param level the level from which the file must be synced
+ * @return true if the file was synced or did not need to be, false on error
+ */
+bool sync_file(char *path, durability_t level) {
+    if (durability_level < level) return true;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return false;
+    bool synced = fdatasync(fd) == 0;
+    close(fd);
+    return synced;
+}
+
+/*!
+ * @brief sync_intermediate forces an intermediate result and the temporary directory to disk at the end of a phase,
+ * in files mode with a durability level of at least DURABILITY_PHASE (memory files are scratch data and never synced)
+ * @param temp_dir the temporary directory
+ * @param name the name of the intermediate result
+ */
+void sync_intermediate(char *temp_dir, char *name) {
+    if (intermediates_mode == INTERMEDIATES_MEMORY || !durability_at_least(DURABILITY_PHASE)) return;
+    char path[STR_MAX_LEN];
+    if (intermediate_path(temp_dir, name, path) != NULL) sync_file(path, DURABILITY_PHASE);
+    sync_temporary_files(temp_dir);
+}
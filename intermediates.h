@@ -0,0 +1,24 @@
+#ifndef A2022_INTERMEDIATES_H
+#define A2022_INTERMEDIATES_H
+
+#include <stdbool.h>
+
+// Names of the intermediate results in the temporary directory
+#define STEP1_OUTPUT "step1_output"
+#define STEP2_OUTPUT "step2_output"
+
+// Where the intermediate results (per-user listings, step1_output, step2_output) are kept
+typedef enum {INTERMEDIATES_FILES, INTERMEDIATES_MEMORY} intermediates_mode_t;
+
+// When files are forced to disk: never, at the end of each phase, or also after each record and for the output file
+typedef enum {DURABILITY_NONE, DURABILITY_PHASE, DURABILITY_FULL} durability_t;
+
+bool init_intermediates(intermediates_mode_t mode, durability_t durability);
+void close_intermediates();
+bool intermediates_in_memory();
+bool durability_at_least(durability_t level);
+char *intermediate_path(char *temp_dir, char *name, char *path);
+bool sync_file(char *path, durability_t level);
+void sync_intermediate(char *temp_dir, char *name);
+
+#endif //A2022_INTERMEDIATES_H
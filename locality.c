@@ -0,0 +1,151 @@
+#include "locality.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+
+#include "global_defs.h"
+#include "utility.h"
+
+// Cleared once FIEMAP fails on a file system that does not implement it, so that later files are not opened for it
+static bool fiemap_available = true;
+
+// A line of the located step1_output
+typedef struct {
+    uint64_t physical;
+    uint64_t inode;
+    char *path;
+    size_t length; // With the '\n'
+} located_file_t;
+
+/*!
+ * @brief first_physical_byte finds where the data of a file starts on its device
+ * @param path the path of the file
+ * @return the physical offset of its first extent, 0 if it has none or FIEMAP is not available
+ */
+static uint64_t first_physical_byte(char *path) {
+    if (!fiemap_available) return 0;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return 0;
+    struct {
+        struct fiemap map;
+        struct fiemap_extent extent;
+    } request;
+    memset(&request, 0, sizeof(request));
+    request.map.fm_length = FIEMAP_MAX_OFFSET;
+    request.map.fm_extent_count = 1;
+    uint64_t physical = 0;
+    if (ioctl(fd, FS_IOC_FIEMAP, &request.map) == -1) {
+        fiemap_available = false;
+    } else if (request.map.fm_mapped_extents > 0) {
+        physical = request.extent.fe_physical;
+    }
+    close(fd);
+    return physical;
+}
+
+/*!
+ * @brief write_located_file writes a file to a listing of the first step, prefixed with its locality keys
+ * @param listing the listing
+ * @param directory the directory of the file
+ * @param name the name of the file
+ * @param inode its inode number (from readdir)
+ */
+void write_located_file(FILE *listing, char *directory, char *name, ino_t inode) {
+    char path[STR_MAX_LEN];
+    snprintf(path, STR_MAX_LEN, "%s/%s", directory, name);
+    fprintf(listing, "%" PRIu64 " %" PRIu64 " %s\n", first_physical_byte(path), (uint64_t) inode, path);
+}
+
+/*!
+ * @brief compare_located_files orders files by physical offset, then by inode number (qsort callback)
+ * @param a a located_file_t pointer
+ * @param b a located_file_t pointer
+ * @return a negative value if a comes first, positive if b comes first, 0 if equal
+ */
+static int compare_located_files(const void *a, const void *b) {
+    const located_file_t *file_a = a, *file_b = b;
+    if (file_a->physical != file_b->physical) return file_a->physical < file_b->physical ? -1 : 1;
+    if (file_a->inode != file_b->inode) return file_a->inode < file_b->inode ? -1 : 1;
+    return 0;
+}
+
+/*!
+ * @brief order_files_list sorts a located step1_output by physical offset and inode number, and removes the keys
+ * @param step1_path the path of step1_output, with lines "physical inode path"
+ * @return true if step1_output was rewritten, false on error (it then still holds the keys)
+ */
+bool order_files_list(char *step1_path) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int fd = open(step1_path, O_RDWR);
+    struct stat sb;
+    if (fd == -1 || fstat(fd, &sb) == -1) {
+        perror("Could not open step1_output");
+        if (fd != -1) close(fd);
+        return false;
+    }
+
+    // 1. Read step1_output and split its lines
+    char *listing = malloc(sb.st_size + 1);
+    uint64_t count = 0;
+    ssize_t bytes_read = 0;
+    for (off_t offset = 0; listing != NULL && offset < sb.st_size; offset += bytes_read) {
+        bytes_read = pread(fd, listing + offset, sb.st_size - offset, offset);
+        if (bytes_read <= 0) {
+            free(listing);
+            listing = NULL;
+        }
+    }
+    if (listing != NULL) {
+        listing[sb.st_size] = '\n';
+        for (off_t i = 0; i < sb.st_size; i++) {
+            if (listing[i] == '\n') count++;
+        }
+    }
+    located_file_t *files = listing == NULL ? NULL : malloc(sizeof(located_file_t) * (count + 1));
+    char *ordered = files == NULL ? NULL : malloc(sb.st_size + 1);
+    if (ordered == NULL) {
+        fprintf(stderr, "Not enough memory to order step1_output\n");
+        free(listing);
+        free(files);
+        close(fd);
+        return false;
+    }
+    uint64_t located = 0;
+    char *line = listing;
+    for (uint64_t i = 0; i < count; i++) {
+        char *end = strchr(line, '\n');
+        files[i].physical = strtoull(line, &line, 10);
+        files[i].inode = strtoull(line, &line, 10);
+        if (*line == ' ') line++;
+        files[i].path = line;
+        files[i].length = end + 1 - line;
+        if (files[i].physical != 0) located++;
+        line = end + 1;
+    }
+
+    // 2. Sort the files, and write their paths back
+    qsort(files, count, sizeof(located_file_t), compare_located_files);
+    size_t length = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        memcpy(ordered + length, files[i].path, files[i].length);
+        length += files[i].length;
+    }
+    bool success = pwrite_all(fd, ordered, length, 0) && ftruncate(fd, (off_t) length) == 0;
+    if (!success) perror("Error writing ordered step1_output");
+    close(fd);
+    free(ordered);
+    free(files);
+    free(listing);
+    printf("Step 1 locality order: %" PRIu64 " files (%" PRIu64 " with a physical extent) in %.3f ms\n", count,
+           located, elapsed_ms(&start));
+    return success;
+}
@@ -0,0 +1,20 @@
+#ifndef A2022_LOCALITY_H
+#define A2022_LOCALITY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/*
+ * Physical locality order of step1_output: readdir order jumps around the disk when the page cache is cold. With the
+ * locality order, the mappers of the first step write each file as "physical inode path", where physical is the
+ * first physical byte of the file on its device (FIEMAP, 0 where it is not available, e.g. NFS or tmpfs) and inode
+ * its inode number. Once step1_output is complete, it is sorted by (physical, inode) and the keys are removed, so the
+ * files analysis reads the e-mails in the order of the disk.
+ */
+
+void write_located_file(FILE *listing, char *directory, char *name, ino_t inode);
+bool order_files_list(char *step1_path);
+
+#endif //A2022_LOCALITY_H
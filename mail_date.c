@@ -0,0 +1,238 @@
+#include "mail_date.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+// Time zones of RFC 2822 given by name (obsolete syntax), with their offset to UTC in minutes
+static const struct {
+    char *name;
+    int offset;
+} zone_names[] = {
+        {"UT", 0}, {"GMT", 0}, {"Z", 0},
+        {"EST", -5 * 60}, {"EDT", -4 * 60}, {"CST", -6 * 60}, {"CDT", -5 * 60},
+        {"MST", -7 * 60}, {"MDT", -6 * 60}, {"PST", -8 * 60}, {"PDT", -7 * 60},
+};
+
+/*!
+ * @brief days_from_civil counts the days from 1970-01-01 to a date of the proleptic Gregorian calendar
+ * @param year the year
+ * @param month the month (1 to 12)
+ * @param day the day of the month (1 to 31)
+ * @return the number of days, negative before 1970
+ */
+int64_t days_from_civil(int64_t year, unsigned month, unsigned day) {
+    // Years start in March, so that the leap day is the last day of the year
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    unsigned year_of_era = (unsigned) (year - era * 400);
+    unsigned day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    unsigned day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + (int64_t) day_of_era - 719468;
+}
+
+/*!
+ * @brief civil_from_days gives the date of the proleptic Gregorian calendar of a number of days from 1970-01-01
+ * @param days the number of days, negative before 1970
+ * @param year set to the year
+ * @param month set to the month (1 to 12)
+ * @param day set to the day of the month (1 to 31)
+ */
+void civil_from_days(int64_t days, int64_t *year, unsigned *month, unsigned *day) {
+    days += 719468;
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    unsigned day_of_era = (unsigned) (days - era * 146097);
+    unsigned year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    unsigned day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    unsigned march_month = (5 * day_of_year + 2) / 153;
+    *day = day_of_year - (153 * march_month + 2) / 5 + 1;
+    *month = march_month < 10 ? march_month + 3 : march_month - 9;
+    *year = (int64_t) year_of_era + era * 400 + (*month <= 2);
+}
+
+/*!
+ * @brief read_number reads a number of at most max_digits digits
+ * @param cursor the position to read from, moved past the digits
+ * @param max_digits the maximum number of digits
+ * @param digits set to the number of digits read
+ * @return the number
+ */
+static unsigned read_number(const char **cursor, unsigned max_digits, unsigned *digits) {
+    unsigned value = 0;
+    *digits = 0;
+    while (*digits < max_digits && isdigit((unsigned char) **cursor)) {
+        value = value * 10 + (**cursor - '0');
+        (*cursor)++;
+        (*digits)++;
+    }
+    return value;
+}
+
+/*!
+ * @brief read_month reads an English month abbreviation (case insensitive)
+ * @param cursor the position to read from, moved past the month
+ * @return the month (1 to 12), 0 if there is no month at cursor
+ */
+static unsigned read_month(const char **cursor) {
+    static const char months[] = "janfebmaraprmayjunjulaugsepoctnovdec";
+    char name[3];
+    for (int i = 0; i < 3; i++) {
+        if (!isalpha((unsigned char) (*cursor)[i])) return 0;
+        name[i] = (char) tolower((unsigned char) (*cursor)[i]);
+    }
+    for (unsigned month = 0; month < 12; month++) {
+        if (memcmp(months + 3 * month, name, 3) == 0) {
+            *cursor += 3;
+            while (isalpha((unsigned char) **cursor)) (*cursor)++; // Full month names
+            return month + 1;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief read_zone reads a time zone: numeric offset (+HHMM or -HHMM) or name. A missing or unknown zone is UTC.
+ * @param cursor the position to read from
+ * @return the offset to UTC in minutes
+ */
+static int read_zone(const char *cursor) {
+    while (*cursor == ' ' || *cursor == '\t') cursor++;
+    if (*cursor == '+' || *cursor == '-') {
+        int sign = *cursor == '-' ? -1 : 1;
+        cursor++;
+        unsigned digits;
+        unsigned offset = read_number(&cursor, 4, &digits);
+        return digits == 4 ? sign * (int) (offset / 100 * 60 + offset % 100) : 0;
+    }
+    size_t length = 0;
+    while (isalpha((unsigned char) cursor[length])) length++;
+    for (size_t i = 0; i < sizeof(zone_names) / sizeof(zone_names[0]); i++) {
+        if (strlen(zone_names[i].name) == length && strncasecmp(cursor, zone_names[i].name, length) == 0) {
+            return zone_names[i].offset;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief parse_mail_date reads the value of a Date header field (RFC 2822: "[Mon, ]14 May 2001 16:39[:00] -0700",
+ * with the obsolete two digits years and zone names), without the locale and time zone lookups of strptime/mktime
+ * @param value the field value
+ * @param timestamp set to the date as seconds since 1970-01-01 UTC
+ * @return true if value is a date, false else
+ */
+bool parse_mail_date(const char *value, int64_t *timestamp) {
+    const char *cursor = value;
+    unsigned digits;
+    while (*cursor == ' ' || *cursor == '\t') cursor++;
+    // Optional day of the week
+    if (isalpha((unsigned char) *cursor)) {
+        while (isalpha((unsigned char) *cursor)) cursor++;
+        if (*cursor == ',') cursor++;
+        while (*cursor == ' ' || *cursor == '\t') cursor++;
+    }
+    unsigned day = read_number(&cursor, 2, &digits);
+    if (digits == 0 || day < 1 || day > 31) return false;
+    while (*cursor == ' ' || *cursor == '-') cursor++;
+    unsigned month = read_month(&cursor);
+    if (month == 0) return false;
+    while (*cursor == ' ' || *cursor == '-') cursor++;
+    int64_t year = read_number(&cursor, 4, &digits);
+    if (digits == 2) {
+        year += year < 50 ? 2000 : 1900;
+    } else if (digits == 3) {
+        year += 1900;
+    } else if (digits != 4) {
+        return false;
+    }
+    while (*cursor == ' ') cursor++;
+    unsigned hour = read_number(&cursor, 2, &digits);
+    if (digits == 0 || hour > 23 || *cursor++ != ':') return false;
+    unsigned minute = read_number(&cursor, 2, &digits);
+    if (digits != 2 || minute > 59) return false;
+    unsigned second = 0;
+    if (*cursor == ':') {
+        cursor++;
+        second = read_number(&cursor, 2, &digits);
+        if (digits != 2 || second > 60) return false;
+    }
+    *timestamp = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second -
+                 read_zone(cursor) * 60;
+    return true;
+}
+
+/*!
+ * @brief parse_iso_date reads a date: YYYY-MM-DD, optionally followed by THH:MM or THH:MM:SS (UTC)
+ * @param value the date
+ * @param timestamp set to the date as seconds since 1970-01-01 UTC
+ * @return true if value is a date, false else
+ */
+bool parse_iso_date(const char *value, int64_t *timestamp) {
+    const char *cursor = value;
+    unsigned digits, hour = 0, minute = 0, second = 0;
+    unsigned year = read_number(&cursor, 4, &digits);
+    if (digits != 4 || *cursor++ != '-') return false;
+    unsigned month = read_number(&cursor, 2, &digits);
+    if (digits != 2 || *cursor++ != '-') return false;
+    unsigned day = read_number(&cursor, 2, &digits);
+    if (digits != 2) return false;
+    if (*cursor == 'T') {
+        cursor++;
+        hour = read_number(&cursor, 2, &digits);
+        if (digits != 2 || *cursor++ != ':') return false;
+        minute = read_number(&cursor, 2, &digits);
+        if (digits != 2) return false;
+        if (*cursor == ':') {
+            cursor++;
+            second = read_number(&cursor, 2, &digits);
+            if (digits != 2) return false;
+        }
+    }
+    if (*cursor != '\0' || month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 59) {
+        return false;
+    }
+    *timestamp = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+    return true;
+}
+
+/*!
+ * @brief time_bucket gives the time bucket of a date
+ * @param timestamp the date as seconds since 1970-01-01 UTC
+ * @param granularity weeks or months
+ * @return the bucket, NO_BUCKET if the date is out of the buckets range
+ */
+uint16_t time_bucket(int64_t timestamp, time_buckets_t granularity) {
+    if (timestamp < 0) return NO_BUCKET;
+    int64_t days = timestamp / 86400;
+    int64_t bucket;
+    if (granularity == TIME_BUCKETS_WEEK) {
+        bucket = (days + 3) / 7; // 1970-01-01 is a Thursday: week 0 starts on Monday 1969-12-29
+    } else {
+        int64_t year;
+        unsigned month, day;
+        civil_from_days(days, &year, &month, &day);
+        bucket = (year - 1970) * 12 + month - 1;
+    }
+    return bucket < NO_BUCKET ? (uint16_t) bucket : NO_BUCKET;
+}
+
+/*!
+ * @brief format_time_bucket writes the label of a time bucket: YYYY-MM for months, ISO 8601 week YYYY-Www for weeks
+ * @param bucket the bucket
+ * @param granularity weeks or months
+ * @param label the buffer receiving the label, of at least TIME_BUCKET_LABEL_SIZE bytes
+ * @return the length of the label
+ */
+size_t format_time_bucket(uint16_t bucket, time_buckets_t granularity, char *label) {
+    int64_t year;
+    unsigned month, day;
+    if (granularity == TIME_BUCKETS_WEEK) {
+        // The ISO year of a week is the year of its Thursday
+        int64_t thursday = (int64_t) bucket * 7; // Monday of the week, -3 days, + 3 days
+        civil_from_days(thursday, &year, &month, &day);
+        int64_t week = (thursday - days_from_civil(year, 1, 1)) / 7 + 1;
+        return snprintf(label, TIME_BUCKET_LABEL_SIZE, "%ld-W%02ld", (long) year, (long) week);
+    }
+    return snprintf(label, TIME_BUCKET_LABEL_SIZE, "%ld-%02u", (long) (1970 + bucket / 12), bucket % 12 + 1);
+}
@@ -0,0 +1,31 @@
+#ifndef A2022_MAIL_DATE_H
+#define A2022_MAIL_DATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define NO_BUCKET UINT16_MAX
+#define TIME_BUCKET_LABEL_SIZE 16
+
+/*
+ * Time buckets of the e-mails: a bucket is a number of weeks (weeks start on Monday, ISO 8601) or of months since
+ * January 1970, so that it fits 16 bits until year 3226 (weeks) or 7431 (months). E-mails without a valid Date header,
+ * or dated before 1970, have no bucket.
+ */
+typedef enum {
+    TIME_BUCKETS_NONE,
+    TIME_BUCKETS_WEEK,
+    TIME_BUCKETS_MONTH,
+} time_buckets_t;
+
+int64_t days_from_civil(int64_t year, unsigned month, unsigned day);
+void civil_from_days(int64_t days, int64_t *year, unsigned *month, unsigned *day);
+
+bool parse_mail_date(const char *value, int64_t *timestamp);
+bool parse_iso_date(const char *value, int64_t *timestamp);
+
+uint16_t time_bucket(int64_t timestamp, time_buckets_t granularity);
+size_t format_time_bucket(uint16_t bucket, time_buckets_t granularity, char *label);
+
+#endif //A2022_MAIL_DATE_H
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include "global_defs.h"
 #include "configuration.h"
 #include "fifo_processes.h"
@@ -8,6 +9,19 @@
 #include "reducers.h"
 #include "utility.h"
 #include "analysis.h"
+#include "dedup.h"
+#include "intermediates.h"
+#include "checkpoint.h"
+#include "distributed.h"
+#include "arena.h"
+#include "query_daemon.h"
+#include "watch.h"
+#include "metrics.h"
+#include "filter.h"
+#include "prefetch.h"
+#include "locality.h"
+#include "progress.h"
+#include "trace.h"
 
 #include <sys/msg.h>
 #include <sys/select.h>
@@ -36,6 +50,217 @@
 #endif
 #endif
 
+/*!
+ * @brief reduce_listings concatenates the per-user listings of the first step into step1_output (in memory mode,
+ * workers already appended their listings to step1_output), then sorts it by physical locality if requested
+ * @param config a pointer to the configuration
+ */
+static void reduce_listings(configuration_t *config) {
+    char step1_file[STR_MAX_LEN];
+    intermediate_path(config->temporary_directory, STEP1_OUTPUT, step1_file);
+    if (!intermediates_in_memory()) {
+        files_list_reducer(config->data_path, config->temporary_directory, step1_file, config->process_count);
+    }
+    if (config->locality_order && !order_files_list(step1_file)) {
+        // The lines of step1_output still start with their keys, they are not paths
+        printf("Could not order %s by physical locality\n", STEP1_OUTPUT);
+        exit(EXIT_FAILURE);
+    }
+    if (!intermediates_in_memory() && durability_at_least(DURABILITY_PHASE)) {
+        sync_temporary_files(config->temporary_directory);
+    }
+}
+
+/*!
+ * @brief begin_files_analysis prepares the shared state of the files analysis phase, once step1_output is complete,
+ * and splits step1_output into batches
+ * @param config a pointer to the configuration
+ * @param resume true to skip the batches committed by a previous run
+ * @return the work list of the files analysis, NULL on error
+ */
+static work_list_t *begin_files_analysis(configuration_t *config, bool resume) {
+    if (config->dedup) {
+        char step1_file[STR_MAX_LEN];
+        intermediate_path(config->temporary_directory, STEP1_OUTPUT, step1_file);
+        if (!make_message_id_set(config->temporary_directory, count_file_lines(step1_file))) {
+            printf("Could not create the Message-ID set, duplicates will be analyzed\n");
+        }
+    }
+    work_list_t *work = make_work_list(config->temporary_directory, resume);
+    if (work == NULL) {
+        printf("Could not split %s into batches\n", STEP1_OUTPUT);
+        fflush(stdout);
+        return NULL;
+    }
+    if (resume) {
+        printf("Resuming files analysis: %" PRIu64 " of %" PRIu64 " batches already done\n", work->done_count,
+               work->batch_count);
+    }
+    uint64_t pending_files = 0;
+    for (uint64_t i = 0; i < work->batch_count; i++) {
+        if (!work->done[i]) pending_files += work->batches[i].file_count;
+    }
+    begin_progress_phase(PROGRESS_ANALYSIS, work->batch_count - work->done_count, pending_files);
+    // Remote workers read the e-mails on their own hosts: reading ahead is only useful to local workers
+    if (config->coordinator_port == 0) {
+        attach_prefetcher(work, config->temporary_directory, config->prefetch_budget);
+    }
+    fflush(stdout);
+    return work;
+}
+
+/*!
+ * @brief coordinate_files serves the files analysis to remote workers instead of the local ones (@see distributed.h)
+ * @param config a pointer to the configuration
+ * @param work the work list of the files analysis
+ */
+static void coordinate_files(configuration_t *config, work_list_t *work) {
+    if (config->dedup) {
+        printf("Message-ID dedup is not available to remote workers, duplicates will be analyzed\n");
+    }
+    if (!coordinate_files_analysis(config->temporary_directory, config->coordinator_port, work)) {
+        printf("The files analysis by remote workers is incomplete\n");
+    }
+}
+
+/*!
+ * @brief end_files_analysis reports and releases the shared state of the files analysis phase
+ * @param config a pointer to the configuration
+ * @param work the work list of the files analysis
+ */
+static void end_files_analysis(configuration_t *config, work_list_t *work) {
+    if (work != NULL) report_prefetcher(work->prefetcher);
+    report_worker_arenas("Mapper");
+    clear_work_list(work);
+    if (config->dedup) {
+        message_id_set_t stats;
+        if (read_message_id_set_stats(config->temporary_directory, &stats)) {
+            printf("Duplicate e-mails skipped: %" PRIu64 " (%" PRIu64 " distinct Message-IDs", stats.duplicates,
+                   stats.unique);
+            if (stats.overflows > 0) {
+                printf(", %" PRIu64 " not recorded because the set was full", stats.overflows);
+            }
+            printf(")\n");
+        }
+        remove_message_id_set(config->temporary_directory);
+    }
+}
+
+/*!
+ * @brief reduce_results runs the second reducer selected by the configuration: exact collation of all senders and
+ * recipients, bounded memory top-k heavy hitters, or approximate distinct counts
+ * @param config a pointer to the configuration
+ */
+static void reduce_results(configuration_t *config) {
+    char step2_file[STR_MAX_LEN];
+    sync_intermediate(config->temporary_directory, STEP2_OUTPUT);
+    intermediate_path(config->temporary_directory, STEP2_OUTPUT, step2_file);
+    begin_progress_phase(PROGRESS_REDUCE, 0, 0);
+    bool success;
+    if (config->top_k > 0) {
+        success = topk_reducer(step2_file, config->temporary_directory, config->output_file, config->top_k,
+                               config->process_count);
+    } else if (config->approx_stats) {
+        success = cardinality_reducer(step2_file, config->temporary_directory, config->output_file,
+                                      config->process_count);
+    } else {
+        success = files_reducer(step2_file, config->temporary_directory, config->output_file,
+                                config->reduce_memory_limit, config->time_buckets, config->process_count);
+    }
+    if (!success || !sync_file(config->output_file, DURABILITY_FULL)) {
+        printf("Could not reduce the results to %s\n", config->output_file);
+    }
+}
+
+/*!
+ * @brief check_time_buckets turns the time buckets off when they cannot be counted: the mappers only prefix records
+ * with their bucket for the exact reducer
+ * @param config a pointer to the configuration, updated
+ */
+static void check_time_buckets(configuration_t *config) {
+    if (config->time_buckets != TIME_BUCKETS_NONE && (config->top_k > 0 || config->approx_stats)) {
+        printf("Time buckets require the exact reducer, they are not counted\n");
+        config->time_buckets = TIME_BUCKETS_NONE;
+    }
+}
+
+/*!
+ * @brief compute_graph_metrics runs the optional third phase: metrics of the communication graph of the output file
+ * (@see metrics.h), computed by as many processes as the analysis
+ * @param config a pointer to the configuration
+ */
+static void compute_graph_metrics(configuration_t *config) {
+    if (config->metrics_file[0] == '\0') return;
+    if (config->top_k > 0 || config->approx_stats) {
+        printf("Graph metrics require the exact reducer, they are not computed\n");
+        return;
+    }
+    begin_progress_phase(PROGRESS_METRICS, 0, 0);
+    if (!write_graph_metrics(config->output_file, config->metrics_file, config->process_count)) {
+        printf("Could not compute the graph metrics\n");
+    }
+    fflush(stdout);
+}
+
+/*!
+ * @brief watch_enabled tells if the data source must be watched after the analysis (@see watch.h)
+ * @param config a pointer to the configuration
+ * @return true if the watch mode is on and possible with the configured reducer
+ */
+static bool watch_enabled(configuration_t *config) {
+    if (config->watch_interval == 0) return false;
+    if (config->top_k > 0 || config->approx_stats) {
+        printf("Watch mode requires the exact reducer, new files will not be analyzed\n");
+        return false;
+    }
+    return true;
+}
+
+#ifdef METHOD_MQ
+// Worker pool of the MQ method, for the watch mode
+typedef struct {
+    configuration_t *config;
+    int mq;
+    pid_t *children;
+} mq_pool_t;
+
+/*!
+ * @brief run_mq_batches runs batches of new files on the MQ worker pool (process_batches_t of the watch mode)
+ */
+static void run_mq_batches(work_list_t *work, void *context) {
+    mq_pool_t *pool = context;
+    mq_process_files(pool->config, pool->mq, pool->children, work);
+}
+#endif
+
+#ifdef METHOD_FIFO
+// Worker pool of the FIFO method, for the watch mode
+typedef struct {
+    configuration_t *config;
+    int *notify_fifos;
+    int *command_fifos;
+    pid_t *children;
+} fifo_pool_t;
+
+/*!
+ * @brief run_fifo_batches runs batches of new files on the FIFO worker pool (process_batches_t of the watch mode)
+ */
+static void run_fifo_batches(work_list_t *work, void *context) {
+    fifo_pool_t *pool = context;
+    fifo_process_files(pool->config->data_path, pool->config->temporary_directory, pool->notify_fifos,
+                       pool->command_fifos, pool->children, pool->config->process_count, work);
+}
+#endif
+
+#ifdef METHOD_DIRECT
+/*!
+ * @brief run_direct_batches runs batches of new files in forked processes (process_batches_t of the watch mode)
+ */
+static void run_direct_batches(work_list_t *work, void *context) {
+    configuration_t *config = context;
+    direct_fork_files(config->data_path, config->temporary_directory, config->process_count, work);
+}
+#endif
 
 int main(int argc, char *argv[]) {
     configuration_t config = {
@@ -44,8 +269,52 @@ int main(int argc, char *argv[]) {
             .output_file = "/home/zedek/Bureau/output",
             .is_verbose = false,
             .cpu_core_multiplier = 4,
+            .top_k = 0,
+            .approx_stats = false,
+            .dedup = false,
+            .reduce_memory_limit = 0,
+            .intermediates = INTERMEDIATES_FILES,
+            .durability = DURABILITY_PHASE,
+            .resume = false,
+            .coordinator_port = 0,
+            .coordinator_address = "",
+            .huge_pages = ARENA_PAGES_DEFAULT,
+            .query_socket = "",
+            .watch_interval = 0,
+            .filters = "",
+            .metrics_file = "",
+            .time_buckets = TIME_BUCKETS_NONE,
+            .prefetch_budget = PREFETCH_DEFAULT_BUDGET,
+            .locality_order = false,
+            .trace_file = "",
     };
+    if (argc > 1 && strcmp(argv[1], "status") == 0) {
+        // Status command: progress of the run using the temporary directory (-t or configuration file)
+        make_configuration(&config, argv + 1, argc - 1);
+        return print_progress(config.temporary_directory) ? 0 : -1;
+    }
     make_configuration(&config, argv, argc);
+    set_arena_pages(config.huge_pages);
+    mail_filter_t *filter = NULL;
+    if (config.filters[0] != '\0') {
+        char filters[STR_MAX_LEN];
+        strcpy(filters, config.filters);
+        filter = make_mail_filter(filters);
+        if (filter == NULL) {
+            printf("Incorrect filters: %s\n", config.filters);
+            return -1;
+        }
+    }
+    if (config.coordinator_address[0] != '\0') {
+        // Remote worker mode: only the files analysis, for a coordinator
+        analysis_options_t analysis_options = {.filter = filter, .time_buckets = config.time_buckets};
+        set_analysis_options(&analysis_options);
+        return run_remote_worker(config.coordinator_address, get_nprocs() * config.cpu_core_multiplier) ? 0 : -1;
+    }
+    if (config.query_socket[0] != '\0') {
+        // Query daemon mode: answer queries on the output file of a previous analysis
+        return run_query_daemon(config.output_file, config.query_socket) ? 0 : -1;
+    }
     if (!is_configuration_valid(&config)) {
         printf("Incorrect configuration:\n");
         display_configuration(&config);
@@ -53,9 +322,30 @@ int main(int argc, char *argv[]) {
         return -1;
     }
     config.process_count = get_nprocs() * config.cpu_core_multiplier;
+    check_time_buckets(&config);
     printf("Running analysis on configuration:\n");
     display_configuration(&config);
     printf("\nPlease wait, it can take a while\n\n");
+    analysis_options_t analysis_options = {.dedup_message_ids = config.dedup, .filter = filter,
+                                           .time_buckets = config.time_buckets,
+                                           .locality_keys = config.locality_order};
+    strcpy(analysis_options.temporary_directory, config.temporary_directory);
+    set_analysis_options(&analysis_options);
+    if (!init_intermediates(config.intermediates, config.durability)) {
+        printf("Intermediate results are kept in files\n");
+    }
+    bool resuming = config.resume && can_resume(config.temporary_directory);
+    if (config.resume && !resuming) {
+        printf("No progress journal matching %s, starting a new run\n", STEP1_OUTPUT);
+    }
+    // The workers forked from now on share the progress counters
+    if (!start_progress(config.temporary_directory, config.process_count)) {
+        printf("Could not create the progress counters, the status command is not available\n");
+    }
+    if (config.trace_file[0] != '\0') start_trace(config.temporary_directory);
+    if (!resuming) begin_progress_phase(PROGRESS_LISTING, 0, 0);
+    fflush(stdout);
+    work_list_t *work;
 
     // Running the analysis, based on defined method:
 
@@ -69,16 +359,23 @@ int main(int argc, char *argv[]) {
     }
     pid_t *my_children = mq_make_processes(&config, mq);
     // Execution
-    mq_process_directory(&config, mq, my_children);
-    sync_temporary_files(config.temporary_directory);
-    char temp_result_name[STR_MAX_LEN];
-    concat_path(config.temporary_directory, "step1_output", temp_result_name);
-    files_list_reducer(config.data_path, config.temporary_directory, temp_result_name);
-    mq_process_files(&config, mq, my_children);
-    sync_temporary_files(config.temporary_directory);
-    char step2_file[STR_MAX_LEN];
-    concat_path(config.temporary_directory, "step2_output", step2_file);
-    files_reducer(step2_file, config.output_file);
+    if (!resuming) {
+        mq_process_directory(&config, mq, my_children);
+        reduce_listings(&config);
+    }
+    work = begin_files_analysis(&config, resuming);
+    if (config.coordinator_port > 0) {
+        coordinate_files(&config, work);
+    } else {
+        mq_process_files(&config, mq, my_children, work);
+    }
+    end_files_analysis(&config, work);
+    reduce_results(&config);
+    compute_graph_metrics(&config);
+    if (watch_enabled(&config)) {
+        mq_pool_t pool = {&config, mq, my_children};
+        watch_data_source(&config, run_mq_batches, &pool);
+    }
 
     // Clean
     close_processes(&config, mq, my_children);
@@ -93,16 +390,25 @@ int main(int argc, char *argv[]) {
     pid_t *children = make_processes(config.process_count);
     int *command_fifos = open_fifos(config.process_count, "fifo-in-%d", O_WRONLY);
     int *notify_fifos = open_fifos(config.process_count, "fifo-out-%d", O_RDONLY);
-    fifo_process_directory(config.data_path, config.temporary_directory, notify_fifos, command_fifos, config.process_count);
-    sync_temporary_files(config.temporary_directory);
-    char fifo_temp_result_name[STR_MAX_LEN];
-    concat_path(config.temporary_directory, "step1_output", fifo_temp_result_name);
-    files_list_reducer(config.data_path, config.temporary_directory, fifo_temp_result_name);
-    fifo_process_files(config.data_path, config.temporary_directory, notify_fifos, command_fifos, config.process_count);
-    sync_temporary_files(config.temporary_directory);
-    char fifo_step2_file[STR_MAX_LEN];
-    concat_path(config.temporary_directory, "step2_output", fifo_step2_file);
-    files_reducer(fifo_step2_file, config.output_file);
+    if (!resuming) {
+        fifo_process_directory(config.data_path, config.temporary_directory, notify_fifos, command_fifos, children,
+                               config.process_count);
+        reduce_listings(&config);
+    }
+    work = begin_files_analysis(&config, resuming);
+    if (config.coordinator_port > 0) {
+        coordinate_files(&config, work);
+    } else {
+        fifo_process_files(config.data_path, config.temporary_directory, notify_fifos, command_fifos, children,
+                           config.process_count, work);
+    }
+    end_files_analysis(&config, work);
+    reduce_results(&config);
+    compute_graph_metrics(&config);
+    if (watch_enabled(&config)) {
+        fifo_pool_t pool = {&config, notify_fifos, command_fifos, children};
+        watch_data_source(&config, run_fifo_batches, &pool);
+    }
     shutdown_processes(config.process_count, command_fifos);
     close_fifos(config.process_count, command_fifos);
     close_fifos(config.process_count, notify_fifos);
@@ -112,16 +418,24 @@ int main(int argc, char *argv[]) {
 #endif
 
 #ifdef METHOD_DIRECT
-    direct_fork_directories(config.data_path, config.temporary_directory, config.process_count);
-    sync_temporary_files(config.temporary_directory);
-    char direct_temp_result_name[STR_MAX_LEN];
-    concat_path(config.temporary_directory, "step1_output", direct_temp_result_name);
-    files_list_reducer(config.data_path, config.temporary_directory, direct_temp_result_name);
-    direct_fork_files(config.data_path, config.temporary_directory, config.process_count);
-    sync_temporary_files(config.temporary_directory);
-    char direct_step2_file[STR_MAX_LEN];
-    concat_path(config.temporary_directory, "step2_output", direct_step2_file);
-    files_reducer(direct_step2_file, config.output_file);
+    if (!resuming) {
+        direct_fork_directories(config.data_path, config.temporary_directory, config.process_count);
+        reduce_listings(&config);
+    }
+    work = begin_files_analysis(&config, resuming);
+    if (config.coordinator_port > 0) {
+        coordinate_files(&config, work);
+    } else {
+        direct_fork_files(config.data_path, config.temporary_directory, config.process_count, work);
+    }
+    end_files_analysis(&config, work);
+    reduce_results(&config);
+    compute_graph_metrics(&config);
+    if (watch_enabled(&config)) watch_data_source(&config, run_direct_batches, &config);
 #endif
+    end_progress();
+    if (config.trace_file[0] != '\0') write_trace(config.trace_file);
+    close_intermediates();
+    clear_mail_filter(filter);
     return 0;
 }
\ No newline at end of file
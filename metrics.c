@@ -0,0 +1,536 @@
+#include "metrics.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "global_defs.h"
+#include "graph.h"
+#include "utility.h"
+
+// The stages of the computation, run by the workers on their nodes
+typedef enum {
+    STAGE_DEGREES,
+    STAGE_COMPONENTS,
+    STAGE_PAGERANK,
+} metrics_stage_id_t;
+
+// A worker computing the metrics of a range of nodes
+typedef struct {
+    pid_t pid; // -1 if the parent computes the range itself (fork failed or the worker died)
+    int command_fd; // Parent to worker: id of the next stage
+    int done_fd; // Worker to parent: one byte when the stage is done
+} metrics_worker_t;
+
+// State of the metrics computation. The graph is inherited by the workers, the metrics arrays are shared with them.
+typedef struct {
+    graph_t graph;
+    uint16_t workers;
+    uint32_t *bounds; // workers + 1 node ids: worker i computes the nodes of [bounds[i], bounds[i + 1])
+    metrics_worker_t *pool;
+    // Shared mapping
+    void *mapping;
+    size_t mapping_size;
+    double *rank_base; // Rank every node gets in the current PageRank iteration (random jumps and dangling nodes)
+    uint32_t *iteration; // Current PageRank iteration: ranks[iteration % 2] are read, the others written
+    uint64_t *sent; // Messages sent, by node
+    uint64_t *received; // Messages received, by node
+    double *ranks[2];
+    double *deltas; // By worker: L1 change of the ranks of its nodes in the current iteration
+    double *dangling; // By worker: rank of its nodes that send no message, in the current iteration
+    uint32_t *reciprocal; // Recipients that also wrote to the node, by node
+    uint32_t *labels; // Smallest node id known in the component of the node
+    uint8_t *changed; // By worker: whether a label of its nodes changed in the current round
+} metrics_t;
+
+// A computation on the nodes of a worker
+typedef void (*metrics_stage_t)(metrics_t *metrics, uint16_t worker, uint32_t first, uint32_t last);
+
+/*!
+ * @brief map_metrics allocates the arrays shared with the workers in a single shared anonymous mapping
+ * @param metrics the metrics state, with its graph and workers count set
+ * @return true on success, false else
+ */
+static bool map_metrics(metrics_t *metrics) {
+    size_t nodes = metrics->graph.node_count + 1;
+    metrics->mapping_size = 2 * sizeof(double) + nodes * (4 * sizeof(uint64_t) + 2 * sizeof(uint32_t)) +
+                            metrics->workers * (2 * sizeof(double) + 1);
+    metrics->mapping = mmap(NULL, metrics->mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (metrics->mapping == MAP_FAILED) {
+        metrics->mapping = NULL;
+        return false;
+    }
+    // 8 bytes arrays first, so that all arrays are aligned
+    char *cursor = metrics->mapping;
+    metrics->rank_base = (double *) cursor;
+    cursor += sizeof(double);
+    metrics->iteration = (uint32_t *) cursor;
+    cursor += sizeof(double);
+    metrics->sent = (uint64_t *) cursor;
+    cursor += nodes * sizeof(uint64_t);
+    metrics->received = (uint64_t *) cursor;
+    cursor += nodes * sizeof(uint64_t);
+    metrics->ranks[0] = (double *) cursor;
+    cursor += nodes * sizeof(double);
+    metrics->ranks[1] = (double *) cursor;
+    cursor += nodes * sizeof(double);
+    metrics->deltas = (double *) cursor;
+    cursor += metrics->workers * sizeof(double);
+    metrics->dangling = (double *) cursor;
+    cursor += metrics->workers * sizeof(double);
+    metrics->reciprocal = (uint32_t *) cursor;
+    cursor += nodes * sizeof(uint32_t);
+    metrics->labels = (uint32_t *) cursor;
+    cursor += nodes * sizeof(uint32_t);
+    metrics->changed = (uint8_t *) cursor;
+    return true;
+}
+
+/*!
+ * @brief split_nodes splits the nodes into ranges of about the same number of edges, one per worker
+ * @param metrics the metrics state, its bounds are set
+ * @return true on success, false else
+ */
+static bool split_nodes(metrics_t *metrics) {
+    graph_t *graph = &metrics->graph;
+    metrics->bounds = malloc(sizeof(uint32_t) * (metrics->workers + 1));
+    if (metrics->bounds == NULL) return false;
+    // Nodes weigh their edges in both directions, plus one for the node itself
+    uint64_t total = graph->out_offsets[graph->node_count] + graph->in_offsets[graph->node_count] + graph->node_count;
+    uint32_t node = 0;
+    uint64_t weight = 0;
+    metrics->bounds[0] = 0;
+    for (uint16_t worker = 1; worker < metrics->workers; worker++) {
+        uint64_t target = total * worker / metrics->workers;
+        while (node < graph->node_count && weight < target) {
+            weight += graph->out_offsets[node + 1] - graph->out_offsets[node] + graph->in_offsets[node + 1] -
+                      graph->in_offsets[node] + 1;
+            node++;
+        }
+        metrics->bounds[worker] = node;
+    }
+    metrics->bounds[metrics->workers] = graph->node_count;
+    return true;
+}
+
+/*!
+ * @brief degrees_stage counts the messages sent and received by the nodes and their reciprocal correspondents, and
+ * initializes their component labels
+ */
+static void degrees_stage(metrics_t *metrics, uint16_t worker, uint32_t first, uint32_t last) {
+    (void) worker;
+    graph_t *graph = &metrics->graph;
+    for (uint32_t node = first; node < last; node++) {
+        uint64_t sent = 0, received = 0;
+        for (uint64_t edge = graph->out_offsets[node]; edge < graph->out_offsets[node + 1]; edge++) {
+            sent += graph->out_weights[edge];
+        }
+        for (uint64_t edge = graph->in_offsets[node]; edge < graph->in_offsets[node + 1]; edge++) {
+            received += graph->in_weights[edge];
+        }
+        // Both rows are sorted by node id: their intersection is found by merging them
+        uint32_t reciprocal = 0;
+        uint64_t out = graph->out_offsets[node], in = graph->in_offsets[node];
+        while (out < graph->out_offsets[node + 1] && in < graph->in_offsets[node + 1]) {
+            if (graph->out_targets[out] == graph->in_sources[in]) {
+                reciprocal++;
+                out++;
+                in++;
+            } else if (graph->out_targets[out] < graph->in_sources[in]) {
+                out++;
+            } else {
+                in++;
+            }
+        }
+        metrics->sent[node] = sent;
+        metrics->received[node] = received;
+        metrics->reciprocal[node] = reciprocal;
+        metrics->labels[node] = node;
+    }
+}
+
+/*!
+ * @brief components_stage lowers the label of each node to the smallest label of its neighbors (in both directions)
+ * and of its label's node. Only the owner of a node writes its label, and labels only decrease, so that reading the
+ * labels of other workers while they change is harmless.
+ */
+static void components_stage(metrics_t *metrics, uint16_t worker, uint32_t first, uint32_t last) {
+    graph_t *graph = &metrics->graph;
+    bool changed = false;
+    for (uint32_t node = first; node < last; node++) {
+        uint32_t label = metrics->labels[node];
+        for (uint64_t edge = graph->out_offsets[node]; edge < graph->out_offsets[node + 1]; edge++) {
+            if (metrics->labels[graph->out_targets[edge]] < label) label = metrics->labels[graph->out_targets[edge]];
+        }
+        for (uint64_t edge = graph->in_offsets[node]; edge < graph->in_offsets[node + 1]; edge++) {
+            if (metrics->labels[graph->in_sources[edge]] < label) label = metrics->labels[graph->in_sources[edge]];
+        }
+        if (metrics->labels[label] < label) label = metrics->labels[label];
+        if (label < metrics->labels[node]) {
+            metrics->labels[node] = label;
+            changed = true;
+        }
+    }
+    metrics->changed[worker] = changed;
+}
+
+/*!
+ * @brief pagerank_stage computes the next ranks of the nodes from the ranks of their senders
+ */
+static void pagerank_stage(metrics_t *metrics, uint16_t worker, uint32_t first, uint32_t last) {
+    graph_t *graph = &metrics->graph;
+    double *ranks = metrics->ranks[*metrics->iteration % 2];
+    double *next_ranks = metrics->ranks[(*metrics->iteration + 1) % 2];
+    double delta = 0, dangling = 0;
+    for (uint32_t node = first; node < last; node++) {
+        double rank = 0;
+        for (uint64_t edge = graph->in_offsets[node]; edge < graph->in_offsets[node + 1]; edge++) {
+            uint32_t sender = graph->in_sources[edge];
+            rank += ranks[sender] * graph->in_weights[edge] / metrics->sent[sender];
+        }
+        rank = *metrics->rank_base + PAGERANK_DAMPING * rank;
+        delta += fabs(rank - ranks[node]);
+        if (metrics->sent[node] == 0) dangling += rank;
+        next_ranks[node] = rank;
+    }
+    metrics->deltas[worker] = delta;
+    metrics->dangling[worker] = dangling;
+}
+
+// Stages by id
+static const metrics_stage_t stages[] = {degrees_stage, components_stage, pagerank_stage};
+
+/*!
+ * @brief metrics_worker is the loop of a worker: it runs the stages commanded by the parent on its nodes until the
+ * parent closes its command pipe
+ * @param metrics the metrics state
+ * @param worker the index of the worker
+ */
+static void metrics_worker(metrics_t *metrics, uint16_t worker) {
+    uint8_t stage;
+    while (read(metrics->pool[worker].command_fd, &stage, 1) == 1 && stage <= STAGE_PAGERANK) {
+        stages[stage](metrics, worker, metrics->bounds[worker], metrics->bounds[worker + 1]);
+        if (write(metrics->pool[worker].done_fd, &stage, 1) != 1) break;
+    }
+}
+
+/*!
+ * @brief start_workers forks the workers, each with a command pipe and a done pipe. The ranges of workers that could
+ * not be started are computed by the parent.
+ * @param metrics the metrics state
+ * @return true on success, false if the pool could not be allocated
+ */
+static bool start_workers(metrics_t *metrics) {
+    metrics->pool = malloc(sizeof(metrics_worker_t) * metrics->workers);
+    if (metrics->pool == NULL) return false;
+    fflush(stdout);
+    for (uint16_t worker = 0; worker < metrics->workers; worker++) {
+        metrics_worker_t *current = &metrics->pool[worker];
+        int command_pipe[2], done_pipe[2];
+        current->pid = -1;
+        if (pipe(command_pipe) == -1) continue;
+        if (pipe(done_pipe) == -1) {
+            close(command_pipe[0]);
+            close(command_pipe[1]);
+            continue;
+        }
+        current->pid = fork();
+        if (current->pid == 0) {
+            // Only keep the ends of this worker
+            for (uint16_t other = 0; other < worker; other++) {
+                if (metrics->pool[other].pid == -1) continue;
+                close(metrics->pool[other].command_fd);
+                close(metrics->pool[other].done_fd);
+            }
+            close(command_pipe[1]);
+            close(done_pipe[0]);
+            current->command_fd = command_pipe[0];
+            current->done_fd = done_pipe[1];
+            metrics_worker(metrics, worker);
+            _exit(0);
+        }
+        close(command_pipe[0]);
+        close(done_pipe[1]);
+        current->command_fd = command_pipe[1];
+        current->done_fd = done_pipe[0];
+        if (current->pid == -1) {
+            close(current->command_fd);
+            close(current->done_fd);
+        }
+    }
+    return true;
+}
+
+/*!
+ * @brief retire_worker closes the pipes of a worker and reaps it, its range is then computed by the parent
+ * @param worker the worker
+ */
+static void retire_worker(metrics_worker_t *worker) {
+    close(worker->command_fd);
+    close(worker->done_fd);
+    waitpid(worker->pid, NULL, 0);
+    worker->pid = -1;
+}
+
+/*!
+ * @brief run_stage runs a stage on all nodes and returns when it is done. The ranges of the workers that are gone
+ * (or die during the stage) are computed by the parent.
+ * @param metrics the metrics state
+ * @param stage the stage to run
+ */
+static void run_stage(metrics_t *metrics, metrics_stage_id_t stage) {
+    uint8_t command = stage;
+    for (uint16_t worker = 0; worker < metrics->workers; worker++) {
+        metrics_worker_t *current = &metrics->pool[worker];
+        if (current->pid != -1 && write(current->command_fd, &command, 1) != 1) retire_worker(current);
+    }
+    for (uint16_t worker = 0; worker < metrics->workers; worker++) {
+        metrics_worker_t *current = &metrics->pool[worker];
+        if (current->pid != -1 && read(current->done_fd, &command, 1) != 1) retire_worker(current);
+        if (current->pid == -1) stages[stage](metrics, worker, metrics->bounds[worker], metrics->bounds[worker + 1]);
+    }
+}
+
+/*!
+ * @brief stop_workers stops the workers (closing their command pipe ends their loop), reaps them and releases the
+ * pool
+ * @param metrics the metrics state
+ */
+static void stop_workers(metrics_t *metrics) {
+    for (uint16_t worker = 0; worker < metrics->workers; worker++) {
+        if (metrics->pool[worker].pid != -1) retire_worker(&metrics->pool[worker]);
+    }
+    free(metrics->pool);
+    metrics->pool = NULL;
+}
+
+/*!
+ * @brief compute_components runs rounds of components_stage until no label changes
+ * @param metrics the metrics state
+ * @return the number of rounds
+ */
+static uint32_t compute_components(metrics_t *metrics) {
+    uint32_t rounds = 0;
+    bool changed = true;
+    while (changed && rounds < COMPONENTS_MAX_ROUNDS) {
+        run_stage(metrics, STAGE_COMPONENTS);
+        rounds++;
+        changed = false;
+        for (uint16_t worker = 0; worker < metrics->workers; worker++) {
+            if (metrics->changed[worker]) changed = true;
+        }
+    }
+    return rounds;
+}
+
+/*!
+ * @brief compute_pagerank runs iterations of pagerank_stage until the ranks are stable
+ * @param metrics the metrics state, ranks[iteration % 2] holds the final ranks on return
+ * @return the number of iterations
+ */
+static uint32_t compute_pagerank(metrics_t *metrics) {
+    uint32_t node_count = metrics->graph.node_count;
+    double dangling = 0;
+    for (uint32_t node = 0; node < node_count; node++) {
+        metrics->ranks[0][node] = 1.0 / node_count;
+        if (metrics->sent[node] == 0) dangling += metrics->ranks[0][node];
+    }
+    *metrics->iteration = 0;
+    uint32_t iterations = 0;
+    double delta = 1;
+    while (delta > PAGERANK_TOLERANCE && iterations < PAGERANK_MAX_ITERATIONS) {
+        // The rank of nodes that send nothing is spread over all nodes, as are random jumps
+        *metrics->rank_base = (1 - PAGERANK_DAMPING) / node_count + PAGERANK_DAMPING * dangling / node_count;
+        run_stage(metrics, STAGE_PAGERANK);
+        iterations++;
+        (*metrics->iteration)++;
+        delta = 0;
+        dangling = 0;
+        for (uint16_t worker = 0; worker < metrics->workers; worker++) {
+            delta += metrics->deltas[worker];
+            dangling += metrics->dangling[worker];
+        }
+    }
+    return iterations;
+}
+
+// A component while components are numbered
+typedef struct {
+    uint32_t label;
+    uint32_t size;
+} component_t;
+
+/*!
+ * @brief compare_components orders components by decreasing size, then by label (qsort callback)
+ */
+static int compare_components(const void *a, const void *b) {
+    const component_t *first = a, *second = b;
+    if (first->size != second->size) return first->size > second->size ? -1 : 1;
+    return first->label < second->label ? -1 : (first->label > second->label);
+}
+
+/*!
+ * @brief number_components replaces the labels of nodes by the numbers of their components, by decreasing size
+ * @param metrics the metrics state
+ * @param largest set to the size of the largest component
+ * @return the number of components, 0 on error
+ */
+static uint32_t number_components(metrics_t *metrics, uint32_t *largest) {
+    uint32_t node_count = metrics->graph.node_count;
+    uint32_t *sizes = calloc(node_count + 1, sizeof(uint32_t));
+    if (sizes == NULL) return 0;
+    uint32_t count = 0;
+    for (uint32_t node = 0; node < node_count; node++) {
+        if (sizes[metrics->labels[node]]++ == 0) count++;
+    }
+    component_t *components = malloc(sizeof(component_t) * (count + 1));
+    if (components == NULL) {
+        free(sizes);
+        return 0;
+    }
+    count = 0;
+    for (uint32_t node = 0; node < node_count; node++) {
+        if (sizes[node] > 0) components[count++] = (component_t) {node, sizes[node]};
+    }
+    qsort(components, count, sizeof(component_t), compare_components);
+    // sizes now maps the label of each component to its number
+    for (uint32_t number = 0; number < count; number++) {
+        sizes[components[number].label] = number;
+    }
+    for (uint32_t node = 0; node < node_count; node++) {
+        metrics->labels[node] = sizes[metrics->labels[node]];
+    }
+    *largest = count > 0 ? components[0].size : 0;
+    free(components);
+    free(sizes);
+    return count;
+}
+
+/*!
+ * @brief write_degrees writes the degree distribution (@see metrics.h)
+ * @param metrics the metrics state
+ * @param degrees_file the path to the degree distribution file
+ * @return true on success, false else
+ */
+static bool write_degrees(metrics_t *metrics, char *degrees_file) {
+    graph_t *graph = &metrics->graph;
+    // No degree is above the number of nodes
+    uint32_t *counts = calloc(2 * ((size_t) graph->node_count + 1), sizeof(uint32_t));
+    FILE *degrees_fp = counts != NULL ? fopen(degrees_file, "w") : NULL;
+    if (degrees_fp == NULL) {
+        free(counts);
+        return false;
+    }
+    uint32_t max_degree = 0;
+    for (uint32_t node = 0; node < graph->node_count; node++) {
+        uint32_t out_degree = graph->out_offsets[node + 1] - graph->out_offsets[node];
+        uint32_t in_degree = graph->in_offsets[node + 1] - graph->in_offsets[node];
+        counts[2 * out_degree]++;
+        counts[2 * in_degree + 1]++;
+        if (out_degree > max_degree) max_degree = out_degree;
+        if (in_degree > max_degree) max_degree = in_degree;
+    }
+    for (uint32_t degree = 0; degree <= max_degree && graph->node_count > 0; degree++) {
+        if (counts[2 * degree] > 0 || counts[2 * degree + 1] > 0) {
+            fprintf(degrees_fp, "%u %u %u\n", degree, counts[2 * degree], counts[2 * degree + 1]);
+        }
+    }
+    free(counts);
+    return fclose(degrees_fp) == 0;
+}
+
+/*!
+ * @brief write_metrics writes the metrics of all nodes (@see metrics.h)
+ * @param metrics the metrics state
+ * @param metrics_file the path to the metrics file
+ * @return true on success, false else
+ */
+static bool write_metrics(metrics_t *metrics, char *metrics_file) {
+    graph_t *graph = &metrics->graph;
+    FILE *metrics_fp = fopen(metrics_file, "w");
+    if (metrics_fp == NULL) return false;
+    for (uint32_t node = 0; node < graph->node_count; node++) {
+        uint32_t out_degree = graph->out_offsets[node + 1] - graph->out_offsets[node];
+        uint32_t in_degree = graph->in_offsets[node + 1] - graph->in_offsets[node];
+        fprintf(metrics_fp, "%s %u %u %" PRIu64 " %" PRIu64 " %.4f %u %.6e\n", node_name(graph, node), out_degree,
+                in_degree, metrics->sent[node], metrics->received[node],
+                out_degree > 0 ? (double) metrics->reciprocal[node] / out_degree : 0.0, metrics->labels[node],
+                metrics->ranks[*metrics->iteration % 2][node]);
+    }
+    return fclose(metrics_fp) == 0;
+}
+
+/*!
+ * @brief write_graph_metrics computes the metrics of the communication graph of the output file of the exact reducer
+ * with process_count processes, and writes them to the metrics file and the degree distribution next to it (@see
+ * metrics.h)
+ * @param output_file the output file of the exact reducer
+ * @param metrics_file the path to the metrics file
+ * @param process_count the number of processes computing the metrics
+ * @return true on success, false else
+ */
+bool write_graph_metrics(char *output_file, char *metrics_file, uint16_t process_count) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    metrics_t metrics = {.workers = process_count > 0 ? process_count : 1};
+    if (!build_graph(&metrics.graph, output_file)) {
+        fprintf(stderr, "Could not load the graph of %s\n", output_file);
+        return false;
+    }
+    if (metrics.workers > metrics.graph.node_count) {
+        metrics.workers = metrics.graph.node_count > 0 ? metrics.graph.node_count : 1;
+    }
+    // The workers of the metrics must not be taken for dead workers of the pool (@see mq_processes.c), and a dead
+    // worker must not kill the parent with SIGPIPE
+    sigset_t child_signal, saved_mask;
+    sigemptyset(&child_signal);
+    sigaddset(&child_signal, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &child_signal, &saved_mask);
+    struct sigaction ignore = {.sa_handler = SIG_IGN}, saved_pipe_action;
+    sigemptyset(&ignore.sa_mask);
+    sigaction(SIGPIPE, &ignore, &saved_pipe_action);
+    if (!map_metrics(&metrics) || !split_nodes(&metrics) || !start_workers(&metrics)) {
+        perror("Could not allocate the graph metrics");
+        sigaction(SIGPIPE, &saved_pipe_action, NULL);
+        sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+        if (metrics.mapping != NULL) munmap(metrics.mapping, metrics.mapping_size);
+        free(metrics.bounds);
+        clear_graph(&metrics.graph);
+        return false;
+    }
+    run_stage(&metrics, STAGE_DEGREES);
+    uint32_t rounds = compute_components(&metrics);
+    uint32_t iterations = compute_pagerank(&metrics);
+    stop_workers(&metrics);
+    sigaction(SIGPIPE, &saved_pipe_action, NULL);
+    sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+
+    uint32_t largest = 0;
+    uint32_t components = number_components(&metrics, &largest);
+    char degrees_file[STR_MAX_LEN];
+    snprintf(degrees_file, STR_MAX_LEN, "%s%s", metrics_file, DEGREES_SUFFIX);
+    bool success = (components > 0 || metrics.graph.node_count == 0) && write_metrics(&metrics, metrics_file) &&
+                   write_degrees(&metrics, degrees_file);
+    if (success) {
+        uint64_t reciprocal = 0;
+        for (uint32_t node = 0; node < metrics.graph.node_count; node++) reciprocal += metrics.reciprocal[node];
+        double reciprocity = metrics.graph.edge_count > 0 ? (double) reciprocal / metrics.graph.edge_count : 0;
+        printf("Graph metrics: %u addresses, %" PRIu64 " edges, reciprocity %.3f, %u components (largest: %u "
+               "addresses, %u rounds), PageRank in %u iterations, %.1f ms with %u processes\n",
+               metrics.graph.node_count, metrics.graph.edge_count, reciprocity, components, largest, rounds, iterations,
+               elapsed_ms(&start), metrics.workers);
+    } else {
+        fprintf(stderr, "Could not write the graph metrics to %s\n", metrics_file);
+    }
+    munmap(metrics.mapping, metrics.mapping_size);
+    free(metrics.bounds);
+    clear_graph(&metrics.graph);
+    return success;
+}
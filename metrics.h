@@ -0,0 +1,28 @@
+#ifndef A2022_METRICS_H
+#define A2022_METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Suffix of the degree distribution, next to the metrics file
+#define DEGREES_SUFFIX ".degrees"
+#define PAGERANK_DAMPING 0.85
+#define PAGERANK_TOLERANCE 1e-10 // L1 change of the ranks between two iterations to stop
+#define PAGERANK_MAX_ITERATIONS 100
+#define COMPONENTS_MAX_ROUNDS 1000
+
+/*
+ * Phase 3: metrics of the communication graph of the output file (@see graph.h), one line per address, in the
+ * alphabetical order of addresses:
+ *   <address> <out degree> <in degree> <sent> <received> <reciprocity> <component> <pagerank>
+ * Degrees count distinct correspondents, sent/received count messages. The reciprocity is the share of the recipients
+ * of the address that also wrote to it. Weakly connected components are numbered by decreasing size (0 is the
+ * largest). The PageRank follows the messages: each address passes its rank to its recipients in proportion of the
+ * messages it sent them.
+ * The degree distribution is written next to the metrics file (DEGREES_SUFFIX) as "<degree> <addresses with this out
+ * degree> <addresses with this in degree>" lines.
+ */
+
+bool write_graph_metrics(char *output_file, char *metrics_file, uint16_t process_count);
+
+#endif //A2022_METRICS_H
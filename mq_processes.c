@@ -5,6 +5,10 @@
 #include "mq_processes.h"
 
 #include <sys/msg.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <dirent.h>
 
 #include <unistd.h>
 #include <stdlib.h>
@@ -15,6 +19,10 @@
 
 #include "utility.h"
 #include "analysis.h"
+#include "supervisor.h"
+#include "scheduler.h"
+#include "progress.h"
+#include "trace.h"
 
 /*!
  * @brief make_message_queue creates the message queue used for communications between parent and worker processes
@@ -35,22 +43,27 @@ void close_message_queue(int mq) {
 /*!
  * @brief child_process is the function handling code for a child
  * @param mq message queue descriptor used to communicate with the parent
+ * Tasks are received on the topic equal to the child's PID, completions are notified on topic MQ_NOTIFY_TOPIC with
+ * a task_notification_t as message content.
  */
 void child_process(int mq) {
+    pid_t self = getpid();
 // 1. Endless loop (interrupted by a task whose callback is NULL)
     while (1) {
 // 2. Upon reception of a task: check is not NULL
         mq_message_t message;
-        if (msgrcv(mq, &message, sizeof(task_t), 0, 0) == -1) {
+        if (msgrcv(mq, &message, sizeof(task_t), self, 0) == -1) {
             perror("msgrcv");
             return;
         }
         task_t *task = (task_t *) message.mtext;
 // 2 bis. If not NULL -> execute it and notify parent
-        if (task != NULL) {
-            task->task_callback(task);
-            message.mtype = 1;
-            if (msgsnd(mq, &message, sizeof(task_t), 0) == -1) {
+        if (task->task_callback != NULL) {
+            run_traced_task(task);
+            task_notification_t notification = {.pid = self, .held = held_file_batches()};
+            message.mtype = MQ_NOTIFY_TOPIC;
+            memcpy(message.mtext, &notification, sizeof(task_notification_t));
+            if (msgsnd(mq, &message, sizeof(task_notification_t), 0) == -1) {
                 perror("msgsnd");
                 return;
             }
@@ -63,8 +76,47 @@ void child_process(int mq) {
 // 3. Cleanup
 }
 
+// Message queue notified by the SIGCHLD handler of the parent, -1 when the pool is not supervised
+static volatile int supervised_mq = -1;
+
+/*!
+ * @brief notify_child_exit is the SIGCHLD handler of the parent: it posts a notification with PID 0 so that a parent
+ * blocked in msgrcv wakes up and looks for dead workers (msgsnd is a plain system call, safe in a handler)
+ * @param signal the signal number (SIGCHLD)
+ */
+static void notify_child_exit(int signal) {
+    (void) signal;
+    int saved_errno = errno;
+    mq_message_t message = {.mtype = MQ_NOTIFY_TOPIC};
+    task_notification_t none = {.pid = 0, .held = 0};
+    memcpy(message.mtext, &none, sizeof(task_notification_t));
+    if (supervised_mq != -1) msgsnd(supervised_mq, &message, sizeof(task_notification_t), IPC_NOWAIT);
+    errno = saved_errno;
+}
+
 /*!
- * @brief mq_make_processes makes a processes pool used for tasks execution
+ * @brief start_worker forks a worker listening on the message queue
+ * @param mq the message queue
+ * @param worker the index of the worker in the pool (for its progress counters)
+ * @return the PID of the worker, -1 if fork failed
+ */
+static pid_t start_worker(int mq, int worker) {
+    fflush(stdout);
+    pid_t child_pid = fork();
+    if (child_pid == 0) {
+        signal(SIGCHLD, SIG_DFL);
+        set_progress_worker(worker);
+        set_trace_worker(worker);
+        hold_file_batches(true);
+        child_process(mq);
+        exit(0);
+    }
+    return child_pid;
+}
+
+/*!
+ * @brief mq_make_processes makes a processes pool used for tasks execution. The parent is notified on the message
+ * queue when a worker dies (@see notify_child_exit).
  * @param config a pointer to the program configuration (with all parameters, inc. processes count)
  * @param mq the identifier of the message queue used to communicate between parent and children (workers)
  * @return a malloc'ed array with all children PIDs
@@ -76,18 +128,15 @@ pid_t *mq_make_processes(configuration_t *config, int mq) {
         perror("malloc error");
         return NULL;
     }
+    supervised_mq = mq;
+    struct sigaction action = {.sa_handler = notify_child_exit, .sa_flags = SA_RESTART | SA_NOCLDSTOP};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGCHLD, &action, NULL);
 
 // 2. Loop over process_count to fork
     for (int i = 0; i < config->process_count; i++) {
-        pid_t child_pid = fork();
-        if (child_pid == 0) {
-// 2 bis. in fork child part, start listening on message queue
-            child_process(mq);
-            exit(0);
-        } else if (child_pid > 0) {
-// parent process
-            children[i] = child_pid;
-        } else {
+        children[i] = start_worker(mq, i);
+        if (children[i] == -1) {
 // fork error
             perror("fork error");
             free(children);
@@ -106,7 +155,9 @@ pid_t *mq_make_processes(configuration_t *config, int mq) {
  * @param children the array of children's PIDs
  */
 void close_processes(configuration_t *config, int mq, pid_t children[]) {
-    // 1. Loop over process_count to send a task with NULL callback
+    // 1. Stop supervision, then loop over process_count to send a task with NULL callback
+    supervised_mq = -1;
+    signal(SIGCHLD, SIG_DFL);
     for (int i = 0; i < config->process_count; i++) {
         task_t task = { .task_callback = NULL };
         mq_message_t message;
@@ -117,71 +168,152 @@ void close_processes(configuration_t *config, int mq, pid_t children[]) {
 
     // 2. Loop over process_count to wait for children
     for (int i = 0; i < config->process_count; i++) {
-        wait(NULL);
+        waitpid(children[i], NULL, 0);
     }
 
     // 3. Cleanup
 }
 
 /*!
- * @brief send_task_to_mq sends a directory task to a worker through the message queue. Directory task's object is
- * data_source/target_dir, temp output file is temp_files/target_dir. Task is sent through MQ with topic equal to
- * the worker's PID
- * @param data_source the data source directory
- * @param temp_files the temporary files directory
- * @param target_dir the name of the target directory
+ * @brief send_task_to_mq sends a task to a worker through the message queue, with topic equal to the worker's PID
+ * @param task the task to send
  * @param mq the MQ descriptor
  * @param worker_pid the worker PID
  */
-void send_task_to_mq(char data_source[], char temp_files[], char target_dir[], int mq, pid_t worker_pid) {
-// 1. Create task
-        directory_task_t dir_task;
-        strcpy(dir_task.object_directory, data_source);
-        strcpy(dir_task.temporary_directory, temp_files);
-        strcpy(dir_task.object_directory, target_dir);
-        dir_task.task_callback = parse_dir;
-
-// 2. Create message
-        mq_message_t message;
-        message.mtype = worker_pid;
-        memcpy(message.mtext, &dir_task, sizeof(dir_task));
+void send_task_to_mq(task_t *task, int mq, pid_t worker_pid) {
+// 1. Create message
+    mq_message_t message;
+    message.mtype = worker_pid;
+    memcpy(message.mtext, task, sizeof(task_t));
 
-// 3. Send message
-        msgsnd(mq, &message, sizeof(dir_task), 0);
+// 2. Send message
+    if (msgsnd(mq, &message, sizeof(task_t), 0) == -1) {
+        perror("Error sending message");
+    }
 }
 
 /*!
- * @brief send_file_task_to_mq sends a file task to a worker. It operates similarly to @see send_task_to_mq
- * @param data_source the data source directory
- * @param temp_files the temporary files directory
- * @param target_file the target filename
+ * @brief replace_dead_workers reaps the workers that died, queues their tasks for a retry (@see worker_crashed) and
+ * forks their replacements
+ * @param supervisor the supervisor of the pool
  * @param mq the MQ descriptor
- * @param worker_pid the worker's PID
  */
-void send_file_task_to_mq(char data_source[], char temp_files[], char target_file[], int mq, pid_t worker_pid) {
-// 1. Create task
-        file_task_t file_task;
-        file_task.task_callback = process_file;
-        strcpy(file_task.object_file, data_source);
-        strcpy(file_task.temporary_directory, temp_files);
-        strcpy(file_task.object_file, target_file);
+static void replace_dead_workers(supervisor_t *supervisor, int mq) {
+    for (int i = 0; i < supervisor->workers; i++) {
+        int status;
+        if (waitpid(supervisor->children[i], &status, WNOHANG) <= 0) continue;
+        worker_crashed(supervisor, i, status);
+        pid_t replacement = start_worker(mq, i);
+        if (replacement == -1) {
+            perror("Could not replace a dead worker");
+            continue;
+        }
+        supervisor->children[i] = replacement;
+    }
+}
 
-// 2. Create message
-        mq_message_t message;
-        message.mtype = worker_pid;
-        memcpy(message.mtext, &file_task, sizeof(file_task_t));
+/*!
+ * @brief mq_dispatch distributes tasks over the workers, one task at a time for each worker: all workers are first
+ * given a task, then a new task is sent to each worker notifying the end of its task. Dead workers are replaced and
+ * their tasks dispatched again. Returns once all tasks are complete.
+ * @param config a pointer to the configuration
+ * @param mq the MQ descriptor
+ * @param children the children's PIDs used as MQ topics number
+ * @param next_task the function building the next task, returning false when no task remains
+ * @param context an opaque pointer passed to next_task
+ * @param pool_name the name of the pool in the report of the dispatch
+ */
+static void mq_dispatch(configuration_t *config, int mq, pid_t children[], bool (*next_task)(task_t *, void *),
+                        void *context, char *pool_name) {
+    supervisor_t supervisor;
+    if (!init_supervisor(&supervisor, children, config->process_count)) return;
+    supervised_task_t task;
+    mq_message_t message;
+    while (true) {
+        // Give a task to every idle worker
+        int worker;
+        while ((worker = idle_worker(&supervisor)) != -1 &&
+               next_supervised_task(&supervisor, next_task, context, &task)) {
+            send_task_to_mq(&task.task, mq, children[worker]);
+            task_started(&supervisor, worker, &task);
+        }
+        // Once all tasks are dispatched, make the workers commit the batches they hold
+        while ((worker = next_commit_task(&supervisor, &task)) != -1) {
+            send_task_to_mq(&task.task, mq, children[worker]);
+            task_started(&supervisor, worker, &task);
+        }
+        if (busy_workers(&supervisor) == 0) break;
 
-// 3. Send message
-        if (msgsnd(mq, &message, sizeof(file_task_t), 0) == -1) {
-            perror("Error sending message");
+        // Wait for a task to complete, or for a worker to die (PID 0)
+        uint64_t wait_start = trace_clock();
+        ssize_t received = msgrcv(mq, &message, sizeof(task_notification_t), MQ_NOTIFY_TOPIC, 0);
+        trace_span(TRACE_WAIT, wait_start);
+        if (received == -1) {
+            if (errno == EINTR) continue;
+            perror("msgrcv");
+            break;
         }
+        task_notification_t notification;
+        memcpy(&notification, message.mtext, sizeof(task_notification_t));
+        if (notification.pid == 0) {
+            replace_dead_workers(&supervisor, mq);
+        } else {
+            task_completed(&supervisor, find_worker(&supervisor, notification.pid), notification.held);
+        }
+    }
+    report_supervisor(&supervisor, pool_name);
+    clear_supervisor(&supervisor);
+}
+
+// Context of next_directory_task
+typedef struct {
+    configuration_t *config;
+    directory_list_t *directories;
+} directory_tasks_t;
 
+/*!
+ * @brief next_directory_task builds the task of the next directory of the data source, largest first
+ * @param task the task to fill
+ * @param context a directory_tasks_t pointer
+ * @return true if a task was built, false when all directories were listed
+ */
+static bool next_directory_task(task_t *task, void *context) {
+    directory_tasks_t *directories = (directory_tasks_t *) context;
+    directory_task_t *dir_task = (directory_task_t *) task;
+    if (!next_directory(directories->directories, directories->config->data_path, dir_task->object_directory)) {
+        return false;
+    }
+    dir_task->task_callback = process_directory;
+    strcpy(dir_task->temporary_directory, directories->config->temporary_directory);
+    return true;
+}
+
+// Context of next_batch_task
+typedef struct {
+    configuration_t *config;
+    work_list_t *work;
+} batch_tasks_t;
+
+/*!
+ * @brief next_batch_task builds the task of the next pending batch of files of step1_output
+ * @param task the task to fill
+ * @param context a batch_tasks_t pointer
+ * @return true if a task was built, false when all batches were handed out
+ */
+static bool next_batch_task(task_t *task, void *context) {
+    batch_tasks_t *batches = (batch_tasks_t *) context;
+    batch_task_t *batch_task = (batch_task_t *) task;
+    if (!next_pending_batch(batches->work, &batch_task->batch)) return false;
+    batch_task->task_callback = process_file_batch;
+    strcpy(batch_task->temporary_directory, batches->config->temporary_directory);
+    return true;
 }
 
 /*!
  * @brief mq_process_directory root function for parallelizing directory analysis over workers. Must keep track of the
  * tasks count to ensure every worker handles one and only one task. Relies on two steps: one to fill all workers with
- * a task each, then, waiting for a child to finish its task before sending a new one.
+ * a task each, then, waiting for a child to finish its task before sending a new one. The largest directories are
+ * dispatched first (@see make_directory_list).
  * @param config a pointer to the configuration with all relevant path and values
  * @param mq the MQ descriptor
  * @param children the children's PIDs used as MQ topics number
@@ -190,82 +322,28 @@ void mq_process_directory(configuration_t *config, int mq, pid_t children[]) {
 // 1. Check parameters
     if (config == NULL || mq < 0 || children == NULL) return;
 
-// 2. Iterate over children and provide one directory to each
-    int running_workers = config->process_count;
-    DIR * d = opendir(config->data_path);
-    if (d == NULL) return;
-    struct dirent * dir;
-    while ((dir = readdir(d)) != NULL) {
-        if (dir->d_type == DT_DIR && strcmp(dir->d_name, ".") != 0 && strcmp(dir->d_name, "..") != 0) {
-            send_task_to_mq(config->data_path, config->temporary_directory, dir->d_name, mq, children[config->process_count - running_workers]);
-            running_workers--;
-        }
-    }
-    closedir(d);
+// 2. Iterate over the directories, largest first, one at a time on each worker
+    directory_tasks_t directories = {config, make_directory_list(config->data_path)};
+    if (directories.directories == NULL) return;
+    mq_dispatch(config, mq, children, next_directory_task, &directories, "MQ pool, directories");
 
-// 3. Loop while there are directories to process, and while all workers are processing
-    mq_message_t message;
-    int tasks_left = running_workers;
-    while (tasks_left > 0) {
-        msgrcv(mq, &message, sizeof(task_t), 0, 0);
-        running_workers--;
-        tasks_left--;
-        if (running_workers > 0) {
-            send_task_to_mq(config->data_path, config->temporary_directory, dir->d_name, mq, children[config->process_count - running_workers]);
-            running_workers--;
-            tasks_left--;
-        }
-    }
-
-// 4. Cleanup
-    while (running_workers > 0) {
-        msgrcv(mq, &message, sizeof(task_t), 0, 0);
-        running_workers--;
-    }
+// 3. Cleanup
+    clear_directory_list(directories.directories);
 }
 
 /*!
- * @brief mq_process_files root function for parallelizing files analysis over workers. Operates as
- * @see mq_process_directory to limit tasks to one on each worker.
+ * @brief mq_process_files root function for parallelizing files analysis over workers, by batches of files of
+ * step1_output. Operates as @see mq_process_directory to limit tasks to one on each worker.
  * @param config a pointer to the configuration with all relevant path and values
  * @param mq the MQ descriptor
  * @param children the children's PIDs used as MQ topics number
+ * @param work the batches of step1_output to analyze
  */
-void mq_process_files(configuration_t *config, int mq, pid_t children[]) {
+void mq_process_files(configuration_t *config, int mq, pid_t children[], work_list_t *work) {
     // 1. Check parameters
-    if (config == NULL || mq < 0 || children == NULL) return;
-
-    // 2. Iterate over children and provide one file to each
-    int running_workers = config->process_count;
-    FILE *files_list = fopen("step1_output", "r");
-    if (files_list == NULL) return;
-    char file_path[STR_MAX_LEN];
-    while (fgets(file_path, STR_MAX_LEN, files_list) != NULL) {
-        // remove newline character from file path
-        file_path[strcspn(file_path, "\n")] = 0;
-        send_file_task_to_mq(config->data_path, config->temporary_directory, file_path, mq, children[config->process_count - running_workers]);
-        running_workers--;
-    }
-    fclose(files_list);
-
-    // 3. Loop while there are files to process, and while all workers are processing
-    mq_message_t message;
-    int tasks_left = running_workers;
-    while (tasks_left > 0) {
-        msgrcv(mq, &message, sizeof(message), 0, 0);
-        running_workers++;
-        tasks_left--;
-        if (running_workers < config->process_count) {
-            send_file_task_to_mq(config->data_path, config->temporary_directory, file_path, mq, children[config->process_count - running_workers]);
-            running_workers--;
-            tasks_left++;
-        }
-    }
-
-    // 4. Cleanup
-    while (running_workers > 0) {
-        msgrcv(mq, &message, sizeof(message), 0, 0);
-        running_workers--;
-    }
+    if (config == NULL || mq < 0 || children == NULL || work == NULL) return;
 
+    // 2. Iterate over the pending batches, one at a time on each worker
+    batch_tasks_t batches = {config, work};
+    mq_dispatch(config, mq, children, next_batch_task, &batches, "MQ pool, files");
 }
@@ -9,6 +9,10 @@
 #include <sys/types.h>
 
 #include "configuration.h"
+#include "checkpoint.h"
+
+// Topic of the end of task notifications sent by workers (PIDs, used as workers topics, are > 1)
+#define MQ_NOTIFY_TOPIC 1
 
 typedef struct {
     long mtype;
@@ -22,6 +26,6 @@ void child_process(int mq);
 pid_t *mq_make_processes(configuration_t *config, int mq);
 void close_processes(configuration_t *config, int mq, pid_t children[]);
 void mq_process_directory(configuration_t *config, int mq, pid_t children[]);
-void mq_process_files(configuration_t *config, int mq, pid_t children[]);
+void mq_process_files(configuration_t *config, int mq, pid_t children[], work_list_t *work);
 
 #endif //A2022_MQ_PROCESSES_H
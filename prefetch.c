@@ -0,0 +1,213 @@
+#define _GNU_SOURCE // O_NOATIME
+
+#include "prefetch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "global_defs.h"
+#include "utility.h"
+#include "intermediates.h"
+
+static void *prefetch_helper(void *arg);
+
+/*!
+ * @brief attach_prefetcher reads ahead the e-mails of a work list while its batches are handed out, from a helper
+ * thread. The prefetcher is released with the work list.
+ * @param work the work list
+ * @param temp_dir the temporary directory (with step1_output)
+ * @param budget the memory budget in bytes, 0 to leave the work list without prefetcher
+ * @return true if a prefetcher was attached, false else
+ */
+bool attach_prefetcher(work_list_t *work, char *temp_dir, uint64_t budget) {
+    if (work == NULL || budget == 0) return false;
+    prefetcher_t *prefetcher = calloc(1, sizeof(prefetcher_t));
+    if (prefetcher == NULL) return false;
+    char step1_path[STR_MAX_LEN];
+    intermediate_path(temp_dir, STEP1_OUTPUT, step1_path);
+    pthread_mutex_init(&prefetcher->lock, NULL);
+    pthread_cond_init(&prefetcher->wake, NULL);
+    prefetcher->files_list = fopen(step1_path, "r");
+    prefetcher->batch_bytes = calloc(work->batch_count + 1, sizeof(uint64_t));
+    prefetcher->batch_files = calloc(work->batch_count + 1, sizeof(uint32_t));
+    prefetcher->work = work;
+    prefetcher->budget = budget;
+    prefetcher->window = FILES_PER_BATCH;
+    clock_gettime(CLOCK_MONOTONIC, &prefetcher->start);
+    if (prefetcher->files_list == NULL || prefetcher->batch_bytes == NULL || prefetcher->batch_files == NULL ||
+        pthread_create(&prefetcher->helper, NULL, prefetch_helper, prefetcher) != 0) {
+        clear_prefetcher(prefetcher);
+        return false;
+    }
+    prefetcher->helper_started = true;
+    work->prefetcher = prefetcher;
+    return true;
+}
+
+/*!
+ * @brief prefetch_file asks the kernel to read the header section of an e-mail into the page cache. The file is
+ * opened without blocking (a FIFO in the data source has no writer) and without updating its access time, and only
+ * regular files are read ahead.
+ * @param path the path of the e-mail
+ * @return the number of bytes read ahead (at most PREFETCH_FILE_BYTES), 0 if the e-mail cannot be opened
+ */
+static uint64_t prefetch_file(char *path) {
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_NOATIME);
+    // O_NOATIME is only allowed to the owner of the file
+    if (fd == -1 && errno == EPERM) fd = open(path, O_RDONLY | O_NONBLOCK);
+    if (fd == -1) return 0;
+    struct stat sb;
+    uint64_t length = 0;
+    if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0) {
+        length = sb.st_size < PREFETCH_FILE_BYTES ? sb.st_size : PREFETCH_FILE_BYTES;
+        // The pages are read asynchronously, and stay in the page cache after the file is closed
+        posix_fadvise(fd, 0, (off_t) length, POSIX_FADV_WILLNEED);
+    }
+    close(fd);
+    return length;
+}
+
+/*!
+ * @brief next_prefetch_target finds the next file to read ahead, waiting for the window to move if it is full (called
+ * by the helper thread with the lock of the prefetcher held)
+ * @param prefetcher the prefetcher
+ * @param batch_index set to the index of the batch of the file
+ * @param offset set to the position of the file in step1_output
+ * @return true if a file must be read ahead, false when the prefetcher stops or all batches were read ahead
+ */
+static bool next_prefetch_target(prefetcher_t *prefetcher, uint64_t *batch_index, off_t *offset) {
+    work_list_t *work = prefetcher->work;
+    while (!prefetcher->stop) {
+        // The batches handed out are not read ahead any more
+        if (prefetcher->prefetched < prefetcher->consumed) {
+            prefetcher->prefetched = prefetcher->consumed;
+            prefetcher->resume_offset = 0;
+        }
+        if (prefetcher->prefetched < work->batch_count && work->done[prefetcher->prefetched]) {
+            prefetcher->prefetched++;
+            continue;
+        }
+        if (prefetcher->prefetched == work->batch_count) return false;
+        if (prefetcher->ahead_files < prefetcher->window && prefetcher->ahead_bytes < prefetcher->budget) {
+            file_batch_t *batch = &work->batches[prefetcher->prefetched];
+            *batch_index = prefetcher->prefetched;
+            *offset = prefetcher->resume_offset != 0 ? prefetcher->resume_offset : batch->start;
+            return true;
+        }
+        pthread_cond_wait(&prefetcher->wake, &prefetcher->lock);
+    }
+    return false;
+}
+
+/*!
+ * @brief prefetch_helper is the helper thread of a prefetcher: it reads ahead the files of the window one by one,
+ * and records how far it went in the current batch so that a batch cut by the budget is resumed where it stopped
+ * @param arg the prefetcher
+ * @return NULL
+ */
+static void *prefetch_helper(void *arg) {
+    prefetcher_t *prefetcher = (prefetcher_t *) arg;
+    uint64_t batch_index;
+    off_t offset;
+    pthread_mutex_lock(&prefetcher->lock);
+    while (next_prefetch_target(prefetcher, &batch_index, &offset)) {
+        file_batch_t batch = prefetcher->work->batches[batch_index];
+        pthread_mutex_unlock(&prefetcher->lock);
+
+        // Read the path and the file without the lock: the orchestrator may hand out batches meanwhile
+        uint64_t bytes = 0;
+        off_t next_offset = batch.end;
+        fseeko(prefetcher->files_list, offset, SEEK_SET);
+        ssize_t length = getline(&prefetcher->path, &prefetcher->path_size, prefetcher->files_list);
+        if (length > 0) {
+            if (prefetcher->path[length - 1] == '\n') prefetcher->path[length - 1] = '\0';
+            bytes = prefetch_file(prefetcher->path);
+            next_offset = offset + length;
+        }
+
+        pthread_mutex_lock(&prefetcher->lock);
+        prefetcher->advised_files++;
+        prefetcher->advised_bytes += bytes;
+        // The batch may have been handed out while its file was read ahead: it is not ahead any more
+        if (batch_index < prefetcher->consumed) continue;
+        prefetcher->batch_bytes[batch_index] += bytes;
+        prefetcher->batch_files[batch_index]++;
+        prefetcher->ahead_bytes += bytes;
+        prefetcher->ahead_files++;
+        if (next_offset >= batch.end) {
+            prefetcher->prefetched = batch_index + 1;
+            prefetcher->resume_offset = 0;
+        } else {
+            prefetcher->resume_offset = next_offset;
+        }
+    }
+    pthread_mutex_unlock(&prefetcher->lock);
+    return NULL;
+}
+
+/*!
+ * @brief prefetch_batches updates the window of the prefetcher after batches were handed out: as many files as are
+ * parsed in PREFETCH_HORIZON_MS at the rate measured since the start, within the memory budget, are read ahead by the
+ * helper thread (called by next_pending_batch)
+ * @param prefetcher the prefetcher
+ */
+void prefetch_batches(prefetcher_t *prefetcher) {
+    work_list_t *work = prefetcher->work;
+    pthread_mutex_lock(&prefetcher->lock);
+    // 1. The batches handed out leave the window
+    for (; prefetcher->consumed < work->next; prefetcher->consumed++) {
+        if (work->done[prefetcher->consumed]) continue;
+        prefetcher->handed_out_files += work->batches[prefetcher->consumed].file_count;
+        prefetcher->ahead_files -= prefetcher->batch_files[prefetcher->consumed];
+        prefetcher->ahead_bytes -= prefetcher->batch_bytes[prefetcher->consumed];
+    }
+
+    // 2. Files parsed in the horizon at the measured rate (the rate is not measured over less than the horizon, so
+    // that the first batches, handed out at once to all workers, do not open the window too wide)
+    double elapsed = elapsed_ms(&prefetcher->start);
+    if (elapsed < PREFETCH_HORIZON_MS) elapsed = PREFETCH_HORIZON_MS;
+    prefetcher->window = (uint64_t) (prefetcher->handed_out_files * PREFETCH_HORIZON_MS / elapsed);
+    if (prefetcher->window < FILES_PER_BATCH) prefetcher->window = FILES_PER_BATCH;
+
+    // 3. Let the helper thread read ahead the next files
+    pthread_cond_signal(&prefetcher->wake);
+    pthread_mutex_unlock(&prefetcher->lock);
+}
+
+/*!
+ * @brief report_prefetcher prints what a prefetcher read ahead
+ * @param prefetcher the prefetcher, may be NULL
+ */
+void report_prefetcher(prefetcher_t *prefetcher) {
+    if (prefetcher == NULL) return;
+    pthread_mutex_lock(&prefetcher->lock);
+    printf("Read-ahead: %" PRIu64 " files, %" PRIu64 " KiB (budget %" PRIu64 " KiB)\n", prefetcher->advised_files,
+           prefetcher->advised_bytes / 1024, prefetcher->budget / 1024);
+    pthread_mutex_unlock(&prefetcher->lock);
+}
+
+/*!
+ * @brief clear_prefetcher stops the helper thread of a prefetcher and releases it
+ * @param prefetcher the prefetcher, may be NULL
+ */
+void clear_prefetcher(prefetcher_t *prefetcher) {
+    if (prefetcher == NULL) return;
+    if (prefetcher->helper_started) {
+        pthread_mutex_lock(&prefetcher->lock);
+        prefetcher->stop = true;
+        pthread_cond_signal(&prefetcher->wake);
+        pthread_mutex_unlock(&prefetcher->lock);
+        pthread_join(prefetcher->helper, NULL);
+    }
+    if (prefetcher->files_list != NULL) fclose(prefetcher->files_list);
+    pthread_mutex_destroy(&prefetcher->lock);
+    pthread_cond_destroy(&prefetcher->wake);
+    free(prefetcher->batch_bytes);
+    free(prefetcher->batch_files);
+    free(prefetcher->path);
+    free(prefetcher);
+}
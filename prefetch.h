@@ -0,0 +1,60 @@
+#ifndef A2022_PREFETCH_H
+#define A2022_PREFETCH_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "checkpoint.h"
+
+// Time of parsing the prefetcher tries to stay ahead of: the window is the number of files parsed in this time at the
+// measured rate
+#define PREFETCH_HORIZON_MS 500
+// Bytes read ahead at most for each e-mail: the mappers only read the header section
+#define PREFETCH_FILE_BYTES (16 * 1024)
+// Default memory budget of the prefetcher (pages read ahead and not handed out yet)
+#define PREFETCH_DEFAULT_BUDGET (64 * 1024 * 1024)
+
+/*
+ * Read-ahead of the e-mails of the files analysis: each time a batch is handed out, the orchestrator moves the window
+ * of the prefetcher, and a helper thread asks the kernel (posix_fadvise WILLNEED) to read the files of the next
+ * batches of step1_output into the page cache, so that the workers do not wait for a seek on each open. The helper
+ * thread does the opens, so that a slow file system (or a file that is not a regular file) never blocks the
+ * dispatch. The window covers the files parsed in PREFETCH_HORIZON_MS at the rate measured since the start of the
+ * phase, and the bytes read ahead of the batches handed out stay within a budget: when the budget is reached in the
+ * middle of a batch, the read-ahead resumes from the next file of the batch once batches were handed out.
+ */
+typedef struct _prefetcher {
+    work_list_t *work;
+    FILE *files_list; // step1_output, read by the helper thread
+    uint64_t budget; // Bytes read ahead at most
+    pthread_t helper;
+    bool helper_started;
+    pthread_mutex_t lock; // Protects the fields below, shared by the orchestrator and the helper thread
+    pthread_cond_t wake; // Signaled when the window moves or the prefetcher stops
+    bool stop;
+    uint64_t consumed; // Batches before this index were handed out
+    uint64_t prefetched; // Batches before this index were read ahead
+    off_t resume_offset; // Position in step1_output of the next file to read ahead in batch prefetched, 0 for none
+    uint64_t window; // Files of the batches to keep read ahead
+    uint64_t *batch_bytes; // Bytes and files read ahead for each batch
+    uint32_t *batch_files;
+    uint64_t ahead_files; // Files and bytes read ahead of the batches not handed out yet
+    uint64_t ahead_bytes;
+    uint64_t advised_files; // Totals for the report
+    uint64_t advised_bytes;
+    uint64_t handed_out_files; // Files handed out since the start (orchestrator only)
+    struct timespec start;
+    char *path; // Buffer of the lines of step1_output (helper thread only)
+    size_t path_size;
+} prefetcher_t;
+
+bool attach_prefetcher(work_list_t *work, char *temp_dir, uint64_t budget);
+void prefetch_batches(prefetcher_t *prefetcher);
+void report_prefetcher(prefetcher_t *prefetcher);
+void clear_prefetcher(prefetcher_t *prefetcher);
+
+#endif //A2022_PREFETCH_H
@@ -0,0 +1,226 @@
+#include "progress.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "global_defs.h"
+#include "utility.h"
+
+static char *phase_names[] = {[PROGRESS_STARTING] = "starting", [PROGRESS_LISTING] = "listing files",
+                              [PROGRESS_ANALYSIS] = "analyzing files", [PROGRESS_REDUCE] = "reducing",
+                              [PROGRESS_METRICS] = "computing graph metrics", [PROGRESS_WATCH] = "watching",
+                              [PROGRESS_DONE] = "done"};
+
+// Progress of the run, mapped by the parent before the workers are forked, NULL when there is none
+static progress_t *progress = NULL;
+static size_t progress_size = 0;
+// Counters of the current process, NULL if it is not a worker
+static worker_progress_t *worker_counters = NULL;
+
+/*!
+ * @brief start_progress creates the shared progress counters of a run in its temporary directory, and maps them
+ * (the workers forked later inherit the mapping)
+ * @param temp_dir the temporary directory
+ * @param worker_count the number of workers of the pools
+ * @return true if the counters were created, false else
+ */
+bool start_progress(char *temp_dir, uint16_t worker_count) {
+    char path[STR_MAX_LEN];
+    if (temp_dir == NULL || concat_path(temp_dir, PROGRESS_FILE_NAME, path) == NULL) return false;
+    size_t size = sizeof(progress_t) + worker_count * sizeof(worker_progress_t);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) return false;
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, (off_t) size) == 0) map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+    progress = map;
+    progress_size = size;
+    progress->worker_count = worker_count;
+    progress->pid = getpid();
+    begin_progress_phase(PROGRESS_STARTING, 0, 0);
+    __atomic_store_n(&progress->magic, PROGRESS_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+/*!
+ * @brief set_progress_worker selects the counters updated by the current process (called by a worker after the fork)
+ * @param worker the index of the worker in its pool
+ */
+void set_progress_worker(uint16_t worker) {
+    worker_counters = progress != NULL && worker < progress->worker_count ? &progress->workers[worker] : NULL;
+}
+
+/*!
+ * @brief begin_progress_phase starts a phase of the run, and resets the counters of the workers (which are idle
+ * between phases)
+ * @param phase the phase
+ * @param total_tasks the number of tasks of the phase, 0 if unknown
+ * @param total_files the number of files of the phase, 0 if unknown
+ */
+void begin_progress_phase(progress_phase_t phase, uint64_t total_tasks, uint64_t total_files) {
+    if (progress == NULL) return;
+    memset(progress->workers, 0, progress->worker_count * sizeof(worker_progress_t));
+    progress->total_tasks = total_tasks;
+    progress->total_files = total_files;
+    clock_gettime(CLOCK_MONOTONIC, &progress->phase_start);
+    __atomic_store_n(&progress->phase, phase, __ATOMIC_RELEASE);
+}
+
+/*!
+ * @brief set_progress_total_tasks sets the number of tasks of the current phase, once it is known
+ * @param total_tasks the number of tasks
+ */
+void set_progress_total_tasks(uint64_t total_tasks) {
+    if (progress != NULL) progress->total_tasks = total_tasks;
+}
+
+/*!
+ * @brief count_progress adds to the counters of the current worker. Each counter has a single writer, so plain
+ * stores are enough (the status command may read a counter one update late).
+ * @param tasks the tasks completed
+ * @param files the files listed or analyzed
+ * @param bytes the bytes of e-mails read
+ * @param errors the errors
+ */
+void count_progress(uint64_t tasks, uint64_t files, uint64_t bytes, uint64_t errors) {
+    if (worker_counters == NULL) return;
+    __atomic_store_n(&worker_counters->tasks, worker_counters->tasks + tasks, __ATOMIC_RELAXED);
+    __atomic_store_n(&worker_counters->files, worker_counters->files + files, __ATOMIC_RELAXED);
+    __atomic_store_n(&worker_counters->bytes, worker_counters->bytes + bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&worker_counters->errors, worker_counters->errors + errors, __ATOMIC_RELAXED);
+}
+
+/*!
+ * @brief set_progress_arena records the statistics of the arena of the current worker
+ * @param peak_bytes the high-water mark of the arena
+ * @param blocks the blocks mapped by the arena
+ */
+void set_progress_arena(uint64_t peak_bytes, uint64_t blocks) {
+    if (worker_counters == NULL) return;
+    __atomic_store_n(&worker_counters->arena_peak_bytes, peak_bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&worker_counters->arena_blocks, blocks, __ATOMIC_RELAXED);
+}
+
+/*!
+ * @brief report_worker_arenas prints the arena statistics recorded by the workers in the current phase: the largest
+ * high-water mark of a worker, and the blocks mapped by the workers
+ * @param name the name of the arenas in the report
+ */
+void report_worker_arenas(char *name) {
+    if (progress == NULL) return;
+    uint64_t peak_bytes = 0, blocks = 0;
+    uint32_t workers = 0;
+    for (uint32_t i = 0; i < progress->worker_count; i++) {
+        uint64_t worker_blocks = __atomic_load_n(&progress->workers[i].arena_blocks, __ATOMIC_RELAXED);
+        uint64_t worker_peak = __atomic_load_n(&progress->workers[i].arena_peak_bytes, __ATOMIC_RELAXED);
+        if (worker_blocks == 0) continue;
+        workers++;
+        blocks += worker_blocks;
+        if (worker_peak > peak_bytes) peak_bytes = worker_peak;
+    }
+    if (workers == 0) return;
+    printf("%s arenas: at most %" PRIu64 " bytes at once in a worker, %" PRIu64 " blocks mapped by %u workers\n", name,
+           peak_bytes, blocks, workers);
+}
+
+/*!
+ * @brief end_progress marks the run as done and unmaps the counters (the file is kept for the status command)
+ */
+void end_progress(void) {
+    if (progress == NULL) return;
+    __atomic_store_n(&progress->phase, PROGRESS_DONE, __ATOMIC_RELEASE);
+    munmap(progress, progress_size);
+    progress = NULL;
+}
+
+/*!
+ * @brief print_progress prints the progress of the run using a temporary directory (status command): its current
+ * phase, the throughput and the ETA of the phase, and the counters of each worker
+ * @param temp_dir the temporary directory of the run
+ * @return true if the progress was printed, false if there is no run in the directory
+ */
+bool print_progress(char *temp_dir) {
+    char path[STR_MAX_LEN];
+    if (temp_dir == NULL || concat_path(temp_dir, PROGRESS_FILE_NAME, path) == NULL) return false;
+    int fd = open(path, O_RDONLY);
+    struct stat sb;
+    if (fd == -1 || fstat(fd, &sb) == -1 || sb.st_size < (off_t) sizeof(progress_t)) {
+        fprintf(stderr, "No run in %s\n", temp_dir);
+        if (fd != -1) close(fd);
+        return false;
+    }
+    progress_t *run = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (run == MAP_FAILED) return false;
+    if (__atomic_load_n(&run->magic, __ATOMIC_ACQUIRE) != PROGRESS_MAGIC ||
+        sizeof(progress_t) + run->worker_count * sizeof(worker_progress_t) > (size_t) sb.st_size) {
+        fprintf(stderr, "%s is not a progress file\n", path);
+        munmap(run, sb.st_size);
+        return false;
+    }
+
+    // 1. Phase of the run
+    progress_phase_t phase = __atomic_load_n(&run->phase, __ATOMIC_ACQUIRE);
+    bool alive = kill(run->pid, 0) == 0;
+    double elapsed = elapsed_ms(&run->phase_start) / 1000.0;
+    if (phase == PROGRESS_DONE) {
+        printf("Run %d is done\n", run->pid);
+    } else if (!alive) {
+        printf("Run %d stopped while %s\n", run->pid, phase_names[phase]);
+    } else {
+        printf("Run %d: %s for %.1f s\n", run->pid, phase_names[phase], elapsed);
+    }
+
+    // 2. Totals of the phase, throughput and ETA
+    worker_progress_t total = {0};
+    for (uint32_t i = 0; i < run->worker_count; i++) {
+        total.tasks += __atomic_load_n(&run->workers[i].tasks, __ATOMIC_RELAXED);
+        total.files += __atomic_load_n(&run->workers[i].files, __ATOMIC_RELAXED);
+        total.bytes += __atomic_load_n(&run->workers[i].bytes, __ATOMIC_RELAXED);
+        total.errors += __atomic_load_n(&run->workers[i].errors, __ATOMIC_RELAXED);
+    }
+    if (phase == PROGRESS_LISTING || phase == PROGRESS_ANALYSIS || phase == PROGRESS_WATCH) {
+        double rate = elapsed > 0 ? total.files / elapsed : 0;
+        printf("    %" PRIu64 " tasks", total.tasks);
+        if (run->total_tasks > 0) printf(" of %" PRIu64, run->total_tasks);
+        printf(", %" PRIu64 " files", total.files);
+        if (run->total_files > 0) printf(" of %" PRIu64, run->total_files);
+        printf(", %.1f files/s, %.2f MiB/s, %" PRIu64 " errors\n", rate,
+               elapsed > 0 ? total.bytes / elapsed / 1048576 : 0, total.errors);
+        // The ETA follows the files when their number is known, else the tasks
+        double done = 0, remaining = 0;
+        if (run->total_files > 0) {
+            done = (double) total.files;
+            remaining = (double) run->total_files - done;
+        } else if (run->total_tasks > 0) {
+            done = (double) total.tasks;
+            remaining = (double) run->total_tasks - done;
+        }
+        if (alive && done > 0 && remaining >= 0) {
+            printf("    %.1f %% done, ETA %.1f s\n", 100 * done / (done + remaining), remaining * elapsed / done);
+        }
+        // 3. Counters of each worker
+        for (uint32_t i = 0; i < run->worker_count; i++) {
+            printf("    Worker %u: %" PRIu64 " tasks, %" PRIu64 " files, %" PRIu64 " bytes, %" PRIu64 " errors", i,
+                   __atomic_load_n(&run->workers[i].tasks, __ATOMIC_RELAXED),
+                   __atomic_load_n(&run->workers[i].files, __ATOMIC_RELAXED),
+                   __atomic_load_n(&run->workers[i].bytes, __ATOMIC_RELAXED),
+                   __atomic_load_n(&run->workers[i].errors, __ATOMIC_RELAXED));
+            uint64_t arena_blocks = __atomic_load_n(&run->workers[i].arena_blocks, __ATOMIC_RELAXED);
+            if (arena_blocks > 0) {
+                printf(", arena at most %" PRIu64 " bytes in %" PRIu64 " blocks",
+                       __atomic_load_n(&run->workers[i].arena_peak_bytes, __ATOMIC_RELAXED), arena_blocks);
+            }
+            printf("\n");
+        }
+    }
+    munmap(run, sb.st_size);
+    return true;
+}
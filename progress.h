@@ -0,0 +1,62 @@
+#ifndef A2022_PROGRESS_H
+#define A2022_PROGRESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+// Name of the shared progress counters in the temporary directory
+#define PROGRESS_FILE_NAME "progress"
+#define PROGRESS_MAGIC 0x41323250
+
+typedef enum {
+    PROGRESS_STARTING,
+    PROGRESS_LISTING, // First step: listing the files of the user directories
+    PROGRESS_ANALYSIS, // Second step: analysis of the files
+    PROGRESS_REDUCE,
+    PROGRESS_METRICS,
+    PROGRESS_WATCH,
+    PROGRESS_DONE,
+} progress_phase_t;
+
+// Counters of a worker in the current phase, only written by the worker: one cache line each, so that workers do not
+// invalidate the lines of the others
+typedef struct {
+    uint64_t tasks;
+    uint64_t files;
+    uint64_t bytes; // Bytes of e-mails read
+    uint64_t errors; // Files that could not be read, batches that could not be committed
+    uint64_t arena_peak_bytes; // High-water mark of the mapper arena of the worker (see arena.h)
+    uint64_t arena_blocks; // Blocks mapped by the mapper arena of the worker
+    uint64_t padding[2];
+} worker_progress_t;
+
+/*
+ * Progress of a run, in a file of the temporary directory mapped by the parent and the workers: the workers update
+ * their counters with plain stores (no system call, no lock), and the status command maps the file read only to
+ * print the throughput and the ETA of the current phase. The parent resets the counters at each phase, while the
+ * workers are idle.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t worker_count;
+    pid_t pid; // The parent process of the run
+    progress_phase_t phase;
+    struct timespec phase_start; // CLOCK_MONOTONIC
+    uint64_t total_tasks; // Tasks of the current phase, 0 if unknown
+    uint64_t total_files; // Files of the current phase, 0 if unknown
+    worker_progress_t workers[];
+} progress_t;
+
+bool start_progress(char *temp_dir, uint16_t worker_count);
+void set_progress_worker(uint16_t worker);
+void begin_progress_phase(progress_phase_t phase, uint64_t total_tasks, uint64_t total_files);
+void set_progress_total_tasks(uint64_t total_tasks);
+void count_progress(uint64_t tasks, uint64_t files, uint64_t bytes, uint64_t errors);
+void set_progress_arena(uint64_t peak_bytes, uint64_t blocks);
+void report_worker_arenas(char *name);
+void end_progress(void);
+bool print_progress(char *temp_dir);
+
+#endif //A2022_PROGRESS_H
@@ -0,0 +1,386 @@
+#include "query_daemon.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "global_defs.h"
+#include "graph.h"
+#include "utility.h"
+
+typedef struct {
+    int socket; // Non-blocking, so that a client that does not read its answers does not stall the others
+    char buffer[QUERY_MAX_LEN];
+    size_t used;
+    char *output; // Answers not sent yet, NULL if none
+    size_t output_size;
+    size_t output_sent;
+} query_client_t;
+
+typedef struct {
+    struct timespec start;
+    uint64_t queries;
+    uint64_t errors;
+    double total_ns;
+    double max_ns;
+    uint64_t latencies[LATENCY_BUCKETS];
+} query_stats_t;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+/*!
+ * @brief request_stop is the SIGINT/SIGTERM handler of the daemon
+ */
+static void request_stop(int signal) {
+    (void) signal;
+    stop_requested = 1;
+}
+
+/*!
+ * @brief record_latency adds the latency of a query to the statistics
+ * @param stats the statistics
+ * @param latency_ns the latency of the query in nanoseconds
+ */
+static void record_latency(query_stats_t *stats, double latency_ns) {
+    int bucket = latency_ns < 1 ? 0 : (int) (LATENCY_BUCKETS_PER_OCTAVE * log2(latency_ns));
+    if (bucket >= LATENCY_BUCKETS) bucket = LATENCY_BUCKETS - 1;
+    stats->latencies[bucket]++;
+    stats->queries++;
+    stats->total_ns += latency_ns;
+    if (latency_ns > stats->max_ns) stats->max_ns = latency_ns;
+}
+
+/*!
+ * @brief latency_percentile estimates a latency percentile from the histogram (upper bound of its bucket)
+ * @param stats the statistics
+ * @param percentile the percentile, between 0 and 1
+ * @return the latency in microseconds
+ */
+static double latency_percentile(query_stats_t *stats, double percentile) {
+    uint64_t rank = (uint64_t) ceil(percentile * stats->queries);
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += stats->latencies[i];
+        if (seen >= rank && seen > 0) {
+            double upper = exp2((double) (i + 1) / LATENCY_BUCKETS_PER_OCTAVE) / 1e3;
+            return upper < stats->max_ns / 1e3 ? upper : stats->max_ns / 1e3;
+        }
+    }
+    return 0;
+}
+
+/*!
+ * @brief lookup_address finds the node of an address of a query (addresses are lower case in the graph)
+ * @param graph the graph
+ * @param address the address, lower-cased in place
+ * @param response the response, receiving the error if the address is unknown
+ * @return the node, NO_NODE if it is unknown
+ */
+static uint32_t lookup_address(graph_t *graph, char *address, FILE *response) {
+    for (char *c = address; *c != '\0'; c++) *c = (char) tolower((unsigned char) *c);
+    uint32_t node = find_node(graph, address);
+    if (node == NO_NODE) fprintf(response, "ERR unknown address %s\n", address);
+    return node;
+}
+
+/*!
+ * @brief answer_query answers a query of the line protocol (@see query_daemon.h)
+ * @param graph the graph
+ * @param stats the statistics of the daemon
+ * @param query the query, without its end of line (modified by the tokenization)
+ * @param response the response
+ * @param connected set to false if the client quits
+ * @param running set to false if the daemon must stop
+ * @return true if the query was answered, false if it was invalid
+ */
+static bool answer_query(graph_t *graph, query_stats_t *stats, char *query, FILE *response, bool *connected,
+                         bool *running) {
+    char *saveptr;
+    char *command = strtok_r(query, " \t\r", &saveptr);
+    char *first = strtok_r(NULL, " \t\r", &saveptr);
+    char *second = strtok_r(NULL, " \t\r", &saveptr);
+    if (command == NULL) {
+        fprintf(response, "ERR empty query\n");
+    } else if (strcasecmp(command, "TOP") == 0 && first != NULL) {
+        unsigned long k = second != NULL ? strtoul(second, NULL, 10) : DEFAULT_TOP_K;
+        if (k == 0 || k > MAX_TOP_K) k = DEFAULT_TOP_K;
+        uint32_t node = lookup_address(graph, first, response);
+        if (node == NO_NODE) return false;
+        correspondent_t top[MAX_TOP_K];
+        size_t count = top_correspondents(graph, node, top, k);
+        fprintf(response, "OK %zu\n", count);
+        for (size_t i = 0; i < count; i++) {
+            fprintf(response, "%s %u %u\n", node_name(graph, top[i].node), top[i].sent, top[i].received);
+        }
+    } else if (strcasecmp(command, "PAIR") == 0 && second != NULL) {
+        uint32_t a = lookup_address(graph, first, response);
+        uint32_t b = a == NO_NODE ? NO_NODE : lookup_address(graph, second, response);
+        if (b == NO_NODE) return false;
+        fprintf(response, "OK 1\n%u %u\n", edge_weight(graph, a, b), edge_weight(graph, b, a));
+    } else if (strcasecmp(command, "PATH") == 0 && second != NULL) {
+        uint32_t from = lookup_address(graph, first, response);
+        uint32_t to = from == NO_NODE ? NO_NODE : lookup_address(graph, second, response);
+        if (to == NO_NODE) return false;
+        uint32_t path[MAX_PATH_LENGTH];
+        size_t length = shortest_path(graph, from, to, path, MAX_PATH_LENGTH);
+        fprintf(response, "OK %zu\n", length);
+        for (size_t i = 0; i < length; i++) fprintf(response, "%s\n", node_name(graph, path[i]));
+    } else if (strcasecmp(command, "STATS") == 0) {
+        double uptime_s = elapsed_ms(&stats->start) / 1e3;
+        fprintf(response, "OK 9\nnodes %u\nedges %" PRIu64 "\nqueries %" PRIu64 "\nerrors %" PRIu64 "\nqps %.1f\n",
+                graph->node_count, graph->edge_count, stats->queries, stats->errors,
+                uptime_s > 0 ? stats->queries / uptime_s : 0);
+        fprintf(response, "latency_mean_us %.2f\nlatency_p50_us %.2f\nlatency_p99_us %.2f\nlatency_max_us %.2f\n",
+                stats->queries > 0 ? stats->total_ns / stats->queries / 1e3 : 0, latency_percentile(stats, 0.5),
+                latency_percentile(stats, 0.99), stats->max_ns / 1e3);
+    } else if (strcasecmp(command, "QUIT") == 0) {
+        *connected = false;
+    } else if (strcasecmp(command, "SHUTDOWN") == 0) {
+        fprintf(response, "OK 0\n");
+        *connected = false;
+        *running = false;
+    } else {
+        fprintf(response, "ERR unknown query %s\n", command);
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief queue_output adds answers to the output of a client not sent yet
+ * @param client the client
+ * @param data the answers
+ * @param size the size of the answers
+ * @return true on success, false on memory error
+ */
+static bool queue_output(query_client_t *client, char *data, size_t size) {
+    size_t pending = client->output_size - client->output_sent;
+    char *output = malloc(pending + size);
+    if (output == NULL) return false;
+    if (pending > 0) memcpy(output, client->output + client->output_sent, pending);
+    memcpy(output + pending, data, size);
+    free(client->output);
+    client->output = output;
+    client->output_size = pending + size;
+    client->output_sent = 0;
+    return true;
+}
+
+/*!
+ * @brief flush_client sends the pending output of a client, as much as its socket takes without blocking
+ * @param client the client
+ * @return false if the client must be disconnected, true else
+ */
+static bool flush_client(query_client_t *client) {
+    while (client->output_sent < client->output_size) {
+        ssize_t sent = write(client->socket, client->output + client->output_sent,
+                             client->output_size - client->output_sent);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true; // The rest waits for POLLOUT
+        if (sent < 0) return false;
+        client->output_sent += sent;
+    }
+    free(client->output);
+    client->output = NULL;
+    client->output_size = 0;
+    client->output_sent = 0;
+    return true;
+}
+
+/*!
+ * @brief serve_client answers the complete queries received from a client. The latency of a query is the time taken
+ * to compute its answer, without the socket I/O. Answers are queued and sent without blocking (@see flush_client).
+ * @param graph the graph
+ * @param stats the statistics of the daemon
+ * @param client the client
+ * @param running set to false if the daemon must stop
+ * @return false if the client must be disconnected, true else
+ */
+static bool serve_client(graph_t *graph, query_stats_t *stats, query_client_t *client, bool *running) {
+    ssize_t received = read(client->socket, client->buffer + client->used, QUERY_MAX_LEN - client->used);
+    if (received <= 0) return received < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK);
+    client->used += received;
+
+    char *answer = NULL;
+    size_t answer_size = 0;
+    FILE *response = open_memstream(&answer, &answer_size);
+    if (response == NULL) return false;
+    bool connected = true;
+    char *line = client->buffer;
+    char *end;
+    while (connected && (end = memchr(line, '\n', client->buffer + client->used - line)) != NULL) {
+        *end = '\0';
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (!answer_query(graph, stats, line, response, &connected, running)) stats->errors++;
+        fflush(response);
+        record_latency(stats, elapsed_ms(&start) * 1e6);
+        line = end + 1;
+    }
+    fclose(response);
+    bool queued = queue_output(client, answer, answer_size);
+    free(answer);
+
+    // Keep the incomplete query for the next read
+    client->used -= line - client->buffer;
+    memmove(client->buffer, line, client->used);
+    if (client->used == QUERY_MAX_LEN) {
+        queue_output(client, "ERR query too long\n", 19);
+        flush_client(client);
+        return false;
+    }
+    bool flushed = flush_client(client);
+    return connected && queued && flushed;
+}
+
+/*!
+ * @brief close_client closes the connection of a client and drops its unsent output
+ * @param client the client
+ */
+static void close_client(query_client_t *client) {
+    close(client->socket);
+    free(client->output);
+}
+
+/*!
+ * @brief load_graph maps the snapshot of the graph if it matches the output file, else builds the graph from the
+ * output file and saves its snapshot for the next start
+ * @param graph the graph to load
+ * @param output_file the output file
+ * @return true if the graph was loaded, false else
+ */
+static bool load_graph(graph_t *graph, char *output_file) {
+    char snapshot_path[STR_MAX_LEN];
+    snprintf(snapshot_path, STR_MAX_LEN, "%s%s", output_file, GRAPH_SNAPSHOT_SUFFIX);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (load_graph_snapshot(graph, snapshot_path, output_file)) {
+        printf("Graph loaded from snapshot %s in %.3f ms", snapshot_path, elapsed_ms(&start));
+    } else if (build_graph(graph, output_file)) {
+        printf("Graph built from %s in %.3f ms", output_file, elapsed_ms(&start));
+        if (!save_graph_snapshot(graph, snapshot_path, output_file)) printf(" (could not save its snapshot)");
+    } else {
+        printf("Could not load the graph of %s\n", output_file);
+        return false;
+    }
+    printf(": %u addresses, %" PRIu64 " pairs\n", graph->node_count, graph->edge_count);
+    return true;
+}
+
+/*!
+ * @brief listen_on_socket opens a Unix socket listening at a path (replacing a stale socket)
+ * @param socket_path the path of the socket
+ * @return the listening socket, -1 on error
+ */
+static int listen_on_socket(char *socket_path) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(address.sun_path)) return -1;
+    strcpy(address.sun_path, socket_path);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener == -1) return -1;
+    unlink(socket_path);
+    if (bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+        close(listener);
+        return -1;
+    }
+    return listener;
+}
+
+/*!
+ * @brief run_query_daemon loads the communication graph of an output file and answers queries over a Unix socket
+ * (@see query_daemon.h for the protocol) until SHUTDOWN, SIGINT or SIGTERM. Query latencies and QPS are reported by
+ * the STATS query and when the daemon stops.
+ * @param output_file the output file of the exact reducer
+ * @param socket_path the path of the Unix socket
+ * @return true if the daemon ran, false if it could not start
+ */
+bool run_query_daemon(char *output_file, char *socket_path) {
+    graph_t graph;
+    if (!load_graph(&graph, output_file)) return false;
+    int listener = listen_on_socket(socket_path);
+    if (listener == -1) {
+        perror("Could not open the query socket");
+        clear_graph(&graph);
+        return false;
+    }
+    struct sigaction action = {.sa_handler = request_stop};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    printf("Answering queries on %s\n", socket_path);
+    fflush(stdout);
+
+    query_stats_t *stats = calloc(1, sizeof(query_stats_t));
+    query_client_t *clients = malloc(sizeof(query_client_t) * MAX_QUERY_CLIENTS);
+    if (stats == NULL || clients == NULL) {
+        free(stats);
+        free(clients);
+        clear_graph(&graph);
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stats->start);
+    int client_count = 0;
+    bool running = true;
+    struct pollfd fds[MAX_QUERY_CLIENTS + 1];
+    while (running && !stop_requested) {
+        fds[0] = (struct pollfd) {.fd = listener, .events = POLLIN};
+        for (int i = 0; i < client_count; i++) {
+            // A client is not read while it does not read its answers, so that they do not grow without bound
+            short events = clients[i].output_size - clients[i].output_sent < QUERY_MAX_PENDING ? POLLIN : 0;
+            if (clients[i].output != NULL) events |= POLLOUT;
+            fds[i + 1] = (struct pollfd) {.fd = clients[i].socket, .events = events};
+        }
+        if (poll(fds, client_count + 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+        // Backwards, so that removing a client (the last one takes its place) keeps the indexes valid
+        for (int i = client_count - 1; i >= 0; i--) {
+            bool keep = true;
+            if (fds[i + 1].revents & POLLOUT) keep = flush_client(&clients[i]);
+            if (keep && (fds[i + 1].revents & ~POLLOUT)) keep = serve_client(&graph, stats, &clients[i], &running);
+            if (!keep) {
+                close_client(&clients[i]);
+                clients[i] = clients[--client_count];
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            int connection = accept(listener, NULL, NULL);
+            if (connection != -1 && client_count == MAX_QUERY_CLIENTS) {
+                write_all(connection, "ERR too many clients\n", 21);
+                close(connection);
+            } else if (connection != -1) {
+                fcntl(connection, F_SETFL, fcntl(connection, F_GETFL) | O_NONBLOCK);
+                clients[client_count++] = (query_client_t) {.socket = connection, .used = 0, .output = NULL};
+            }
+        }
+    }
+
+    for (int i = 0; i < client_count; i++) close_client(&clients[i]);
+    close(listener);
+    unlink(socket_path);
+    double uptime_s = elapsed_ms(&stats->start) / 1e3;
+    printf("Query daemon: %" PRIu64 " queries (%" PRIu64 " errors) in %.1f s, %.1f QPS, latency mean %.2f us, "
+           "p50 %.2f us, p99 %.2f us, max %.2f us\n", stats->queries, stats->errors, uptime_s,
+           uptime_s > 0 ? stats->queries / uptime_s : 0,
+           stats->queries > 0 ? stats->total_ns / stats->queries / 1e3 : 0, latency_percentile(stats, 0.5),
+           latency_percentile(stats, 0.99), stats->max_ns / 1e3);
+    free(clients);
+    free(stats);
+    clear_graph(&graph);
+    return true;
+}
@@ -0,0 +1,32 @@
+#ifndef A2022_QUERY_DAEMON_H
+#define A2022_QUERY_DAEMON_H
+
+#include <stdbool.h>
+
+// Suffix of the snapshot of the graph, next to the output file it was built from
+#define GRAPH_SNAPSHOT_SUFFIX ".graph"
+#define MAX_QUERY_CLIENTS 64
+#define QUERY_MAX_LEN 4096
+// A client whose unsent answers reach this size is not read until it reads them
+#define QUERY_MAX_PENDING (1024 * 1024)
+#define DEFAULT_TOP_K 10
+#define MAX_TOP_K 1000
+#define MAX_PATH_LENGTH 64
+// Latency histogram buckets: bucket i counts latencies in [2^(i/8), 2^((i+1)/8)) ns
+#define LATENCY_BUCKETS_PER_OCTAVE 8
+#define LATENCY_BUCKETS (40 * LATENCY_BUCKETS_PER_OCTAVE)
+
+/*
+ * Line protocol of the query daemon, one query per line. Answers start with "OK <n>" followed by n lines, or are a
+ * single "ERR <message>" line.
+ *   TOP <address> [k]   the k (default 10) top correspondents: "<address> <sent> <received>" lines
+ *   PAIR <a> <b>        "<messages from a to b> <messages from b to a>"
+ *   PATH <a> <b>        the addresses of a shortest chain of correspondents from a to b (OK 0 if there is none)
+ *   STATS               "<name> <value>" lines: graph size, queries, QPS and latency percentiles
+ *   QUIT                closes the connection
+ *   SHUTDOWN            stops the daemon
+ */
+
+bool run_query_daemon(char *output_file, char *socket_path);
+
+#endif //A2022_QUERY_DAEMON_H
@@ -5,13 +5,69 @@
 #include "reducers.h"
 
 #include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <math.h>
 
 #include "global_defs.h"
 #include "utility.h"
+#include "sketch.h"
+#include "hash_table.h"
+#include "intermediates.h"
+#include "combiner.h"
+
+/*!
+ * @brief prepend_source adds a new source at the beginning of the sources list, without looking for duplicates
+ * @param list the list to update
+ * @param source_email the e-mail to add as a string
+ * @param arena the arena of the list, NULL if its nodes are malloc'ed (@see clear_sources_list)
+ * @return a pointer to the updated beginning of the list
+ */
+static sender_t *prepend_source(sender_t *list, char *source_email, arena_t *arena) {
+    sender_t *new_sender = arena_alloc(arena, sizeof(sender_t));
+    strcpy(new_sender->sender_address, source_email);
+    new_sender->head = NULL;
+    new_sender->tail = NULL;
+    new_sender->prev = NULL;
+    new_sender->next = list;
+    if (list != NULL) {
+        list->prev = new_sender;
+    }
+    return new_sender;
+}
+
+/*!
+ * @brief append_recipient adds a new recipient, with occurrences = 1, at the end of the recipients list of a source,
+ * without looking for duplicates
+ * @param source a pointer to the source to add the recipient to
+ * @param recipient_email the recipient e-mail to add as a string
+ * @param arena the arena of the list, NULL if its nodes are malloc'ed (@see clear_sources_list)
+ * @return a pointer to the new recipient
+ */
+static recipient_t *append_recipient(sender_t *source, char *recipient_email, arena_t *arena) {
+    recipient_t *new_recipient = (recipient_t *) arena_alloc(arena, sizeof(recipient_t));
+    strcpy(new_recipient->recipient_address, recipient_email);
+    new_recipient->occurrences = 1;
+    new_recipient->buckets = NULL;
+    new_recipient->bucket_count = 0;
+    new_recipient->bucket_capacity = 0;
+    new_recipient->next = NULL;
+    new_recipient->prev = source->tail;
+    if (source->head == NULL) {
+        source->head = new_recipient;
+    } else {
+        source->tail->next = new_recipient;
+    }
+    source->tail = new_recipient;
+    return new_recipient;
+}
 
 /*!
  * @brief add_source_to_list adds an e-mail to the sources list. If the e-mail already exists, do not add it.
@@ -29,16 +85,7 @@ sender_t *add_source_to_list(sender_t *list, char *source_email) {
         current = current->next;
     }
     // Email not found in list, add it
-    sender_t *new_sender = malloc(sizeof(sender_t));
-    strcpy(new_sender->sender_address, source_email);
-    new_sender->head = NULL;
-    new_sender->tail = NULL;
-    new_sender->prev = NULL;
-    new_sender->next = list;
-    if (list != NULL) {
-        list->prev = new_sender;
-    }
-    return new_sender;
+    return prepend_source(list, source_email, NULL);
 }
 
 /*!
@@ -51,6 +98,7 @@ void clear_sources_list(sender_t *list) {
         recipient_t *recipient = current->head;
         while (recipient != NULL) {
             recipient_t *next = recipient->next;
+            free(recipient->buckets);
             free(recipient);
             recipient = next;
         }
@@ -105,134 +153,1434 @@ void add_recipient_to_source(sender_t *source, char *recipient_email) {
         current_recipient = current_recipient->next;
     }
     // 3. If not, add it
-    recipient_t *new_recipient = (recipient_t *) malloc(sizeof(recipient_t));
-    strcpy(new_recipient->recipient_address, recipient_email);
-    new_recipient->occurrences = 1;
-    new_recipient->next = NULL;
-    new_recipient->prev = source->tail;
-    if (source->head == NULL) {
-        source->head = new_recipient;
-    } else {
-        source->tail->next = new_recipient;
+    append_recipient(source, recipient_email, NULL);
+}
+
+// Listings are split between forked copiers by slices of this size at least (below, forking costs more than it saves)
+#define LIST_COPY_BYTES_PER_WORKER (4 * 1024 * 1024)
+
+// A per-user listing of the first step, and where it goes in step1_output
+typedef struct {
+    char path[STR_MAX_LEN];
+    off_t offset;
+    off_t size;
+} listing_t;
+
+/*!
+ * @brief copy_listings copies a share of the listings at their offsets in the output file (listings worker,
+ * worker + workers, worker + 2 * workers, etc.)
+ * @param listings the listings to concatenate
+ * @param count the number of listings
+ * @param out_fd the output file
+ * @param worker the index of the copier
+ * @param workers the number of copiers
+ * @return true if all listings of the share were copied, false else
+ */
+static bool copy_listings(listing_t *listings, size_t count, int out_fd, size_t worker, size_t workers) {
+    for (size_t i = worker; i < count; i += workers) {
+        int in_fd = open(listings[i].path, O_RDONLY);
+        if (in_fd == -1) {
+            perror("Error opening step 1 listing");
+            return false;
+        }
+        bool copied = copy_file_at(in_fd, out_fd, listings[i].offset, listings[i].size);
+        close(in_fd);
+        if (!copied) {
+            perror("Error copying step 1 listing");
+            return false;
+        }
     }
-    source->tail = new_recipient;
+    return true;
 }
 
 /*!
  * @brief files_list_reducer is the first reducer. It uses concatenates all temporary files from the first step into
- * a single file. Don't forget to sync filesystem before leaving the function.
+ * a single file. The offset of each file in the output is computed beforehand from its size, so that files are
+ * copied in the kernel (copy_file_range) by several processes at once. Only the output file is synced (fdatasync),
+ * unless the durability level is DURABILITY_NONE.
  * @param data_source the data source directory (its directories have the same names as the temp files to concatenate)
  * @param temp_files the temporary files directory, where to read files to be concatenated
  * @param output_file path to the output file (default name is step1_output, but we'll keep it as a parameter).
+ * @param nb_proc the maximum number of simultaneous copy processes
+ * @return true if the output file was written, false else
  */
-void files_list_reducer(char *data_source, char *temp_files, char *output_file) {
+bool files_list_reducer(char *data_source, char *temp_files, char *output_file, uint16_t nb_proc) {
     // 1. Check parameters
-    if (data_source == NULL || temp_files == NULL || output_file == NULL) return;
-    // 2. Open output file for writing
-    FILE *out = fopen(output_file, "w");
-    if (out == NULL) return;
-    // 3. Iterate over subdirectories in data_source
+    if (data_source == NULL || temp_files == NULL || output_file == NULL) return false;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // 2. List the temp files of the subdirectories in data_source, and compute their offsets in the output file
     DIR *dir = opendir(data_source);
-    if (dir == NULL) return;
+    if (dir == NULL) return false;
+    size_t count = 0, capacity = 64;
+    off_t total = 0;
+    listing_t *listings = malloc(sizeof(listing_t) * capacity);
     struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
+    while (listings != NULL && (entry = readdir(dir)) != NULL) {
         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
-        // 4. Concatenate files from subdirectory into output file
-        char temp_path[STR_MAX_LEN];
-        sprintf(temp_path, "%s/%s", temp_files, entry->d_name);
-        FILE *temp = fopen(temp_path, "r");
-        if (temp == NULL) continue;
-        char line[STR_MAX_LEN];
-        while (fgets(line, STR_MAX_LEN, temp) != NULL) {
-            fputs(line, out);
-        }
-        fclose(temp);
-        remove(temp_path);
+        if (count == capacity) {
+            capacity *= 2;
+            listing_t *grown = realloc(listings, sizeof(listing_t) * capacity);
+            if (grown == NULL) {
+                free(listings);
+                listings = NULL;
+                break;
+            }
+            listings = grown;
+        }
+        struct stat sb;
+        snprintf(listings[count].path, STR_MAX_LEN, "%s/%s", temp_files, entry->d_name);
+        if (stat(listings[count].path, &sb) == -1) continue;
+        listings[count].offset = total;
+        listings[count].size = sb.st_size;
+        total += sb.st_size;
+        count++;
     }
     closedir(dir);
-    // 5. Close output file and sync filesystem
-    fclose(out);
-    sync();
+    if (listings == NULL) return false;
+
+    // 3. Concatenate the files into the output file, in parallel for large listings
+    int out_fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd == -1 || ftruncate(out_fd, total) == -1) {
+        perror("Error creating step 1 output");
+        if (out_fd != -1) close(out_fd);
+        free(listings);
+        return false;
+    }
+    size_t workers = 1 + total / LIST_COPY_BYTES_PER_WORKER;
+    if (workers > nb_proc) workers = nb_proc;
+    if (workers > count) workers = count;
+    bool success = true;
+    if (workers <= 1) {
+        success = copy_listings(listings, count, out_fd, 0, 1);
+    } else {
+        fflush(stdout);
+        pid_t copiers[workers];
+        size_t started = 0;
+        for (; started < workers; started++) {
+            pid_t pid = fork();
+            copiers[started] = pid;
+            if (pid == 0) {
+                exit(copy_listings(listings, count, out_fd, started, workers) ? 0 : 1);
+            } else if (pid < 0) {
+                perror("fork");
+                break;
+            }
+        }
+        // Only reap the copiers: the pool workers are children of this process too
+        success = started == workers;
+        for (size_t i = 0; i < started; i++) {
+            int status;
+            if (waitpid(copiers[i], &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                success = false;
+            }
+        }
+    }
+
+    // 4. Sync the output file only (not the whole filesystem), then remove the concatenated files
+    struct timespec sync_start;
+    clock_gettime(CLOCK_MONOTONIC, &sync_start);
+    if (durability_at_least(DURABILITY_PHASE) && fdatasync(out_fd) == -1) success = false;
+    double sync_ms = elapsed_ms(&sync_start);
+    if (close(out_fd) == -1) success = false;
+    for (size_t i = 0; success && i < count; i++) {
+        remove(listings[i].path);
+    }
+    free(listings);
+    printf("Step 1 reduce: %zu files, %ld bytes, %zu copiers in %.3f ms (%.3f ms blocked in fdatasync)\n", count,
+           (long) total, workers, elapsed_ms(&start), sync_ms);
+    return success;
+}
+
+// Prefix of the sorted runs spilled by files_reducer in the temporary directory
+#define REDUCE_RUN_PREFIX "reduce-run"
+// Maximum number of runs merged at once (each one holds an open file)
+#define MAX_MERGE_FAN_IN 64
+// Approximate bookkeeping cost of a key in a hash index (entry and bucket pointer), its characters excluded
+#define INDEX_ENTRY_COST (sizeof(hash_entry_t) + sizeof(hash_entry_t *))
+// The output of files_reducer is formatted by one worker per this many senders, up to nb_proc workers
+#define OUTPUT_SENDERS_PER_WORKER 256
+// Size of the buffers the output lines are formatted into before being written (grown for longer lines)
+#define OUTPUT_BUFFER_SIZE (4 * 1024 * 1024)
+// Suffix of the file of counts per time bucket, next to the output file
+#define BUCKETS_SUFFIX ".buckets"
+// Initial number of time buckets of a pair (doubled when full)
+#define INITIAL_BUCKET_CAPACITY 4
+
+// In memory state of files_reducer: the sources list and its indexes, with their approximate memory footprint. The
+// nodes, index entries, keys and time buckets are allocated from the arena, released at once by each spill.
+typedef struct {
+    arena_t arena;
+    sender_t *senders;
+    hash_table_t *senders_index; // sender address -> sender_t
+    hash_table_t *pairs_index; // "sender recipient" -> recipient_t
+    uint64_t memory_used;
+    time_buckets_t granularity; // With time buckets, lines start with a bucket counted per pair (kept by spills)
+} collation_t;
+
+// The lines written for a sender: their length, and their formatting with the recipients sorted by address
+typedef struct {
+    uint64_t (*length)(sender_t *sender, time_buckets_t granularity);
+    char *(*format)(sender_t *sender, recipient_t **recipients, size_t count, time_buckets_t granularity,
+                    char *buffer);
+} line_format_t;
+
+// A recipient and its occurrences, as read from a sorted run
+typedef struct {
+    char *address;
+    uint64_t occurrences;
+} run_recipient_t;
+
+// A sorted run being merged, and its current line (sender, then "count:recipient" items)
+typedef struct {
+    FILE *file;
+    char *line;
+    size_t line_size;
+    char *sender;
+    char *recipients;
+} run_reader_t;
+
+/*!
+ * @brief compare_recipients orders recipients by address (qsort callback on recipient_t pointers)
+ */
+static int compare_recipients(const void *a, const void *b) {
+    return strcmp((*(recipient_t **) a)->recipient_address, (*(recipient_t **) b)->recipient_address);
+}
+
+/*!
+ * @brief sorted_recipients lists the recipients of a sender, sorted by address
+ * @param sender the sender
+ * @param count set to the number of recipients
+ * @return the malloc'ed array of recipients, NULL if memory is exhausted
+ */
+static recipient_t **sorted_recipients(sender_t *sender, size_t *count) {
+    *count = 0;
+    for (recipient_t *recipient = sender->head; recipient != NULL; recipient = recipient->next) (*count)++;
+    recipient_t **recipients = malloc(sizeof(recipient_t *) * (*count > 0 ? *count : 1));
+    if (recipients == NULL) return NULL;
+    size_t index = 0;
+    for (recipient_t *recipient = sender->head; recipient != NULL; recipient = recipient->next) {
+        recipients[index++] = recipient;
+    }
+    qsort(recipients, *count, sizeof(recipient_t *), compare_recipients);
+    return recipients;
+}
+
+/*!
+ * @brief sender_line_length computes the length of the output line of a sender, without formatting it
+ * @param sender the sender
+ * @param granularity unused (@see line_format_t)
+ * @return the length of the line in bytes
+ */
+static uint64_t sender_line_length(sender_t *sender, time_buckets_t granularity) {
+    (void) granularity;
+    // Space after the sender, then '\n'
+    uint64_t length = strlen(sender->sender_address) + 2;
+    for (recipient_t *recipient = sender->head; recipient != NULL; recipient = recipient->next) {
+        // ':' between the count and the recipient, then a space
+        length += decimal_length(recipient->occurrences) + strlen(recipient->recipient_address) + 2;
+    }
+    return length;
+}
+
+/*!
+ * @brief format_sender_line formats the output line of a sender: "sender count:recipient count:recipient ... \n"
+ * @param sender the sender
+ * @param recipients its recipients, sorted by address
+ * @param count the number of recipients
+ * @param granularity unused (@see line_format_t)
+ * @param buffer where to format the line, at least sender_line_length(sender) bytes (no '\0' is written)
+ * @return a pointer past the end of the line
+ */
+static char *format_sender_line(sender_t *sender, recipient_t **recipients, size_t count, time_buckets_t granularity,
+                                char *buffer) {
+    (void) granularity;
+    size_t length = strlen(sender->sender_address);
+    memcpy(buffer, sender->sender_address, length);
+    buffer += length;
+    *buffer++ = ' ';
+    for (size_t i = 0; i < count; i++) {
+        buffer = format_uint(recipients[i]->occurrences, buffer);
+        *buffer++ = ':';
+        length = strlen(recipients[i]->recipient_address);
+        memcpy(buffer, recipients[i]->recipient_address, length);
+        buffer += length;
+        *buffer++ = ' ';
+    }
+    *buffer++ = '\n';
+    return buffer;
+}
+
+static const line_format_t totals_format = {sender_line_length, format_sender_line};
+
+/*!
+ * @brief buckets_lines_length computes the length of the time buckets lines of a sender, without formatting them
+ * @param sender the sender
+ * @param granularity the granularity of the buckets
+ * @return the length of the lines in bytes
+ */
+static uint64_t buckets_lines_length(sender_t *sender, time_buckets_t granularity) {
+    uint64_t length = 0;
+    size_t sender_length = strlen(sender->sender_address);
+    char label[TIME_BUCKET_LABEL_SIZE];
+    for (recipient_t *recipient = sender->head; recipient != NULL; recipient = recipient->next) {
+        if (recipient->bucket_count == 0) continue;
+        // Space between the sender and the recipient, then '\n'
+        length += sender_length + strlen(recipient->recipient_address) + 2;
+        for (uint32_t i = 0; i < recipient->bucket_count; i++) {
+            // Space then ':' between the label and the count
+            length += format_time_bucket(recipient->buckets[i].bucket, granularity, label) +
+                      decimal_length(recipient->buckets[i].count) + 2;
+        }
+    }
+    return length;
+}
+
+/*!
+ * @brief format_buckets_lines formats the time buckets lines of a sender, one per recipient with dated e-mails:
+ * "sender recipient label:count label:count ...\n" with the buckets in chronological order
+ * @param sender the sender
+ * @param recipients its recipients, sorted by address
+ * @param count the number of recipients
+ * @param granularity the granularity of the buckets
+ * @param buffer where to format the lines, at least buckets_lines_length(sender) bytes (no '\0' is written)
+ * @return a pointer past the end of the lines
+ */
+static char *format_buckets_lines(sender_t *sender, recipient_t **recipients, size_t count, time_buckets_t granularity,
+                                  char *buffer) {
+    size_t sender_length = strlen(sender->sender_address);
+    for (size_t i = 0; i < count; i++) {
+        if (recipients[i]->bucket_count == 0) continue;
+        memcpy(buffer, sender->sender_address, sender_length);
+        buffer += sender_length;
+        *buffer++ = ' ';
+        size_t length = strlen(recipients[i]->recipient_address);
+        memcpy(buffer, recipients[i]->recipient_address, length);
+        buffer += length;
+        for (uint32_t b = 0; b < recipients[i]->bucket_count; b++) {
+            *buffer++ = ' ';
+            buffer += format_time_bucket(recipients[i]->buckets[b].bucket, granularity, buffer);
+            *buffer++ = ':'; // Over the '\0' of the label
+            buffer = format_uint(recipients[i]->buckets[b].count, buffer);
+        }
+        *buffer++ = '\n';
+    }
+    return buffer;
+}
+
+static const line_format_t buckets_format = {buckets_lines_length, format_buckets_lines};
+
+/*!
+ * @brief write_sender_line writes a sender and its recipients, sorted by address, as output lines
+ * @param output_fp the output file
+ * @param sender the sender to write
+ * @param format the lines to write
+ * @param granularity the granularity of the time buckets
+ * @return true if the lines were written, false else
+ */
+static bool write_sender_line(FILE *output_fp, sender_t *sender, const line_format_t *format,
+                              time_buckets_t granularity) {
+    size_t count;
+    recipient_t **recipients = sorted_recipients(sender, &count);
+    char *line = recipients != NULL ? malloc(format->length(sender, granularity)) : NULL;
+    bool success = line != NULL;
+    if (success) {
+        size_t length = format->format(sender, recipients, count, granularity, line) - line;
+        success = fwrite(line, 1, length, output_fp) == length;
+    }
+    free(line);
+    free(recipients);
+    return success;
+}
+
+/*!
+ * @brief init_collation prepares an empty in memory collation
+ * @param collation the collation to initialize
+ * @return true if the indexes could be allocated, false else
+ */
+static bool init_collation(collation_t *collation) {
+    collation->senders = NULL;
+    collation->senders_index = make_hash_table(1024);
+    collation->pairs_index = make_hash_table(1024);
+    collation->memory_used = 0;
+    if (collation->senders_index == NULL || collation->pairs_index == NULL) return false;
+    collation->senders_index->arena = &collation->arena;
+    collation->pairs_index->arena = &collation->arena;
+    return true;
+}
+
+/*!
+ * @brief clear_collation releases the lists and indexes of a collation (the arena keeps a block for the next ones)
+ * @param collation the collation to release
+ */
+static void clear_collation(collation_t *collation) {
+    clear_hash_table(collation->senders_index, NULL);
+    clear_hash_table(collation->pairs_index, NULL);
+    rewind_arena(&collation->arena);
+    collation->senders = NULL;
+    collation->senders_index = NULL;
+    collation->pairs_index = NULL;
+    collation->memory_used = 0;
+}
+
+/*!
+ * @brief count_in_bucket adds occurrences of a pair to a time bucket. The buckets of a pair are a sorted array,
+ * grown by doubling in the arena of the collation: a pair costs 8 bytes per non empty bucket, its addresses are
+ * stored once whatever the number of buckets.
+ * @param collation the collation of the pair
+ * @param recipient the pair
+ * @param bucket the time bucket
+ * @param occurrences the number of occurrences
+ * @return true on success, false if memory is exhausted
+ */
+static bool count_in_bucket(collation_t *collation, recipient_t *recipient, uint16_t bucket, uint32_t occurrences) {
+    // Records mostly come in chronological order: look for the bucket from the end
+    uint32_t index = recipient->bucket_count;
+    while (index > 0 && recipient->buckets[index - 1].bucket > bucket) index--;
+    if (index > 0 && recipient->buckets[index - 1].bucket == bucket) {
+        recipient->buckets[index - 1].count += occurrences;
+        return true;
+    }
+    if (recipient->bucket_count == recipient->bucket_capacity) {
+        uint32_t capacity = recipient->bucket_capacity > 0 ? 2 * recipient->bucket_capacity : INITIAL_BUCKET_CAPACITY;
+        bucket_count_t *grown = arena_alloc(&collation->arena, sizeof(bucket_count_t) * capacity);
+        if (grown == NULL) return false;
+        if (recipient->bucket_count > 0) {
+            memcpy(grown, recipient->buckets, sizeof(bucket_count_t) * recipient->bucket_count);
+        }
+        recipient->buckets = grown;
+        recipient->bucket_capacity = capacity;
+        collation->memory_used += sizeof(bucket_count_t) * capacity;
+    }
+    memmove(recipient->buckets + index + 1, recipient->buckets + index,
+            sizeof(bucket_count_t) * (recipient->bucket_count - index));
+    recipient->buckets[index] = (bucket_count_t) {.bucket = bucket, .count = occurrences};
+    recipient->bucket_count++;
+    return true;
+}
+
+/*!
+ * @brief collate_line adds a line of the second temporary output file (sender, then its recipients) to a collation.
+ * With time buckets, the line starts with the bucket of the e-mail ("-" for none). Combined recipients count for
+ * their weight (@see combiner.h).
+ * @param collation the collation to update
+ * @param line the line, modified by the tokenization
+ * @return true on success, false if memory is exhausted
+ */
+static bool collate_line(collation_t *collation, char *line) {
+    char *saveptr;
+    char *sender = strtok_r(line, " \n", &saveptr);
+    uint16_t bucket = NO_BUCKET;
+    if (sender != NULL && collation->granularity != TIME_BUCKETS_NONE) {
+        char *end;
+        unsigned long value = strtoul(sender, &end, 10);
+        if (*end == '\0' && end != sender && value < NO_BUCKET) bucket = (uint16_t) value;
+        sender = strtok_r(NULL, " \n", &saveptr);
+    }
+    if (sender == NULL) return true;
+    uint32_t weight;
+    sender = split_weight(sender, &weight);
+    if (strlen(sender) >= STR_MAX_LEN) sender[STR_MAX_LEN - 1] = '\0';
+    hash_entry_t *sender_entry = hash_table_find(collation->senders_index, sender, true);
+    if (sender_entry == NULL) return false;
+    if (sender_entry->value == NULL) {
+        // The index tells the sender is new: prepend it without scanning the sources list
+        collation->senders = prepend_source(collation->senders, sender, &collation->arena);
+        sender_entry->value = collation->senders;
+        collation->memory_used += sizeof(sender_t) + INDEX_ENTRY_COST + strlen(sender) + 1;
+    }
+    sender_t *source = sender_entry->value;
+
+    char pair[2 * STR_MAX_LEN];
+    char *recipient;
+    while ((recipient = strtok_r(NULL, " \n", &saveptr)) != NULL) {
+        recipient = split_weight(recipient, &weight);
+        if (strlen(recipient) >= STR_MAX_LEN) recipient[STR_MAX_LEN - 1] = '\0';
+        int pair_length = snprintf(pair, sizeof(pair), "%s %s", sender, recipient);
+        hash_entry_t *pair_entry = hash_table_find(collation->pairs_index, pair, true);
+        if (pair_entry == NULL) return false;
+        if (pair_entry->value == NULL) {
+            // The index tells the recipient is new: append it without scanning the recipients list
+            pair_entry->value = append_recipient(source, recipient, &collation->arena);
+            ((recipient_t *) pair_entry->value)->occurrences = weight;
+            collation->memory_used += sizeof(recipient_t) + INDEX_ENTRY_COST + pair_length + 1;
+        } else {
+            ((recipient_t *) pair_entry->value)->occurrences += weight;
+        }
+        if (bucket != NO_BUCKET && !count_in_bucket(collation, pair_entry->value, bucket, weight)) return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief write_collation writes all senders of a collation, sorted by address, with their sorted recipients
+ * @param collation the collation to write
+ * @param format the lines to write for each sender (totals or time buckets)
+ * @param output_fp the output file
+ * @return true if all lines were written, false else
+ */
+static bool write_collation(collation_t *collation, const line_format_t *format, FILE *output_fp) {
+    hash_entry_t **entries = hash_table_sorted_entries(collation->senders_index);
+    if (entries == NULL && collation->senders_index->size > 0) return false;
+    bool success = true;
+    for (size_t i = 0; success && i < collation->senders_index->size; i++) {
+        success = write_sender_line(output_fp, entries[i]->value, format, collation->granularity);
+    }
+    free(entries);
+    return success;
+}
+
+// Output of files_reducer formatted by forked workers: each one formats the lines of a range of senders in memory,
+// sends their size to the parent, which sends back the offset where the worker writes them in the output file
+typedef struct {
+    hash_entry_t **senders; // Sorted by address
+    size_t sender_count;
+    size_t *bounds; // workers + 1 indexes in senders: worker i formats the senders of [bounds[i], bounds[i + 1])
+    uint16_t workers;
+    const line_format_t *format;
+    time_buckets_t granularity;
+    int output_fd;
+} output_writer_t;
+
+// An output worker, seen from the parent
+typedef struct {
+    pid_t pid; // -1 if the parent formats the range itself (fork failed or the worker died)
+    int size_fd; // Worker to parent: size of the formatted lines (UINT64_MAX on error)
+    int offset_fd; // Parent to worker: offset where to write them
+    char *buffer; // Lines formatted by the parent when pid is -1
+    uint64_t size;
+} output_worker_t;
+
+/*!
+ * @brief format_range formats the lines of a range of senders into a buffer
+ * @param writer the output writer
+ * @param worker the index of the range
+ * @param size set to the size of the lines in bytes
+ * @return the malloc'ed buffer, NULL if memory is exhausted
+ */
+static char *format_range(output_writer_t *writer, uint16_t worker, uint64_t *size) {
+    size_t capacity = OUTPUT_BUFFER_SIZE;
+    char *buffer = malloc(capacity);
+    *size = 0;
+    for (size_t i = writer->bounds[worker]; buffer != NULL && i < writer->bounds[worker + 1]; i++) {
+        sender_t *sender = writer->senders[i]->value;
+        size_t count;
+        recipient_t **recipients = sorted_recipients(sender, &count);
+        uint64_t length = writer->format->length(sender, writer->granularity);
+        while (recipients != NULL && *size + length > capacity) {
+            capacity *= 2;
+            char *grown = realloc(buffer, capacity);
+            if (grown == NULL) {
+                free(recipients);
+                recipients = NULL;
+            }
+            buffer = grown;
+        }
+        if (recipients == NULL) {
+            free(buffer);
+            return NULL;
+        }
+        *size = writer->format->format(sender, recipients, count, writer->granularity, buffer + *size) - buffer;
+        free(recipients);
+    }
+    return buffer;
+}
+
+/*!
+ * @brief output_worker formats a range of lines, sends their size to the parent, then writes them at the offset sent
+ * back by the parent
+ * @param writer the output writer
+ * @param worker the index of the range
+ * @param size_fd the pipe to send the size
+ * @param offset_fd the pipe to receive the offset
+ * @return true if the lines were written, false else
+ */
+static bool output_worker(output_writer_t *writer, uint16_t worker, int size_fd, int offset_fd) {
+    uint64_t size, offset;
+    char *buffer = format_range(writer, worker, &size);
+    if (buffer == NULL) size = UINT64_MAX;
+    bool success = write_all(size_fd, (char *) &size, sizeof(uint64_t)) && buffer != NULL &&
+                   read(offset_fd, &offset, sizeof(uint64_t)) == sizeof(uint64_t) &&
+                   pwrite_all(writer->output_fd, buffer, size, (off_t) offset);
+    free(buffer);
+    return success;
+}
+
+/*!
+ * @brief start_output_workers forks a worker per range of senders, with its pipes. The ranges of workers that could
+ * not be forked are formatted by the parent.
+ * @param writer the output writer
+ * @param workers the workers to start
+ */
+static void start_output_workers(output_writer_t *writer, output_worker_t *workers) {
+    fflush(stdout);
+    for (uint16_t worker = 0; worker < writer->workers; worker++) {
+        output_worker_t *current = &workers[worker];
+        int size_pipe[2], offset_pipe[2];
+        current->pid = -1;
+        current->buffer = NULL;
+        if (writer->workers == 1 || pipe(size_pipe) == -1) continue;
+        if (pipe(offset_pipe) == -1) {
+            close(size_pipe[0]);
+            close(size_pipe[1]);
+            continue;
+        }
+        current->pid = fork();
+        if (current->pid == 0) {
+            // Only keep the ends of this worker, so that the pipes of the others see their end
+            for (uint16_t other = 0; other < worker; other++) {
+                if (workers[other].pid == -1) continue;
+                close(workers[other].size_fd);
+                close(workers[other].offset_fd);
+            }
+            close(size_pipe[0]);
+            close(offset_pipe[1]);
+            exit(output_worker(writer, worker, size_pipe[1], offset_pipe[0]) ? 0 : 1);
+        }
+        close(size_pipe[1]);
+        close(offset_pipe[0]);
+        current->size_fd = size_pipe[0];
+        current->offset_fd = offset_pipe[1];
+        if (current->pid == -1) {
+            close(current->size_fd);
+            close(current->offset_fd);
+        }
+    }
+}
+
+/*!
+ * @brief write_collation_parallel writes all senders of a collation to the output file, byte for byte as
+ * write_collation, with up to nb_proc workers formatting ranges of senders in parallel and writing them at their
+ * offset with pwrite. The formatted output is held in memory until the offsets are known.
+ * @param collation the collation to write
+ * @param format the lines to write for each sender (totals or time buckets)
+ * @param output_file the path to the output file
+ * @param nb_proc the maximum number of workers
+ * @return true if all lines were written, false else
+ */
+static bool write_collation_parallel(collation_t *collation, const line_format_t *format, char *output_file,
+                                     uint16_t nb_proc) {
+    output_writer_t writer = {.sender_count = collation->senders_index->size, .format = format,
+                              .granularity = collation->granularity};
+    writer.senders = hash_table_sorted_entries(collation->senders_index);
+    if (writer.senders == NULL && writer.sender_count > 0) return false;
+    writer.workers = writer.sender_count / OUTPUT_SENDERS_PER_WORKER;
+    if (writer.workers > nb_proc) writer.workers = nb_proc;
+    if (writer.workers == 0) writer.workers = 1;
+    writer.bounds = malloc(sizeof(size_t) * (writer.workers + 1));
+    output_worker_t *workers = malloc(sizeof(output_worker_t) * writer.workers);
+    writer.output_fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (writer.output_fd == -1) fprintf(stderr, "Error opening final output file %s\n", output_file);
+    if (writer.bounds == NULL || workers == NULL || writer.output_fd == -1) {
+        if (writer.output_fd != -1) close(writer.output_fd);
+        free(workers);
+        free(writer.bounds);
+        free(writer.senders);
+        return false;
+    }
+    for (uint16_t worker = 0; worker <= writer.workers; worker++) {
+        writer.bounds[worker] = writer.sender_count * worker / writer.workers;
+    }
+
+    // Gather the sizes of all ranges, formatting the ranges of missing workers, then send their offsets. A worker that
+    // died must not kill the parent with SIGPIPE.
+    void (*pipe_handler)(int) = signal(SIGPIPE, SIG_IGN);
+    start_output_workers(&writer, workers);
+    bool success = true;
+    uint64_t offset = 0;
+    for (uint16_t worker = 0; worker < writer.workers; worker++) {
+        output_worker_t *current = &workers[worker];
+        if (current->pid != -1 && (read(current->size_fd, &current->size, sizeof(uint64_t)) != sizeof(uint64_t) ||
+                                   current->size == UINT64_MAX)) {
+            success = false;
+        }
+        if (success && current->pid == -1) {
+            current->buffer = format_range(&writer, worker, &current->size);
+            if (current->buffer == NULL) success = false;
+        }
+        if (success && current->pid != -1) {
+            success = write_all(current->offset_fd, (char *) &offset, sizeof(uint64_t));
+        } else if (success) {
+            success = pwrite_all(writer.output_fd, current->buffer, current->size, (off_t) offset);
+        }
+        offset += current->size;
+    }
+    for (uint16_t worker = 0; worker < writer.workers; worker++) {
+        output_worker_t *current = &workers[worker];
+        free(current->buffer);
+        if (current->pid == -1) continue;
+        // Closing the pipes ends the workers still waiting for their offset after a failure
+        close(current->size_fd);
+        close(current->offset_fd);
+        int status;
+        if (waitpid(current->pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            success = false;
+        }
+    }
+    signal(SIGPIPE, pipe_handler);
+    if (close(writer.output_fd) != 0) success = false;
+    free(workers);
+    free(writer.bounds);
+    free(writer.senders);
+    return success;
+}
+
+/*!
+ * @brief run_path builds the path of a sorted run of files_reducer
+ * @param temp_files the temporary files directory
+ * @param index the run index
+ * @param path the resulting path (STR_MAX_LEN long)
+ */
+static void run_path(char *temp_files, uint32_t index, char *path) {
+    snprintf(path, STR_MAX_LEN, "%s/%s-%u", temp_files, REDUCE_RUN_PREFIX, index);
+}
+
+/*!
+ * @brief spill_collation writes a collation as a sorted run (same format as the output file), then empties it
+ * @param collation the collation to spill
+ * @param path the path of the run
+ * @return true if the run was written, false else
+ */
+static bool spill_collation(collation_t *collation, char *path) {
+    FILE *run_fp = fopen(path, "w");
+    if (run_fp == NULL) {
+        perror("Error creating reducer run");
+        return false;
+    }
+    bool success = write_collation(collation, &totals_format, run_fp);
+    if (fclose(run_fp) != 0) success = false;
+    clear_collation(collation);
+    return init_collation(collation) && success;
+}
+
+/*!
+ * @brief read_run_line reads the next line of a sorted run, and splits its sender from its recipients
+ * @param reader the run reader
+ * @return true if a line was read, false at the end of the run
+ */
+static bool read_run_line(run_reader_t *reader) {
+    while (getline(&reader->line, &reader->line_size, reader->file) != -1) {
+        reader->sender = strtok_r(reader->line, " \n", &reader->recipients);
+        if (reader->sender != NULL) return true;
+    }
+    reader->sender = NULL;
+    return false;
+}
+
+/*!
+ * @brief sift_down restores the heap property of the run readers min-heap (ordered by current sender) from a node
+ * @param heap the heap of run readers
+ * @param size the size of the heap
+ * @param index the node to move down
+ */
+static void sift_down(run_reader_t **heap, size_t size, size_t index) {
+    while (true) {
+        size_t smallest = index;
+        size_t left = 2 * index + 1, right = 2 * index + 2;
+        if (left < size && strcmp(heap[left]->sender, heap[smallest]->sender) < 0) smallest = left;
+        if (right < size && strcmp(heap[right]->sender, heap[smallest]->sender) < 0) smallest = right;
+        if (smallest == index) return;
+        run_reader_t *swap = heap[index];
+        heap[index] = heap[smallest];
+        heap[smallest] = swap;
+        index = smallest;
+    }
+}
+
+/*!
+ * @brief compare_run_recipients orders run recipients by address (qsort callback)
+ */
+static int compare_run_recipients(const void *a, const void *b) {
+    return strcmp(((run_recipient_t *) a)->address, ((run_recipient_t *) b)->address);
+}
+
+/*!
+ * @brief write_merged_sender writes the line of a sender from its lines in several runs: recipients are sorted and
+ * the occurrences of a recipient found in several runs are added
+ * @param output_fp the output file
+ * @param group the readers whose current line is about the sender
+ * @param group_size the number of readers in group
+ * @return true if the line was written, false else
+ */
+static bool write_merged_sender(FILE *output_fp, run_reader_t **group, size_t group_size) {
+    size_t count = 0, capacity = 64;
+    run_recipient_t *recipients = malloc(sizeof(run_recipient_t) * capacity);
+    if (recipients == NULL) return false;
+    for (size_t g = 0; g < group_size; g++) {
+        char *item;
+        while ((item = strtok_r(NULL, " \n", &group[g]->recipients)) != NULL) {
+            char *address;
+            uint64_t occurrences = strtoull(item, &address, 10);
+            if (*address != ':') continue;
+            if (count == capacity) {
+                capacity *= 2;
+                run_recipient_t *grown = realloc(recipients, sizeof(run_recipient_t) * capacity);
+                if (grown == NULL) {
+                    free(recipients);
+                    return false;
+                }
+                recipients = grown;
+            }
+            recipients[count].address = address + 1;
+            recipients[count].occurrences = occurrences;
+            count++;
+        }
+    }
+    qsort(recipients, count, sizeof(run_recipient_t), compare_run_recipients);
+    fprintf(output_fp, "%s ", group[0]->sender);
+    for (size_t i = 0; i < count; i++) {
+        uint64_t occurrences = recipients[i].occurrences;
+        while (i + 1 < count && strcmp(recipients[i + 1].address, recipients[i].address) == 0) {
+            occurrences += recipients[++i].occurrences;
+        }
+        fprintf(output_fp, "%" PRIu64 ":%s ", occurrences, recipients[i].address);
+    }
+    free(recipients);
+    return fprintf(output_fp, "\n") > 0;
+}
+
+/*!
+ * @brief merge_runs merges sorted runs into a single sorted file (k-way merge with a min-heap on senders)
+ * @param temp_files the temporary files directory
+ * @param first the index of the first run to merge
+ * @param count the number of runs to merge (at most MAX_MERGE_FAN_IN)
+ * @param output_fp the file receiving the merge
+ * @return true if the runs were merged, false else
+ */
+static bool merge_runs(char *temp_files, uint32_t first, uint32_t count, FILE *output_fp) {
+    run_reader_t readers[MAX_MERGE_FAN_IN];
+    run_reader_t *heap[MAX_MERGE_FAN_IN];
+    run_reader_t *group[MAX_MERGE_FAN_IN];
+    size_t heap_size = 0;
+    uint32_t opened = 0;
+    bool success = true;
+    for (; opened < count; opened++) {
+        char path[STR_MAX_LEN];
+        run_path(temp_files, first + opened, path);
+        readers[opened] = (run_reader_t) {fopen(path, "r"), NULL, 0, NULL, NULL};
+        if (readers[opened].file == NULL) {
+            perror("Error opening reducer run");
+            success = false;
+            break;
+        }
+        if (read_run_line(&readers[opened])) heap[heap_size++] = &readers[opened];
+    }
+    for (size_t i = heap_size; success && i-- > 0;) sift_down(heap, heap_size, i);
+
+    while (success && heap_size > 0) {
+        // Pop every run whose current line is about the smallest sender
+        size_t group_size = 0;
+        do {
+            group[group_size++] = heap[0];
+            heap[0] = heap[--heap_size];
+            sift_down(heap, heap_size, 0);
+        } while (heap_size > 0 && strcmp(heap[0]->sender, group[0]->sender) == 0);
+        success = write_merged_sender(output_fp, group, group_size);
+        for (size_t g = 0; g < group_size; g++) {
+            if (read_run_line(group[g])) {
+                // Push back: append, then sift up
+                size_t index = heap_size++;
+                heap[index] = group[g];
+                while (index > 0 && strcmp(heap[(index - 1) / 2]->sender, heap[index]->sender) > 0) {
+                    run_reader_t *swap = heap[index];
+                    heap[index] = heap[(index - 1) / 2];
+                    heap[(index - 1) / 2] = swap;
+                    index = (index - 1) / 2;
+                }
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < opened; i++) {
+        char path[STR_MAX_LEN];
+        fclose(readers[i].file);
+        free(readers[i].line);
+        run_path(temp_files, first + i, path);
+        remove(path);
+    }
+    return success;
+}
+
+// The exact collation of step2_output, kept in memory and updated as records are appended (watch mode)
+struct _live_aggregate {
+    collation_t collation;
+    off_t offset; // End of the records already collated
+};
+
+/*!
+ * @brief make_live_aggregate allocates an empty live aggregate
+ * @param granularity the time buckets of the records (@see files_reducer)
+ * @return the malloc'ed aggregate, NULL on error
+ */
+live_aggregate_t *make_live_aggregate(time_buckets_t granularity) {
+    live_aggregate_t *aggregate = malloc(sizeof(live_aggregate_t));
+    if (aggregate == NULL) return NULL;
+    init_arena(&aggregate->collation.arena);
+    aggregate->collation.granularity = granularity;
+    aggregate->offset = 0;
+    if (!init_collation(&aggregate->collation)) {
+        clear_live_aggregate(aggregate);
+        return NULL;
+    }
+    return aggregate;
+}
+
+/*!
+ * @brief update_live_aggregate collates the records appended to the second temporary output file since the last
+ * update (an incomplete last line is left for the next update)
+ * @param aggregate the aggregate
+ * @param temp_file the second temporary output file
+ * @return the number of collated records, -1 on error
+ */
+int64_t update_live_aggregate(live_aggregate_t *aggregate, char *temp_file) {
+    FILE *temp_fp = fopen(temp_file, "r");
+    if (temp_fp == NULL) return -1;
+    fseeko(temp_fp, aggregate->offset, SEEK_SET);
+    int64_t records = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_size, temp_fp)) != -1 && line[length - 1] == '\n') {
+        if (!collate_line(&aggregate->collation, line)) {
+            records = -1;
+            break;
+        }
+        aggregate->offset += length;
+        records++;
+    }
+    free(line);
+    fclose(temp_fp);
+    return records;
+}
+
+/*!
+ * @brief replace_with_collation writes a collation to a temporary file renamed over a file, so readers never see a
+ * partial file
+ * @param collation the collation
+ * @param format the lines to write for each sender
+ * @param path the file to replace
+ * @return true if the file was replaced, false else
+ */
+static bool replace_with_collation(collation_t *collation, const line_format_t *format, char *path) {
+    char temporary_path[STR_MAX_LEN];
+    snprintf(temporary_path, STR_MAX_LEN, "%s.tmp", path);
+    FILE *output_fp = fopen(temporary_path, "w");
+    if (output_fp == NULL) return false;
+    bool success = write_collation(collation, format, output_fp);
+    if (fclose(output_fp) != 0) success = false;
+    if (success) success = sync_file(temporary_path, DURABILITY_FULL) && rename(temporary_path, path) == 0;
+    if (!success) remove(temporary_path);
+    return success;
+}
+
+/*!
+ * @brief write_live_aggregate writes the aggregate as the output file, and its time buckets file if any (same formats
+ * as files_reducer). Each file is written to a temporary file renamed over it, so readers never see a partial output.
+ * @param aggregate the aggregate
+ * @param output_file the output file
+ * @return true if the files were replaced, false else
+ */
+bool write_live_aggregate(live_aggregate_t *aggregate, char *output_file) {
+    if (!replace_with_collation(&aggregate->collation, &totals_format, output_file)) return false;
+    if (aggregate->collation.granularity == TIME_BUCKETS_NONE) return true;
+    char buckets_file[STR_MAX_LEN];
+    snprintf(buckets_file, STR_MAX_LEN, "%s%s", output_file, BUCKETS_SUFFIX);
+    return replace_with_collation(&aggregate->collation, &buckets_format, buckets_file);
+}
+
+/*!
+ * @brief clear_live_aggregate releases a live aggregate
+ * @param aggregate the aggregate
+ */
+void clear_live_aggregate(live_aggregate_t *aggregate) {
+    if (aggregate == NULL) return;
+    clear_collation(&aggregate->collation);
+    clear_arena(&aggregate->collation.arena);
+    free(aggregate);
 }
 
 /*!
  * @brief files_reducer opens the second temporary output file (default step2_output) and collates all sender/recipient
  * information as defined in the project instructions. Stores data in a double level linked list (list of source e-mails
- * containing each a list of recipients with their occurrences).
+ * containing each a list of recipients with their occurrences), indexed by hash tables. When the collation exceeds
+ * memory_limit, it is spilled as a sorted run to the temporary directory and the output is the k-way merge of the runs,
+ * so that memory stays bounded whatever the data size. Senders and recipients are written in alphabetical order. Without
+ * runs, the output is formatted in parallel (@see write_collation_parallel).
+ * With time buckets, each pair also counts its occurrences per bucket, written to <output_file>.buckets. Runs do not
+ * carry buckets, so the memory limit is ignored.
  * @param temp_file path to temp output file
+ * @param temp_files the temporary files directory, where runs are spilled
  * @param output_file final output file to be written by your function
+ * @param memory_limit approximate memory budget of the collation in bytes, 0 for no limit
+ * @param granularity the time buckets of the records, TIME_BUCKETS_NONE if records have no bucket
+ * @param nb_proc the maximum number of processes formatting the output when it is written from memory
+ * @return true if the output file was written, false else
  */
-void files_reducer(char *temp_file, char *output_file) {
+bool files_reducer(char *temp_file, char *temp_files, char *output_file, uint64_t memory_limit,
+                   time_buckets_t granularity, uint16_t nb_proc) {
     // Open the temporary output file for reading
     FILE *temp_fp = fopen(temp_file, "r");
     if (temp_fp == NULL) {
         fprintf(stderr, "Error opening temporary output file\n");
-        exit(1);
+        return false;
     }
 
-    // Open the final output file for writing
-    FILE *output_fp = fopen(output_file, "w");
-    if (output_fp == NULL) {
-        fprintf(stderr, "Error opening final output file\n");
+    collation_t collation;
+    init_arena(&collation.arena);
+    collation.granularity = granularity;
+    if (!init_collation(&collation)) {
+        clear_collation(&collation);
         fclose(temp_fp);
-        exit(1);
+        return false;
+    }
+    if (granularity != TIME_BUCKETS_NONE && memory_limit > 0) {
+        printf("The reducer memory limit is ignored with time buckets\n");
+        memory_limit = 0;
+    }
+
+    // Collate each line, spilling a sorted run whenever the budget is exceeded
+    uint32_t runs = 0;
+    bool success = true;
+    char *line = NULL;
+    size_t line_size = 0;
+    char path[STR_MAX_LEN];
+    while (success && getline(&line, &line_size, temp_fp) != -1) {
+        success = collate_line(&collation, line);
+        if (success && memory_limit > 0 && collation.memory_used >= memory_limit) {
+            run_path(temp_files, runs++, path);
+            success = spill_collation(&collation, path);
+        }
+    }
+    free(line);
+    fclose(temp_fp);
+    if (success && runs > 0 && collation.senders != NULL) {
+        run_path(temp_files, runs++, path);
+        success = spill_collation(&collation, path);
+    }
+
+    // Merge runs by groups of MAX_MERGE_FAN_IN until one pass can produce the output
+    uint32_t first = 0;
+    while (success && runs - first > MAX_MERGE_FAN_IN) {
+        run_path(temp_files, runs, path);
+        FILE *run_fp = fopen(path, "w");
+        if (run_fp == NULL) {
+            perror("Error creating reducer run");
+            success = false;
+            break;
+        }
+        success = merge_runs(temp_files, first, MAX_MERGE_FAN_IN, run_fp);
+        if (fclose(run_fp) != 0) success = false;
+        first += MAX_MERGE_FAN_IN;
+        runs++;
     }
 
-    // Initialize the linked list of sources
-    sender_t *senders = NULL;
+    if (success && runs > 0) {
+        printf("Reducer spilled %u sorted runs\n", runs);
+        FILE *output_fp = fopen(output_file, "w");
+        if (output_fp == NULL) {
+            fprintf(stderr, "Error opening final output file\n");
+            success = false;
+        } else {
+            success = merge_runs(temp_files, first, runs - first, output_fp);
+            if (fclose(output_fp) != 0) success = false;
+        }
+    } else if (success) {
+        success = write_collation_parallel(&collation, &totals_format, output_file, nb_proc);
+        if (success && granularity != TIME_BUCKETS_NONE) {
+            snprintf(path, STR_MAX_LEN, "%s%s", output_file, BUCKETS_SUFFIX);
+            success = write_collation_parallel(&collation, &buckets_format, path, nb_proc);
+        }
+    }
 
-    // Read each line in the temporary output file
-    char line[STR_MAX_LEN];
-    while (fgets(line, STR_MAX_LEN, temp_fp) != NULL) {
-        // Parse the sender and recipient email addresses from the line
-        char *sender = strtok(line, " ");
+    // Remove the runs left by a failure
+    for (uint32_t i = first; !success && i < runs; i++) {
+        run_path(temp_files, i, path);
+        remove(path);
+    }
+    clear_collation(&collation);
+    clear_arena(&collation.arena);
+    report_arena(&collation.arena, "Reducer");
+    return success;
+}
 
-        sender = str_trim(sender);
+/*!
+ * @brief range_dump_path builds the path of the file where a range worker dumps its partial result
+ * @param temp_files the temporary files directory
+ * @param prefix the name prefix of the dumps of the current reducer
+ * @param index the range index
+ * @param path the resulting path (STR_MAX_LEN long)
+ */
+static void range_dump_path(char *temp_files, char *prefix, uint16_t index, char *path) {
+    snprintf(path, STR_MAX_LEN, "%s/%s-%u", temp_files, prefix, index);
+}
 
-        // Add the sender to the linked list if it does not already exist
-        senders = add_source_to_list(senders, sender);
+/*!
+ * @brief run_range_workers splits the second temporary output file into at most nb_proc line aligned ranges and forks
+ * one worker per range. Each worker dumps its partial result to the file given by range_dump_path. Returns once all
+ * workers have terminated.
+ * @param temp_file path to temp output file (step2_output)
+ * @param temp_files the temporary files directory
+ * @param prefix the name prefix of the dumps
+ * @param nb_proc the maximum number of simultaneous processes
+ * @param worker the function run by each worker, returning true on success
+ * @param context an opaque pointer passed to worker
+ * @return the number of ranges whose dump can be read, 0 if any worker failed
+ */
+static uint16_t run_range_workers(char *temp_file, char *temp_files, char *prefix, uint16_t nb_proc,
+                                  bool (*worker)(char *, off_t, off_t, char *, void *), void *context) {
+    off_t *bounds = malloc(sizeof(off_t) * (nb_proc + 1));
+    pid_t *pids = malloc(sizeof(pid_t) * nb_proc);
+    uint16_t ranges = bounds == NULL || pids == NULL ? 0 : split_file_lines(temp_file, nb_proc, bounds);
+    if (ranges == 0) {
+        fprintf(stderr, "Error opening temporary output file\n");
+        free(pids);
+        free(bounds);
+        return 0;
+    }
+    fflush(stdout);
+    uint16_t started = 0;
+    for (; started < ranges; started++) {
+        pid_t pid = fork();
+        pids[started] = pid;
+        if (pid == 0) {
+            char dump_path[STR_MAX_LEN];
+            range_dump_path(temp_files, prefix, started, dump_path);
+            exit(worker(temp_file, bounds[started], bounds[started + 1], dump_path, context) ? 0 : 1);
+        } else if (pid < 0) {
+            perror("fork");
+            break;
+        }
+    }
+    // Only reap the range workers: other children (pool workers) are not ours to wait for
+    bool success = started == ranges;
+    for (uint16_t i = 0; i < started; i++) {
+        int status;
+        if (waitpid(pids[i], &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) success = false;
+    }
+    free(pids);
+    free(bounds);
+    return success ? ranges : 0;
+}
 
-        // Find the sender in the linked list
-        sender_t *source = find_source_in_list(senders, sender);
+/*!
+ * @brief topk_range_worker feeds the sender/recipient pairs, senders and recipients of a range of lines of the
+ * second temporary output file into three heavy hitters sketches, then dumps them
+ * @param temp_file path to temp output file (step2_output)
+ * @param start offset of the first line of the range
+ * @param end offset of the end of the range
+ * @param dump_path the file where to dump the sketches
+ * @param context a pointer to the number k of heavy hitters
+ * @return true if the sketches were dumped, false else
+ */
+static bool topk_range_worker(char *temp_file, off_t start, off_t end, char *dump_path, void *context) {
+    uint32_t k = *(uint32_t *) context;
+    FILE *temp_fp = fopen(temp_file, "r");
+    if (temp_fp == NULL) return false;
+    space_saving_t *sketches[3];
+    for (int s = 0; s < 3; s++) sketches[s] = make_space_saving(k * SKETCH_CAPACITY_FACTOR);
+    if (sketches[0] == NULL || sketches[1] == NULL || sketches[2] == NULL) return false;
 
-        char *recipient = strtok(NULL, " ");
+    fseeko(temp_fp, start, SEEK_SET);
+    char *line = NULL;
+    size_t line_size = 0;
+    char pair[SKETCH_KEY_LEN];
+    while (ftello(temp_fp) < end && getline(&line, &line_size, temp_fp) != -1) {
+        char *saveptr;
+        char *sender = strtok_r(line, " \n", &saveptr);
+        if (sender == NULL) continue;
+        // Combined lines weigh their number of e-mails, combined recipients their occurrences (@see combiner.h)
+        uint32_t weight;
+        sender = split_weight(sender, &weight);
+        space_saving_add(sketches[1], sender, weight);
+        char *recipient;
+        while ((recipient = strtok_r(NULL, " \n", &saveptr)) != NULL) {
+            recipient = split_weight(recipient, &weight);
+            snprintf(pair, SKETCH_KEY_LEN, "%s %s", sender, recipient);
+            space_saving_add(sketches[0], pair, weight);
+            space_saving_add(sketches[2], recipient, weight);
+        }
+    }
+    free(line);
+    fclose(temp_fp);
 
-        while (recipient != NULL) {
+    FILE *dump_fp = fopen(dump_path, "w");
+    bool success = dump_fp != NULL;
+    for (int s = 0; s < 3; s++) {
+        if (success && !space_saving_write(sketches[s], dump_fp)) success = false;
+        clear_space_saving(sketches[s]);
+    }
+    if (dump_fp != NULL && fclose(dump_fp) != 0) success = false;
+    return success;
+}
+
+/*!
+ * @brief write_topk_section writes the k heaviest keys of a sketch, with their error, to the final output file
+ * @param output_fp the final output file
+ * @param title the name of the section
+ * @param sketch the merged sketch
+ * @param k the number of keys to write
+ */
+static void write_topk_section(FILE *output_fp, char *title, space_saving_t *sketch, uint32_t k) {
+    sketch_counter_t **sorted = malloc(sizeof(sketch_counter_t *) * sketch->capacity);
+    if (sorted == NULL) return;
+    uint32_t size = space_saving_sorted(sketch, sorted);
+    fprintf(output_fp, "# top %s: k=%u weight=%" PRIu64 " capacity=%u error_bound=%" PRIu64 "\n", title, k,
+            sketch->total, sketch->capacity, space_saving_error_bound(sketch));
+    for (uint32_t i = 0; i < size && i < k; i++) {
+        fprintf(output_fp, "%" PRIu64 ":%s error=%" PRIu64 "\n", sorted[i]->count, sorted[i]->key, sorted[i]->error);
+    }
+    free(sorted);
+}
 
-            // Remove newline character if it is present at the end of the email address
-            size_t recipient_len = strlen(recipient);
-            if (recipient[recipient_len - 1] == '\n') recipient[recipient_len - 1] = '\0';
+/*!
+ * @brief topk_reducer is the bounded memory alternative to files_reducer: it only finds the k heaviest sender/recipient
+ * pairs, senders and recipients. The second temporary output file is split into nb_proc ranges, each processed by a
+ * forked worker into Space-Saving sketches of fixed size that are then dumped to temporary files and merged. Each
+ * count is an over-estimation of the real count by at most its reported error, itself bounded by error_bound.
+ * @param temp_file path to temp output file (step2_output)
+ * @param temp_files the temporary files directory, where to write the workers sketches
+ * @param output_file final output file
+ * @param k the number of heavy hitters to report for each category
+ * @param nb_proc the maximum number of simultaneous processes
+ * @return true if the reduction succeeded, false else
+ */
+bool topk_reducer(char *temp_file, char *temp_files, char *output_file, uint32_t k, uint16_t nb_proc) {
+    static char *titles[3] = {"pairs", "senders", "recipients"};
+    if (temp_file == NULL || temp_files == NULL || output_file == NULL || k == 0 || nb_proc == 0) return false;
 
-            // Add the recipient to the sender's list of recipients
-            add_recipient_to_source(source, recipient);
+    // 1. Each worker sketches its range and dumps the sketches into temp_files/topk-<range>
+    uint16_t ranges = run_range_workers(temp_file, temp_files, "topk", nb_proc, topk_range_worker, &k);
+    bool success = ranges > 0;
 
-            // Get the next token
-            recipient = strtok(NULL, " ");
+    // 2. Merge the workers sketches
+    space_saving_t *sketches[3];
+    for (int s = 0; s < 3; s++) sketches[s] = make_space_saving(k * SKETCH_CAPACITY_FACTOR);
+    if (sketches[0] == NULL || sketches[1] == NULL || sketches[2] == NULL) success = false;
+    for (uint16_t i = 0; i < ranges; i++) {
+        char sketch_path[STR_MAX_LEN];
+        range_dump_path(temp_files, "topk", i, sketch_path);
+        FILE *sketch_fp = fopen(sketch_path, "r");
+        if (sketch_fp == NULL) continue;
+        for (int s = 0; s < 3 && success; s++) {
+            if (!space_saving_read(sketches[s], sketch_fp)) success = false;
         }
+        fclose(sketch_fp);
+        remove(sketch_path);
     }
 
-    // Iterate over the linked list of senders and write the summary to the final output file
-    sender_t *current_sender = senders;
-    while (current_sender != NULL) {
-        // Write the sender email address to the output file
-        fprintf(output_fp, "%s ", current_sender->sender_address);
+    // 3. Write the heavy hitters with their error bounds
+    FILE *output_fp = success ? fopen(output_file, "w") : NULL;
+    if (output_fp != NULL) {
+        for (int s = 0; s < 3; s++) write_topk_section(output_fp, titles[s], sketches[s], k);
+        fclose(output_fp);
+    } else {
+        fprintf(stderr, "Error computing top-%u heavy hitters\n", k);
+        success = false;
+    }
+    for (int s = 0; s < 3; s++) clear_space_saving(sketches[s]);
+    return success;
+}
 
-        // Iterate over the sender's list of recipients and write their occurrences to the output file
-        recipient_t *current_recipient = current_sender->head;
-        while (current_recipient != NULL) {
-            fprintf(output_fp, "%u:%s ", current_recipient->occurrences, current_recipient->recipient_address);
-            current_recipient = current_recipient->next;
-        }
+/*!
+ * @brief find_sketch returns the HyperLogLog sketch of a key, creating an empty one if required
+ * @param table the table of sketches
+ * @param key the key of the sketch
+ * @return a pointer to the sketch, NULL if allocation failed
+ */
+static hyperloglog_t *find_sketch(hash_table_t *table, const char *key) {
+    hash_entry_t *entry = hash_table_find(table, key, true);
+    if (entry == NULL) return NULL;
+    if (entry->value == NULL) entry->value = calloc(1, sizeof(hyperloglog_t)); // An empty sparse sketch
+    return entry->value;
+}
 
-        // Write a newline character to the output file
-        fprintf(output_fp, "\n");
+/*!
+ * @brief free_sketch releases a sketch of a table of sketches
+ * @param value the sketch
+ */
+static void free_sketch(void *value) {
+    clear_hyperloglog((hyperloglog_t *) value);
+}
 
-        // Move to the next sender in the linked list
-        current_sender = current_sender->next;
+/*!
+ * @brief email_domain returns the domain part of an e-mail address
+ * @param email the e-mail address
+ * @return a pointer to the character following the last '@' in email, NULL if there is none
+ */
+static char *email_domain(char *email) {
+    char *at = strrchr(email, '@');
+    return at == NULL || at[1] == '\0' ? NULL : at + 1;
+}
+
+/*!
+ * @brief dump_sketches writes all sketches of a table into a dump file, as a "<kind> <key>" line followed by the
+ * sketch (@see hyperloglog_write)
+ * @param dump_fp the dump file
+ * @param kind the kind of the keys (s for senders, d for domains, g for global counts)
+ * @param table the table of sketches
+ */
+static void dump_sketches(FILE *dump_fp, char kind, hash_table_t *table) {
+    for (size_t i = 0; i < table->bucket_count; i++) {
+        for (hash_entry_t *entry = table->buckets[i]; entry != NULL; entry = entry->next) {
+            fprintf(dump_fp, "%c %s\n", kind, entry->key);
+            hyperloglog_write(entry->value, dump_fp);
+        }
     }
+}
 
-    // Close the files and free the memory allocated for the linked list
+/*!
+ * @brief cardinality_range_worker builds the HyperLogLog sketches of a range of the second temporary output file:
+ * distinct recipients of each sender, distinct correspondents (senders to it and recipients from it) of each
+ * domain, and distinct senders and recipients overall. Sketches are then dumped.
+ * @param temp_file path to temp output file (step2_output)
+ * @param start offset of the first line of the range
+ * @param end offset of the end of the range
+ * @param dump_path the file where to dump the sketches
+ * @param context unused
+ * @return true if the sketches were dumped, false else
+ */
+static bool cardinality_range_worker(char *temp_file, off_t start, off_t end, char *dump_path, void *context) {
+    (void) context;
+    FILE *temp_fp = fopen(temp_file, "r");
+    if (temp_fp == NULL) return false;
+    hash_table_t *tables[3] = {make_hash_table(1024), make_hash_table(256), make_hash_table(2)};
+    if (tables[0] == NULL || tables[1] == NULL || tables[2] == NULL) return false;
+    hyperloglog_t *all_senders = find_sketch(tables[2], "senders");
+    hyperloglog_t *all_recipients = find_sketch(tables[2], "recipients");
+
+    fseeko(temp_fp, start, SEEK_SET);
+    char *line = NULL;
+    size_t line_size = 0;
+    bool success = all_senders != NULL && all_recipients != NULL;
+    while (success && ftello(temp_fp) < end && getline(&line, &line_size, temp_fp) != -1) {
+        char *saveptr;
+        char *sender = strtok_r(line, " \n", &saveptr);
+        if (sender == NULL) continue;
+        // Distinct counts ignore the weights of combined lines (@see combiner.h)
+        uint32_t weight;
+        sender = split_weight(sender, &weight);
+        size_t sender_length = strlen(sender);
+        char *sender_domain = email_domain(sender);
+        hyperloglog_t *sender_sketch = find_sketch(tables[0], sender);
+        hyperloglog_t *sender_domain_sketch = sender_domain == NULL ? NULL : find_sketch(tables[1], sender_domain);
+        if (sender_sketch == NULL) success = false;
+        if (!hyperloglog_add(all_senders, sender, sender_length)) success = false;
+        char *recipient;
+        while (success && (recipient = strtok_r(NULL, " \n", &saveptr)) != NULL) {
+            recipient = split_weight(recipient, &weight);
+            size_t recipient_length = strlen(recipient);
+            success = hyperloglog_add(sender_sketch, recipient, recipient_length) &&
+                      hyperloglog_add(sender_domain_sketch, recipient, recipient_length) &&
+                      hyperloglog_add(all_recipients, recipient, recipient_length);
+            char *recipient_domain = email_domain(recipient);
+            if (success && recipient_domain != NULL) {
+                hyperloglog_t *recipient_domain_sketch = find_sketch(tables[1], recipient_domain);
+                success = recipient_domain_sketch != NULL &&
+                          hyperloglog_add(recipient_domain_sketch, sender, sender_length);
+            }
+        }
+    }
+    free(line);
     fclose(temp_fp);
-    fclose(output_fp);
-    clear_sources_list(senders);
-}
\ No newline at end of file
+
+    FILE *dump_fp = success ? fopen(dump_path, "w") : NULL;
+    if (dump_fp != NULL) {
+        dump_sketches(dump_fp, 's', tables[0]);
+        dump_sketches(dump_fp, 'd', tables[1]);
+        dump_sketches(dump_fp, 'g', tables[2]);
+        if (ferror(dump_fp) || fclose(dump_fp) != 0) success = false;
+    } else {
+        success = false;
+    }
+    for (int t = 0; t < 3; t++) clear_hash_table(tables[t], free_sketch);
+    return success;
+}
+
+/*!
+ * @brief merge_sketches_dump reads a dump written by cardinality_range_worker and merges its sketches into tables
+ * @param dump_path the path of the dump
+ * @param tables the sender, domain and global sketches tables
+ * @return true if the dump was read, false else
+ */
+static bool merge_sketches_dump(char *dump_path, hash_table_t *tables[3]) {
+    FILE *dump_fp = fopen(dump_path, "r");
+    if (dump_fp == NULL) return false;
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+    bool success = true;
+    while (success && (length = getline(&line, &line_size, dump_fp)) > 2) {
+        line[length - 1] = '\0';
+        int table = line[0] == 's' ? 0 : (line[0] == 'd' ? 1 : 2);
+        hyperloglog_t *target = find_sketch(tables[table], line + 2);
+        success = target != NULL && hyperloglog_read(target, dump_fp);
+    }
+    free(line);
+    fclose(dump_fp);
+    return success;
+}
+
+/*!
+ * @brief write_cardinality_section writes the estimated cardinality of each sketch of a table, sorted by key
+ * @param output_fp the final output file
+ * @param title the section title
+ * @param table the table of sketches
+ */
+static void write_cardinality_section(FILE *output_fp, char *title, hash_table_t *table) {
+    hash_entry_t **entries = hash_table_sorted_entries(table);
+    if (entries == NULL) return;
+    fprintf(output_fp, "# %s\n", title);
+    for (size_t i = 0; i < table->size; i++) {
+        fprintf(output_fp, "%s %.0f\n", entries[i]->key, hyperloglog_estimate(entries[i]->value));
+    }
+    free(entries);
+}
+
+/*!
+ * @brief cardinality_reducer is the approximate statistics alternative to files_reducer: it estimates, with mergeable
+ * HyperLogLog sketches (sparse while a key has few distinct values, 4 KB at most, instead of lists of recipients), the
+ * number of distinct recipients of each sender and the number of distinct correspondents of each domain. The second
+ * temporary output file is split into nb_proc ranges sketched by forked workers, then the reducer merges their dumps.
+ * @param temp_file path to temp output file (step2_output)
+ * @param temp_files the temporary files directory, where to write the workers sketches
+ * @param output_file final output file
+ * @param nb_proc the maximum number of simultaneous processes
+ * @return true if the reduction succeeded, false else
+ */
+bool cardinality_reducer(char *temp_file, char *temp_files, char *output_file, uint16_t nb_proc) {
+    if (temp_file == NULL || temp_files == NULL || output_file == NULL || nb_proc == 0) return false;
+
+    // 1. Each worker sketches its range and dumps the sketches into temp_files/hll-<range>
+    uint16_t ranges = run_range_workers(temp_file, temp_files, "hll", nb_proc, cardinality_range_worker, NULL);
+    bool success = ranges > 0;
+
+    // 2. Merge the workers sketches
+    hash_table_t *tables[3] = {make_hash_table(1024), make_hash_table(256), make_hash_table(2)};
+    if (tables[0] == NULL || tables[1] == NULL || tables[2] == NULL) success = false;
+    for (uint16_t i = 0; i < ranges; i++) {
+        char dump_path[STR_MAX_LEN];
+        range_dump_path(temp_files, "hll", i, dump_path);
+        if (success && !merge_sketches_dump(dump_path, tables)) success = false;
+        remove(dump_path);
+    }
+
+    // 3. Write the estimations
+    FILE *output_fp = success ? fopen(output_file, "w") : NULL;
+    if (output_fp != NULL) {
+        hash_entry_t *senders = hash_table_find(tables[2], "senders", false);
+        hash_entry_t *recipients = hash_table_find(tables[2], "recipients", false);
+        fprintf(output_fp, "# HyperLogLog estimations (%d registers, standard error %.1f%%)\n", HLL_REGISTERS,
+                104.0 / sqrt(HLL_REGISTERS));
+        fprintf(output_fp, "# distinct senders: %.0f\n", senders == NULL ? 0 : hyperloglog_estimate(senders->value));
+        fprintf(output_fp, "# distinct recipients: %.0f\n",
+                recipients == NULL ? 0 : hyperloglog_estimate(recipients->value));
+        write_cardinality_section(output_fp, "distinct recipients per sender", tables[0]);
+        write_cardinality_section(output_fp, "distinct correspondents per domain", tables[1]);
+        fclose(output_fp);
+    } else {
+        fprintf(stderr, "Error computing approximate statistics\n");
+        success = false;
+    }
+    for (int t = 0; t < 3; t++) clear_hash_table(tables[t], free_sketch);
+    return success;
+}
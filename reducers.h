@@ -5,11 +5,23 @@
 #ifndef A2022_REDUCERS_H
 #define A2022_REDUCERS_H
 
+#include <stdbool.h>
+
 #include "global_defs.h"
+#include "mail_date.h"
+
+// Occurrences of a sender/recipient pair in a time bucket (@see mail_date.h), 8 bytes
+typedef struct {
+    uint16_t bucket;
+    uint32_t count;
+} bucket_count_t;
 
 typedef struct _recipient {
     char recipient_address[STR_MAX_LEN];
     uint32_t occurrences;
+    bucket_count_t *buckets; // Non empty time buckets sorted by bucket, NULL without time buckets
+    uint32_t bucket_count;
+    uint32_t bucket_capacity;
     struct _recipient *prev;
     struct _recipient *next;
 } recipient_t;
@@ -27,7 +39,17 @@ void clear_sources_list(sender_t *list);
 sender_t *find_source_in_list(sender_t *list, char *source_email);
 void add_recipient_to_source(sender_t *source, char *recipient_email);
 
-void files_list_reducer(char *data_source, char *temp_files, char *output_file);
-void files_reducer(char *temp_file, char *output_file);
+bool files_list_reducer(char *data_source, char *temp_files, char *output_file, uint16_t nb_proc);
+bool files_reducer(char *temp_file, char *temp_files, char *output_file, uint64_t memory_limit,
+                   time_buckets_t granularity, uint16_t nb_proc);
+bool topk_reducer(char *temp_file, char *temp_files, char *output_file, uint32_t k, uint16_t nb_proc);
+bool cardinality_reducer(char *temp_file, char *temp_files, char *output_file, uint16_t nb_proc);
+
+typedef struct _live_aggregate live_aggregate_t;
+
+live_aggregate_t *make_live_aggregate(time_buckets_t granularity);
+int64_t update_live_aggregate(live_aggregate_t *aggregate, char *temp_file);
+bool write_live_aggregate(live_aggregate_t *aggregate, char *output_file);
+void clear_live_aggregate(live_aggregate_t *aggregate);
 
 #endif //A2022_REDUCERS_H
@@ -0,0 +1,167 @@
+#include "scheduler.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "utility.h"
+#include "progress.h"
+
+/*!
+ * @brief is_subdirectory tells if an entry of a directory is a directory
+ * @param parent_fd the directory
+ * @param entry the entry
+ * @param sb set to the status of the entry when it is a directory
+ * @return true if the entry is a directory (other than . and ..), false else
+ */
+static bool is_subdirectory(int parent_fd, struct dirent *entry, struct stat *sb) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) return false;
+    if (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN) return false;
+    return fstatat(parent_fd, entry->d_name, sb, 0) == 0 && S_ISDIR(sb->st_mode);
+}
+
+/*!
+ * @brief directory_cost estimates the cost of listing a user directory from its size and the sizes of its
+ * subdirectories (the mail folders): directory sizes grow with their number of entries, and are read without listing
+ * the folders
+ * @param parent_fd the data source directory
+ * @param name the name of the user directory
+ * @param sb the status of the user directory
+ * @return the estimated cost
+ */
+static uint64_t directory_cost(int parent_fd, char *name, struct stat *sb) {
+    uint64_t cost = sb->st_size;
+    int fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY);
+    DIR *directory = fd != -1 ? fdopendir(fd) : NULL;
+    if (directory == NULL) {
+        if (fd != -1) close(fd);
+        return cost;
+    }
+    struct dirent *entry;
+    struct stat folder;
+    while ((entry = readdir(directory)) != NULL) {
+        if (is_subdirectory(fd, entry, &folder)) cost += folder.st_size;
+    }
+    closedir(directory);
+    return cost;
+}
+
+/*!
+ * @brief compare_directory_costs orders directories by decreasing cost, then by name (qsort callback)
+ */
+static int compare_directory_costs(const void *a, const void *b) {
+    const directory_cost_t *first = a, *second = b;
+    if (first->cost != second->cost) return first->cost < second->cost ? 1 : -1;
+    return strcmp(first->name, second->name);
+}
+
+/*!
+ * @brief make_directory_list lists the user directories of the data source with their estimated cost, largest first
+ * @param data_source the data source directory
+ * @return the malloc'ed list, NULL on error
+ */
+directory_list_t *make_directory_list(char *data_source) {
+    DIR *data = opendir(data_source);
+    if (data == NULL) return NULL;
+    directory_list_t *list = calloc(1, sizeof(directory_list_t));
+    size_t capacity = 64;
+    if (list != NULL) list->directories = malloc(sizeof(directory_cost_t) * capacity);
+    struct dirent *entry;
+    struct stat sb;
+    while (list != NULL && list->directories != NULL && (entry = readdir(data)) != NULL) {
+        if (!is_subdirectory(dirfd(data), entry, &sb) || strlen(entry->d_name) >= STR_MAX_LEN) continue;
+        if (list->count == capacity) {
+            capacity *= 2;
+            directory_cost_t *grown = realloc(list->directories, sizeof(directory_cost_t) * capacity);
+            if (grown == NULL) break;
+            list->directories = grown;
+        }
+        strcpy(list->directories[list->count].name, entry->d_name);
+        list->directories[list->count].cost = directory_cost(dirfd(data), entry->d_name, &sb);
+        list->count++;
+    }
+    closedir(data);
+    if (list == NULL || list->directories == NULL || entry != NULL) {
+        clear_directory_list(list);
+        return NULL;
+    }
+    qsort(list->directories, list->count, sizeof(directory_cost_t), compare_directory_costs);
+    set_progress_total_tasks(list->count);
+    return list;
+}
+
+/*!
+ * @brief next_directory hands out the next directory of a list
+ * @param list the list
+ * @param data_source the data source directory
+ * @param path set to the path of the directory (STR_MAX_LEN long)
+ * @return true if a directory was found, false when all directories were handed out (directories whose path does not
+ * fit in STR_MAX_LEN are skipped)
+ */
+bool next_directory(directory_list_t *list, char *data_source, char *path) {
+    while (list->next < list->count) {
+        char *name = list->directories[list->next++].name;
+        if (snprintf(path, STR_MAX_LEN, "%s/%s", data_source, name) < STR_MAX_LEN) return true;
+        fprintf(stderr, "Skipping directory %s/%s: path too long\n", data_source, name);
+    }
+    return false;
+}
+
+/*!
+ * @brief clear_directory_list releases a list of directories
+ * @param list the list, may be NULL
+ */
+void clear_directory_list(directory_list_t *list) {
+    if (list == NULL) return;
+    free(list->directories);
+    free(list);
+}
+
+/*!
+ * @brief start_phase_timing starts the timings of a phase
+ * @param timing the timings
+ */
+void start_phase_timing(phase_timing_t *timing) {
+    clock_gettime(CLOCK_MONOTONIC, &timing->start);
+    timing->last_dispatch = timing->start;
+    timing->tasks = 0;
+    timing->longest_task_ms = 0;
+}
+
+/*!
+ * @brief task_dispatched records the dispatch of a task
+ * @param timing the timings of the phase
+ * @param dispatch set to the dispatch time of the task
+ */
+void task_dispatched(phase_timing_t *timing, struct timespec *dispatch) {
+    clock_gettime(CLOCK_MONOTONIC, dispatch);
+    timing->last_dispatch = *dispatch;
+    timing->tasks++;
+}
+
+/*!
+ * @brief task_finished records the end of a task, as seen by the dispatcher
+ * @param timing the timings of the phase
+ * @param dispatch the dispatch time of the task
+ */
+void task_finished(phase_timing_t *timing, struct timespec *dispatch) {
+    double duration = elapsed_ms(dispatch);
+    if (duration > timing->longest_task_ms) timing->longest_task_ms = duration;
+}
+
+/*!
+ * @brief report_phase_timing prints the timings of a phase: the tail is the time some workers are left idle because
+ * no task remains, which longest job first dispatch keeps short
+ * @param timing the timings
+ * @param phase_name the name of the phase in the report
+ */
+void report_phase_timing(phase_timing_t *timing, char *phase_name) {
+    if (timing->tasks == 0) return;
+    printf("%s: %" PRIu64 " tasks in %.3f ms, tail %.3f ms after the last dispatch, longest task %.3f ms\n", phase_name,
+           timing->tasks, elapsed_ms(&timing->start), elapsed_ms(&timing->last_dispatch), timing->longest_task_ms);
+}
@@ -0,0 +1,45 @@
+#ifndef A2022_SCHEDULER_H
+#define A2022_SCHEDULER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "global_defs.h"
+
+// A user directory of the data source, and the estimated cost of its listing
+typedef struct {
+    char name[STR_MAX_LEN];
+    uint64_t cost; // Sizes of the directory and of its subdirectories (they grow with their number of entries)
+} directory_cost_t;
+
+// The user directories of the data source, by decreasing estimated cost: the largest mailboxes are listed first
+// (longest job first), so that a large mailbox does not stretch the end of the phase. The files analysis keeps the
+// order of step1_output instead: its batches have close costs (only the header sections are read), and the tail
+// left by the heaviest batch is a small part of the phase (see README)
+typedef struct {
+    directory_cost_t *directories;
+    size_t count;
+    size_t next; // Next directory to hand out
+} directory_list_t;
+
+directory_list_t *make_directory_list(char *data_source);
+bool next_directory(directory_list_t *list, char *data_source, char *path);
+void clear_directory_list(directory_list_t *list);
+
+// Dispatch timings of a phase: its duration, its tail (from the dispatch of the last task to the end of the phase)
+// and its longest task
+typedef struct {
+    struct timespec start;
+    struct timespec last_dispatch;
+    uint64_t tasks;
+    double longest_task_ms;
+} phase_timing_t;
+
+void start_phase_timing(phase_timing_t *timing);
+void task_dispatched(phase_timing_t *timing, struct timespec *dispatch);
+void task_finished(phase_timing_t *timing, struct timespec *dispatch);
+void report_phase_timing(phase_timing_t *timing, char *phase_name);
+
+#endif //A2022_SCHEDULER_H
@@ -0,0 +1,534 @@
+#include "sketch.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "utility.h"
+
+/*!
+ * @brief heap_swap exchanges two positions in the sketch min-heap and keeps the positions index up to date
+ * @param sketch the sketch whose heap is modified
+ * @param a first heap position
+ * @param b second heap position
+ */
+static void heap_swap(space_saving_t *sketch, uint32_t a, uint32_t b) {
+    uint32_t tmp = sketch->heap[a];
+    sketch->heap[a] = sketch->heap[b];
+    sketch->heap[b] = tmp;
+    sketch->heap_pos[sketch->heap[a]] = a;
+    sketch->heap_pos[sketch->heap[b]] = b;
+}
+
+/*!
+ * @brief heap_sift_up moves a counter toward the root of the heap while it is smaller than its parent
+ * @param sketch the sketch whose heap is modified
+ * @param position the heap position of the counter to move
+ */
+static void heap_sift_up(space_saving_t *sketch, uint32_t position) {
+    while (position > 0) {
+        uint32_t parent = (position - 1) / 2;
+        if (sketch->counters[sketch->heap[parent]].count <= sketch->counters[sketch->heap[position]].count) break;
+        heap_swap(sketch, parent, position);
+        position = parent;
+    }
+}
+
+/*!
+ * @brief heap_sift_down moves a counter toward the leaves of the heap while it is bigger than one of its children
+ * @param sketch the sketch whose heap is modified
+ * @param position the heap position of the counter to move
+ */
+static void heap_sift_down(space_saving_t *sketch, uint32_t position) {
+    while (1) {
+        uint32_t smallest = position;
+        uint32_t left = 2 * position + 1;
+        uint32_t right = left + 1;
+        if (left < sketch->size &&
+            sketch->counters[sketch->heap[left]].count < sketch->counters[sketch->heap[smallest]].count) {
+            smallest = left;
+        }
+        if (right < sketch->size &&
+            sketch->counters[sketch->heap[right]].count < sketch->counters[sketch->heap[smallest]].count) {
+            smallest = right;
+        }
+        if (smallest == position) return;
+        heap_swap(sketch, smallest, position);
+        position = smallest;
+    }
+}
+
+/*!
+ * @brief table_find looks for the slot of a key in the sketch index
+ * @param sketch the sketch to look into
+ * @param key the key to look for
+ * @param hash the hash of the key
+ * @return the slot holding the key, or the empty slot where it would be inserted
+ */
+static uint32_t table_find(space_saving_t *sketch, const char *key, uint64_t hash) {
+    uint32_t slot = (uint32_t) hash & sketch->table_mask;
+    while (sketch->table[slot] != -1) {
+        sketch_counter_t *counter = &sketch->counters[sketch->table[slot]];
+        if (counter->hash == hash && strcmp(counter->key, key) == 0) break;
+        slot = (slot + 1) & sketch->table_mask;
+    }
+    return slot;
+}
+
+/*!
+ * @brief table_remove removes a slot from the sketch index, shifting back the following entries of the probe
+ * sequence so that no tombstone is required
+ * @param sketch the sketch whose index is modified
+ * @param slot the slot to empty
+ */
+static void table_remove(space_saving_t *sketch, uint32_t slot) {
+    uint32_t next = (slot + 1) & sketch->table_mask;
+    sketch->table[slot] = -1;
+    while (sketch->table[next] != -1) {
+        uint32_t home = (uint32_t) sketch->counters[sketch->table[next]].hash & sketch->table_mask;
+        // Move the entry back if its home slot is not between the hole and its current position
+        if (((next - home) & sketch->table_mask) >= ((next - slot) & sketch->table_mask)) {
+            sketch->table[slot] = sketch->table[next];
+            sketch->table[next] = -1;
+            slot = next;
+        }
+        next = (next + 1) & sketch->table_mask;
+    }
+}
+
+/*!
+ * @brief sketch_insert counts a weighted occurrence of a key with the Space-Saving rule: a monitored key is
+ * incremented, an unmonitored key takes a free counter or replaces the smallest one (inheriting its count as error)
+ * @param sketch the sketch to update
+ * @param key the key to count
+ * @param weight the weight of the occurrence
+ * @param error the over-estimation already included in weight
+ */
+static void sketch_insert(space_saving_t *sketch, const char *key, uint64_t weight, uint64_t error) {
+    // Keys are stored truncated: look up the truncated key, so that long keys find their own counter
+    char stored_key[SKETCH_KEY_LEN];
+    size_t length = strnlen(key, SKETCH_KEY_LEN - 1);
+    memcpy(stored_key, key, length);
+    stored_key[length] = '\0';
+    key = stored_key;
+    uint64_t hash = hash_bytes(key, length);
+    uint32_t slot = table_find(sketch, key, hash);
+    if (sketch->table[slot] != -1) {
+        sketch_counter_t *counter = &sketch->counters[sketch->table[slot]];
+        counter->count += weight;
+        counter->error += error;
+        heap_sift_down(sketch, sketch->heap_pos[sketch->table[slot]]);
+        return;
+    }
+    uint32_t index;
+    uint64_t inherited = 0;
+    bool appended = sketch->size < sketch->capacity;
+    if (appended) {
+        index = sketch->size;
+        sketch->heap[sketch->size] = index;
+        sketch->heap_pos[index] = sketch->size;
+        sketch->size++;
+    } else {
+        // Evict the smallest counter, which is the root of the heap
+        index = sketch->heap[0];
+        inherited = sketch->counters[index].count;
+        table_remove(sketch, table_find(sketch, sketch->counters[index].key, sketch->counters[index].hash));
+    }
+    sketch_counter_t *counter = &sketch->counters[index];
+    memcpy(counter->key, key, length + 1);
+    counter->hash = hash;
+    counter->count = inherited + weight;
+    counter->error = inherited + error;
+    sketch->table[table_find(sketch, counter->key, counter->hash)] = (int32_t) index;
+    if (appended) {
+        heap_sift_up(sketch, sketch->heap_pos[index]);
+    } else {
+        heap_sift_down(sketch, sketch->heap_pos[index]);
+    }
+}
+
+/*!
+ * @brief sketch_reset empties a sketch without releasing its memory
+ * @param sketch the sketch to reset
+ */
+static void sketch_reset(space_saving_t *sketch) {
+    sketch->size = 0;
+    sketch->total = 0;
+    memset(sketch->table, -1, sizeof(int32_t) * (sketch->table_mask + 1));
+}
+
+/*!
+ * @brief make_space_saving allocates a Space-Saving heavy hitters sketch. Its memory does not depend on the number
+ * of distinct keys added later.
+ * @param capacity the number of monitored keys
+ * @return a pointer to the malloc'ed sketch, NULL if allocation failed
+ */
+space_saving_t *make_space_saving(uint32_t capacity) {
+    if (capacity == 0) return NULL;
+    space_saving_t *sketch = malloc(sizeof(space_saving_t));
+    if (sketch == NULL) return NULL;
+    uint32_t table_size = 1;
+    while (table_size < 2 * capacity) table_size <<= 1;
+    sketch->capacity = capacity;
+    sketch->table_mask = table_size - 1;
+    sketch->counters = malloc(sizeof(sketch_counter_t) * capacity);
+    sketch->heap = malloc(sizeof(uint32_t) * capacity);
+    sketch->heap_pos = malloc(sizeof(uint32_t) * capacity);
+    sketch->table = malloc(sizeof(int32_t) * table_size);
+    if (sketch->counters == NULL || sketch->heap == NULL || sketch->heap_pos == NULL || sketch->table == NULL) {
+        clear_space_saving(sketch);
+        return NULL;
+    }
+    sketch_reset(sketch);
+    return sketch;
+}
+
+/*!
+ * @brief clear_space_saving releases all memory used by a sketch
+ * @param sketch the sketch to release
+ */
+void clear_space_saving(space_saving_t *sketch) {
+    if (sketch == NULL) return;
+    free(sketch->counters);
+    free(sketch->heap);
+    free(sketch->heap_pos);
+    free(sketch->table);
+    free(sketch);
+}
+
+/*!
+ * @brief space_saving_add counts an occurrence of a key
+ * @param sketch the sketch to update
+ * @param key the key (truncated to SKETCH_KEY_LEN - 1 characters)
+ * @param weight the number of occurrences to count
+ */
+void space_saving_add(space_saving_t *sketch, const char *key, uint64_t weight) {
+    if (sketch == NULL || key == NULL || weight == 0) return;
+    sketch_insert(sketch, key, weight, 0);
+    sketch->total += weight;
+}
+
+/*!
+ * @brief compare_counters orders counters by decreasing count, then by key
+ */
+static int compare_counters(const void *a, const void *b) {
+    const sketch_counter_t *first = *(const sketch_counter_t **) a;
+    const sketch_counter_t *second = *(const sketch_counter_t **) b;
+    if (first->count != second->count) return first->count < second->count ? 1 : -1;
+    return strcmp(first->key, second->key);
+}
+
+/*!
+ * @brief space_saving_merge merges a sketch into another one (mergeable summaries): a key missing from one of the
+ * sketches is assumed to have the minimum count of that sketch (if full), then the biggest counters are kept. The
+ * error bound of the result is the sum of the error bounds of both sketches.
+ * @param target the sketch to update
+ * @param source the sketch to merge into target (unchanged)
+ */
+void space_saving_merge(space_saving_t *target, space_saving_t *source) {
+    if (target == NULL || source == NULL || source->size == 0) return;
+    uint64_t target_min = target->size == target->capacity ? target->counters[target->heap[0]].count : 0;
+    uint64_t source_min = source->size == source->capacity ? source->counters[source->heap[0]].count : 0;
+    uint32_t merged_size = 0;
+    sketch_counter_t *merged = malloc(sizeof(sketch_counter_t) * (target->size + source->size));
+    bool *matched = calloc(target->size + 1, sizeof(bool));
+    if (merged == NULL || matched == NULL) {
+        free(merged);
+        free(matched);
+        return;
+    }
+    for (uint32_t i = 0; i < source->size; i++) {
+        sketch_counter_t *counter = &source->counters[i];
+        uint32_t slot = table_find(target, counter->key, counter->hash);
+        merged[merged_size] = *counter;
+        if (target->table[slot] != -1) {
+            matched[target->table[slot]] = true;
+            merged[merged_size].count += target->counters[target->table[slot]].count;
+            merged[merged_size].error += target->counters[target->table[slot]].error;
+        } else {
+            merged[merged_size].count += target_min;
+            merged[merged_size].error += target_min;
+        }
+        merged_size++;
+    }
+    for (uint32_t i = 0; i < target->size; i++) {
+        if (matched[i]) continue;
+        merged[merged_size] = target->counters[i];
+        merged[merged_size].count += source_min;
+        merged[merged_size].error += source_min;
+        merged_size++;
+    }
+
+    // Keep the capacity biggest counters
+    sketch_counter_t **order = malloc(sizeof(sketch_counter_t *) * merged_size);
+    if (order != NULL) {
+        for (uint32_t i = 0; i < merged_size; i++) order[i] = &merged[i];
+        qsort(order, merged_size, sizeof(sketch_counter_t *), compare_counters);
+        uint64_t total = target->total + source->total;
+        sketch_reset(target);
+        for (uint32_t i = 0; i < merged_size && i < target->capacity; i++) {
+            sketch_insert(target, order[i]->key, order[i]->count, order[i]->error);
+        }
+        target->total = total;
+        free(order);
+    }
+    free(merged);
+    free(matched);
+}
+
+/*!
+ * @brief space_saving_error_bound gives the guaranteed maximum over-estimation of any count in the sketch
+ * @param sketch the sketch
+ * @return the error bound (total weight divided by the capacity)
+ */
+uint64_t space_saving_error_bound(space_saving_t *sketch) {
+    if (sketch == NULL) return 0;
+    return sketch->total / sketch->capacity;
+}
+
+/*!
+ * @brief space_saving_sorted lists the counters of a sketch by decreasing count
+ * @param sketch the sketch
+ * @param sorted an array of at least capacity pointers, filled with the sorted counters
+ * @return the number of counters in sorted
+ */
+uint32_t space_saving_sorted(space_saving_t *sketch, sketch_counter_t **sorted) {
+    if (sketch == NULL || sorted == NULL) return 0;
+    for (uint32_t i = 0; i < sketch->size; i++) sorted[i] = &sketch->counters[i];
+    qsort(sorted, sketch->size, sizeof(sketch_counter_t *), compare_counters);
+    return sketch->size;
+}
+
+/*!
+ * @brief space_saving_write dumps a sketch into a text file: a header line with the capacity, size and total, then
+ * one "count error key" line per counter
+ * @param sketch the sketch to dump
+ * @param file an already opened file
+ * @return true if writing succeeded, false else
+ */
+bool space_saving_write(space_saving_t *sketch, FILE *file) {
+    if (sketch == NULL || file == NULL) return false;
+    fprintf(file, "space_saving %u %u %" PRIu64 "\n", sketch->capacity, sketch->size, sketch->total);
+    for (uint32_t i = 0; i < sketch->size; i++) {
+        sketch_counter_t *counter = &sketch->counters[i];
+        fprintf(file, "%" PRIu64 " %" PRIu64 " %s\n", counter->count, counter->error, counter->key);
+    }
+    return ferror(file) == 0;
+}
+
+/*!
+ * @brief space_saving_read reads a sketch dumped by space_saving_write and merges it into a sketch
+ * @param sketch the sketch to merge the file content into
+ * @param file an already opened file
+ * @return true if reading succeeded, false else
+ */
+bool space_saving_read(space_saving_t *sketch, FILE *file) {
+    if (sketch == NULL || file == NULL) return false;
+    uint32_t capacity, size;
+    uint64_t total;
+    if (fscanf(file, "space_saving %u %u %" SCNu64 "\n", &capacity, &size, &total) != 3) return false;
+    space_saving_t *read_sketch = make_space_saving(capacity);
+    if (read_sketch == NULL) return false;
+    char line[SKETCH_KEY_LEN + 64];
+    for (uint32_t i = 0; i < size && fgets(line, sizeof(line), file) != NULL; i++) {
+        char *key;
+        uint64_t count = strtoull(line, &key, 10);
+        uint64_t error = strtoull(key, &key, 10);
+        key = str_trim(key);
+        sketch_insert(read_sketch, key, count, error);
+    }
+    read_sketch->total = total;
+    space_saving_merge(sketch, read_sketch);
+    clear_space_saving(read_sketch);
+    return true;
+}
+
+/*!
+ * @brief clear_hyperloglog releases a HyperLogLog sketch allocated with malloc (and its registers)
+ * @param sketch the sketch to release
+ */
+void clear_hyperloglog(hyperloglog_t *sketch) {
+    if (sketch == NULL) return;
+    free(sketch->registers);
+    free(sketch->pairs);
+    free(sketch);
+}
+
+/*!
+ * @brief hyperloglog_densify turns a sparse sketch into a dense one
+ * @param sketch the sketch
+ * @return true on success, false if the registers could not be allocated (the sketch is unchanged)
+ */
+static bool hyperloglog_densify(hyperloglog_t *sketch) {
+    uint8_t *registers = calloc(HLL_REGISTERS, sizeof(uint8_t));
+    if (registers == NULL) return false;
+    for (uint32_t i = 0; i < sketch->pair_count; i++) {
+        registers[sketch->pairs[i] >> 8] = (uint8_t) (sketch->pairs[i] & 0xff);
+    }
+    free(sketch->pairs);
+    sketch->pairs = NULL;
+    sketch->pair_count = 0;
+    sketch->pair_capacity = 0;
+    sketch->registers = registers;
+    return true;
+}
+
+/*!
+ * @brief hyperloglog_raise raises a register of a sketch to a rank if it is lower. A sparse sketch gets a new pair,
+ * or becomes dense past HLL_SPARSE_MAX_PAIRS pairs.
+ * @param sketch the sketch
+ * @param index the index of the register
+ * @param rank the rank
+ * @return true on success, false on memory error
+ */
+static bool hyperloglog_raise(hyperloglog_t *sketch, uint32_t index, uint8_t rank) {
+    if (sketch->registers != NULL) {
+        if (rank > sketch->registers[index]) sketch->registers[index] = rank;
+        return true;
+    }
+    // Binary search of the index among the sorted pairs
+    uint32_t low = 0, high = sketch->pair_count;
+    while (low < high) {
+        uint32_t middle = (low + high) / 2;
+        if ((sketch->pairs[middle] >> 8) < index) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low < sketch->pair_count && (sketch->pairs[low] >> 8) == index) {
+        if (rank > (sketch->pairs[low] & 0xff)) sketch->pairs[low] = index << 8 | rank;
+        return true;
+    }
+    if (sketch->pair_count == HLL_SPARSE_MAX_PAIRS) {
+        if (!hyperloglog_densify(sketch)) return false;
+        sketch->registers[index] = rank;
+        return true;
+    }
+    if (sketch->pair_count == sketch->pair_capacity) {
+        uint32_t capacity = sketch->pair_capacity == 0 ? 4 : 2 * sketch->pair_capacity;
+        uint32_t *pairs = realloc(sketch->pairs, sizeof(uint32_t) * capacity);
+        if (pairs == NULL) return false;
+        sketch->pairs = pairs;
+        sketch->pair_capacity = capacity;
+    }
+    memmove(&sketch->pairs[low + 1], &sketch->pairs[low], sizeof(uint32_t) * (sketch->pair_count - low));
+    sketch->pairs[low] = index << 8 | rank;
+    sketch->pair_count++;
+    return true;
+}
+
+/*!
+ * @brief hyperloglog_add adds a key to a HyperLogLog distinct count sketch
+ * @param sketch the sketch to update
+ * @param key the key to add
+ * @param length the length of the key
+ * @return true on success, false on memory error
+ */
+bool hyperloglog_add(hyperloglog_t *sketch, const char *key, size_t length) {
+    if (sketch == NULL || key == NULL) return true;
+    // FNV-1a has weak high bits, mix them with the splitmix64 finalizer
+    uint64_t hash = hash_bytes(key, length);
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+    uint32_t index = (uint32_t) (hash >> (64 - HLL_PRECISION));
+    uint64_t remaining = (hash << HLL_PRECISION) | (1ULL << (HLL_PRECISION - 1)); // Bounds the rank
+    uint8_t rank = (uint8_t) (__builtin_clzll(remaining) + 1);
+    return hyperloglog_raise(sketch, index, rank);
+}
+
+/*!
+ * @brief hyperloglog_merge merges a sketch into another one: the result counts the union of both sets
+ * @param target the sketch to update
+ * @param source the sketch to merge into target
+ * @return true on success, false on memory error
+ */
+bool hyperloglog_merge(hyperloglog_t *target, const hyperloglog_t *source) {
+    if (target == NULL || source == NULL) return true;
+    if (source->registers == NULL) {
+        for (uint32_t i = 0; i < source->pair_count; i++) {
+            if (!hyperloglog_raise(target, source->pairs[i] >> 8, (uint8_t) (source->pairs[i] & 0xff))) return false;
+        }
+        return true;
+    }
+    if (target->registers == NULL && !hyperloglog_densify(target)) return false;
+    for (uint32_t i = 0; i < HLL_REGISTERS; i++) {
+        if (source->registers[i] > target->registers[i]) target->registers[i] = source->registers[i];
+    }
+    return true;
+}
+
+/*!
+ * @brief hyperloglog_estimate estimates the number of distinct keys added to a sketch (with the linear counting
+ * correction for small cardinalities). A sparse sketch gives the same estimate as its dense form.
+ * @param sketch the sketch
+ * @return the estimated cardinality
+ */
+double hyperloglog_estimate(const hyperloglog_t *sketch) {
+    if (sketch == NULL) return 0;
+    double sum = 0;
+    uint32_t zeros = 0;
+    if (sketch->registers != NULL) {
+        for (uint32_t i = 0; i < HLL_REGISTERS; i++) {
+            sum += ldexp(1.0, -sketch->registers[i]);
+            if (sketch->registers[i] == 0) zeros++;
+        }
+    } else {
+        zeros = HLL_REGISTERS - sketch->pair_count;
+        sum = zeros;
+        for (uint32_t i = 0; i < sketch->pair_count; i++) sum += ldexp(1.0, -(int) (sketch->pairs[i] & 0xff));
+    }
+    double m = HLL_REGISTERS;
+    double estimate = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log(m / zeros);
+    }
+    return estimate;
+}
+
+/*!
+ * @brief hyperloglog_write dumps a sketch into a binary file: its number of pairs (HLL_REGISTERS + 1 for a dense
+ * sketch), then its pairs or its registers
+ * @param sketch the sketch to dump
+ * @param file an already opened file
+ * @return true if writing succeeded, false else
+ */
+bool hyperloglog_write(const hyperloglog_t *sketch, FILE *file) {
+    if (sketch == NULL || file == NULL) return false;
+    uint32_t count = sketch->registers != NULL ? HLL_REGISTERS + 1 : sketch->pair_count;
+    if (fwrite(&count, sizeof(count), 1, file) != 1) return false;
+    if (sketch->registers != NULL) {
+        return fwrite(sketch->registers, sizeof(uint8_t), HLL_REGISTERS, file) == HLL_REGISTERS;
+    }
+    return fwrite(sketch->pairs, sizeof(uint32_t), count, file) == count;
+}
+
+/*!
+ * @brief hyperloglog_read reads a sketch dumped by hyperloglog_write and merges it into a sketch
+ * @param sketch the sketch to merge the file content into
+ * @param file an already opened file
+ * @return true if reading succeeded, false else
+ */
+bool hyperloglog_read(hyperloglog_t *sketch, FILE *file) {
+    if (sketch == NULL || file == NULL) return false;
+    uint32_t count;
+    if (fread(&count, sizeof(count), 1, file) != 1 || count > HLL_REGISTERS + 1) return false;
+    hyperloglog_t read_sketch = {0};
+    bool success;
+    if (count == HLL_REGISTERS + 1) {
+        read_sketch.registers = malloc(HLL_REGISTERS);
+        success = read_sketch.registers != NULL &&
+                  fread(read_sketch.registers, sizeof(uint8_t), HLL_REGISTERS, file) == HLL_REGISTERS;
+    } else {
+        read_sketch.pairs = malloc(sizeof(uint32_t) * (count + 1));
+        read_sketch.pair_count = count;
+        success = read_sketch.pairs != NULL && fread(read_sketch.pairs, sizeof(uint32_t), count, file) == count;
+        for (uint32_t i = 0; success && i < count; i++) success = (read_sketch.pairs[i] >> 8) < HLL_REGISTERS;
+    }
+    success = success && hyperloglog_merge(sketch, &read_sketch);
+    free(read_sketch.registers);
+    free(read_sketch.pairs);
+    return success;
+}
@@ -0,0 +1,62 @@
+#ifndef A2022_SKETCH_H
+#define A2022_SKETCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Longest key kept by a sketch (a sender/recipient pair with a separating space)
+#define SKETCH_KEY_LEN 512
+// Number of counters monitored for each of the k requested heavy hitters
+#define SKETCH_CAPACITY_FACTOR 4
+
+// HyperLogLog precision: 2^12 one byte registers per dense sketch (4 KB), standard error 1.04/sqrt(4096) = 1.6%
+#define HLL_PRECISION 12
+#define HLL_REGISTERS (1 << HLL_PRECISION)
+// A sparse sketch becomes dense when it has more non-zero registers (4 bytes each) than this
+#define HLL_SPARSE_MAX_PAIRS (HLL_REGISTERS / 16)
+
+typedef struct {
+    char key[SKETCH_KEY_LEN];
+    uint64_t hash;
+    uint64_t count; // Over-estimation of the key frequency
+    uint64_t error; // Maximum over-estimation included in count
+} sketch_counter_t;
+
+typedef struct {
+    uint32_t capacity;
+    uint32_t size;
+    uint64_t total; // Sum of all weights added to the sketch
+    sketch_counter_t *counters;
+    uint32_t *heap;     // Min-heap (on count) of counter indexes
+    uint32_t *heap_pos; // Position of each counter in the heap
+    int32_t *table;     // Linear probing index from key hash to counter index (-1 when empty)
+    uint32_t table_mask;
+} space_saving_t;
+
+// A sketch starts sparse, as the (index, rank) pairs of its non-zero registers, so that the many keys with a few
+// distinct values only take a few bytes. A zeroed hyperloglog_t is an empty sketch.
+typedef struct {
+    uint8_t *registers; // The HLL_REGISTERS registers once dense, NULL while sparse
+    uint32_t *pairs; // Sparse registers: index << 8 | rank, sorted by index
+    uint32_t pair_count;
+    uint32_t pair_capacity;
+} hyperloglog_t;
+
+space_saving_t *make_space_saving(uint32_t capacity);
+void clear_space_saving(space_saving_t *sketch);
+void space_saving_add(space_saving_t *sketch, const char *key, uint64_t weight);
+void space_saving_merge(space_saving_t *target, space_saving_t *source);
+uint64_t space_saving_error_bound(space_saving_t *sketch);
+uint32_t space_saving_sorted(space_saving_t *sketch, sketch_counter_t **sorted);
+bool space_saving_write(space_saving_t *sketch, FILE *file);
+bool space_saving_read(space_saving_t *sketch, FILE *file);
+
+void clear_hyperloglog(hyperloglog_t *sketch);
+bool hyperloglog_add(hyperloglog_t *sketch, const char *key, size_t length);
+bool hyperloglog_merge(hyperloglog_t *target, const hyperloglog_t *source);
+double hyperloglog_estimate(const hyperloglog_t *sketch);
+bool hyperloglog_write(const hyperloglog_t *sketch, FILE *file);
+bool hyperloglog_read(hyperloglog_t *sketch, FILE *file);
+
+#endif //A2022_SKETCH_H
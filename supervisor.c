@@ -0,0 +1,309 @@
+#include "supervisor.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "analysis.h"
+#include "checkpoint.h"
+#include "trace.h"
+
+// Description of a task in crash reports: a kind prefix ("directory ") and a STR_MAX_LEN path
+#define TASK_DESCRIPTION_LEN (STR_MAX_LEN + 64)
+
+/*!
+ * @brief init_supervisor prepares the supervision of a processes pool with no task running
+ * @param supervisor the supervisor to initialize
+ * @param children the PIDs of the workers
+ * @param workers the number of workers
+ * @return true on success, false if allocation failed
+ */
+bool init_supervisor(supervisor_t *supervisor, pid_t *children, uint16_t workers) {
+    memset(supervisor, 0, sizeof(supervisor_t));
+    supervisor->workers = workers;
+    supervisor->children = children;
+    supervisor->in_flight = malloc(sizeof(supervised_task_t) * workers);
+    supervisor->busy = calloc(workers, sizeof(bool));
+    supervisor->held = calloc(workers, sizeof(held_tasks_t));
+    // Grown when crashed workers held tasks (@see queue_retry)
+    supervisor->retry_capacity = workers;
+    supervisor->retries = malloc(sizeof(supervised_task_t) * workers);
+    supervisor->dispatched = malloc(sizeof(struct timespec) * workers);
+    if (supervisor->in_flight == NULL || supervisor->busy == NULL || supervisor->held == NULL ||
+        supervisor->retries == NULL || supervisor->dispatched == NULL) {
+        clear_supervisor(supervisor);
+        return false;
+    }
+    start_phase_timing(&supervisor->timing);
+    return true;
+}
+
+/*!
+ * @brief clear_supervisor releases the state of a supervisor (not the children array)
+ * @param supervisor the supervisor to release
+ */
+void clear_supervisor(supervisor_t *supervisor) {
+    free(supervisor->in_flight);
+    free(supervisor->busy);
+    for (int i = 0; supervisor->held != NULL && i < supervisor->workers; i++) {
+        free(supervisor->held[i].tasks);
+    }
+    free(supervisor->held);
+    supervisor->held = NULL;
+    free(supervisor->retries);
+    free(supervisor->dispatched);
+    supervisor->in_flight = NULL;
+    supervisor->busy = NULL;
+    supervisor->retries = NULL;
+    supervisor->dispatched = NULL;
+}
+
+/*!
+ * @brief idle_worker finds a worker with no task
+ * @param supervisor the supervisor
+ * @return the index of an idle worker, -1 if all workers are busy
+ */
+int idle_worker(supervisor_t *supervisor) {
+    for (int i = 0; i < supervisor->workers; i++) {
+        if (!supervisor->busy[i]) return i;
+    }
+    return -1;
+}
+
+/*!
+ * @brief busy_workers counts the workers running a task
+ * @param supervisor the supervisor
+ * @return the number of busy workers
+ */
+int busy_workers(supervisor_t *supervisor) {
+    int count = 0;
+    for (int i = 0; i < supervisor->workers; i++) {
+        if (supervisor->busy[i]) count++;
+    }
+    return count;
+}
+
+/*!
+ * @brief find_worker finds the index of a worker from its PID
+ * @param supervisor the supervisor
+ * @param pid the PID of the worker
+ * @return the index of the worker, -1 if the PID is not a worker of the pool
+ */
+int find_worker(supervisor_t *supervisor, pid_t pid) {
+    for (int i = 0; i < supervisor->workers; i++) {
+        if (supervisor->children[i] == pid) return i;
+    }
+    return -1;
+}
+
+/*!
+ * @brief next_supervised_task gets the next task to dispatch: the tasks of crashed workers first, then the tasks
+ * of the task source
+ * @param supervisor the supervisor
+ * @param next_task the task source, returning false when no task remains
+ * @param context an opaque pointer passed to next_task
+ * @param task the task to fill
+ * @return true if a task was found, false else
+ */
+bool next_supervised_task(supervisor_t *supervisor, bool (*next_task)(task_t *, void *), void *context,
+                          supervised_task_t *task) {
+    if (supervisor->retry_count > 0) {
+        *task = supervisor->retries[--supervisor->retry_count];
+        supervisor->retried++;
+        return true;
+    }
+    if (supervisor->exhausted) return false;
+    task->attempts = 0;
+    if (next_task(&task->task, context)) return true;
+    supervisor->exhausted = true;
+    return false;
+}
+
+/*!
+ * @brief task_started records the task sent to a worker
+ * @param supervisor the supervisor
+ * @param worker the index of the worker
+ * @param task the task
+ */
+void task_started(supervisor_t *supervisor, int worker, supervised_task_t *task) {
+    supervisor->in_flight[worker] = *task;
+    supervisor->busy[worker] = true;
+    // Commit tasks are not part of the phase timings: they are only sent to the workers left idle by the tail
+    if (task->task.task_callback != commit_file_batches) {
+        task_dispatched(&supervisor->timing, &supervisor->dispatched[worker]);
+    }
+    trace_dispatch(&task->task);
+}
+
+/*!
+ * @brief task_completed records the end of the task of a worker. A worker holding batches keeps their records until
+ * it commits them: its completed tasks are kept to be dispatched again if it crashes before.
+ * @param supervisor the supervisor
+ * @param worker the index of the worker
+ * @param held the number of batches the worker holds after its task (@see held_file_batches), 0 once committed
+ */
+void task_completed(supervisor_t *supervisor, int worker, uint32_t held) {
+    if (worker < 0 || worker >= supervisor->workers || !supervisor->busy[worker]) return;
+    supervisor->busy[worker] = false;
+    if (supervisor->in_flight[worker].task.task_callback != commit_file_batches) {
+        task_finished(&supervisor->timing, &supervisor->dispatched[worker]);
+    }
+    held_tasks_t *held_tasks = &supervisor->held[worker];
+    if (held == 0) {
+        held_tasks->count = 0;
+        return;
+    }
+    if (held_tasks->count == held_tasks->capacity) {
+        uint32_t capacity = held_tasks->capacity == 0 ? 64 : 2 * held_tasks->capacity;
+        supervised_task_t *tasks = realloc(held_tasks->tasks, sizeof(supervised_task_t) * capacity);
+        if (tasks == NULL) {
+            // The task can not be dispatched again: the held records would be lost if the worker crashed
+            perror("Could not record a held task");
+            return;
+        }
+        held_tasks->tasks = tasks;
+        held_tasks->capacity = capacity;
+    }
+    held_tasks->tasks[held_tasks->count++] = supervisor->in_flight[worker];
+}
+
+/*!
+ * @brief next_commit_task finds an idle worker holding batches once all tasks were dispatched, and builds the task
+ * that makes it commit them (@see commit_file_batches)
+ * @param supervisor the supervisor
+ * @param task the task to fill
+ * @return the index of the worker to send the task to, -1 if no commit is due
+ */
+int next_commit_task(supervisor_t *supervisor, supervised_task_t *task) {
+    if (!supervisor->exhausted || supervisor->retry_count > 0) return -1;
+    for (int i = 0; i < supervisor->workers; i++) {
+        if (supervisor->busy[i] || supervisor->held[i].count == 0) continue;
+        memset(task, 0, sizeof(supervised_task_t));
+        task->task.task_callback = commit_file_batches;
+        return i;
+    }
+    return -1;
+}
+
+/*!
+ * @brief queue_retry queues a task to be dispatched again
+ * @param supervisor the supervisor
+ * @param task the task
+ */
+static void queue_retry(supervisor_t *supervisor, supervised_task_t *task) {
+    if (supervisor->retry_count == supervisor->retry_capacity) {
+        size_t capacity = 2 * supervisor->retry_capacity;
+        supervised_task_t *retries = realloc(supervisor->retries, sizeof(supervised_task_t) * capacity);
+        if (retries == NULL) {
+            perror("Could not queue a task for a retry");
+            return;
+        }
+        supervisor->retries = retries;
+        supervisor->retry_capacity = capacity;
+    }
+    supervisor->retries[supervisor->retry_count++] = *task;
+}
+
+/*!
+ * @brief describe_task describes the object of an analysis task for crash reports
+ * @param task the task
+ * @param description the resulting description (TASK_DESCRIPTION_LEN long)
+ */
+static void describe_task(task_t *task, char *description) {
+    if (task->task_callback == process_file_batch) {
+        file_batch_t *batch = &((batch_task_t *) task)->batch;
+        snprintf(description, TASK_DESCRIPTION_LEN, "files %" PRIu64 " to %" PRIu64 " of step1_output",
+                 batch->first_file, batch->first_file + batch->file_count - 1);
+    } else if (task->task_callback == process_directory) {
+        snprintf(description, TASK_DESCRIPTION_LEN, "directory %s",
+                 ((directory_task_t *) task)->object_directory);
+    } else if (task->task_callback == process_file) {
+        snprintf(description, TASK_DESCRIPTION_LEN, "file %s", ((file_task_t *) task)->object_file);
+    } else {
+        snprintf(description, TASK_DESCRIPTION_LEN, "unknown task");
+    }
+}
+
+/*!
+ * @brief find_committed_tasks removes the records a crashed worker appended to step2_output without journaling them,
+ * and flags its batch tasks (the held ones, then the current one) that it committed before dying
+ * (@see trim_interrupted_commit)
+ * @param supervisor the supervisor
+ * @param worker the index of the crashed worker
+ * @param committed the flags of the tasks (number of held tasks + 1 long), left false if the worker had no batch
+ */
+static void find_committed_tasks(supervisor_t *supervisor, int worker, bool *committed) {
+    held_tasks_t *held_tasks = &supervisor->held[worker];
+    file_batch_t *batches = malloc(sizeof(file_batch_t) * (held_tasks->count + 1));
+    if (batches == NULL) return;
+    batch_task_t *batch_task = NULL;
+    for (uint32_t i = 0; i < held_tasks->count; i++) {
+        batch_task = (batch_task_t *) &held_tasks->tasks[i].task;
+        batches[i] = batch_task->batch;
+    }
+    uint32_t count = held_tasks->count;
+    if (supervisor->busy[worker] && supervisor->in_flight[worker].task.task_callback == process_file_batch) {
+        batch_task = (batch_task_t *) &supervisor->in_flight[worker].task;
+        batches[count++] = batch_task->batch;
+    }
+    if (batch_task != NULL &&
+        !trim_interrupted_commit(batch_task->temporary_directory, batches, count, committed)) {
+        fprintf(stderr, "Could not check the commits of worker %d: its batches may be counted twice\n",
+                supervisor->children[worker]);
+    }
+    free(batches);
+}
+
+/*!
+ * @brief worker_crashed records the death of a worker (the caller replaces it): the records it did not journal are
+ * removed from step2_output, the tasks it held are queued for a retry, and so is its current task, if any, unless it
+ * made MAX_TASK_ATTEMPTS workers crash: it is then quarantined. A commit task is not retried, the held tasks are.
+ * Batch tasks the worker committed before dying are not retried.
+ * @param supervisor the supervisor
+ * @param worker the index of the worker
+ * @param status the wait status of the worker
+ */
+void worker_crashed(supervisor_t *supervisor, int worker, int status) {
+    supervisor->crashes++;
+    if (WIFSIGNALED(status)) {
+        fprintf(stderr, "Worker %d killed by signal %d\n", supervisor->children[worker], WTERMSIG(status));
+    } else {
+        fprintf(stderr, "Worker %d exited with status %d\n", supervisor->children[worker], WEXITSTATUS(status));
+    }
+    // The held tasks did not make the worker crash: their attempts are unchanged
+    held_tasks_t *held_tasks = &supervisor->held[worker];
+    bool *committed = calloc(held_tasks->count + 1, sizeof(bool));
+    if (committed != NULL) find_committed_tasks(supervisor, worker, committed);
+    for (uint32_t i = 0; i < held_tasks->count; i++) {
+        if (committed == NULL || !committed[i]) queue_retry(supervisor, &held_tasks->tasks[i]);
+    }
+    bool task_committed = committed != NULL && committed[held_tasks->count];
+    free(committed);
+    held_tasks->count = 0;
+    if (!supervisor->busy[worker]) return;
+    supervisor->busy[worker] = false;
+    supervised_task_t *task = &supervisor->in_flight[worker];
+    if (task->task.task_callback == commit_file_batches || task_committed) return;
+    if (++task->attempts >= MAX_TASK_ATTEMPTS) {
+        char description[TASK_DESCRIPTION_LEN];
+        describe_task(&task->task, description);
+        supervisor->quarantined++;
+        fprintf(stderr, "Quarantined %s after %d crashes\n", description, task->attempts);
+        return;
+    }
+    queue_retry(supervisor, task);
+}
+
+/*!
+ * @brief report_supervisor prints the dispatch timings of a pool, and its crashes if any
+ * @param supervisor the supervisor
+ * @param pool_name the name of the pool in the report
+ */
+void report_supervisor(supervisor_t *supervisor, char *pool_name) {
+    report_phase_timing(&supervisor->timing, pool_name);
+    if (supervisor->crashes == 0) return;
+    printf("%s: %u worker crashes, %u tasks retried, %u tasks quarantined\n", pool_name, supervisor->crashes,
+           supervisor->retried, supervisor->quarantined);
+}
@@ -0,0 +1,64 @@
+#ifndef A2022_SUPERVISOR_H
+#define A2022_SUPERVISOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "global_defs.h"
+#include "scheduler.h"
+
+// A task is run at most this number of times on crashing workers before it is quarantined (dropped)
+#define MAX_TASK_ATTEMPTS 3
+
+typedef struct {
+    task_t task;
+    uint8_t attempts; // Number of workers that crashed while running the task
+} supervised_task_t;
+
+// Completion notification of a worker task
+typedef struct {
+    pid_t pid; // The worker, 0 to notify the death of a worker
+    uint32_t held; // Number of batches analyzed but not committed yet by the worker (@see hold_file_batches)
+} task_notification_t;
+
+// Tasks completed by a worker whose results are not committed yet
+typedef struct {
+    supervised_task_t *tasks;
+    uint32_t count;
+    uint32_t capacity;
+} held_tasks_t;
+
+// State of the tasks of a processes pool, used to re-dispatch the task of a crashed worker
+typedef struct {
+    uint16_t workers;
+    pid_t *children; // The workers PIDs (updated when a worker is replaced)
+    supervised_task_t *in_flight; // Task of each worker
+    bool *busy;
+    held_tasks_t *held; // Tasks held by each worker, dispatched again if the worker crashes
+    supervised_task_t *retries; // Tasks of crashed workers, waiting to be dispatched again
+    size_t retry_count;
+    size_t retry_capacity;
+    bool exhausted; // true when the task source has no more tasks
+    uint32_t crashes;
+    uint32_t retried;
+    uint32_t quarantined;
+    phase_timing_t timing;
+    struct timespec *dispatched; // Dispatch time of the task of each worker
+} supervisor_t;
+
+bool init_supervisor(supervisor_t *supervisor, pid_t *children, uint16_t workers);
+void clear_supervisor(supervisor_t *supervisor);
+int idle_worker(supervisor_t *supervisor);
+int busy_workers(supervisor_t *supervisor);
+int find_worker(supervisor_t *supervisor, pid_t pid);
+bool next_supervised_task(supervisor_t *supervisor, bool (*next_task)(task_t *, void *), void *context,
+                          supervised_task_t *task);
+void task_started(supervisor_t *supervisor, int worker, supervised_task_t *task);
+void task_completed(supervisor_t *supervisor, int worker, uint32_t held);
+int next_commit_task(supervisor_t *supervisor, supervised_task_t *task);
+void worker_crashed(supervisor_t *supervisor, int worker, int status);
+void report_supervisor(supervisor_t *supervisor, char *pool_name);
+
+#endif //A2022_SUPERVISOR_H
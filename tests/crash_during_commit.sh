@@ -0,0 +1,49 @@
+#!/bin/sh
+# Kills the first worker committing its batches after it wrote its records to step2_output and before it journaled
+# them, and checks that the run gives the same results as a run without crash: the records of the interrupted commit
+# must be removed before its batches are analyzed again. Checked with intermediate results in files and in memory.
+# Usage: crash_during_commit.sh path/to/A22-solution-test (built with the A22_TEST_HOOKS fault injection hooks)
+
+solution=$1
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+
+# 6 mailboxes of 40 e-mails
+for user in 0 1 2 3 4 5; do
+    mkdir -p "$work/maildir/user$user/all_documents"
+    for mail in $(seq 1 40); do
+        {
+            echo "Message-ID: <$user.$mail.JavaMail.evans@thyme>"
+            echo "Date: Mon, 14 May 2001 16:39:00 -0700 (PDT)"
+            echo "From: user$user@enron.com"
+            echo "To: person$(( (mail * 7 + user) % 30 ))@enron.com, person$(( mail * 3 % 30 ))@enron.com"
+            echo "Subject: Test $mail"
+            echo
+            echo "Body"
+        } > "$work/maildir/user$user/all_documents/$mail."
+    done
+done
+
+run() {
+    name=$1
+    shift
+    mkdir "$work/$name" && : > "$work/$name.out"
+    (cd "$work/$name" && "$solution" -d "$work/maildir" -t "$work/$name" -o "$work/$name.out" "$@" \
+        > "$work/$name.log" 2>&1)
+}
+
+run clean || { echo "The run without crash failed"; cat "$work/clean.log"; exit 1; }
+for intermediates in files memory; do
+    A22_CRASH_IN_COMMIT=1 run "$intermediates" --intermediates "$intermediates" ||
+        { echo "The run with a crash failed ($intermediates)"; cat "$work/$intermediates.log"; exit 1; }
+    if ! grep -q "killed by signal" "$work/$intermediates.log"; then
+        echo "No worker was killed ($intermediates)"
+        exit 1
+    fi
+    if ! cmp -s "$work/clean.out" "$work/$intermediates.out"; then
+        echo "The results differ after a crash during a commit ($intermediates)"
+        diff "$work/clean.out" "$work/$intermediates.out" | head -20
+        exit 1
+    fi
+done
+echo "Same results after a crash during a commit"
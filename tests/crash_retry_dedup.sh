@@ -0,0 +1,52 @@
+#!/bin/sh
+# Kills a worker during the files analysis of a run with --dedup, and checks that the run gives the same results as a
+# run without crash: the retried batches must not take their own Message-IDs for duplicates.
+# Usage: crash_retry_dedup.sh path/to/A22-solution-test (built with the A22_TEST_HOOKS fault injection hooks)
+
+solution=$1
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+
+# 6 mailboxes of 40 e-mails, the first 20 of each being copied in the sent folder with the same Message-ID
+for user in 0 1 2 3 4 5; do
+    mkdir -p "$work/maildir/user$user/all_documents" "$work/maildir/user$user/sent"
+    for mail in $(seq 1 40); do
+        {
+            echo "Message-ID: <$user.$mail.JavaMail.evans@thyme>"
+            echo "Date: Mon, 14 May 2001 16:39:00 -0700 (PDT)"
+            echo "From: user$user@enron.com"
+            echo "To: person$(( (mail * 7 + user) % 30 ))@enron.com, person$(( mail * 3 % 30 ))@enron.com"
+            echo "Subject: Test $mail"
+            echo
+            echo "Body"
+        } > "$work/maildir/user$user/all_documents/$mail."
+        if [ "$mail" -le 20 ]; then
+            cp "$work/maildir/user$user/all_documents/$mail." "$work/maildir/user$user/sent/$mail."
+        fi
+    done
+done
+
+run() {
+    mkdir "$work/$1" && : > "$work/$1.out"
+    (cd "$work/$1" && "$solution" -d "$work/maildir" -t "$work/$1" -o "$work/$1.out" --dedup > "$work/$1.log" 2>&1)
+}
+
+run clean || { echo "The run without crash failed"; cat "$work/clean.log"; exit 1; }
+A22_CRASH_AT_FILE=64 run crashed || { echo "The run with a crash failed"; cat "$work/crashed.log"; exit 1; }
+
+if ! grep -q "killed by signal" "$work/crashed.log"; then
+    echo "No worker was killed"
+    exit 1
+fi
+if ! cmp -s "$work/clean.out" "$work/crashed.out"; then
+    echo "The results differ after a crash"
+    diff "$work/clean.out" "$work/crashed.out" | head -20
+    exit 1
+fi
+clean_stats=$(grep "Duplicate e-mails skipped" "$work/clean.log")
+crashed_stats=$(grep "Duplicate e-mails skipped" "$work/crashed.log")
+if [ "$clean_stats" != "$crashed_stats" ]; then
+    echo "The dedup counts differ after a crash: $clean_stats / $crashed_stats"
+    exit 1
+fi
+echo "$crashed_stats"
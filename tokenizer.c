@@ -0,0 +1,150 @@
+#include "tokenizer.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Character classes of an address list (RFC 5322 subset). CC_ADDRESS is 0 so that every character missing from the
+// table is part of an address, and the classes of address characters come first (class <= CC_AT).
+typedef enum {
+    CC_ADDRESS = 0,
+    CC_UPPER,
+    CC_AT,
+    CC_SPACE,
+    CC_SEPARATOR,
+    CC_QUOTE,
+    CC_BACKSLASH,
+    CC_OPEN_ANGLE,
+    CC_CLOSE_ANGLE,
+    CC_OPEN_COMMENT,
+    CC_CLOSE_COMMENT,
+    CC_END,
+} char_class_t;
+
+static const uint8_t char_classes[256] = {
+        ['\0'] = CC_END,
+        [' '] = CC_SPACE, ['\t'] = CC_SPACE, ['\r'] = CC_SPACE, ['\n'] = CC_SPACE,
+        [','] = CC_SEPARATOR, [';'] = CC_SEPARATOR,
+        ['"'] = CC_QUOTE, ['\\'] = CC_BACKSLASH,
+        ['<'] = CC_OPEN_ANGLE, ['>'] = CC_CLOSE_ANGLE,
+        ['('] = CC_OPEN_COMMENT, [')'] = CC_CLOSE_COMMENT,
+        ['@'] = CC_AT,
+        ['A'] = CC_UPPER, ['B'] = CC_UPPER, ['C'] = CC_UPPER, ['D'] = CC_UPPER, ['E'] = CC_UPPER, ['F'] = CC_UPPER,
+        ['G'] = CC_UPPER, ['H'] = CC_UPPER, ['I'] = CC_UPPER, ['J'] = CC_UPPER, ['K'] = CC_UPPER, ['L'] = CC_UPPER,
+        ['M'] = CC_UPPER, ['N'] = CC_UPPER, ['O'] = CC_UPPER, ['P'] = CC_UPPER, ['Q'] = CC_UPPER, ['R'] = CC_UPPER,
+        ['S'] = CC_UPPER, ['T'] = CC_UPPER, ['U'] = CC_UPPER, ['V'] = CC_UPPER, ['W'] = CC_UPPER, ['X'] = CC_UPPER,
+        ['Y'] = CC_UPPER, ['Z'] = CC_UPPER,
+};
+
+typedef enum {IN_LIST, IN_QUOTED_NAME, IN_ESCAPE, IN_ANGLE_ADDRESS, IN_COMMENT} tokenizer_state_t;
+
+/*!
+ * @brief trim_span removes spaces and single quotes (as in 'john.doe@enron.com') at both ends of a span
+ * @param span the span to trim
+ */
+static void trim_span(address_span_t *span) {
+    while (span->length > 0 && (char_classes[(uint8_t) span->start[0]] == CC_SPACE || span->start[0] == '\'')) {
+        span->start++;
+        span->length--;
+    }
+    while (span->length > 0 && (char_classes[(uint8_t) span->start[span->length - 1]] == CC_SPACE ||
+                                span->start[span->length - 1] == '\'')) {
+        span->length--;
+    }
+}
+
+/*!
+ * @brief tokenize_addresses extracts the canonical addresses of an address list (To:, Cc:, Bcc: or From: value) in
+ * a single pass driven by a characters classes table. Display names, quoted strings and comments are skipped, the
+ * address between angle brackets is preferred when present, else the word containing an '@'. Addresses are
+ * lower-cased in place and returned as spans of buffer (nothing is copied).
+ * @param buffer the address list, modified in place by case folding
+ * @param length the length of the address list (scanning also stops at a '\0')
+ * @param spans the array receiving the spans of the addresses
+ * @param max_spans the size of spans
+ * @return the number of addresses in the list (spans only holds the max_spans first ones)
+ */
+size_t tokenize_addresses(char *buffer, size_t length, address_span_t *spans, size_t max_spans) {
+    if (buffer == NULL) return 0;
+    size_t count = 0;
+    tokenizer_state_t state = IN_LIST;
+    int comment_depth = 0;
+    address_span_t angle = {NULL, 0};
+    address_span_t best = {NULL, 0};
+    for (size_t i = 0; i <= length; i++) {
+        uint8_t cls = i == length ? CC_END : char_classes[(uint8_t) buffer[i]];
+        switch (state) {
+            case IN_LIST:
+                if (cls <= CC_AT) {
+                    // Consume a whole word, it is the candidate address of the element if it contains a '@'
+                    address_span_t word = {buffer + i, 0};
+                    bool has_at = false;
+                    while (cls <= CC_AT) {
+                        if (cls == CC_UPPER) buffer[i] += 'a' - 'A';
+                        else if (cls == CC_AT) has_at = true;
+                        cls = ++i == length ? CC_END : char_classes[(uint8_t) buffer[i]];
+                    }
+                    word.length = buffer + i - word.start;
+                    if (has_at) best = word;
+                }
+                if (cls == CC_QUOTE) {
+                    state = IN_QUOTED_NAME;
+                } else if (cls == CC_OPEN_ANGLE) {
+                    state = IN_ANGLE_ADDRESS;
+                    angle.start = buffer + i + 1;
+                    angle.length = 0;
+                } else if (cls == CC_OPEN_COMMENT) {
+                    state = IN_COMMENT;
+                    comment_depth = 1;
+                } else if (cls == CC_SEPARATOR || cls == CC_END) {
+                    // End of a list element: emit its address, if any
+                    address_span_t *address = angle.start != NULL ? &angle : (best.start != NULL ? &best : NULL);
+                    if (address != NULL) {
+                        trim_span(address);
+                        if (address->length > 0) {
+                            if (count < max_spans) spans[count] = *address;
+                            count++;
+                        }
+                    }
+                    angle.start = NULL;
+                    best.start = NULL;
+                    if (cls == CC_END) return count;
+                }
+                break;
+            case IN_QUOTED_NAME:
+                // Display names are skipped without case folding
+                while (cls != CC_QUOTE && cls != CC_BACKSLASH && cls != CC_END) {
+                    cls = ++i == length ? CC_END : char_classes[(uint8_t) buffer[i]];
+                }
+                if (cls == CC_QUOTE) state = IN_LIST;
+                else if (cls == CC_BACKSLASH) state = IN_ESCAPE;
+                else {
+                    // Unterminated quote: let IN_LIST flush the element
+                    state = IN_LIST;
+                    i--;
+                }
+                break;
+            case IN_ESCAPE:
+                state = IN_QUOTED_NAME;
+                if (cls == CC_END) i--;
+                break;
+            case IN_ANGLE_ADDRESS:
+                if (cls == CC_UPPER) {
+                    buffer[i] += 'a' - 'A';
+                } else if (cls == CC_CLOSE_ANGLE || cls == CC_END) {
+                    angle.length = buffer + i - angle.start;
+                    state = IN_LIST;
+                    if (cls == CC_END) i--; // Let IN_LIST flush the element
+                }
+                break;
+            case IN_COMMENT:
+                if (cls == CC_OPEN_COMMENT) comment_depth++;
+                else if (cls == CC_CLOSE_COMMENT && --comment_depth == 0) state = IN_LIST;
+                else if (cls == CC_END) {
+                    state = IN_LIST;
+                    i--;
+                }
+                break;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,13 @@
+#ifndef A2022_TOKENIZER_H
+#define A2022_TOKENIZER_H
+
+#include <stddef.h>
+
+typedef struct {
+    const char *start;
+    size_t length;
+} address_span_t;
+
+size_t tokenize_addresses(char *buffer, size_t length, address_span_t *spans, size_t max_spans);
+
+#endif //A2022_TOKENIZER_H
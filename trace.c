@@ -0,0 +1,221 @@
+#include "trace.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utility.h"
+
+static char *trace_names[] = {[TRACE_DISPATCH] = "dispatch", [TRACE_WAIT] = "wait", [TRACE_TASK] = "task",
+                              [TRACE_OPEN] = "open", [TRACE_PARSE] = "parse", [TRACE_EMIT] = "emit"};
+
+// Tracing state of the current process (inherited by the workers forked after start_trace)
+static bool tracing = false;
+static char trace_directory[STR_MAX_LEN];
+static pid_t run_pid; // The orchestrator
+static uint64_t origin_ns; // Start of the trace
+static trace_header_t header;
+static bool header_written = false;
+static trace_event_t buffer[TRACE_BUFFER_EVENTS];
+static size_t buffered = 0;
+
+/*!
+ * @brief trace_clock reads the clock of the trace
+ * @return the CLOCK_MONOTONIC time in ns, 0 if the process does not trace
+ */
+uint64_t trace_clock(void) {
+    if (!tracing) return 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*!
+ * @brief start_trace enables the trace in the orchestrator and in the workers it forks later
+ * @param temp_dir the temporary directory, where the processes write their events
+ * @return true (the trace cannot fail to start, the event files are created on the first flush)
+ */
+bool start_trace(char *temp_dir) {
+    strncpy(trace_directory, temp_dir, STR_MAX_LEN - 1);
+    tracing = true;
+    run_pid = getpid();
+    origin_ns = trace_clock();
+    header = (trace_header_t) {.magic = TRACE_MAGIC, .worker = -1, .pid = run_pid};
+    return true;
+}
+
+/*!
+ * @brief set_trace_worker starts the trace of a worker (called after the fork): the events inherited from the
+ * orchestrator are dropped
+ * @param worker the index of the worker in its pool
+ */
+void set_trace_worker(int worker) {
+    if (!tracing) return;
+    header = (trace_header_t) {.magic = TRACE_MAGIC, .worker = worker, .pid = getpid()};
+    header_written = false;
+    buffered = 0;
+}
+
+/*!
+ * @brief record_event buffers an event, and writes the buffer when it is full
+ * @param event the event
+ */
+static void record_event(trace_event_t *event) {
+    if (buffered == TRACE_BUFFER_EVENTS) flush_trace();
+    buffer[buffered++] = *event;
+}
+
+/*!
+ * @brief trace_span records a span that ends now
+ * @param name the name of the span
+ * @param start_ns the start of the span (@see trace_clock)
+ */
+void trace_span(trace_name_t name, uint64_t start_ns) {
+    if (!tracing) return;
+    trace_event_t event = {.start_ns = start_ns, .duration_ns = trace_clock() - start_ns, .flow = 0, .name = name,
+                           .phase = 'X'};
+    record_event(&event);
+}
+
+/*!
+ * @brief task_flow identifies a task in the orchestrator and in its worker: the task is sent as is, so its bytes are
+ * the same on both sides
+ * @param task the task
+ * @return the flow identifier (never 0)
+ */
+static uint64_t task_flow(task_t *task) {
+    return hash_bytes((const char *) task, sizeof(task_t)) | 1;
+}
+
+/*!
+ * @brief trace_dispatch records the dispatch of a task by the orchestrator
+ * @param task the dispatched task
+ */
+void trace_dispatch(task_t *task) {
+    if (!tracing) return;
+    trace_event_t event = {.start_ns = trace_clock(), .duration_ns = 0, .flow = task_flow(task),
+                           .name = TRACE_DISPATCH, .phase = 'i'};
+    record_event(&event);
+}
+
+/*!
+ * @brief run_traced_task runs a task in a worker, records its span (linked to its dispatch) and writes the events of
+ * the worker
+ * @param task the task
+ */
+void run_traced_task(task_t *task) {
+    if (!tracing) {
+        task->task_callback(task);
+        return;
+    }
+    uint64_t flow = task_flow(task);
+    uint64_t start = trace_clock();
+    task->task_callback(task);
+    trace_event_t event = {.start_ns = start, .duration_ns = trace_clock() - start, .flow = flow, .name = TRACE_TASK,
+                           .phase = 'X'};
+    record_event(&event);
+    flush_trace();
+}
+
+/*!
+ * @brief flush_trace appends the buffered events of the process to its event file. errno is preserved, as events are
+ * recorded right after the system calls they time.
+ */
+void flush_trace(void) {
+    if (!tracing || (buffered == 0 && header_written)) return;
+    int saved_errno = errno;
+    char name[STR_MAX_LEN], path[STR_MAX_LEN];
+    snprintf(name, STR_MAX_LEN, TRACE_FILE_PREFIX "%d", header.pid);
+    int fd = open(concat_path(trace_directory, name, path), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd != -1) {
+        if (!header_written) header_written = write_all(fd, (char *) &header, sizeof(header));
+        write_all(fd, (char *) buffer, buffered * sizeof(trace_event_t));
+        close(fd);
+    }
+    buffered = 0;
+    errno = saved_errno;
+}
+
+/*!
+ * @brief write_events writes the events of an event file as Chrome trace events
+ * @param trace the trace
+ * @param events the event file
+ * @return true if events were written
+ */
+static bool write_events(FILE *trace, FILE *events) {
+    trace_header_t process;
+    if (fread(&process, sizeof(process), 1, events) != 1 || process.magic != TRACE_MAGIC) return false;
+    fprintf(trace, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"", run_pid,
+            process.pid);
+    if (process.worker < 0) {
+        fprintf(trace, "orchestrator\"}}");
+    } else {
+        fprintf(trace, "worker %d\"}}", process.worker);
+    }
+    fprintf(trace, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                   "\"args\":{\"sort_index\":%d}}", run_pid, process.pid, process.worker + 1);
+    trace_event_t event;
+    while (fread(&event, sizeof(event), 1, events) == 1) {
+        if (event.name > TRACE_EMIT) continue;
+        double ts = (double) (event.start_ns - origin_ns) / 1000;
+        fprintf(trace, ",\n{\"name\":\"%s\",\"cat\":\"a22\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+                trace_names[event.name], event.phase, ts, run_pid, process.pid);
+        if (event.phase == 'X') {
+            fprintf(trace, ",\"dur\":%.3f}", (double) event.duration_ns / 1000);
+        } else {
+            fprintf(trace, ",\"s\":\"t\"}");
+        }
+        // Flow from the dispatch (start) to the task (end, bound to the task span)
+        if (event.flow != 0) {
+            bool dispatch = event.name == TRACE_DISPATCH;
+            fprintf(trace, ",\n{\"name\":\"task\",\"cat\":\"a22\",\"ph\":\"%c\",\"id\":\"0x%" PRIx64 "\",\"ts\":%.3f,"
+                           "\"pid\":%d,\"tid\":%d%s}", dispatch ? 's' : 'f', event.flow, ts, run_pid, process.pid,
+                    dispatch ? "" : ",\"bp\":\"e\"");
+        }
+    }
+    return true;
+}
+
+/*!
+ * @brief write_trace merges the event files of the run into a Chrome trace-event JSON file, and removes them (called
+ * by the orchestrator once the workers are done)
+ * @param trace_file the path of the trace
+ * @return true if the trace was written, false else
+ */
+bool write_trace(char *trace_file) {
+    if (!tracing) return false;
+    flush_trace();
+    DIR *directory = opendir(trace_directory);
+    FILE *trace = fopen(trace_file, "w");
+    if (directory == NULL || trace == NULL) {
+        perror("Could not write the trace");
+        if (directory != NULL) closedir(directory);
+        if (trace != NULL) fclose(trace);
+        return false;
+    }
+    fprintf(trace, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    fprintf(trace, "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"A22 run\"}}", run_pid);
+    struct dirent *entry;
+    size_t processes = 0;
+    while ((entry = readdir(directory)) != NULL) {
+        if (strncmp(entry->d_name, TRACE_FILE_PREFIX, strlen(TRACE_FILE_PREFIX)) != 0) continue;
+        char path[STR_MAX_LEN];
+        FILE *events = fopen(concat_path(trace_directory, entry->d_name, path), "r");
+        if (events == NULL) continue;
+        if (write_events(trace, events)) processes++;
+        fclose(events);
+        remove(path);
+    }
+    closedir(directory);
+    fprintf(trace, "\n]}\n");
+    bool success = fclose(trace) == 0;
+    printf("Trace of %zu processes written to %s\n", processes, trace_file);
+    tracing = false;
+    return success;
+}
@@ -0,0 +1,58 @@
+#ifndef A2022_TRACE_H
+#define A2022_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "global_defs.h"
+
+// Prefix of the event files of the processes in the temporary directory (trace-<pid>)
+#define TRACE_FILE_PREFIX "trace-"
+// Events buffered by a process before they are written to its event file
+#define TRACE_BUFFER_EVENTS 4096
+#define TRACE_MAGIC 0x41323254
+
+typedef enum {
+    TRACE_DISPATCH, // Orchestrator: a task is sent to a worker (with a flow to the task)
+    TRACE_WAIT, // Orchestrator: waiting for a worker (msgrcv, select, wait)
+    TRACE_TASK, // Worker: a task, from its start to its completion
+    TRACE_OPEN, // Worker: opening an e-mail
+    TRACE_PARSE, // Worker: reading and parsing the header section of an e-mail
+    TRACE_EMIT, // Worker: committing the records of a batch to step2_output
+} trace_name_t;
+
+// An event of a process: a span, or an instant (dispatches)
+typedef struct {
+    uint64_t start_ns; // CLOCK_MONOTONIC
+    uint64_t duration_ns;
+    uint64_t flow; // Identifier of the flow from a dispatch to its task, 0 for none
+    uint32_t name; // trace_name_t
+    char phase; // Chrome trace-event phase: 'X' span, 'i' instant
+} trace_event_t;
+
+// Header of the event file of a process
+typedef struct {
+    uint32_t magic;
+    int32_t worker; // Index of the worker in its pool, -1 for the orchestrator
+    pid_t pid;
+} trace_header_t;
+
+/*
+ * Timeline of the run in the Chrome trace-event format (loaded by Perfetto or chrome://tracing): each process buffers
+ * its events in memory (a clock read and a store per event) and writes them to its event file in the temporary
+ * directory after each task. At the end of the run, the orchestrator merges the event files into the trace, with a
+ * track per process: dispatches and waits of the orchestrator, and the tasks of the workers with their opens, parses
+ * and commits. Dispatches are linked to their tasks by flows.
+ */
+
+bool start_trace(char *temp_dir);
+void set_trace_worker(int worker);
+uint64_t trace_clock(void);
+void trace_span(trace_name_t name, uint64_t start_ns);
+void trace_dispatch(task_t *task);
+void run_traced_task(task_t *task);
+void flush_trace(void);
+bool write_trace(char *trace_file);
+
+#endif //A2022_TRACE_H
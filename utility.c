@@ -2,6 +2,8 @@
 // Created by flassabe on 26/10/22.
 //this must compile on linux
 
+#define _GNU_SOURCE // copy_file_range
+
 #include "utility.h"
 
 #include <string.h>
@@ -13,6 +15,8 @@
 #include <libgen.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <errno.h>
+#include <time.h>
 
 
 #include "global_defs.h"
@@ -112,4 +116,199 @@ void str_remove_char(char *str, char c) {
         }
     }
     *dst = '\0';
-}
\ No newline at end of file
+}
+
+/*!
+ * @brief hash_bytes computes the 64 bits FNV-1a hash of a memory area
+ * @param data the bytes to hash
+ * @param length the number of bytes to hash
+ * @return the hash value
+ */
+uint64_t hash_bytes(const char *data, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char) data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*!
+ * @brief split_file_lines splits a text file into contiguous ranges of about the same size, each range starting at
+ * the beginning of a line (so that each range can be processed independently, e.g. by a forked worker)
+ * @param path the path to the file to split
+ * @param parts the maximum number of ranges
+ * @param bounds an array of at least parts + 1 offsets: range i is [bounds[i], bounds[i+1])
+ * @return the actual number of ranges (0 if the file could not be read)
+ */
+uint16_t split_file_lines(char *path, uint16_t parts, off_t *bounds) {
+    if (path == NULL || bounds == NULL || parts == 0) return 0;
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return 0;
+    struct stat sb;
+    if (fstat(fileno(file), &sb) != 0) {
+        fclose(file);
+        return 0;
+    }
+    uint16_t count = 0;
+    bounds[0] = 0;
+    for (uint16_t i = 1; i < parts && bounds[count] < sb.st_size; i++) {
+        off_t target = (off_t) (sb.st_size * (double) i / parts);
+        if (target <= bounds[count]) continue;
+        // Move the range bound after the end of the line containing target
+        fseeko(file, target - 1, SEEK_SET);
+        int c;
+        while ((c = fgetc(file)) != EOF && c != '\n');
+        off_t bound = ftello(file);
+        if (bound >= sb.st_size) break;
+        bounds[++count] = bound;
+    }
+    bounds[++count] = sb.st_size;
+    fclose(file);
+    return count;
+}
+
+/*!
+ * @brief count_file_lines counts the lines of a text file
+ * @param path the path to the file
+ * @return the number of '\n' in the file, 0 if it could not be read
+ */
+uint64_t count_file_lines(char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return 0;
+    uint64_t lines = 0;
+    char buffer[64 * 1024];
+    size_t bytes_read;
+    while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        for (char *cursor = buffer; (cursor = memchr(cursor, '\n', buffer + bytes_read - cursor)) != NULL; cursor++) {
+            lines++;
+        }
+    }
+    fclose(file);
+    return lines;
+}
+
+/*!
+ * @brief copy_file_at copies the content of a file to a given offset of another file, in the kernel when possible
+ * (copy_file_range), else with pread/pwrite. The file positions of both descriptors are left unchanged, so several
+ * processes may copy to distinct ranges of the same output file at once.
+ * @param in_fd the file to copy, from its beginning
+ * @param out_fd the file to write to
+ * @param offset the offset in out_fd where to write
+ * @param length the number of bytes to copy
+ * @return true if length bytes were copied, false else
+ */
+bool copy_file_at(int in_fd, int out_fd, off_t offset, size_t length) {
+    off_t in_offset = 0;
+    while (length > 0) {
+        ssize_t copied = copy_file_range(in_fd, &in_offset, out_fd, &offset, length, 0);
+        if (copied == -1 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) break;
+        if (copied <= 0) return false;
+        length -= copied;
+    }
+    // Fallback when the kernel or the filesystems can't copy (too old kernel, cross filesystem copy)
+    char buffer[64 * 1024];
+    while (length > 0) {
+        ssize_t bytes_read = pread(in_fd, buffer, length < sizeof(buffer) ? length : sizeof(buffer), in_offset);
+        if (bytes_read <= 0) return false;
+        for (ssize_t written = 0; written < bytes_read;) {
+            ssize_t count = pwrite(out_fd, buffer + written, bytes_read - written, offset + written);
+            if (count <= 0) return false;
+            written += count;
+        }
+        in_offset += bytes_read;
+        offset += bytes_read;
+        length -= bytes_read;
+    }
+    return true;
+}
+
+/*!
+ * @brief write_all writes a whole buffer to a file descriptor, retrying after partial writes
+ * @param fd the file descriptor
+ * @param data the data to write
+ * @param length the length of data
+ * @return true if length bytes were written, false else
+ */
+bool write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t count = write(fd, data, length);
+        if (count <= 0) return false;
+        data += count;
+        length -= count;
+    }
+    return true;
+}
+
+/*!
+ * @brief pwrite_all writes a whole buffer at an offset of a file descriptor, retrying after partial writes. The file
+ * position is left unchanged.
+ * @param fd the file descriptor
+ * @param data the data to write
+ * @param length the length of data
+ * @param offset the offset in fd where to write
+ * @return true if length bytes were written, false else
+ */
+bool pwrite_all(int fd, const char *data, size_t length, off_t offset) {
+    while (length > 0) {
+        ssize_t count = pwrite(fd, data, length, offset);
+        if (count <= 0) return false;
+        data += count;
+        offset += count;
+        length -= count;
+    }
+    return true;
+}
+
+/*!
+ * @brief decimal_length counts the decimal digits of an integer
+ * @param value the integer
+ * @return the number of digits (1 for 0)
+ */
+size_t decimal_length(uint64_t value) {
+    size_t length = 1;
+    while (value >= 10) {
+        value /= 10;
+        length++;
+    }
+    return length;
+}
+
+/*!
+ * @brief format_uint writes an integer in decimal, two digits at a time (same text as printf's %lu, without its
+ * parsing of the format and locking of the stream)
+ * @param value the integer
+ * @param buffer where to write the digits, at least decimal_length(value) bytes (no '\0' is written)
+ * @return a pointer past the last digit
+ */
+char *format_uint(uint64_t value, char *buffer) {
+    static const char digit_pairs[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+                                      "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+                                      "8081828384858687888990919293949596979899";
+    char *end = buffer + decimal_length(value);
+    char *cursor = end;
+    while (value >= 100) {
+        const char *pair = digit_pairs + 2 * (value % 100);
+        value /= 100;
+        *--cursor = pair[1];
+        *--cursor = pair[0];
+    }
+    if (value >= 10) {
+        *--cursor = digit_pairs[2 * value + 1];
+        *--cursor = digit_pairs[2 * value];
+    } else {
+        *--cursor = (char) ('0' + value);
+    }
+    return end;
+}
+
+/*!
+ * @brief elapsed_ms measures the time since a previous reading of the monotonic clock
+ * @param start the previous reading
+ * @return the elapsed time in milliseconds
+ */
+double elapsed_ms(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
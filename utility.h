@@ -6,7 +6,11 @@
 #define A2022_UTILITY_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <dirent.h>
+#include <sys/types.h>
+#include <time.h>
 
 char *concat_path(char *prefix, char *suffix, char *full_path);
 bool directory_exists(char *path);
@@ -16,6 +20,15 @@ struct dirent *next_dir(struct dirent *entry, DIR *dir);
 
 char *str_trim(char *str);
 void str_remove_char(char *str, char c);
+uint64_t hash_bytes(const char *data, size_t length);
+uint16_t split_file_lines(char *path, uint16_t parts, off_t *bounds);
+uint64_t count_file_lines(char *path);
+bool copy_file_at(int in_fd, int out_fd, off_t offset, size_t length);
+bool write_all(int fd, const char *data, size_t length);
+bool pwrite_all(int fd, const char *data, size_t length, off_t offset);
+size_t decimal_length(uint64_t value);
+char *format_uint(uint64_t value, char *buffer);
+double elapsed_ms(struct timespec *start);
 
 
 #endif //A2022_UTILITY_H
@@ -0,0 +1,281 @@
+#include "watch.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "global_defs.h"
+#include "utility.h"
+#include "reducers.h"
+#include "intermediates.h"
+#include "prefetch.h"
+#include "progress.h"
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE)
+
+typedef struct {
+    int inotify_fd;
+    char **paths; // Watched directories, by watch descriptor
+    int path_capacity;
+    uint32_t watches;
+    // New files waiting to be dispatched, as lines of step1_output
+    FILE *pending;
+    char *pending_paths;
+    size_t pending_size;
+    uint32_t pending_count;
+    struct timespec first_pending;
+    double pending_arrivals_ms; // Sum of the arrival times of pending files, relative to start
+    struct timespec start;
+    // Statistics
+    uint64_t ingested;
+    uint64_t rounds;
+    double total_latency_ms;
+    double max_latency_ms;
+} watch_t;
+
+static volatile sig_atomic_t emit_requested = 0;
+static volatile sig_atomic_t stop_requested = 0;
+
+/*!
+ * @brief request_emit is the SIGUSR1 handler of the watch mode: the output is written at once
+ */
+static void request_emit(int signal) {
+    (void) signal;
+    emit_requested = 1;
+}
+
+/*!
+ * @brief request_stop is the SIGINT/SIGTERM handler of the watch mode
+ */
+static void request_stop(int signal) {
+    (void) signal;
+    stop_requested = 1;
+}
+
+/*!
+ * @brief queue_file adds a new file to the files waiting to be dispatched
+ * @param watch the watch state
+ * @param path the path to the file
+ */
+static void queue_file(watch_t *watch, char *path) {
+    if (watch->pending_count == 0) clock_gettime(CLOCK_MONOTONIC, &watch->first_pending);
+    fprintf(watch->pending, "%s\n", path);
+    watch->pending_count++;
+    watch->pending_arrivals_ms += elapsed_ms(&watch->start);
+}
+
+/*!
+ * @brief add_watches watches a directory and all its subdirectories
+ * @param watch the watch state
+ * @param path the path to the directory
+ * @param queue_files true to queue the files already in the directories (a directory created while watching may
+ * receive files before its watch is added)
+ */
+static void add_watches(watch_t *watch, char *path, bool queue_files) {
+    int wd = inotify_add_watch(watch->inotify_fd, path, WATCH_MASK);
+    if (wd == -1) {
+        fprintf(stderr, "Could not watch %s: %s\n", path, strerror(errno));
+        return;
+    }
+    if (wd >= watch->path_capacity) {
+        int capacity = watch->path_capacity > 0 ? watch->path_capacity : 1024;
+        while (capacity <= wd) capacity *= 2;
+        char **grown = realloc(watch->paths, sizeof(char *) * capacity);
+        if (grown == NULL) return;
+        memset(grown + watch->path_capacity, 0, sizeof(char *) * (capacity - watch->path_capacity));
+        watch->paths = grown;
+        watch->path_capacity = capacity;
+    }
+    if (watch->paths[wd] == NULL) watch->watches++;
+    free(watch->paths[wd]);
+    watch->paths[wd] = strdup(path);
+
+    DIR *dir = opendir(path);
+    if (dir == NULL) return;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        char entry_path[STR_MAX_LEN];
+        concat_path(path, entry->d_name, entry_path);
+        if (entry->d_type == DT_DIR) {
+            add_watches(watch, entry_path, queue_files);
+        } else if (queue_files) {
+            queue_file(watch, entry_path);
+        }
+    }
+    closedir(dir);
+}
+
+/*!
+ * @brief read_events reads the pending inotify events: closed or moved in files are queued, new directories are
+ * watched
+ * @param watch the watch state
+ */
+static void read_events(watch_t *watch) {
+    char buffer[WATCH_EVENTS_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+    while ((length = read(watch->inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *cursor = buffer; cursor < buffer + length;) {
+            struct inotify_event *event = (struct inotify_event *) cursor;
+            cursor += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                fprintf(stderr, "Too many new files at once, some of them were missed\n");
+                continue;
+            }
+            if (event->len == 0 || event->wd >= watch->path_capacity || watch->paths[event->wd] == NULL) continue;
+            char path[STR_MAX_LEN];
+            concat_path(watch->paths[event->wd], event->name, path);
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) add_watches(watch, path, true);
+            } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                queue_file(watch, path);
+            }
+        }
+    }
+}
+
+/*!
+ * @brief ingest_pending appends the pending files to step1_output, runs their batches on the worker pool, then
+ * collates their records into the live aggregate
+ * @param watch the watch state
+ * @param config the configuration
+ * @param aggregate the live aggregate
+ * @param files_count the number of files in step1_output, updated
+ * @param process_batches the function running batches on the worker pool
+ * @param context the context of process_batches
+ * @return true on success, false else
+ */
+static bool ingest_pending(watch_t *watch, configuration_t *config, live_aggregate_t *aggregate, uint64_t *files_count,
+                           process_batches_t process_batches, void *context) {
+    fflush(watch->pending);
+    char step1_path[STR_MAX_LEN], step2_path[STR_MAX_LEN];
+    intermediate_path(config->temporary_directory, STEP1_OUTPUT, step1_path);
+    intermediate_path(config->temporary_directory, STEP2_OUTPUT, step2_path);
+    int step1_fd = open(step1_path, O_WRONLY | O_APPEND);
+    off_t start = step1_fd == -1 ? -1 : lseek(step1_fd, 0, SEEK_END);
+    bool success = start != -1 && write_all(step1_fd, watch->pending_paths, watch->pending_size);
+    if (step1_fd != -1) close(step1_fd);
+    work_list_t *work = success ? make_appended_work_list(config->temporary_directory, start, *files_count) : NULL;
+    if (work != NULL) {
+        attach_prefetcher(work, config->temporary_directory, config->prefetch_budget);
+        process_batches(work, context);
+        clear_work_list(work);
+        success = update_live_aggregate(aggregate, step2_path) >= 0;
+    } else {
+        success = false;
+    }
+    *files_count += watch->pending_count;
+
+    // Ingest latency of a file: from its event to its records in the aggregate
+    double now_ms = elapsed_ms(&watch->start);
+    double round_ms = elapsed_ms(&watch->first_pending);
+    watch->total_latency_ms += now_ms * watch->pending_count - watch->pending_arrivals_ms;
+    if (round_ms > watch->max_latency_ms) watch->max_latency_ms = round_ms;
+    watch->ingested += watch->pending_count;
+    watch->rounds++;
+
+    rewind(watch->pending);
+    watch->pending_count = 0;
+    watch->pending_arrivals_ms = 0;
+    return success;
+}
+
+/*!
+ * @brief watch_data_source keeps the output up to date with the files added to the data source after the analysis:
+ * the data source is watched with inotify, new files are analyzed by batches on the worker pool and their records are
+ * collated into a live aggregate of step2_output, written as the output file every watch_interval seconds and on
+ * SIGUSR1. Runs until SIGINT or SIGTERM.
+ * @param config the configuration
+ * @param process_batches the function running batches on the worker pool
+ * @param context the context of process_batches
+ * @return true if the data source was watched until stopped, false if it could not be watched
+ */
+bool watch_data_source(configuration_t *config, process_batches_t process_batches, void *context) {
+    char step1_path[STR_MAX_LEN], step2_path[STR_MAX_LEN];
+    intermediate_path(config->temporary_directory, STEP1_OUTPUT, step1_path);
+    intermediate_path(config->temporary_directory, STEP2_OUTPUT, step2_path);
+    watch_t watch = {.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)};
+    watch.pending = open_memstream(&watch.pending_paths, &watch.pending_size);
+    live_aggregate_t *aggregate = make_live_aggregate(config->time_buckets);
+    if (watch.inotify_fd == -1 || watch.pending == NULL || aggregate == NULL ||
+        update_live_aggregate(aggregate, step2_path) < 0) {
+        perror("Could not start watching the data source");
+        if (watch.inotify_fd != -1) close(watch.inotify_fd);
+        if (watch.pending != NULL) fclose(watch.pending);
+        free(watch.pending_paths);
+        clear_live_aggregate(aggregate);
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &watch.start);
+    begin_progress_phase(PROGRESS_WATCH, 0, 0);
+    add_watches(&watch, config->data_path, false);
+    uint64_t files_count = count_file_lines(step1_path);
+
+    struct sigaction action = {.sa_handler = request_emit};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, NULL);
+    action.sa_handler = request_stop;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    printf("Watching %u directories of %s, output written every %u s and on SIGUSR1 (pid %d)\n", watch.watches,
+           config->data_path, config->watch_interval, getpid());
+    fflush(stdout);
+
+    double next_emit_ms = config->watch_interval * 1e3;
+    bool dirty = false;
+    while (!stop_requested) {
+        double now_ms = elapsed_ms(&watch.start);
+        double timeout_ms = next_emit_ms - now_ms;
+        if (watch.pending_count > 0) {
+            double collect_ms = WATCH_COLLECT_MS - elapsed_ms(&watch.first_pending);
+            if (collect_ms < timeout_ms) timeout_ms = collect_ms;
+        }
+        struct pollfd fds = {.fd = watch.inotify_fd, .events = POLLIN};
+        if (timeout_ms > 0 && poll(&fds, 1, (int) timeout_ms + 1) > 0) read_events(&watch);
+
+        if (watch.pending_count > 0 && (watch.pending_count >= WATCH_MAX_PENDING ||
+                                        elapsed_ms(&watch.first_pending) >= WATCH_COLLECT_MS)) {
+            if (!ingest_pending(&watch, config, aggregate, &files_count, process_batches, context)) {
+                fprintf(stderr, "Could not analyze some new files\n");
+            }
+            dirty = true;
+        }
+        if (emit_requested || elapsed_ms(&watch.start) >= next_emit_ms) {
+            if ((dirty || emit_requested) && !write_live_aggregate(aggregate, config->output_file)) {
+                fprintf(stderr, "Could not write %s\n", config->output_file);
+            }
+            dirty = false;
+            emit_requested = 0;
+            while (next_emit_ms <= elapsed_ms(&watch.start)) next_emit_ms += config->watch_interval * 1e3;
+        }
+    }
+
+    // Last ingestion and output before stopping
+    read_events(&watch);
+    if (watch.pending_count > 0) ingest_pending(&watch, config, aggregate, &files_count, process_batches, context);
+    if (!write_live_aggregate(aggregate, config->output_file)) fprintf(stderr, "Could not write %s\n", config->output_file);
+    printf("Watch mode: %" PRIu64 " new files in %" PRIu64 " rounds, ingest latency mean %.1f ms, max %.1f ms\n",
+           watch.ingested, watch.rounds, watch.ingested > 0 ? watch.total_latency_ms / watch.ingested : 0,
+           watch.max_latency_ms);
+
+    signal(SIGUSR1, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    for (int wd = 0; wd < watch.path_capacity; wd++) free(watch.paths[wd]);
+    free(watch.paths);
+    close(watch.inotify_fd);
+    fclose(watch.pending);
+    free(watch.pending_paths);
+    clear_live_aggregate(aggregate);
+    return true;
+}
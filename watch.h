@@ -0,0 +1,20 @@
+#ifndef A2022_WATCH_H
+#define A2022_WATCH_H
+
+#include <stdbool.h>
+
+#include "configuration.h"
+#include "checkpoint.h"
+
+// New files are collected for this long after the first one arrives, then dispatched together
+#define WATCH_COLLECT_MS 100
+// New files are dispatched at once when this many are waiting, without waiting for the end of the collection
+#define WATCH_MAX_PENDING (64 * FILES_PER_BATCH)
+#define WATCH_EVENTS_BUFFER_SIZE (64 * 1024)
+
+// Runs the batches of a work list on the worker pool of the method in use, returns once they are all committed
+typedef void (*process_batches_t)(work_list_t *work, void *context);
+
+bool watch_data_source(configuration_t *config, process_batches_t process_batches, void *context);
+
+#endif //A2022_WATCH_H